@@ -0,0 +1,94 @@
+#include "accel_cache.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace {
+// Increment version each time the file layout changes.
+constexpr uint32_t accel_cache_magic = 0x4c434341; // 'ACCL'
+constexpr uint32_t accel_cache_version = 1;
+
+// The header is followed by entry records and serialized data of all structures.
+struct Accel_Cache_Header {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    accel_count;
+    uint32_t    reserved;
+    uint64_t    key;
+    uint64_t    data_size;
+};
+}
+
+void Accel_Cache::release() {
+    platform::unmap_file(file);
+    *this = Accel_Cache{};
+}
+
+bool open_accel_cache(const std::string& path, uint64_t key, uint32_t accel_count, Accel_Cache& cache) {
+    cache = Accel_Cache{};
+
+    platform::Mapped_File file;
+    if (!platform::map_file(path, file))
+        return false;
+
+    auto reject = [&file, &cache]() {
+        platform::unmap_file(file);
+        cache = Accel_Cache{};
+        return false;
+    };
+
+    if (file.size < sizeof(Accel_Cache_Header))
+        return reject();
+
+    Accel_Cache_Header header;
+    memcpy(&header, file.data, sizeof(header));
+
+    if (header.magic != accel_cache_magic || header.version != accel_cache_version ||
+        header.key != key || header.accel_count != accel_count)
+        return reject();
+
+    const uint64_t data_offset = sizeof(Accel_Cache_Header) + uint64_t(header.accel_count) * sizeof(Accel_Cache::Entry);
+    if (file.size != data_offset + header.data_size)
+        return reject();
+
+    cache.entries.resize(header.accel_count);
+    memcpy(cache.entries.data(), file.data + sizeof(Accel_Cache_Header), header.accel_count * sizeof(Accel_Cache::Entry));
+    const uint8_t* data = file.data + data_offset;
+
+    for (const Accel_Cache::Entry& entry : cache.entries) {
+        // Serialized data starts with the driver UUID and compatibility UUID.
+        if (entry.offset + entry.size > header.data_size || entry.size < 2 * VK_UUID_SIZE)
+            return reject();
+
+        VkAccelerationStructureVersionKHR version { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_KHR };
+        version.versionData = data + entry.offset;
+        if (vkGetDeviceAccelerationStructureCompatibilityKHR(vk.device, &version) != VK_SUCCESS)
+            return reject();
+    }
+
+    cache.data      = data;
+    cache.data_size = header.data_size;
+    cache.file      = file;
+    return true;
+}
+
+void write_accel_cache(const std::string& path, uint64_t key, const std::vector<Accel_Cache::Entry>& entries, const void* data, uint64_t data_size) {
+    Accel_Cache_Header header{};
+    header.magic        = accel_cache_magic;
+    header.version      = accel_cache_version;
+    header.accel_count  = (uint32_t)entries.size();
+    header.key          = key;
+    header.data_size    = data_size;
+
+    // The cache is only an optimization, so failure to write it is not an error.
+    std::ofstream file(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!file) {
+        printf("failed to create acceleration structure cache file: %s\n", path.c_str());
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Accel_Cache::Entry));
+    file.write(reinterpret_cast<const char*>(data), data_size);
+    if (!file)
+        printf("failed to write acceleration structure cache file: %s\n", path.c_str());
+}
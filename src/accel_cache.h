@@ -0,0 +1,33 @@
+#pragma once
+
+#include "platform.h"
+#include "vk.h"
+
+#include <string>
+#include <vector>
+
+// Serialized bottom level acceleration structures stored on disk.
+//
+// The cache file is memory-mapped and the serialized data is copied to the GPU directly from
+// the mapped memory. The cache is valid for the given key, which the caller computes from the
+// geometry content and the build parameters. The device compatibility of the serialized data
+// (driver UUID and acceleration structure format) is verified with vkGetDeviceAccelerationStructureCompatibilityKHR.
+struct Accel_Cache {
+    struct Entry {
+        uint64_t    offset; // offset of the serialized structure in data
+        uint64_t    size; // serialized size
+        uint64_t    compacted_size; // zero if the structure was not compacted
+    };
+    std::vector<Entry>      entries;
+    const uint8_t*          data = nullptr; // all serialized structures
+    uint64_t                data_size = 0;
+    platform::Mapped_File   file;
+
+    void release();
+};
+
+// Returns false if cache file does not exist, was written for another key or accel count,
+// or when the serialized data is not compatible with the current device.
+bool open_accel_cache(const std::string& path, uint64_t key, uint32_t accel_count, Accel_Cache& cache);
+
+void write_accel_cache(const std::string& path, uint64_t key, const std::vector<Accel_Cache::Entry>& entries, const void* data, uint64_t data_size);
@@ -1,10 +1,18 @@
+#include "accel_cache.h"
 #include "acceleration_structure.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "thread_pool.h"
 #include "vk_utils.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// Disabled while running build time comparison to keep the log readable.
+static bool log_build_time = true;
 
 void Vk_Intersection_Accelerator::destroy() {
     for (VkAccelerationStructureKHR accel : bottom_level_accels) {
@@ -14,48 +22,56 @@ void Vk_Intersection_Accelerator::destroy() {
     vmaFreeMemory(vk.allocator, allocation);
     instance_buffer.destroy();
     scratch_buffer.destroy();
+    bottom_level_scratch_buffer.destroy();
+    bottom_level_update_scratch_buffer.destroy();
     *this = Vk_Intersection_Accelerator{};
 }
 
-static VmaAllocation allocate_acceleration_structures_memory(const Vk_Intersection_Accelerator& accelerator) {
+// Makes single allocation for the given acceleration structures and binds them at different offsets.
+// memory_sizes receives the memory size required by each acceleration structure.
+// Structures built on the host and then copied by the device use VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_OR_DEVICE_KHR
+// requirements and memory that is host visible and accessible by the device (VMA_MEMORY_USAGE_CPU_TO_GPU).
+static VmaAllocation allocate_acceleration_structures_memory(const std::vector<VkAccelerationStructureKHR>& accels, std::vector<VkDeviceSize>* memory_sizes,
+    VkAccelerationStructureBuildTypeKHR build_type = VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, VmaMemoryUsage memory_usage = VMA_MEMORY_USAGE_GPU_ONLY) {
+    assert(!accels.empty());
+
     // Get memory requirements for each acceleration structure.
-    auto get_memory_reqs = [](VkAccelerationStructureKHR accel) {
+    auto get_memory_reqs = [build_type](VkAccelerationStructureKHR accel) {
         VkAccelerationStructureMemoryRequirementsInfoKHR reqs_info{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_KHR };
         reqs_info.type = VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_OBJECT_KHR;
-        reqs_info.buildType = VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR;
+        reqs_info.buildType = build_type;
         reqs_info.accelerationStructure = accel;
         VkMemoryRequirements2 reqs_holder{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
         vkGetAccelerationStructureMemoryRequirementsKHR(vk.device, &reqs_info, &reqs_holder);
         return reqs_holder.memoryRequirements;
     };
 
-    VkMemoryRequirements top_level_memory_reqs = get_memory_reqs(accelerator.top_level_accel);
-    std::vector<VkMemoryRequirements> bottom_level_memory_reqs(accelerator.bottom_level_accels.size());
-    for (int i = 0; i < (int)accelerator.bottom_level_accels.size(); i++) {
-        bottom_level_memory_reqs[i] = get_memory_reqs(accelerator.bottom_level_accels[i]);
+    std::vector<VkMemoryRequirements> accel_memory_reqs(accels.size());
+    for (int i = 0; i < (int)accels.size(); i++) {
+        accel_memory_reqs[i] = get_memory_reqs(accels[i]);
     }
 
     // Compute alignment and memory type bits.
-    VkDeviceSize alignment = top_level_memory_reqs.alignment;
-    uint32_t memory_type_bits = top_level_memory_reqs.memoryTypeBits;
-    for (const VkMemoryRequirements& reqs : bottom_level_memory_reqs) {
+    VkDeviceSize alignment = accel_memory_reqs[0].alignment;
+    uint32_t memory_type_bits = accel_memory_reqs[0].memoryTypeBits;
+    for (const VkMemoryRequirements& reqs : accel_memory_reqs) {
         alignment = std::max(alignment, reqs.alignment);
         memory_type_bits &= reqs.memoryTypeBits;
     }
     assert(memory_type_bits != 0); // not guaranteed by spec
 
     // Compute required amount of memory and offsets.
-    std::vector<VkDeviceSize> bottom_level_offsets(accelerator.bottom_level_accels.size());
-    VkDeviceSize size = top_level_memory_reqs.size;
-    for (int i = 0; i < (int)accelerator.bottom_level_accels.size(); i++) {
+    std::vector<VkDeviceSize> offsets(accels.size());
+    VkDeviceSize size = 0;
+    for (int i = 0; i < (int)accels.size(); i++) {
         const VkDeviceSize offset = round_up(size, alignment);
-        bottom_level_offsets[i] = offset;
-        size = offset + bottom_level_memory_reqs[i].size;
+        offsets[i] = offset;
+        size = offset + accel_memory_reqs[i].size;
     }
 
     // Allocate memory.
     VmaAllocationCreateInfo alloc_create_info{};
-    alloc_create_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    alloc_create_info.usage = memory_usage;
 
     VkMemoryRequirements memory_reqs;
     memory_reqs.size = size;
@@ -67,40 +83,320 @@ static VmaAllocation allocate_acceleration_structures_memory(const Vk_Intersecti
     VK_CHECK(vmaAllocateMemory(vk.allocator, &memory_reqs, &alloc_create_info, &allocation, &alloc_info));
 
     // Attach memory to acceleration structures.
-    std::vector<VkBindAccelerationStructureMemoryInfoKHR> bind_infos(1 + accelerator.bottom_level_accels.size());
-    bind_infos[0] = VkBindAccelerationStructureMemoryInfoKHR{ VK_STRUCTURE_TYPE_BIND_ACCELERATION_STRUCTURE_MEMORY_INFO_KHR };
-    bind_infos[0].accelerationStructure = accelerator.top_level_accel;
-    bind_infos[0].memory = alloc_info.deviceMemory;
-    bind_infos[0].memoryOffset = alloc_info.offset + 0;
-
-    for (int i = 0; i < (int)accelerator.bottom_level_accels.size(); i++) {
-        bind_infos[i+1] = VkBindAccelerationStructureMemoryInfoKHR{ VK_STRUCTURE_TYPE_BIND_ACCELERATION_STRUCTURE_MEMORY_INFO_KHR };
-        bind_infos[i+1].accelerationStructure = accelerator.bottom_level_accels[i];
-        bind_infos[i+1].memory = alloc_info.deviceMemory;
-        bind_infos[i+1].memoryOffset = alloc_info.offset + bottom_level_offsets[i];
+    std::vector<VkBindAccelerationStructureMemoryInfoKHR> bind_infos(accels.size());
+    for (int i = 0; i < (int)accels.size(); i++) {
+        bind_infos[i] = VkBindAccelerationStructureMemoryInfoKHR{ VK_STRUCTURE_TYPE_BIND_ACCELERATION_STRUCTURE_MEMORY_INFO_KHR };
+        bind_infos[i].accelerationStructure = accels[i];
+        bind_infos[i].memory = alloc_info.deviceMemory;
+        bind_infos[i].memoryOffset = alloc_info.offset + offsets[i];
     }
     VK_CHECK(vkBindAccelerationStructureMemoryKHR(vk.device, (uint32_t)bind_infos.size(), bind_infos.data()));
+
+    if (memory_sizes) {
+        memory_sizes->resize(accels.size());
+        for (int i = 0; i < (int)accels.size(); i++)
+            (*memory_sizes)[i] = accel_memory_reqs[i].size;
+    }
     return allocation;
 }
 
-Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GPU_Mesh>& gpu_meshes, bool keep_scratch_buffer) {
-    Vk_Intersection_Accelerator accelerator;
+static const struct {
+    VkBuildAccelerationStructureFlagBitsKHR flag;
+    const char* name;
+} build_preference_flag_names[] = {
+    { VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR, "fast-trace" },
+    { VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR, "fast-build" },
+    { VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_KHR, "low-memory" },
+};
 
-    // Create bottom level acceleration structures.
-    accelerator.bottom_level_accels.resize(gpu_meshes.size());
-    for (int i = 0; i < (int)gpu_meshes.size(); i++) {
+std::string get_build_preference_flags_name(VkBuildAccelerationStructureFlagsKHR flags) {
+    std::string name;
+    for (const auto& flag_name : build_preference_flag_names) {
+        if (flags & flag_name.flag) {
+            if (!name.empty())
+                name += "+";
+            name += flag_name.name;
+        }
+    }
+    return name.empty() ? "default" : name;
+}
+
+bool parse_build_preference_flags(const std::string& str, VkBuildAccelerationStructureFlagsKHR* flags) {
+    *flags = 0;
+    if (str == "default")
+        return true;
+
+    size_t start = 0;
+    while (start <= str.size()) {
+        size_t end = str.find('+', start);
+        if (end == std::string::npos)
+            end = str.size();
+        const std::string token = str.substr(start, end - start);
+
+        bool found = false;
+        for (const auto& flag_name : build_preference_flag_names) {
+            if (token == flag_name.name) {
+                *flags |= flag_name.flag;
+                found = true;
+            }
+        }
+        if (!found)
+            return false;
+        start = end + 1;
+    }
+    // The fast trace and fast build preferences are mutually exclusive.
+    return (*flags & VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR) == 0 ||
+           (*flags & VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR) == 0;
+}
+
+static VkDeviceAddress get_acceleration_structure_device_address(VkAccelerationStructureKHR accel) {
+    VkAccelerationStructureDeviceAddressInfoKHR device_address_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
+    device_address_info.accelerationStructure = accel;
+    return vkGetAccelerationStructureDeviceAddressKHR(vk.device, &device_address_info);
+}
+
+namespace {
+struct Host_Build {
+    Host_Mesh_Geometry                      geometry;
+    uint32_t                                vertex_count;
+    Mesh_LOD                                lod;
+    VkAccelerationStructureKHR              accel;
+};
+}
+
+// Builds bottom level structures on the CPU. The structures are placed in the returned host visible
+// allocation. The device clones them to the device local structures, so the memory requirements are
+// queried for both host and device access and the memory is accessible by the device.
+// Each build is a deferred operation that is joined by one of the worker threads, so the builds run
+// concurrently on all CPU cores and the calling thread returns when all of them are finished.
+static VmaAllocation build_bottom_level_accels_on_host(std::vector<Host_Build>& builds, VkBuildAccelerationStructureFlagsKHR flags) {
+    assert(!builds.empty());
+    std::vector<VkAccelerationStructureKHR> accels(builds.size());
+
+    for (auto [i, build] : enumerate(builds)) {
         VkAccelerationStructureCreateGeometryTypeInfoKHR geometry_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_GEOMETRY_TYPE_INFO_KHR };
         geometry_info.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
-        geometry_info.maxPrimitiveCount = gpu_meshes[i].index_count / 3;
+        geometry_info.maxPrimitiveCount = build.lod.index_count / 3;
         geometry_info.indexType = VK_INDEX_TYPE_UINT32;
-        geometry_info.maxVertexCount = gpu_meshes[i].vertex_count;
+        geometry_info.maxVertexCount = build.vertex_count;
         geometry_info.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
 
         VkAccelerationStructureCreateInfoKHR create_info{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
         create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        create_info.flags = flags;
         create_info.maxGeometryCount = 1;
         create_info.pGeometryInfos = &geometry_info;
 
+        VK_CHECK(vkCreateAccelerationStructureKHR(vk.device, &create_info, nullptr, &build.accel));
+        vk_set_debug_name(build.accel, "bottom_level_accel (host build)");
+        accels[i] = build.accel;
+    }
+    VmaAllocation allocation = allocate_acceleration_structures_memory(accels, nullptr, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_OR_DEVICE_KHR, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+    // Errors are reported after parallel_for since error() throws.
+    std::vector<VkResult> results(builds.size());
+
+    parallel_for((uint32_t)builds.size(), [&builds, &results, flags](uint32_t i, uint32_t) {
+        const Host_Build& build = builds[i];
+
+        VkAccelerationStructureMemoryRequirementsInfoKHR reqs_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_KHR };
+        reqs_info.type = VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_KHR;
+        reqs_info.buildType = VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR;
+        reqs_info.accelerationStructure = build.accel;
+        VkMemoryRequirements2 reqs_holder{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+        vkGetAccelerationStructureMemoryRequirementsKHR(vk.device, &reqs_info, &reqs_holder);
+        std::vector<uint64_t> scratch((reqs_holder.memoryRequirements.size + 7) / 8);
+
+        VkAccelerationStructureGeometryKHR geometry { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
+        geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+        geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+        auto& triangles = geometry.geometry.triangles;
+        triangles = VkAccelerationStructureGeometryTrianglesDataKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR };
+        triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+        triangles.vertexData.hostAddress = build.geometry.vertices;
+        triangles.vertexStride = build.geometry.vertex_stride;
+        triangles.indexType = VK_INDEX_TYPE_UINT32;
+        triangles.indexData.hostAddress = build.geometry.indices;
+        const VkAccelerationStructureGeometryKHR* p_geometry = &geometry;
+
+        VkDeferredOperationKHR operation;
+        results[i] = vkCreateDeferredOperationKHR(vk.device, nullptr, &operation);
+        if (results[i] != VK_SUCCESS)
+            return;
+
+        VkDeferredOperationInfoKHR deferred_operation_info { VK_STRUCTURE_TYPE_DEFERRED_OPERATION_INFO_KHR };
+        deferred_operation_info.operationHandle = operation;
+
+        VkAccelerationStructureBuildGeometryInfoKHR geometry_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+        geometry_info.pNext = &deferred_operation_info;
+        geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        geometry_info.flags = flags;
+        geometry_info.update = VK_FALSE;
+        geometry_info.dstAccelerationStructure = build.accel;
+        geometry_info.geometryArrayOfPointers = VK_TRUE;
+        geometry_info.geometryCount = 1;
+        geometry_info.ppGeometries = &p_geometry;
+        geometry_info.scratchData.hostAddress = scratch.data();
+
+        VkAccelerationStructureBuildOffsetInfoKHR offset_info{};
+        offset_info.primitiveCount = build.lod.index_count / 3;
+        offset_info.primitiveOffset = build.lod.first_index * 4 /*VK_INDEX_TYPE_UINT32*/;
+        const VkAccelerationStructureBuildOffsetInfoKHR* p_offset_info = &offset_info;
+
+        VkResult result = vkBuildAccelerationStructureKHR(vk.device, 1, &geometry_info, &p_offset_info);
+        if (result == VK_OPERATION_DEFERRED_KHR) {
+            // VK_THREAD_IDLE_KHR means there is no work for this thread at the moment, but the operation is not finished.
+            VkResult join_result;
+            do {
+                join_result = vkDeferredOperationJoinKHR(vk.device, operation);
+            } while (join_result == VK_THREAD_IDLE_KHR);
+            const bool joined = join_result == VK_SUCCESS || join_result == VK_THREAD_DONE_KHR;
+            result = joined ? vkGetDeferredOperationResultKHR(vk.device, operation) : join_result;
+        }
+        results[i] = (result == VK_OPERATION_NOT_DEFERRED_KHR) ? VK_SUCCESS : result;
+        vkDestroyDeferredOperationKHR(vk.device, operation, nullptr);
+    });
+
+    for (VkResult result : results) {
+        if (result != VK_SUCCESS)
+            error("host acceleration structure build failed: " + std::to_string(int(result)));
+    }
+    return allocation;
+}
+
+// Serializes bottom level structures and writes them to the cache file. compacted_sizes are stored
+// in the cache, so the structures can be created with the same size when they are deserialized.
+static void write_bottom_level_accels_cache(const std::vector<VkAccelerationStructureKHR>& accels, const std::vector<uint64_t>& compacted_sizes,
+    const std::string& cache_path, uint64_t cache_key) {
+    const uint32_t accel_count = (uint32_t)accels.size();
+
+    VkQueryPool query_pool;
+    {
+        VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        create_info.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+        create_info.queryCount = accel_count;
+        VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &query_pool));
+    }
+    vk_execute(vk.command_pools[0], vk.queue, [&accels, query_pool, accel_count](VkCommandBuffer command_buffer) {
+        vkCmdResetQueryPool(command_buffer, query_pool, 0, accel_count);
+        vkCmdWriteAccelerationStructuresPropertiesKHR(command_buffer, accel_count, accels.data(),
+            VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, query_pool, 0);
+    });
+    std::vector<uint64_t> serialized_sizes(accel_count);
+    VK_CHECK(vkGetQueryPoolResults(vk.device, query_pool, 0, accel_count, serialized_sizes.size() * sizeof(uint64_t),
+        serialized_sizes.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    vkDestroyQueryPool(vk.device, query_pool, nullptr);
+
+    // Serialized data address should be 256 byte aligned.
+    std::vector<Accel_Cache::Entry> entries(accel_count);
+    uint64_t data_size = 0;
+    for (uint32_t i = 0; i < accel_count; i++) {
+        entries[i].offset = round_up(data_size, uint64_t(256));
+        entries[i].size = serialized_sizes[i];
+        entries[i].compacted_size = compacted_sizes[i];
+        data_size = entries[i].offset + entries[i].size;
+    }
+
+    void* buffer_ptr;
+    Vk_Buffer buffer = vk_create_mapped_buffer(data_size, VK_BUFFER_USAGE_RAY_TRACING_BIT_KHR, &buffer_ptr, "accel_serialization_buffer");
+
+    vk_execute(vk.command_pools[0], vk.queue, [&accels, &entries, &buffer](VkCommandBuffer command_buffer) {
+        for (auto [i, accel] : enumerate(accels)) {
+            VkCopyAccelerationStructureToMemoryInfoKHR copy_info { VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR };
+            copy_info.src = accel;
+            copy_info.dst.deviceAddress = buffer.device_address + entries[i].offset;
+            copy_info.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+            vkCmdCopyAccelerationStructureToMemoryKHR(command_buffer, &copy_info);
+        }
+
+        VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(command_buffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_HOST_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+    });
+
+    write_accel_cache(cache_path, cache_key, entries, buffer_ptr, data_size);
+    buffer.destroy();
+}
+
+Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GPU_Mesh>& gpu_meshes, bool keep_scratch_buffer, const Accelerator_Build_Params& params) {
+    Vk_Intersection_Accelerator accelerator;
+
+    // Each LOD of the mesh gets its own bottom level acceleration structure.
+    struct Bottom_Level_Geometry {
+        const GPU_Mesh* mesh;
+        Mesh_LOD lod;
+    };
+    std::vector<Bottom_Level_Geometry> geometries;
+    for (const GPU_Mesh& gpu_mesh : gpu_meshes) {
+        accelerator.mesh_first_accel.push_back((uint32_t)geometries.size());
+        for (const Mesh_LOD& lod : gpu_mesh.lods)
+            geometries.push_back(Bottom_Level_Geometry{ &gpu_mesh, lod });
+    }
+
+    const bool compact = params.compact && !params.allow_bottom_level_update;
+    const VkBuildAccelerationStructureFlagsKHR bottom_level_flags = params.bottom_level_flags |
+        (compact ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR : 0) |
+        (params.allow_bottom_level_update ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR : 0);
+    accelerator.bottom_level_flags = bottom_level_flags;
+
+    // Bottom level structures are deserialized from the cache if it was written for the same geometry and build flags.
+    // The cache is not used for the updatable structures, the vertex buffers can contain deformed geometry.
+    Accel_Cache cache;
+    uint64_t cache_key = 0;
+    const bool use_cache = !params.cache_path.empty() && !params.allow_bottom_level_update;
+    if (use_cache && !geometries.empty()) {
+        std::vector<uint64_t> key_data { params.geometry_hash, bottom_level_flags, geometries.size() };
+        for (const Bottom_Level_Geometry& geometry : geometries)
+            key_data.insert(key_data.end(), { geometry.mesh->vertex_count, geometry.mesh->vertex_stride, geometry.lod.first_index, geometry.lod.index_count });
+        cache_key = hash_memory(key_data.data(), key_data.size() * sizeof(uint64_t));
+        accelerator.loaded_from_cache = open_accel_cache(params.cache_path, cache_key, (uint32_t)geometries.size(), cache);
+    }
+    const bool from_cache = accelerator.loaded_from_cache;
+
+    // Small structures are built on the CPU when the host meshes are provided. The GPU build of a small
+    // structure is dominated by the fixed cost, while the CPU builds run concurrently on all cores.
+    std::vector<uint32_t> host_build_indices;
+    std::vector<uint32_t> device_build_indices;
+    if (!from_cache) {
+        const bool host_builds_enabled = vk.host_accel_builds_supported && params.host_build_max_triangles > 0 &&
+            params.host_meshes.size() == gpu_meshes.size();
+        for (auto [i, geometry] : enumerate(geometries)) {
+            if (host_builds_enabled && geometry.lod.index_count / 3 <= params.host_build_max_triangles)
+                host_build_indices.push_back(uint32_t(i));
+            else
+                device_build_indices.push_back(uint32_t(i));
+        }
+    }
+
+    // Top level structure is refitted when only the instances change.
+    accelerator.top_level_flags = params.top_level_flags | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+    const bool external_instances = params.instance_buffer_address != 0;
+    accelerator.max_instance_count = external_instances ? params.instance_count : (uint32_t)gpu_meshes.size();
+
+    // Create bottom level acceleration structures.
+    accelerator.bottom_level_accels.resize(geometries.size());
+    for (int i = 0; i < (int)geometries.size(); i++) {
+        VkAccelerationStructureCreateGeometryTypeInfoKHR geometry_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_GEOMETRY_TYPE_INFO_KHR };
+        geometry_info.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+        geometry_info.maxPrimitiveCount = geometries[i].lod.index_count / 3;
+        geometry_info.indexType = VK_INDEX_TYPE_UINT32;
+        geometry_info.maxVertexCount = geometries[i].mesh->vertex_count;
+        geometry_info.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+
+        VkAccelerationStructureCreateInfoKHR create_info{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+        create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        create_info.flags = bottom_level_flags;
+        if (from_cache && cache.entries[i].compacted_size != 0) {
+            create_info.compactedSize = cache.entries[i].compacted_size;
+        } else {
+            create_info.maxGeometryCount = 1;
+            create_info.pGeometryInfos = &geometry_info;
+        }
+
         VK_CHECK(vkCreateAccelerationStructureKHR(vk.device, &create_info, nullptr, &accelerator.bottom_level_accels[i]));
         vk_set_debug_name(accelerator.bottom_level_accels[i], "bottom_level_accel");
     }
@@ -109,10 +405,11 @@ Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GP
     {
         VkAccelerationStructureCreateGeometryTypeInfoKHR geometry_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_GEOMETRY_TYPE_INFO_KHR };
         geometry_info.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-        geometry_info.maxPrimitiveCount = (uint32_t)gpu_meshes.size();
+        geometry_info.maxPrimitiveCount = accelerator.max_instance_count;
 
         VkAccelerationStructureCreateInfoKHR create_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
         create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+        create_info.flags = accelerator.top_level_flags;
         create_info.maxGeometryCount = 1;
         create_info.pGeometryInfos = &geometry_info;
 
@@ -121,36 +418,70 @@ Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GP
     }
 
     // Allocate memory and bind acceleration structures.
-    // Single allocation is made, acceleration structures are bound at different offsets.
-    accelerator.allocation = allocate_acceleration_structures_memory(accelerator);
+    // Single allocation is made, acceleration structures are bound at different offsets. With compaction the
+    // bottom level structures are built in a temporary allocation that is released after they are copied
+    // to the compacted structures.
+    std::vector<VkDeviceSize> bottom_level_memory_sizes;
+    VmaAllocation build_allocation = VK_NULL_HANDLE;
+    if (compact && !from_cache) {
+        if (!geometries.empty())
+            build_allocation = allocate_acceleration_structures_memory(accelerator.bottom_level_accels, &bottom_level_memory_sizes);
+    } else {
+        std::vector<VkAccelerationStructureKHR> accels { accelerator.top_level_accel };
+        accels.insert(accels.end(), accelerator.bottom_level_accels.begin(), accelerator.bottom_level_accels.end());
 
-    // Create instance buffer.
-    {
-        accelerator.bottom_level_accel_device_addresses.resize(gpu_meshes.size());
-        for (int i = 0; i < (int)gpu_meshes.size(); i++) {
-            VkAccelerationStructureDeviceAddressInfoKHR device_address_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
-            device_address_info.accelerationStructure = accelerator.bottom_level_accels[i];
-            accelerator.bottom_level_accel_device_addresses[i] = vkGetAccelerationStructureDeviceAddressKHR(vk.device, &device_address_info);
+        std::vector<VkDeviceSize> memory_sizes;
+        accelerator.allocation = allocate_acceleration_structures_memory(accels, &memory_sizes);
+        accelerator.top_level_memory_size = memory_sizes[0];
+        bottom_level_memory_sizes.assign(memory_sizes.begin() + 1, memory_sizes.end());
+    }
+
+    // Instance buffer references the final bottom level structures, so with compaction
+    // it is created after the compacted structures are available.
+    auto create_instance_buffer = [&gpu_meshes, &accelerator, &params, external_instances]() {
+        accelerator.bottom_level_accel_device_addresses.resize(accelerator.bottom_level_accels.size());
+        for (auto [i, accel] : enumerate(accelerator.bottom_level_accels))
+            accelerator.bottom_level_accel_device_addresses[i] = get_acceleration_structure_device_address(accel);
+
+        if (external_instances) {
+            accelerator.instance_buffer_address = params.instance_buffer_address;
+            return;
         }
 
         std::vector<VkAccelerationStructureInstanceKHR> instances(gpu_meshes.size());
         for (int i = 0; i < (int)instances.size(); i++) {
             memcpy(&instances[i].transform.matrix[0][0], &Matrix3x4::identity.a[0][0], 12 * sizeof(float));
-            instances[i].instanceCustomIndex = i;
+            instances[i].instanceCustomIndex = i; // object index
             instances[i].mask = 0xff;
             instances[i].instanceShaderBindingTableRecordOffset = 0;
             instances[i].flags = 0;
-            instances[i].accelerationStructureReference = accelerator.bottom_level_accel_device_addresses[i];
+            instances[i].accelerationStructureReference = accelerator.bottom_level_accel_device_addresses[accelerator.mesh_first_accel[i]];
         }
         VkDeviceSize instance_buffer_size = instances.size() * sizeof(VkAccelerationStructureInstanceKHR);
         accelerator.instance_buffer = vk_create_mapped_buffer(instance_buffer_size, VK_BUFFER_USAGE_RAY_TRACING_BIT_KHR, &(void*&)accelerator.mapped_instance_buffer, "instance_buffer");
-    }
+        memcpy(accelerator.mapped_instance_buffer, instances.data(), instance_buffer_size);
+        accelerator.instance_buffer_address = accelerator.instance_buffer.device_address;
+    };
 
-    // Create scratch buffert.
+    // Create scratch buffers.
+    //
+    // Bottom level builds are grouped into batches. Each build in a batch gets its own range of the
+    // batch scratch buffer, so all builds of the batch are issued with a single build call and run
+    // concurrently. Barriers are needed only between the batches, since the next batch reuses the
+    // scratch memory. The batch size is limited by scratch_budget, a build that alone exceeds the
+    // budget gets its own batch.
+    struct Build_Batch {
+        uint32_t first_build; // index in device_build_indices
+        uint32_t accel_count;
+    };
+    std::vector<Build_Batch> batches;
+    std::vector<VkDeviceSize> scratch_offsets(geometries.size());
+    VkDeviceSize bottom_level_scratch_size = 0;
     {
-        auto get_scratch_size = [](VkAccelerationStructureKHR accel) {
+        auto get_scratch_size = [](VkAccelerationStructureKHR accel,
+            VkAccelerationStructureMemoryRequirementsTypeKHR type = VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_KHR) {
             VkAccelerationStructureMemoryRequirementsInfoKHR reqs_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_KHR };
-            reqs_info.type = VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_KHR;
+            reqs_info.type = type;
             reqs_info.buildType = VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR;
             reqs_info.accelerationStructure = accel;
             VkMemoryRequirements2 reqs_holder{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
@@ -161,56 +492,135 @@ Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GP
             return reqs_holder.memoryRequirements.size;            
         };
 
-        {
-            VkDeviceSize scratch_size = get_scratch_size(accelerator.top_level_accel);
-            for (VkAccelerationStructureKHR accel : accelerator.bottom_level_accels) {
-                scratch_size = std::max(scratch_size, get_scratch_size(accel));
+        // The provisional extension does not report scratch offset alignment, 256 bytes satisfies known implementations.
+        const VkDeviceSize scratch_alignment = 256;
+
+        VkDeviceSize batch_scratch_size = 0;
+        for (auto [k, i] : enumerate(device_build_indices)) {
+            const VkDeviceSize scratch_size = round_up(get_scratch_size(accelerator.bottom_level_accels[i]), scratch_alignment);
+            if (batches.empty() || (batch_scratch_size > 0 && batch_scratch_size + scratch_size > params.scratch_budget)) {
+                batches.push_back(Build_Batch{ uint32_t(k), 0 });
+                batch_scratch_size = 0;
+            }
+            scratch_offsets[i] = batch_scratch_size;
+            batch_scratch_size += scratch_size;
+            batches.back().accel_count++;
+            bottom_level_scratch_size = std::max(bottom_level_scratch_size, batch_scratch_size);
+        }
+        if (bottom_level_scratch_size > 0)
+            accelerator.bottom_level_scratch_buffer = vk_create_buffer(bottom_level_scratch_size, VK_BUFFER_USAGE_RAY_TRACING_BIT_KHR, nullptr, "bottom_level_scratch_buffer");
+
+        // Top level scratch buffer is used both for the full builds and for the refits.
+        const VkDeviceSize top_level_scratch_size = std::max(get_scratch_size(accelerator.top_level_accel),
+            get_scratch_size(accelerator.top_level_accel, VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_UPDATE_SCRATCH_KHR));
+        accelerator.scratch_buffer = vk_create_buffer(top_level_scratch_size, VK_BUFFER_USAGE_RAY_TRACING_BIT_KHR, nullptr, "top_level_scratch_buffer");
+
+        // The update scratch ranges are used both for the refits and for the full rebuilds of the deformed geometry.
+        if (params.allow_bottom_level_update && !geometries.empty()) {
+            VkDeviceSize update_scratch_size = 0;
+            accelerator.bottom_level_update_scratch_offsets.resize(geometries.size());
+            for (auto [i, accel] : enumerate(accelerator.bottom_level_accels)) {
+                accelerator.bottom_level_update_scratch_offsets[i] = update_scratch_size;
+                update_scratch_size += round_up(std::max(get_scratch_size(accel),
+                    get_scratch_size(accel, VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_UPDATE_SCRATCH_KHR)), scratch_alignment);
             }
-            accelerator.scratch_buffer = vk_create_buffer(scratch_size, VK_BUFFER_USAGE_RAY_TRACING_BIT_KHR);
+            accelerator.bottom_level_update_scratch_buffer = vk_create_buffer(update_scratch_size, VK_BUFFER_USAGE_RAY_TRACING_BIT_KHR, nullptr, "bottom_level_update_scratch_buffer");
         }
     }
+    accelerator.bottom_level_batch_count = (uint32_t)batches.size();
+    accelerator.bottom_level_scratch_size = bottom_level_scratch_size;
 
-    // Build acceleration structures.
-    Timestamp t;
+    // Host builds. The structures are cloned to the device memory by the GPU before the top level build.
+    std::vector<Host_Build> host_builds(host_build_indices.size());
+    VmaAllocation host_build_allocation = VK_NULL_HANDLE;
+    if (!host_builds.empty()) {
+        for (auto [k, i] : enumerate(host_build_indices)) {
+            const GPU_Mesh* mesh = geometries[i].mesh;
+            host_builds[k].geometry = params.host_meshes[mesh - gpu_meshes.data()];
+            host_builds[k].vertex_count = mesh->vertex_count;
+            host_builds[k].lod = geometries[i].lod;
+        }
+        Timestamp host_build_time;
+        host_build_allocation = build_bottom_level_accels_on_host(host_builds, bottom_level_flags);
+        accelerator.host_build_time_ms = float(elapsed_microseconds(host_build_time) / 1000.0);
+    }
+    accelerator.host_build_count = (uint32_t)host_builds.size();
 
-    vk_execute(vk.command_pools[0], vk.queue,
-        [&gpu_meshes, &accelerator](VkCommandBuffer command_buffer)
+    // Timestamp queries to measure bottom level build time on the GPU.
+    VkQueryPool query_pool;
     {
-        for (auto [i, accel] : enumerate(accelerator.bottom_level_accels)) {
-            VkAccelerationStructureGeometryKHR geometry { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
-            const VkAccelerationStructureGeometryKHR* p_geometry[1] = { &geometry };
-            {
+        VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        create_info.queryCount = 2;
+        VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &query_pool));
+    }
+
+    // Compacted size queries.
+    VkQueryPool compacted_size_query_pool = VK_NULL_HANDLE;
+    if (compact && !from_cache && !geometries.empty()) {
+        VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        create_info.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+        create_info.queryCount = (uint32_t)geometries.size();
+        VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &compacted_size_query_pool));
+    }
+
+    auto record_bottom_level_builds = [&geometries, &batches, &scratch_offsets, &device_build_indices, &host_build_indices, &host_builds, &accelerator,
+        bottom_level_flags, query_pool, compacted_size_query_pool](VkCommandBuffer command_buffer) {
+        vkCmdResetQueryPool(command_buffer, query_pool, 0, 2);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+
+        std::vector<VkAccelerationStructureGeometryKHR> batch_geometries;
+        std::vector<const VkAccelerationStructureGeometryKHR*> batch_p_geometries;
+        std::vector<VkAccelerationStructureBuildGeometryInfoKHR> batch_geometry_infos;
+        std::vector<VkAccelerationStructureBuildOffsetInfoKHR> batch_offset_infos;
+        std::vector<const VkAccelerationStructureBuildOffsetInfoKHR*> batch_p_offset_infos;
+
+        for (const Build_Batch& batch : batches) {
+            // Resize first, so the pointers to the elements stay valid.
+            batch_geometries.resize(batch.accel_count);
+            batch_p_geometries.resize(batch.accel_count);
+            batch_geometry_infos.resize(batch.accel_count);
+            batch_offset_infos.resize(batch.accel_count);
+            batch_p_offset_infos.resize(batch.accel_count);
+
+            for (uint32_t k = 0; k < batch.accel_count; k++) {
+                const uint32_t i = device_build_indices[batch.first_build + k];
+
+                VkAccelerationStructureGeometryKHR& geometry = batch_geometries[k];
+                geometry = VkAccelerationStructureGeometryKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
                 geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
                 geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
                 auto& triangles = geometry.geometry.triangles;
                 triangles = VkAccelerationStructureGeometryTrianglesDataKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR };
                 triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-                triangles.vertexData.deviceAddress = gpu_meshes[i].vertex_buffer.device_address;
-                triangles.vertexStride = sizeof(Vertex);
+                triangles.vertexData.deviceAddress = geometries[i].mesh->vertex_buffer.device_address + geometries[i].mesh->get_vertex_offset();
+                triangles.vertexStride = geometries[i].mesh->vertex_stride;
                 triangles.indexType = VK_INDEX_TYPE_UINT32;
-                triangles.indexData.deviceAddress = gpu_meshes[i].index_buffer.device_address;
-            }
+                triangles.indexData.deviceAddress = geometries[i].mesh->index_buffer.device_address + geometries[i].mesh->get_index_offset();
+                batch_p_geometries[k] = &geometry;
 
-            VkAccelerationStructureBuildGeometryInfoKHR geometry_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
-            {
+                VkAccelerationStructureBuildGeometryInfoKHR& geometry_info = batch_geometry_infos[k];
+                geometry_info = VkAccelerationStructureBuildGeometryInfoKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
                 geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+                geometry_info.flags = bottom_level_flags;
                 geometry_info.update = VK_FALSE;
                 geometry_info.dstAccelerationStructure = accelerator.bottom_level_accels[i];
                 geometry_info.geometryArrayOfPointers = VK_TRUE;
                 geometry_info.geometryCount = 1;
-                geometry_info.ppGeometries = p_geometry;
-                geometry_info.scratchData.deviceAddress = accelerator.scratch_buffer.device_address;
-            }
+                geometry_info.ppGeometries = &batch_p_geometries[k];
+                geometry_info.scratchData.deviceAddress = accelerator.bottom_level_scratch_buffer.device_address + scratch_offsets[i];
 
-            VkAccelerationStructureBuildOffsetInfoKHR offset_info{};
-            const VkAccelerationStructureBuildOffsetInfoKHR* p_offset_info[1] = { &offset_info };
-            offset_info.primitiveCount = gpu_meshes[i].index_count / 3;
-            offset_info.primitiveOffset = 0;
+                VkAccelerationStructureBuildOffsetInfoKHR& offset_info = batch_offset_infos[k];
+                offset_info = VkAccelerationStructureBuildOffsetInfoKHR{};
+                offset_info.primitiveCount = geometries[i].lod.index_count / 3;
+                offset_info.primitiveOffset = geometries[i].lod.first_index * 4 /*VK_INDEX_TYPE_UINT32*/;
+                batch_p_offset_infos[k] = &offset_info;
+            }
 
-            vkCmdBuildAccelerationStructureKHR(command_buffer, 1, &geometry_info, p_offset_info);
+            vkCmdBuildAccelerationStructureKHR(command_buffer, batch.accel_count, batch_geometry_infos.data(), batch_p_offset_infos.data());
 
-            // We need a barrier when building multiple bottom level AS because
-            // signle scratch space is used for all builds.
+            // The next batch reuses the scratch memory. After the last batch the barrier
+            // makes bottom level structures available to the top level build.
             VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
             barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
             barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
@@ -220,44 +630,434 @@ Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GP
                 0, 1, &barrier, 0, nullptr, 0, nullptr);
         }
 
-        VkAccelerationStructureGeometryKHR geometry { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
-        const VkAccelerationStructureGeometryKHR* p_geometry[1] = { &geometry };
-        {
-            geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-            geometry.geometry.instances = VkAccelerationStructureGeometryInstancesDataKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR };
-            geometry.geometry.instances.arrayOfPointers = VK_FALSE;
-            geometry.geometry.instances.data.deviceAddress = accelerator.instance_buffer.device_address;
+        // Structures built on the host are cloned to the device memory.
+        if (!host_builds.empty()) {
+            for (auto [k, build] : enumerate(host_builds)) {
+                VkCopyAccelerationStructureInfoKHR copy_info { VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR };
+                copy_info.src = build.accel;
+                copy_info.dst = accelerator.bottom_level_accels[host_build_indices[k]];
+                copy_info.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_CLONE_KHR;
+                vkCmdCopyAccelerationStructureKHR(command_buffer, &copy_info);
+            }
+
+            VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+            barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            vkCmdPipelineBarrier(command_buffer,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
         }
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, query_pool, 1);
 
-        VkAccelerationStructureBuildGeometryInfoKHR geometry_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
-        {
-            geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-            geometry_info.flags = 0;
-            geometry_info.update = VK_FALSE;
-            geometry_info.dstAccelerationStructure = accelerator.top_level_accel;
-            geometry_info.geometryArrayOfPointers = VK_TRUE;
-            geometry_info.geometryCount = 1;
-            geometry_info.ppGeometries = p_geometry;
-            geometry_info.scratchData.deviceAddress = accelerator.scratch_buffer.device_address;
+        if (compacted_size_query_pool != VK_NULL_HANDLE) {
+            const uint32_t accel_count = (uint32_t)accelerator.bottom_level_accels.size();
+            vkCmdResetQueryPool(command_buffer, compacted_size_query_pool, 0, accel_count);
+            vkCmdWriteAccelerationStructuresPropertiesKHR(command_buffer, accel_count, accelerator.bottom_level_accels.data(),
+                VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, compacted_size_query_pool, 0);
         }
+    };
 
-        VkAccelerationStructureBuildOffsetInfoKHR offset_info{};
-        const VkAccelerationStructureBuildOffsetInfoKHR* p_offset_info[1] = { &offset_info };
-        offset_info.primitiveCount = 1;
-        offset_info.primitiveOffset = 0;
+    // The caller's instances are not written yet, the first cmd_build_top_level_accel call does the full build.
+    auto record_top_level_build = [&accelerator, external_instances](VkCommandBuffer command_buffer) {
+        if (!external_instances)
+            cmd_build_top_level_accel(command_buffer, accelerator, accelerator.max_instance_count, 0);
+    };
 
-        vkCmdBuildAccelerationStructureKHR(command_buffer, 1, &geometry_info, p_offset_info);
+    // Build acceleration structures.
+    Timestamp t;
+    std::vector<uint64_t> compacted_sizes(geometries.size()); // zero if the structure is not compacted
 
-        VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
-        barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-        barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
-        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
-            0, 1, &barrier, 0, nullptr, 0, nullptr);
-    });
+    if (from_cache) {
+        create_instance_buffer();
+
+        void* cache_buffer_ptr;
+        Vk_Buffer cache_buffer = vk_create_mapped_buffer(cache.data_size, VK_BUFFER_USAGE_RAY_TRACING_BIT_KHR, &cache_buffer_ptr, "accel_cache_buffer");
+        memcpy(cache_buffer_ptr, cache.data, cache.data_size);
+
+        vk_execute(vk.command_pools[0], vk.queue, [&cache, &cache_buffer, &accelerator, &record_top_level_build, query_pool](VkCommandBuffer command_buffer) {
+            vkCmdResetQueryPool(command_buffer, query_pool, 0, 2);
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+
+            for (auto [i, entry] : enumerate(cache.entries)) {
+                VkCopyMemoryToAccelerationStructureInfoKHR copy_info { VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR };
+                copy_info.src.deviceAddress = cache_buffer.device_address + entry.offset;
+                copy_info.dst = accelerator.bottom_level_accels[i];
+                copy_info.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+                vkCmdCopyMemoryToAccelerationStructureKHR(command_buffer, &copy_info);
+            }
+
+            VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+            barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+            vkCmdPipelineBarrier(command_buffer,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, query_pool, 1);
+
+            record_top_level_build(command_buffer);
+        });
+        cache_buffer.destroy();
+        cache.release();
+    } else if (!compact) {
+        create_instance_buffer();
+        vk_execute(vk.command_pools[0], vk.queue, [&record_bottom_level_builds, &record_top_level_build](VkCommandBuffer command_buffer) {
+            record_bottom_level_builds(command_buffer);
+            record_top_level_build(command_buffer);
+        });
+    } else {
+        vk_execute(vk.command_pools[0], vk.queue, record_bottom_level_builds);
+
+        // Create compacted bottom level structures. They are placed in the same allocation as
+        // the top level structure, the allocation is tightly packed according to the compacted sizes.
+        if (!geometries.empty()) {
+            VK_CHECK(vkGetQueryPoolResults(vk.device, compacted_size_query_pool, 0, (uint32_t)geometries.size(), compacted_sizes.size() * sizeof(uint64_t),
+                compacted_sizes.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+            vkDestroyQueryPool(vk.device, compacted_size_query_pool, nullptr);
+        }
+
+        std::vector<VkAccelerationStructureKHR> compacted_accels(geometries.size());
+        for (auto [i, compacted_accel] : enumerate(compacted_accels)) {
+            VkAccelerationStructureCreateInfoKHR create_info{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+            create_info.compactedSize = compacted_sizes[i];
+            create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+            create_info.flags = bottom_level_flags;
+
+            VK_CHECK(vkCreateAccelerationStructureKHR(vk.device, &create_info, nullptr, &compacted_accel));
+            vk_set_debug_name(compacted_accel, "bottom_level_accel (compacted)");
+        }
+
+        std::vector<VkAccelerationStructureKHR> accels { accelerator.top_level_accel };
+        accels.insert(accels.end(), compacted_accels.begin(), compacted_accels.end());
+
+        std::vector<VkDeviceSize> memory_sizes;
+        accelerator.allocation = allocate_acceleration_structures_memory(accels, &memory_sizes);
+        accelerator.top_level_memory_size = memory_sizes[0];
+        const std::vector<VkDeviceSize> compacted_memory_sizes(memory_sizes.begin() + 1, memory_sizes.end());
+
+        const std::vector<VkAccelerationStructureKHR> build_accels = accelerator.bottom_level_accels;
+        accelerator.bottom_level_accels = compacted_accels;
+        create_instance_buffer();
+
+        vk_execute(vk.command_pools[0], vk.queue, [&build_accels, &compacted_accels, &record_top_level_build](VkCommandBuffer command_buffer) {
+            for (auto [i, compacted_accel] : enumerate(compacted_accels)) {
+                VkCopyAccelerationStructureInfoKHR copy_info { VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR };
+                copy_info.src = build_accels[i];
+                copy_info.dst = compacted_accel;
+                copy_info.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+                vkCmdCopyAccelerationStructureKHR(command_buffer, &copy_info);
+            }
+
+            VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+            barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+            vkCmdPipelineBarrier(command_buffer,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+            record_top_level_build(command_buffer);
+        });
+
+        for (VkAccelerationStructureKHR accel : build_accels)
+            vkDestroyAccelerationStructureKHR(vk.device, accel, nullptr);
+        if (build_allocation != VK_NULL_HANDLE)
+            vmaFreeMemory(vk.allocator, build_allocation);
+
+        if (log_build_time && !gpu_meshes.empty()) {
+            VkDeviceSize total_size = 0;
+            VkDeviceSize total_compacted_size = 0;
+            printf("\nBottom level compaction (memory before -> after):\n");
+            for (auto [mesh_index, first_accel] : enumerate(accelerator.mesh_first_accel)) {
+                const size_t end_accel = mesh_index + 1 < accelerator.mesh_first_accel.size() ? accelerator.mesh_first_accel[mesh_index + 1] : geometries.size();
+                VkDeviceSize size = 0;
+                VkDeviceSize compacted_size = 0;
+                for (size_t i = first_accel; i < end_accel; i++) {
+                    size += bottom_level_memory_sizes[i];
+                    compacted_size += compacted_memory_sizes[i];
+                }
+                printf("  mesh %d: %u KB -> %u KB (%d LODs)\n", (int)mesh_index, uint32_t(size / 1024), uint32_t(compacted_size / 1024), int(end_accel - first_accel));
+                total_size += size;
+                total_compacted_size += compacted_size;
+            }
+            printf("  total: %u KB -> %u KB (%.1f%%)\n", uint32_t(total_size / 1024), uint32_t(total_compacted_size / 1024),
+                total_size ? 100.0 * double(total_compacted_size) / double(total_size) : 100.0);
+        }
+        bottom_level_memory_sizes = compacted_memory_sizes;
+    }
 
+    const long long build_time = elapsed_microseconds(t);
+
+    for (const Host_Build& build : host_builds)
+        vkDestroyAccelerationStructureKHR(vk.device, build.accel, nullptr);
+    if (host_build_allocation != VK_NULL_HANDLE)
+        vmaFreeMemory(vk.allocator, host_build_allocation);
+
+    uint64_t timestamps[2];
+    VK_CHECK(vkGetQueryPoolResults(vk.device, query_pool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    vkDestroyQueryPool(vk.device, query_pool, nullptr);
+    accelerator.bottom_level_build_time_ms = float(double(timestamps[1] - timestamps[0]) * vk.timestamp_period_ms);
+
+    accelerator.bottom_level_memory_size = 0;
+    for (VkDeviceSize size : bottom_level_memory_sizes)
+        accelerator.bottom_level_memory_size += size;
+
+    accelerator.bottom_level_scratch_buffer.destroy();
     if (!keep_scratch_buffer)
         accelerator.scratch_buffer.destroy();
 
-    printf("\nAcceleration structures build time = %lld microseconds\n", elapsed_microseconds(t));
+    Timestamp serialize_time;
+    if (!from_cache && use_cache && !geometries.empty()) {
+        write_bottom_level_accels_cache(accelerator.bottom_level_accels, compacted_sizes, params.cache_path, cache_key);
+        if (log_build_time)
+            printf("Acceleration structure cache written in %lld milliseconds: %s\n", elapsed_milliseconds(serialize_time), params.cache_path.c_str());
+    }
+
+    if (log_build_time && !gpu_meshes.empty()) {
+        printf("\nAcceleration structures build time = %lld microseconds (%d bottom level %s, GPU time %.3f ms, vertex stride %u, %s layout)\n",
+            build_time, (int)geometries.size(), from_cache ? "deserialized from cache" : "built", accelerator.bottom_level_build_time_ms,
+            gpu_meshes[0].vertex_stride, get_vertex_layout_name(gpu_meshes[0].vertex_layout));
+        printf("Bottom level build batches = %u, scratch size = %u KB (budget %u KB), memory size = %u KB%s\n",
+            accelerator.bottom_level_batch_count, uint32_t(bottom_level_scratch_size / 1024), uint32_t(params.scratch_budget / 1024),
+            uint32_t(accelerator.bottom_level_memory_size / 1024), compact ? " (compacted)" : "");
+        if (accelerator.host_build_count > 0) {
+            printf("Host builds = %u (up to %u triangles), CPU time %.3f ms on %u threads\n",
+                accelerator.host_build_count, params.host_build_max_triangles, accelerator.host_build_time_ms, get_thread_count());
+        }
+        printf("Build flags: bottom level %s, top level %s\n",
+            get_build_preference_flags_name(params.bottom_level_flags).c_str(), get_build_preference_flags_name(params.top_level_flags).c_str());
+    }
     return accelerator;
 }
+
+bool cmd_build_top_level_accel(VkCommandBuffer command_buffer, Vk_Intersection_Accelerator& accelerator, uint32_t instance_count, uint32_t max_refit_count) {
+    // Refit keeps the tree topology of the last full build. The instances can move and reference
+    // other bottom level structures, but the tree quality degrades as the instances move away from
+    // their initial positions, so the number of successive refits is limited.
+    assert(instance_count <= accelerator.max_instance_count);
+    const bool refit = accelerator.top_level_instance_count == instance_count && accelerator.top_level_refit_count < max_refit_count;
+
+    VkAccelerationStructureGeometryKHR geometry { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
+    geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    geometry.geometry.instances = VkAccelerationStructureGeometryInstancesDataKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR };
+    geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+    geometry.geometry.instances.data.deviceAddress = accelerator.instance_buffer_address;
+
+    const VkAccelerationStructureGeometryKHR* p_geometry[1] = { &geometry };
+
+    VkAccelerationStructureBuildGeometryInfoKHR geometry_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+    geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    geometry_info.flags = accelerator.top_level_flags;
+    geometry_info.update = refit ? VK_TRUE : VK_FALSE;
+    geometry_info.srcAccelerationStructure = refit ? accelerator.top_level_accel : VK_NULL_HANDLE;
+    geometry_info.dstAccelerationStructure = accelerator.top_level_accel;
+    geometry_info.geometryArrayOfPointers = VK_TRUE;
+    geometry_info.geometryCount = 1;
+    geometry_info.ppGeometries = p_geometry;
+    geometry_info.scratchData.deviceAddress = accelerator.scratch_buffer.device_address;
+
+    VkAccelerationStructureBuildOffsetInfoKHR offset_info{};
+    offset_info.primitiveCount = instance_count;
+    offset_info.primitiveOffset = 0;
+
+    const VkAccelerationStructureBuildOffsetInfoKHR* p_offset_info[1] = { &offset_info };
+
+    vkCmdBuildAccelerationStructureKHR(command_buffer, 1, &geometry_info, p_offset_info);
+
+    VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+
+    vkCmdPipelineBarrier(command_buffer,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    accelerator.top_level_instance_count = instance_count;
+    accelerator.top_level_refit_count = refit ? accelerator.top_level_refit_count + 1 : 0;
+    return refit;
+}
+
+bool cmd_build_bottom_level_accels(VkCommandBuffer command_buffer, Vk_Intersection_Accelerator& accelerator, const std::vector<GPU_Mesh>& gpu_meshes, uint32_t max_refit_count) {
+    assert(accelerator.bottom_level_flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
+    assert(accelerator.mesh_first_accel.size() == gpu_meshes.size());
+    const bool refit = accelerator.bottom_level_refit_count < max_refit_count;
+    const uint32_t accel_count = (uint32_t)accelerator.bottom_level_accels.size();
+
+    // The previous frame can still trace rays against the structures and its builds use the same scratch memory.
+    {
+        VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        vkCmdPipelineBarrier(command_buffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    // All LODs of the mesh share the vertex buffer, so all of them are updated.
+    std::vector<VkAccelerationStructureGeometryKHR> geometries(accel_count);
+    std::vector<const VkAccelerationStructureGeometryKHR*> p_geometries(accel_count);
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> geometry_infos(accel_count);
+    std::vector<VkAccelerationStructureBuildOffsetInfoKHR> offset_infos(accel_count);
+    std::vector<const VkAccelerationStructureBuildOffsetInfoKHR*> p_offset_infos(accel_count);
+
+    for (auto [mesh_index, gpu_mesh] : enumerate(gpu_meshes)) {
+        for (auto [lod_index, lod] : enumerate(gpu_mesh.lods)) {
+            const uint32_t i = accelerator.mesh_first_accel[mesh_index] + uint32_t(lod_index);
+
+            VkAccelerationStructureGeometryKHR& geometry = geometries[i];
+            geometry = VkAccelerationStructureGeometryKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
+            geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+            geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+            auto& triangles = geometry.geometry.triangles;
+            triangles = VkAccelerationStructureGeometryTrianglesDataKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR };
+            triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+            triangles.vertexData.deviceAddress = gpu_mesh.vertex_buffer.device_address + gpu_mesh.get_vertex_offset();
+            triangles.vertexStride = gpu_mesh.vertex_stride;
+            triangles.indexType = VK_INDEX_TYPE_UINT32;
+            triangles.indexData.deviceAddress = gpu_mesh.index_buffer.device_address + gpu_mesh.get_index_offset();
+            p_geometries[i] = &geometry;
+
+            VkAccelerationStructureBuildGeometryInfoKHR& geometry_info = geometry_infos[i];
+            geometry_info = VkAccelerationStructureBuildGeometryInfoKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+            geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+            geometry_info.flags = accelerator.bottom_level_flags;
+            geometry_info.update = refit ? VK_TRUE : VK_FALSE;
+            geometry_info.srcAccelerationStructure = refit ? accelerator.bottom_level_accels[i] : VK_NULL_HANDLE;
+            geometry_info.dstAccelerationStructure = accelerator.bottom_level_accels[i];
+            geometry_info.geometryArrayOfPointers = VK_TRUE;
+            geometry_info.geometryCount = 1;
+            geometry_info.ppGeometries = &p_geometries[i];
+            geometry_info.scratchData.deviceAddress = accelerator.bottom_level_update_scratch_buffer.device_address + accelerator.bottom_level_update_scratch_offsets[i];
+
+            VkAccelerationStructureBuildOffsetInfoKHR& offset_info = offset_infos[i];
+            offset_info = VkAccelerationStructureBuildOffsetInfoKHR{};
+            offset_info.primitiveCount = lod.index_count / 3;
+            offset_info.primitiveOffset = lod.first_index * 4 /*VK_INDEX_TYPE_UINT32*/;
+            p_offset_infos[i] = &offset_info;
+        }
+    }
+    vkCmdBuildAccelerationStructureKHR(command_buffer, accel_count, geometry_infos.data(), p_offset_infos.data());
+
+    VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(command_buffer,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    accelerator.bottom_level_refit_count = refit ? accelerator.bottom_level_refit_count + 1 : 0;
+    return refit;
+}
+
+void compare_bottom_level_build_times() {
+    const int grid_sizes[] = { 128, 256, 512, 1024 };
+    const int repeat_count = 3;
+    log_build_time = false;
+
+    printf("\nBottom level build time comparison (best of %d runs):\n", repeat_count);
+    printf("%12s %12s %14s %14s %10s\n", "triangles", "vertices", "interleaved ms", "split ms", "speedup");
+
+    for (int grid_size : grid_sizes) {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        create_grid_mesh(grid_size, vertices, indices);
+        const uint32_t vertex_count = uint32_t(vertices.size());
+
+        float best_time_ms[2];
+        const Vertex_Layout layouts[2] = { vertex_layout_interleaved, vertex_layout_split };
+        for (int k = 0; k < 2; k++) {
+            std::vector<GPU_Mesh> gpu_meshes { create_gpu_mesh(vertices.data(), vertex_count, indices.data(), uint32_t(indices.size()), layouts[k]) };
+            best_time_ms[k] = std::numeric_limits<float>::max();
+            for (int r = 0; r < repeat_count; r++) {
+                Vk_Intersection_Accelerator accelerator = create_intersection_accelerator(gpu_meshes, false);
+                best_time_ms[k] = std::min(best_time_ms[k], accelerator.bottom_level_build_time_ms);
+                accelerator.destroy();
+            }
+            gpu_meshes[0].destroy();
+        }
+        printf("%12u %12u %14.3f %14.3f %9.2fx\n", uint32_t(indices.size() / 3), vertex_count,
+            best_time_ms[0], best_time_ms[1], best_time_ms[0] / best_time_ms[1]);
+    }
+
+    // Serial builds (zero scratch budget) compared to the batched builds with the default budget.
+    // All meshes reference the same geometry buffers, each mesh gets its own bottom level structure.
+    {
+        const int grid_size = 32;
+        const int mesh_counts[] = { 1, 16, 64, 256 };
+
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        create_grid_mesh(grid_size, vertices, indices);
+        GPU_Mesh grid_mesh = create_gpu_mesh(vertices.data(), uint32_t(vertices.size()), indices.data(), uint32_t(indices.size()), vertex_layout_split);
+
+        printf("\nSerial and batched bottom level builds, %u triangles per mesh (best of %d runs):\n", uint32_t(indices.size() / 3), repeat_count);
+        printf("%12s %12s %12s %10s %10s %12s\n", "meshes", "serial ms", "batched ms", "speedup", "batches", "scratch KB");
+
+        for (int mesh_count : mesh_counts) {
+            const std::vector<GPU_Mesh> gpu_meshes(mesh_count, grid_mesh);
+            const VkDeviceSize scratch_budgets[2] = { 0, default_bottom_level_scratch_budget };
+            float best_time_ms[2];
+            uint32_t batch_count = 0;
+            VkDeviceSize scratch_size = 0;
+
+            for (int k = 0; k < 2; k++) {
+                best_time_ms[k] = std::numeric_limits<float>::max();
+                Accelerator_Build_Params params;
+                params.scratch_budget = scratch_budgets[k];
+                for (int r = 0; r < repeat_count; r++) {
+                    Vk_Intersection_Accelerator accelerator = create_intersection_accelerator(gpu_meshes, false, params);
+                    best_time_ms[k] = std::min(best_time_ms[k], accelerator.bottom_level_build_time_ms);
+                    batch_count = accelerator.bottom_level_batch_count;
+                    scratch_size = accelerator.bottom_level_scratch_size;
+                    accelerator.destroy();
+                }
+            }
+            printf("%12d %12.3f %12.3f %9.2fx %10u %12u\n", mesh_count, best_time_ms[0], best_time_ms[1],
+                best_time_ms[0] / best_time_ms[1], batch_count, uint32_t(scratch_size / 1024));
+        }
+        grid_mesh.destroy();
+    }
+
+    // Host builds compared to the batched device builds. Host time is CPU time of the builds on all worker
+    // threads, device time is GPU time. Throughput is in millions of triangles per second.
+    if (vk.host_accel_builds_supported) {
+        const int grid_sizes[] = { 8, 32, 128 };
+        const int mesh_count = 64;
+
+        printf("\nHost and device bottom level builds, %d meshes, %u threads (best of %d runs):\n", mesh_count, get_thread_count(), repeat_count);
+        printf("%12s %12s %12s %14s %14s\n", "triangles", "device ms", "host ms", "device Mtri/s", "host Mtri/s");
+
+        for (int grid_size : grid_sizes) {
+            std::vector<Vertex> vertices;
+            std::vector<uint32_t> indices;
+            create_grid_mesh(grid_size, vertices, indices);
+            GPU_Mesh grid_mesh = create_gpu_mesh(vertices.data(), uint32_t(vertices.size()), indices.data(), uint32_t(indices.size()), vertex_layout_interleaved);
+            const std::vector<GPU_Mesh> gpu_meshes(mesh_count, grid_mesh);
+
+            Accelerator_Build_Params host_params;
+            host_params.host_meshes.assign(mesh_count, Host_Mesh_Geometry{ vertices.data(), uint32_t(sizeof(Vertex)), indices.data() });
+            host_params.host_build_max_triangles = std::numeric_limits<uint32_t>::max();
+
+            float device_time_ms = std::numeric_limits<float>::max();
+            float host_time_ms = std::numeric_limits<float>::max();
+            for (int r = 0; r < repeat_count; r++) {
+                Vk_Intersection_Accelerator accelerator = create_intersection_accelerator(gpu_meshes, false);
+                device_time_ms = std::min(device_time_ms, accelerator.bottom_level_build_time_ms);
+                accelerator.destroy();
+
+                accelerator = create_intersection_accelerator(gpu_meshes, false, host_params);
+                host_time_ms = std::min(host_time_ms, accelerator.host_build_time_ms);
+                accelerator.destroy();
+            }
+            const double total_triangles = double(indices.size() / 3) * mesh_count;
+            printf("%12u %12.3f %12.3f %14.2f %14.2f\n", uint32_t(indices.size() / 3), device_time_ms, host_time_ms,
+                total_triangles / (device_time_ms * 1e3), total_triangles / (host_time_ms * 1e3));
+            grid_mesh.destroy();
+        }
+    }
+    log_build_time = true;
+}
@@ -2,22 +2,138 @@
 
 #include "vk.h"
 
+#include <string>
+
 struct GPU_Mesh;
 
 struct Vk_Intersection_Accelerator {
     std::vector<VkAccelerationStructureKHR> bottom_level_accels;
     std::vector<VkDeviceAddress> bottom_level_accel_device_addresses;
+    std::vector<uint32_t> mesh_first_accel; // index of the LOD 0 bottom level accel for each mesh, LODs are stored sequentially
     VkAccelerationStructureKHR top_level_accel = VK_NULL_HANDLE;
 
     // allocation shared by bottom level and top level acceleration structures
     VmaAllocation allocation = VK_NULL_HANDLE;
 
-    Vk_Buffer instance_buffer; // array of VkAccelerationStructureInstanceKHR
+    Vk_Buffer instance_buffer; // array of VkAccelerationStructureInstanceKHR, not created when instances are provided by the caller
     VkAccelerationStructureInstanceKHR* mapped_instance_buffer = nullptr;
+    VkDeviceAddress instance_buffer_address = 0; // instance_buffer or the caller's instance buffer
+    uint32_t max_instance_count = 0; // the top level structure is created for this number of instances
+
+    Vk_Buffer scratch_buffer; // top level build scratch
+    Vk_Buffer bottom_level_scratch_buffer; // shared by the builds of one batch, released after the build
+
+    // Per-frame bottom level builds of the deformed geometry, created only if the updates are allowed.
+    // Each bottom level structure has its own range, so all of them are built concurrently.
+    Vk_Buffer bottom_level_update_scratch_buffer;
+    std::vector<VkDeviceSize> bottom_level_update_scratch_offsets;
 
-    Vk_Buffer scratch_buffer;
+    float bottom_level_build_time_ms = 0.f; // GPU time of the bottom level builds
+    uint32_t host_build_count = 0; // bottom level structures built on the CPU
+    float host_build_time_ms = 0.f; // CPU time of the host builds
+    uint32_t bottom_level_batch_count = 0;
+    VkDeviceSize bottom_level_scratch_size = 0;
+    VkDeviceSize bottom_level_memory_size = 0; // memory of all bottom level structures, after compaction if enabled
+
+    VkBuildAccelerationStructureFlagsKHR bottom_level_flags = 0; // flags used to create the bottom level structures
+    VkBuildAccelerationStructureFlagsKHR top_level_flags = 0; // flags used to create the top level structure
+    VkDeviceSize top_level_memory_size = 0;
+    bool loaded_from_cache = false; // bottom level structures were deserialized from the cache
+    uint32_t top_level_instance_count = 0; // instance count of the last top level build
+    uint32_t top_level_refit_count = 0; // refits since the last full top level build
+    uint32_t bottom_level_refit_count = 0; // bottom level refits since the last full bottom level build
 
     void destroy();
 };
 
-Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GPU_Mesh>& gpu_meshes, bool keep_scratch_buffer);
+// Default limit for the scratch memory used by one batch of bottom level builds.
+constexpr VkDeviceSize default_bottom_level_scratch_budget = 64 * 1024 * 1024;
+
+// Build preference flag combinations that can be selected for bottom level and top level structures.
+// Zero means no preference, the driver default.
+constexpr VkBuildAccelerationStructureFlagsKHR build_preference_flag_combinations[] = {
+    0,
+    VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+    VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR,
+    VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_KHR,
+    VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_KHR,
+    VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_KHR,
+};
+constexpr int build_preference_flag_combination_count = int(sizeof(build_preference_flag_combinations) / sizeof(build_preference_flag_combinations[0]));
+
+// Returns the name of the build preference flags, e.g. "fast-trace+low-memory" or "default".
+std::string get_build_preference_flags_name(VkBuildAccelerationStructureFlagsKHR flags);
+
+// Parses '+' separated list of fast-trace, fast-build and low-memory or "default". Returns false on error.
+bool parse_build_preference_flags(const std::string& str, VkBuildAccelerationStructureFlagsKHR* flags);
+
+// CPU copy of the mesh geometry used by the host builds.
+struct Host_Mesh_Geometry {
+    const void*     vertices; // vertex position is stored in the first 3 floats
+    uint32_t        vertex_stride;
+    const uint32_t* indices; // indices of all LODs, the same layout as in the GPU index buffer
+};
+
+struct Accelerator_Build_Params {
+    // Build preference flags (fast trace, fast build, low memory). Compaction and update flags are added as needed.
+    VkBuildAccelerationStructureFlagsKHR    bottom_level_flags  = 0;
+    VkBuildAccelerationStructureFlagsKHR    top_level_flags     = 0;
+
+    // Limits the scratch size of one batch of bottom level builds. With zero budget the structures are built one by one.
+    VkDeviceSize                            scratch_budget      = default_bottom_level_scratch_budget;
+
+    // Builds with the allow-compaction flag and then copies the structures to the compacted ones
+    // that use a separate tightly packed allocation. The original structures are released.
+    bool                                    compact             = false;
+
+    // Bottom level structures are serialized to the cache file after the build and deserialized on
+    // the next runs instead of building. geometry_hash is the content hash of the vertex and index data.
+    // The cache is disabled if the path is empty.
+    std::string                             cache_path;
+    uint64_t                                geometry_hash       = 0;
+
+    // Bottom level structures with at most host_build_max_triangles triangles are built on the CPU
+    // if the device supports host builds. host_meshes provides geometry for each GPU mesh,
+    // host builds are disabled if it is empty.
+    std::vector<Host_Mesh_Geometry>         host_meshes;
+    uint32_t                                host_build_max_triangles = 0;
+
+    // Top level instances can be written by the caller, for example by a compute shader. In that case
+    // the top level structure is created for instance_count instances read from instance_buffer_address
+    // and it is not built until the first cmd_build_top_level_accel call. Otherwise the accelerator
+    // creates a mapped instance buffer with one instance per mesh.
+    VkDeviceAddress                         instance_buffer_address = 0;
+    uint32_t                                instance_count      = 0;
+
+    // Bottom level structures are created with the allow-update flag, so they can be refitted when the vertex
+    // buffers are modified on the GPU (see cmd_build_bottom_level_accels). Compaction and the cache are not used
+    // in this case: the compacted structures can't be fully rebuilt in place and the geometry can be deformed.
+    bool                                    allow_bottom_level_update = false;
+};
+
+// Bottom level structures are built in batches, all builds of the batch run concurrently and use
+// separate ranges of the scratch buffer. keep_scratch_buffer keeps the top level scratch buffer.
+Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GPU_Mesh>& gpu_meshes, bool keep_scratch_buffer,
+    const Accelerator_Build_Params& params = Accelerator_Build_Params{});
+
+// Default limit for the number of successive top level refits before the full rebuild.
+constexpr uint32_t default_top_level_max_refit_count = 64;
+
+// Records the top level build from the instance buffer followed by a barrier for the raytracing shaders.
+// The structure is refitted in place unless the instance count has changed since the last build or
+// max_refit_count refits were already done, in that case it is fully rebuilt. Returns true for refit.
+bool cmd_build_top_level_accel(VkCommandBuffer command_buffer, Vk_Intersection_Accelerator& accelerator, uint32_t instance_count, uint32_t max_refit_count);
+
+// Default limit for the number of successive bottom level refits before the full rebuild.
+constexpr uint32_t default_bottom_level_max_refit_count = 16;
+
+// Records the builds of all bottom level structures from the current vertex data of gpu_meshes followed by a barrier
+// for the top level build. The accelerator should be created with allow_bottom_level_update. The structures are refitted
+// in place, after max_refit_count successive refits they are fully rebuilt, since the refit keeps the tree topology of
+// the rest pose and the tree quality degrades with large deformations. Returns true for refit.
+bool cmd_build_bottom_level_accels(VkCommandBuffer command_buffer, Vk_Intersection_Accelerator& accelerator, const std::vector<GPU_Mesh>& gpu_meshes, uint32_t max_refit_count);
+
+// Builds bottom level acceleration structures for grid meshes of different sizes with interleaved
+// and split vertex layouts and prints GPU build times. Then compares serial and batched builds
+// for different mesh counts and, if supported, host and device build throughput.
+void compare_bottom_level_build_times();
@@ -0,0 +1,582 @@
+#include "benchmarks.h"
+#include "bvh.h"
+#include "common.h"
+#include "mesh.h"
+#include "obj_reader.h"
+#include "thread_pool.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+
+//
+// OBJ reader benchmark.
+// Generates OBJ files of increasing size and compares throughput of tinyobjloader
+// and multi-threaded OBJ reader. Also checks that both readers produce the same data.
+//
+static void write_grid_obj_file(const std::string& path, int grid_size) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (f == nullptr)
+        error("failed to create file: " + path);
+
+    const float step = 1.f / float(grid_size - 1);
+    for (int y = 0; y < grid_size; y++) {
+        for (int x = 0; x < grid_size; x++) {
+            float u = x * step;
+            float v = y * step;
+            fprintf(f, "v %.6f %.6f %.6f\n", u, 0.1f * std::sin(u * 20.f) * std::cos(v * 20.f), v);
+            fprintf(f, "vt %.6f %.6f\n", u, v);
+            fprintf(f, "vn 0.0 1.0 0.0\n");
+        }
+    }
+    // Mix absolute and relative indices. Split faces into several objects.
+    for (int y = 0; y < grid_size - 1; y++) {
+        if (y % 64 == 0)
+            fprintf(f, "o part%d\n", y / 64);
+        for (int x = 0; x < grid_size - 1; x++) {
+            int i0 = y * grid_size + x + 1;
+            int i1 = i0 + 1;
+            int i2 = i1 + grid_size;
+            int i3 = i0 + grid_size;
+            if ((x & 1) == 0)
+                fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", i0, i0, i0, i1, i1, i1, i2, i2, i2, i3, i3, i3);
+            else {
+                const int n = grid_size * grid_size + 1;
+                fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", i0 - n, i0 - n, i0 - n, i1 - n, i1 - n, i1 - n, i2 - n, i2 - n, i2 - n);
+                fprintf(f, "f %d//%d %d//%d %d//%d\n", i0, i0, i2, i2, i3, i3);
+            }
+        }
+    }
+    fclose(f);
+}
+
+static bool obj_data_equal(const Obj_Data& a, const Obj_Data& b) {
+    if (a.positions.size() != b.positions.size() || a.normals.size() != b.normals.size() ||
+        a.texcoords.size() != b.texcoords.size() || a.corners.size() != b.corners.size())
+        return false;
+
+    for (size_t i = 0; i < a.positions.size(); i++)
+        if (!(a.positions[i] == b.positions[i]))
+            return false;
+    for (size_t i = 0; i < a.normals.size(); i++)
+        if (!(a.normals[i] == b.normals[i]))
+            return false;
+    for (size_t i = 0; i < a.texcoords.size(); i++)
+        if (!(a.texcoords[i] == b.texcoords[i]))
+            return false;
+    for (size_t i = 0; i < a.corners.size(); i++) {
+        const Obj_Index& ca = a.corners[i];
+        const Obj_Index& cb = b.corners[i];
+        if (ca.position != cb.position || ca.normal != cb.normal || ca.texcoord != cb.texcoord)
+            return false;
+    }
+    if (a.groups.size() != b.groups.size() || a.materials.size() != b.materials.size())
+        return false;
+    for (size_t i = 0; i < a.groups.size(); i++) {
+        const Obj_Group& ga = a.groups[i];
+        const Obj_Group& gb = b.groups[i];
+        if (ga.object_name != gb.object_name || ga.material != gb.material || ga.first_corner != gb.first_corner || ga.corner_count != gb.corner_count)
+            return false;
+    }
+    for (size_t i = 0; i < a.materials.size(); i++) {
+        if (a.materials[i].name != b.materials[i].name || a.materials[i].diffuse_texture != b.materials[i].diffuse_texture)
+            return false;
+    }
+    return true;
+}
+
+static void run_obj_reader_benchmark() {
+    const std::string path = "obj_reader_benchmark.obj";
+    const int grid_sizes[] = { 200, 400, 800, 1600 };
+
+    printf("OBJ reader benchmark (%u threads)\n", get_thread_count());
+    printf("%-12s %-18s %-18s %-10s %s\n", "File size", "tinyobj", "read_obj_file", "Speedup", "Data match");
+
+    for (int grid_size : grid_sizes) {
+        write_grid_obj_file(path, grid_size);
+
+        FILE* f = fopen(path.c_str(), "rb");
+        fseek(f, 0, SEEK_END);
+        const double file_size_mb = double(ftell(f)) / (1024.0 * 1024.0);
+        fclose(f);
+
+        Obj_Data tinyobj_data;
+        Timestamp t;
+        if (!read_obj_file_tinyobj(path, tinyobj_data))
+            error("tinyobj failed to read benchmark file");
+        const double tinyobj_time = elapsed_microseconds(t) * 1e-6;
+
+        Obj_Data obj_data;
+        t = Timestamp();
+        if (!read_obj_file(path, obj_data))
+            error("read_obj_file failed to read benchmark file");
+        const double obj_reader_time = elapsed_microseconds(t) * 1e-6;
+
+        char tinyobj_str[32], obj_reader_str[32], size_str[32];
+        snprintf(size_str, sizeof(size_str), "%.1f MB", file_size_mb);
+        snprintf(tinyobj_str, sizeof(tinyobj_str), "%.1f MB/s", file_size_mb / tinyobj_time);
+        snprintf(obj_reader_str, sizeof(obj_reader_str), "%.1f MB/s", file_size_mb / obj_reader_time);
+
+        printf("%-12s %-18s %-18s %-10.2f %s\n", size_str, tinyobj_str, obj_reader_str, tinyobj_time / obj_reader_time,
+            obj_data_equal(tinyobj_data, obj_data) ? "yes" : "NO");
+    }
+    remove(path.c_str());
+}
+
+//
+// Vertex welding benchmark.
+// Compares weld_vertices with the std::unordered_map based implementation that was used before.
+//
+namespace std {
+template<> struct hash<Vertex> {
+    size_t operator()(Vertex const& v) const {
+        size_t hash = 0;
+        hash_combine(hash, v.pos);
+        hash_combine(hash, v.normal);
+        hash_combine(hash, v.uv);
+        return hash;
+    }
+};
+}
+
+static inline bool operator==(const Vertex& v1, const Vertex& v2) {
+    return v1.pos == v2.pos && v1.normal == v2.normal && v1.uv == v2.uv;
+}
+
+static void weld_vertices_unordered_map(const std::vector<Vertex>& corner_vertices, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+    Allocation_Counter* working_memory_counter) {
+    using Map_Allocator = Counting_Allocator<std::pair<const Vertex, std::size_t>>;
+    std::unordered_map<Vertex, std::size_t, std::hash<Vertex>, std::equal_to<Vertex>, Map_Allocator> unique_vertices(0,
+        std::hash<Vertex>(), std::equal_to<Vertex>(), Map_Allocator(working_memory_counter));
+    vertices.clear();
+    indices.clear();
+    for (const Vertex& vertex : corner_vertices) {
+        if (unique_vertices.count(vertex) == 0) {
+            unique_vertices[vertex] = vertices.size();
+            vertices.push_back(vertex);
+        }
+        indices.push_back((uint32_t)unique_vertices[vertex]);
+    }
+}
+
+// Grid with per-face texture seams: each vertex is shared by 6 triangles and 2 different uvs.
+static std::vector<Vertex> create_grid_corner_vertices(int grid_size) {
+    std::vector<Vertex> vertices;
+    vertices.reserve(size_t(grid_size - 1) * size_t(grid_size - 1) * 6);
+
+    auto make_vertex = [grid_size](int x, int y, bool seam) {
+        Vertex v;
+        v.pos = Vector3(float(x), 0.f, float(y));
+        v.normal = Vector3(0, 1, 0);
+        v.uv = seam ? Vector2(0.f, float(y) / grid_size) : Vector2(float(x) / grid_size, float(y) / grid_size);
+        return v;
+    };
+    for (int y = 0; y < grid_size - 1; y++) {
+        for (int x = 0; x < grid_size - 1; x++) {
+            bool seam = (x % 64) == 63;
+            vertices.push_back(make_vertex(x, y, false));
+            vertices.push_back(make_vertex(x + 1, y, seam));
+            vertices.push_back(make_vertex(x + 1, y + 1, seam));
+            vertices.push_back(make_vertex(x, y, false));
+            vertices.push_back(make_vertex(x + 1, y + 1, seam));
+            vertices.push_back(make_vertex(x, y + 1, false));
+        }
+    }
+    return vertices;
+}
+
+static std::vector<Vertex> load_obj_corner_vertices(const std::string& path) {
+    Obj_Data obj;
+    if (!read_obj_file(path, obj))
+        error("failed to load obj model: " + path);
+
+    std::vector<Vertex> vertices(obj.corners.size());
+    for (size_t i = 0; i < obj.corners.size(); i++) {
+        const Obj_Index& index = obj.corners[i];
+        vertices[i].pos = obj.positions[index.position];
+        vertices[i].normal = obj.normals.empty() ? Vector3_Zero : obj.normals[index.normal];
+        vertices[i].uv = obj.texcoords.empty() ? Vector2_Zero : obj.texcoords[index.texcoord];
+    }
+    return vertices;
+}
+
+static void run_vertex_weld_benchmark() {
+    struct Test_Mesh {
+        std::string name;
+        std::vector<Vertex> corner_vertices;
+    };
+    std::vector<Test_Mesh> meshes;
+    meshes.push_back(Test_Mesh{ "mesh.obj", load_obj_corner_vertices(get_resource_path("model/mesh.obj")) });
+    meshes.push_back(Test_Mesh{ "grid 256", create_grid_corner_vertices(256) });
+    meshes.push_back(Test_Mesh{ "grid 1024", create_grid_corner_vertices(1024) });
+    meshes.push_back(Test_Mesh{ "grid 2048", create_grid_corner_vertices(2048) });
+
+    printf("Vertex weld benchmark (%u threads)\n", get_thread_count());
+    printf("Peak memory is the working memory of the weld, it does not include input and output data.\n");
+    printf("%-10s %-10s %-10s | %-22s | %-22s | %-22s | %s\n", "Mesh", "Corners", "Vertices",
+        "unordered_map", "flat table", "flat table parallel", "Match");
+
+    for (const Test_Mesh& mesh : meshes) {
+        struct Result {
+            std::vector<Vertex> vertices;
+            std::vector<uint32_t> indices;
+            double time_ms;
+            double peak_mb;
+        };
+
+        auto run = [&mesh](Result& result, auto&& weld_func) {
+            Allocation_Counter counter;
+            Timestamp t;
+            weld_func(result, &counter);
+            result.time_ms = elapsed_microseconds(t) / 1000.0;
+            result.peak_mb = double(counter.peak_bytes.load()) / (1024.0 * 1024.0);
+        };
+
+        Result reference, serial, parallel;
+        run(reference, [&mesh](Result& r, Allocation_Counter* c) { weld_vertices_unordered_map(mesh.corner_vertices, r.vertices, r.indices, c); });
+        run(serial, [&mesh](Result& r, Allocation_Counter* c) { weld_vertices(mesh.corner_vertices, false, r.vertices, r.indices, c); });
+        run(parallel, [&mesh](Result& r, Allocation_Counter* c) { weld_vertices(mesh.corner_vertices, true, r.vertices, r.indices, c); });
+
+        auto same_result = [&reference](const Result& r) {
+            if (r.indices != reference.indices || r.vertices.size() != reference.vertices.size())
+                return false;
+            for (size_t i = 0; i < r.vertices.size(); i++)
+                if (!(r.vertices[i] == reference.vertices[i]))
+                    return false;
+            return true;
+        };
+
+        char columns[3][32];
+        const Result* results[3] = { &reference, &serial, &parallel };
+        for (int i = 0; i < 3; i++)
+            snprintf(columns[i], sizeof(columns[i]), "%8.2f ms %7.1f MB", results[i]->time_ms, results[i]->peak_mb);
+
+        printf("%-10s %-10zu %-10zu | %-22s | %-22s | %-22s | %s\n", mesh.name.c_str(), mesh.corner_vertices.size(), reference.vertices.size(),
+            columns[0], columns[1], columns[2], (same_result(serial) && same_result(parallel)) ? "yes" : "NO");
+    }
+}
+
+//
+// Vertex normals benchmark.
+// Compares compute_normals with the std::unordered_map based implementation that was used before.
+//
+static void compute_normals_unordered_map(const Vector3* vertex_positions, uint32_t vertex_count, uint32_t vertex_stride, const uint32_t* indices, uint32_t index_count, Vector3* normals) {
+    std::unordered_map<Vector3, std::vector<uint32_t>> duplicated_vertices; // due to different texture coordinates
+    for (uint32_t i = 0; i < vertex_count; i++) {
+        const Vector3& pos = index_array_with_stride(vertex_positions, vertex_stride, i);
+        duplicated_vertices[pos].push_back(i);
+    }
+
+    std::vector<bool> has_duplicates(vertex_count);
+    for (uint32_t i = 0; i < vertex_count; i++) {
+        const Vector3& pos = index_array_with_stride(vertex_positions, vertex_stride, i);
+        has_duplicates[i] = duplicated_vertices[pos].size() > 1;
+    }
+
+    for (uint32_t i = 0; i < vertex_count; i++)
+        index_array_with_stride(normals, vertex_stride, i) = Vector3_Zero;
+
+    for (uint32_t i = 0; i < index_count; i += 3) {
+        uint32_t vi[3] = { indices[i + 0], indices[i + 1], indices[i + 2] };
+        Vector3 p[3];
+        for (int k = 0; k < 3; k++)
+            p[k] = index_array_with_stride(vertex_positions, vertex_stride, vi[k]);
+
+        Vector3 n = cross(p[1] - p[0], p[2] - p[0]).normalized();
+
+        for (int k = 0; k < 3; k++) {
+            if (has_duplicates[vi[k]]) {
+                for (uint32_t dup : duplicated_vertices[p[k]])
+                    index_array_with_stride(normals, vertex_stride, dup) += n;
+            } else {
+                index_array_with_stride(normals, vertex_stride, vi[k]) += n;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < vertex_count; i++)
+        index_array_with_stride(normals, vertex_stride, i).normalize();
+}
+
+static void run_vertex_normals_benchmark() {
+    struct Test_Mesh {
+        std::string name;
+        std::vector<Vector3> positions;
+        std::vector<uint32_t> indices;
+    };
+    auto create_test_mesh = [](const std::string& name, const std::vector<Vertex>& corner_vertices) {
+        std::vector<Vertex> vertices;
+        Test_Mesh mesh;
+        mesh.name = name;
+        weld_vertices(corner_vertices, false, vertices, mesh.indices);
+        for (const Vertex& v : vertices)
+            mesh.positions.push_back(v.pos);
+        return mesh;
+    };
+
+    std::vector<Test_Mesh> meshes;
+    meshes.push_back(create_test_mesh("mesh.obj", load_obj_corner_vertices(get_resource_path("model/mesh.obj"))));
+    meshes.push_back(create_test_mesh("grid 256", create_grid_corner_vertices(256)));
+    meshes.push_back(create_test_mesh("grid 1024", create_grid_corner_vertices(1024)));
+    meshes.push_back(create_test_mesh("grid 2048", create_grid_corner_vertices(2048)));
+
+    printf("Vertex normals benchmark (%u threads)\n", get_thread_count());
+    printf("Max error is the largest distance to the normal computed by the unordered_map version.\n");
+    printf("\"bad\" is the number of vertices that got NaN or a non-unit normal.\n");
+    printf("%-10s %-10s %-10s | %-13s | %-22s | %-22s\n", "Mesh", "Vertices", "Triangles",
+        "unordered_map", "serial (max error)", "parallel (max error)");
+
+    for (const Test_Mesh& mesh : meshes) {
+        const uint32_t vertex_count = (uint32_t)mesh.positions.size();
+        const uint32_t index_count = (uint32_t)mesh.indices.size();
+
+        std::vector<Vector3> reference(vertex_count), serial(vertex_count), parallel(vertex_count);
+
+        Timestamp t;
+        compute_normals_unordered_map(mesh.positions.data(), vertex_count, sizeof(Vector3), mesh.indices.data(), index_count, reference.data());
+        double reference_time = elapsed_microseconds(t) / 1000.0;
+
+        // The new version is fast enough to take the best of several runs.
+        auto run = [&mesh, vertex_count, index_count](std::vector<Vector3>& normals, bool parallel) {
+            double best_time = Infinity;
+            for (int i = 0; i < 3; i++) {
+                Timestamp t;
+                compute_normals(mesh.positions.data(), vertex_count, sizeof(Vector3), mesh.indices.data(), index_count, normals.data(), parallel);
+                best_time = std::min(best_time, elapsed_microseconds(t) / 1000.0);
+            }
+            return best_time;
+        };
+        double serial_time = run(serial, false);
+        double parallel_time = run(parallel, true);
+
+        // The unordered_map version produces NaN for vertices where the face normals cancel out, compute_normals
+        // falls back to a face normal there. Those vertices are only checked for a valid unit normal.
+        // Any NaN or non-unit normal returned by compute_normals is reported as a failure.
+        auto format_column = [&reference, vertex_count](char* column, size_t column_size, double time, const std::vector<Vector3>& normals) {
+            float error = 0.f;
+            uint32_t failed_count = 0;
+            for (uint32_t i = 0; i < vertex_count; i++) {
+                if (!normals[i].is_normalized()) { // also false for NaN
+                    failed_count++;
+                    continue;
+                }
+                if (!std::isnan(reference[i].x))
+                    error = std::max(error, (normals[i] - reference[i]).length());
+            }
+            if (failed_count > 0)
+                snprintf(column, column_size, "%9.2f ms (%u bad)", time, failed_count);
+            else
+                snprintf(column, column_size, "%9.2f ms (%.1e)", time, error);
+        };
+
+        char columns[3][32];
+        snprintf(columns[0], sizeof(columns[0]), "%9.2f ms", reference_time);
+        format_column(columns[1], sizeof(columns[1]), serial_time, serial);
+        format_column(columns[2], sizeof(columns[2]), parallel_time, parallel);
+
+        printf("%-10s %-10u %-10u | %-13s | %-22s | %-22s\n", mesh.name.c_str(), vertex_count, index_count / 3,
+            columns[0], columns[1], columns[2]);
+    }
+}
+
+//
+// BVH benchmark.
+//
+
+// Triangles with random positions and sizes inside the unit cube. Produces many overlapping
+// triangles, which is the hard case for the builder.
+static std::vector<Vertex> create_triangle_soup_corner_vertices(uint32_t triangle_count) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(0.f, 1.f);
+    std::uniform_real_distribution<float> offset(-0.01f, 0.01f);
+
+    std::vector<Vertex> vertices(size_t(triangle_count) * 3);
+    for (uint32_t i = 0; i < triangle_count; i++) {
+        Vector3 center(position(rng), position(rng), position(rng));
+        for (uint32_t k = 0; k < 3; k++) {
+            Vertex& v = vertices[i * 3 + k];
+            v.pos = center + Vector3(offset(rng), offset(rng), offset(rng));
+            v.normal = Vector3_Zero;
+            v.uv = Vector2_Zero;
+        }
+    }
+    return vertices;
+}
+
+// Rays start on the bounding sphere of the mesh and point to random locations inside the bounds.
+static std::vector<BVH_Ray> create_bvh_benchmark_rays(const Vector3& bounds_min, const Vector3& bounds_max, uint32_t ray_count) {
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+    const Vector3 center = (bounds_min + bounds_max) * 0.5f;
+    const Vector3 extent = bounds_max - bounds_min;
+    const float radius = std::max(extent.length() * 0.5f, 1e-3f);
+
+    std::vector<BVH_Ray> rays(ray_count);
+    for (BVH_Ray& ray : rays) {
+        const float z = 2.f * uniform(rng) - 1.f;
+        const float phi = 2.f * Pi * uniform(rng);
+        const float r = std::sqrt(std::max(0.f, 1.f - z * z));
+        const Vector3 target = bounds_min + extent * Vector3(uniform(rng), uniform(rng), uniform(rng));
+
+        ray.origin = center + Vector3(r * std::cos(phi), r * std::sin(phi), z) * radius;
+        ray.direction = target - ray.origin;
+        ray.t_min = 0.f;
+        ray.t_max = Infinity;
+    }
+    return rays;
+}
+
+// Closest hit by testing all triangles. Used to validate the BVH traversal.
+static BVH_Hit intersect_triangles_brute_force(const std::vector<Vector3>& positions, const std::vector<uint32_t>& indices, const BVH_Ray& ray) {
+    BVH_Hit hit;
+    hit.t = ray.t_max;
+    hit.triangle_index = UINT32_MAX;
+    for (uint32_t i = 0; i < uint32_t(indices.size() / 3); i++) {
+        const Vector3 v0 = positions[indices[i * 3 + 0]];
+        const Vector3 edge1 = positions[indices[i * 3 + 1]] - v0;
+        const Vector3 edge2 = positions[indices[i * 3 + 2]] - v0;
+        const Vector3 p = cross(ray.direction, edge2);
+        const float det = dot(edge1, p);
+        if (det == 0.f)
+            continue;
+        const Vector3 s = ray.origin - v0;
+        const float u = dot(s, p) / det;
+        const Vector3 q = cross(s, edge1);
+        const float v = dot(ray.direction, q) / det;
+        const float t = dot(edge2, q) / det;
+        if (u >= 0.f && v >= 0.f && u + v <= 1.f && t >= ray.t_min && t < hit.t) {
+            hit.t = t;
+            hit.u = u;
+            hit.v = v;
+            hit.triangle_index = i;
+        }
+    }
+    return hit;
+}
+
+static bool bvh_equal(const BVH& a, const BVH& b) {
+    return a.nodes.size() == b.nodes.size() && a.triangle_packs.size() == b.triangle_packs.size() &&
+        memcmp(a.nodes.data(), b.nodes.data(), a.nodes.size() * sizeof(BVH_Node)) == 0 &&
+        memcmp(a.triangle_packs.data(), b.triangle_packs.data(), a.triangle_packs.size() * sizeof(BVH_Triangle4)) == 0;
+}
+
+static void run_bvh_benchmark() {
+    struct Test_Mesh {
+        std::string name;
+        std::vector<Vector3> positions;
+        std::vector<uint32_t> indices;
+        Vector3 bounds_min = Vector3(Infinity);
+        Vector3 bounds_max = Vector3(-Infinity);
+    };
+    auto create_test_mesh = [](const std::string& name, const std::vector<Vertex>& corner_vertices) {
+        std::vector<Vertex> vertices;
+        Test_Mesh mesh;
+        mesh.name = name;
+        weld_vertices(corner_vertices, true, vertices, mesh.indices);
+        for (const Vertex& v : vertices) {
+            mesh.positions.push_back(v.pos);
+            for (int i = 0; i < 3; i++) {
+                mesh.bounds_min[i] = std::min(mesh.bounds_min[i], v.pos[i]);
+                mesh.bounds_max[i] = std::max(mesh.bounds_max[i], v.pos[i]);
+            }
+        }
+        return mesh;
+    };
+
+    std::vector<Test_Mesh> meshes;
+    meshes.push_back(create_test_mesh("mesh.obj", load_obj_corner_vertices(get_resource_path("model/mesh.obj"))));
+    meshes.push_back(create_test_mesh("grid 256", create_grid_corner_vertices(256)));
+    meshes.push_back(create_test_mesh("grid 1024", create_grid_corner_vertices(1024)));
+    meshes.push_back(create_test_mesh("soup 100K", create_triangle_soup_corner_vertices(100'000)));
+    meshes.push_back(create_test_mesh("soup 1M", create_triangle_soup_corner_vertices(1'000'000)));
+
+    const uint32_t ray_count = 1 << 20;
+    const uint32_t validation_ray_count = 256;
+
+    printf("BVH benchmark (%u threads, %u rays)\n", get_thread_count(), ray_count);
+    printf("SAH cost is relative to the root bounds. Match: parallel build gives the same tree and the closest hits agree with brute force.\n");
+    printf("%-10s %-10s | %-11s | %-11s | %-9s | %-8s | %-5s | %-14s | %-14s | %s\n", "Mesh", "Triangles",
+        "build", "build par", "Nodes", "SAH cost", "Depth", "trace", "trace par", "Match");
+
+    for (const Test_Mesh& mesh : meshes) {
+        const uint32_t index_count = (uint32_t)mesh.indices.size();
+
+        Timestamp t;
+        BVH bvh = build_bvh(mesh.positions.data(), sizeof(Vector3), mesh.indices.data(), index_count, false);
+        double build_time = elapsed_microseconds(t) / 1000.0;
+
+        double parallel_build_time = Infinity;
+        bool same_tree = true;
+        for (int i = 0; i < 3; i++) {
+            Timestamp t;
+            BVH parallel_bvh = build_bvh(mesh.positions.data(), sizeof(Vector3), mesh.indices.data(), index_count, true);
+            parallel_build_time = std::min(parallel_build_time, elapsed_microseconds(t) / 1000.0);
+            same_tree &= bvh_equal(bvh, parallel_bvh);
+        }
+
+        std::vector<BVH_Ray> rays = create_bvh_benchmark_rays(mesh.bounds_min, mesh.bounds_max, ray_count);
+        std::vector<BVH_Hit> hits(ray_count);
+
+        auto trace = [&bvh, &rays, &hits](bool parallel) {
+            Timestamp t;
+            intersect_bvh(bvh, rays.data(), uint32_t(rays.size()), hits.data(), parallel);
+            double seconds = elapsed_microseconds(t) / 1e6;
+            return double(rays.size()) / seconds / 1e6;
+        };
+        double mrays = trace(false);
+        double parallel_mrays = trace(true);
+
+        // The same triangle should be hit, the distance can differ a bit when the ray hits the shared edge.
+        bool hits_match = true;
+        for (uint32_t i = 0; i < validation_ray_count; i++) {
+            const uint32_t ray_index = i * (ray_count / validation_ray_count);
+            const BVH_Hit& hit = hits[ray_index];
+            BVH_Hit reference = intersect_triangles_brute_force(mesh.positions, mesh.indices, rays[ray_index]);
+            if ((hit.triangle_index == UINT32_MAX) != (reference.triangle_index == UINT32_MAX))
+                hits_match = false;
+            else if (hit.triangle_index != UINT32_MAX && std::abs(hit.t - reference.t) > 1e-4f * std::max(1.f, reference.t))
+                hits_match = false;
+            if (occluded_bvh(bvh, rays[ray_index]) != (reference.triangle_index != UINT32_MAX))
+                hits_match = false;
+        }
+
+        char columns[4][32];
+        snprintf(columns[0], sizeof(columns[0]), "%8.2f ms", build_time);
+        snprintf(columns[1], sizeof(columns[1]), "%8.2f ms", parallel_build_time);
+        snprintf(columns[2], sizeof(columns[2]), "%7.2f Mrays/s", mrays);
+        snprintf(columns[3], sizeof(columns[3]), "%7.2f Mrays/s", parallel_mrays);
+
+        printf("%-10s %-10u | %-11s | %-11s | %-9zu | %-8.2f | %-5u | %-14s | %-14s | %s\n", mesh.name.c_str(), index_count / 3,
+            columns[0], columns[1], bvh.nodes.size(), compute_bvh_sah_cost(bvh), bvh.max_depth,
+            columns[2], columns[3], (same_tree && hits_match) ? "yes" : "NO");
+    }
+}
+
+struct Benchmark {
+    const char* name;
+    void (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+    { "obj-reader", run_obj_reader_benchmark },
+    { "vertex-weld", run_vertex_weld_benchmark },
+    { "vertex-normals", run_vertex_normals_benchmark },
+    { "bvh", run_bvh_benchmark },
+};
+
+bool run_benchmark(const std::string& name) {
+    for (const Benchmark& benchmark : benchmarks) {
+        if (name == benchmark.name) {
+            benchmark.run();
+            return true;
+        }
+    }
+    return false;
+}
+
+void print_benchmark_names() {
+    for (const Benchmark& benchmark : benchmarks)
+        printf("    %s\n", benchmark.name);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+
+// Runs CPU benchmark with the given name. Returns false if there is no such benchmark.
+bool run_benchmark(const std::string& name);
+
+// Prints the names of available benchmarks.
+void print_benchmark_names();
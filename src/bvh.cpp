@@ -0,0 +1,659 @@
+#include "bvh.h"
+#include "common.h"
+#include "mesh.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+
+#include <emmintrin.h>
+
+namespace {
+constexpr uint32_t bin_count = 16;
+constexpr uint32_t max_leaf_size = 4; // one triangle pack
+constexpr uint32_t binning_chunk_size = 16 * 1024; // primitives per task of the parallel binning
+
+// SAH cost of the traversal step relative to the triangle intersection.
+constexpr float traversal_cost = 1.f;
+
+// Below this depth the nodes are split at the object median, so the tree depth is bounded
+// for any input and the traversal stack has fixed size.
+constexpr uint32_t max_sah_depth = 48;
+constexpr uint32_t traversal_stack_size = 96;
+
+// Each median split halves the primitive count, so a tree over 32-bit primitive indices is at
+// most 32 levels deeper than max_sah_depth. The traversal stack holds one entry per level.
+static_assert(max_sah_depth + 32 <= traversal_stack_size, "traversal stack does not fit the maximum tree depth");
+
+constexpr uint32_t ray_chunk_size = 256; // rays per task of the parallel traversal
+
+struct Bounds {
+    Vector3 min = Vector3(Infinity);
+    Vector3 max = Vector3(-Infinity);
+
+    void add(const Vector3& p) {
+        min = Vector3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = Vector3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+    void add(const Bounds& b) {
+        add(b.min);
+        add(b.max);
+    }
+    float half_area() const {
+        if (min.x > max.x)
+            return 0.f;
+        Vector3 d = max - min;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+};
+
+struct Build_Primitive {
+    Bounds      bounds;
+    Vector3     centroid;
+    uint32_t    triangle_index;
+};
+
+// Range of primitives that becomes the given node.
+struct Build_Task {
+    uint32_t    node_index;
+    uint32_t    begin;
+    uint32_t    end;
+    uint32_t    depth;
+    Bounds      bounds;
+    Bounds      centroid_bounds;
+};
+
+struct Bin {
+    Bounds      bounds;
+    Bounds      centroid_bounds;
+    uint32_t    count = 0;
+};
+
+struct Bins {
+    Bin         bins[3][bin_count];
+
+    void add(const Bins& other) {
+        for (int axis = 0; axis < 3; axis++) {
+            for (uint32_t i = 0; i < bin_count; i++) {
+                bins[axis][i].bounds.add(other.bins[axis][i].bounds);
+                bins[axis][i].centroid_bounds.add(other.bins[axis][i].centroid_bounds);
+                bins[axis][i].count += other.bins[axis][i].count;
+            }
+        }
+    }
+};
+
+// Maps centroid coordinate to the bin. The same computation is used for binning and partitioning.
+struct Bin_Mapping {
+    Vector3     origin;
+    Vector3     scale; // zero for the axis with zero centroid extent
+
+    Bin_Mapping(const Bounds& centroid_bounds) {
+        origin = centroid_bounds.min;
+        Vector3 extent = centroid_bounds.max - centroid_bounds.min;
+        for (int axis = 0; axis < 3; axis++)
+            scale[axis] = extent[axis] > 0.f ? float(bin_count) / extent[axis] : 0.f;
+    }
+    uint32_t get_bin(const Vector3& centroid, int axis) const {
+        return std::min(uint32_t((centroid[axis] - origin[axis]) * scale[axis]), bin_count - 1);
+    }
+};
+
+struct Split {
+    int         axis = -1; // -1 if no SAH split is found
+    uint32_t    bin; // the first bin of the second child
+    float       cost = Infinity;
+    Bounds      bounds[2];
+    Bounds      centroid_bounds[2];
+};
+
+struct Builder {
+    const Vector3*                  vertex_positions;
+    uint32_t                        vertex_stride;
+    const uint32_t*                 indices;
+    std::vector<Build_Primitive>    primitives;
+    std::vector<BVH_Node>           nodes;
+    std::atomic<uint32_t>           node_count;
+};
+}
+
+static void add_to_bins(const Build_Primitive* primitives, uint32_t count, const Bin_Mapping& mapping, Bins& bins) {
+    for (uint32_t i = 0; i < count; i++) {
+        const Build_Primitive& primitive = primitives[i];
+        for (int axis = 0; axis < 3; axis++) {
+            Bin& bin = bins.bins[axis][mapping.get_bin(primitive.centroid, axis)];
+            bin.bounds.add(primitive.bounds);
+            bin.centroid_bounds.add(primitive.centroid);
+            bin.count++;
+        }
+    }
+}
+
+// Bins the primitives of the task. Large tasks are binned in parallel, each thread fills its own bins.
+static Bins bin_primitives(const Builder& builder, const Build_Task& task, const Bin_Mapping& mapping, bool parallel) {
+    const Build_Primitive* primitives = builder.primitives.data() + task.begin;
+    const uint32_t count = task.end - task.begin;
+
+    if (!parallel) {
+        Bins bins;
+        add_to_bins(primitives, count, mapping, bins);
+        return bins;
+    }
+
+    const uint32_t chunk_count = (count + binning_chunk_size - 1) / binning_chunk_size;
+    std::vector<Bins> thread_bins(get_thread_count());
+
+    parallel_for(chunk_count, [primitives, count, &mapping, &thread_bins](uint32_t chunk, uint32_t thread_index) {
+        const uint32_t begin = chunk * binning_chunk_size;
+        add_to_bins(primitives + begin, std::min(binning_chunk_size, count - begin), mapping, thread_bins[thread_index]);
+    });
+
+    Bins bins;
+    for (const Bins& b : thread_bins)
+        bins.add(b);
+    return bins;
+}
+
+static Split find_sah_split(const Bins& bins, const Bin_Mapping& mapping, const Build_Task& task) {
+    const float parent_area = task.bounds.half_area();
+    Split split;
+
+    // All primitives are degenerate, the SAH cost is undefined. No split is returned and the node is split at the median.
+    if (!(parent_area > 0.f))
+        return split;
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (mapping.scale[axis] == 0.f)
+            continue;
+
+        // Cost of the second child for each split position.
+        float right_costs[bin_count];
+        Bounds right_bounds;
+        uint32_t right_count = 0;
+        for (uint32_t i = bin_count - 1; i > 0; i--) {
+            right_bounds.add(bins.bins[axis][i].bounds);
+            right_count += bins.bins[axis][i].count;
+            right_costs[i] = right_bounds.half_area() * float(right_count);
+        }
+
+        Bounds left_bounds;
+        uint32_t left_count = 0;
+        for (uint32_t i = 1; i < bin_count; i++) {
+            left_bounds.add(bins.bins[axis][i - 1].bounds);
+            left_count += bins.bins[axis][i - 1].count;
+            const uint32_t count = task.end - task.begin;
+            if (left_count == 0 || left_count == count)
+                continue;
+
+            const float cost = traversal_cost + (left_bounds.half_area() * float(left_count) + right_costs[i]) / parent_area;
+            if (cost < split.cost) {
+                split.axis = axis;
+                split.bin = i;
+                split.cost = cost;
+            }
+        }
+    }
+
+    if (split.axis >= 0) {
+        for (uint32_t i = 0; i < bin_count; i++) {
+            const Bin& bin = bins.bins[split.axis][i];
+            const int child = i < split.bin ? 0 : 1;
+            split.bounds[child].add(bin.bounds);
+            split.centroid_bounds[child].add(bin.centroid_bounds);
+        }
+    }
+    return split;
+}
+
+// Splits the task into two child tasks. Returns false if the task becomes a leaf.
+static bool split_task(Builder& builder, const Build_Task& task, bool parallel_binning, Build_Task children[2]) {
+    const uint32_t count = task.end - task.begin;
+    Build_Primitive* primitives = builder.primitives.data();
+    uint32_t middle;
+
+    Split split;
+    Bin_Mapping mapping(task.centroid_bounds);
+    if (task.depth < max_sah_depth) {
+        Bins bins = bin_primitives(builder, task, mapping, parallel_binning);
+        split = find_sah_split(bins, mapping, task);
+    }
+
+    if (count <= max_leaf_size && (split.axis < 0 || split.cost >= float(count)))
+        return false;
+
+    if (split.axis >= 0) {
+        const int axis = split.axis;
+        Build_Primitive* p = std::partition(primitives + task.begin, primitives + task.end, [&mapping, &split, axis](const Build_Primitive& primitive) {
+            return mapping.get_bin(primitive.centroid, axis) < split.bin;
+        });
+        middle = uint32_t(p - primitives);
+        for (int i = 0; i < 2; i++) {
+            children[i].bounds = split.bounds[i];
+            children[i].centroid_bounds = split.centroid_bounds[i];
+        }
+    } else {
+        // All centroids are the same or the tree is too deep: split at the object median along the longest axis.
+        Vector3 extent = task.centroid_bounds.max - task.centroid_bounds.min;
+        const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+        middle = task.begin + count / 2;
+        std::nth_element(primitives + task.begin, primitives + middle, primitives + task.end, [axis](const Build_Primitive& a, const Build_Primitive& b) {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+        for (int i = 0; i < 2; i++) {
+            children[i].bounds = Bounds();
+            children[i].centroid_bounds = Bounds();
+            for (uint32_t k = (i == 0 ? task.begin : middle); k < (i == 0 ? middle : task.end); k++) {
+                children[i].bounds.add(primitives[k].bounds);
+                children[i].centroid_bounds.add(primitives[k].centroid);
+            }
+        }
+    }
+    assert(middle > task.begin && middle < task.end);
+
+    // Children are allocated in pairs, the node stores the index of the first child.
+    const uint32_t first_child = builder.node_count.fetch_add(2);
+    builder.nodes[task.node_index].first = first_child;
+    builder.nodes[task.node_index].triangle_count = 0;
+
+    children[0].node_index  = first_child;
+    children[0].begin       = task.begin;
+    children[0].end         = middle;
+    children[1].node_index  = first_child + 1;
+    children[1].begin       = middle;
+    children[1].end         = task.end;
+
+    for (int i = 0; i < 2; i++) {
+        children[i].depth = task.depth + 1;
+        builder.nodes[children[i].node_index].bounds_min = children[i].bounds.min;
+        builder.nodes[children[i].node_index].bounds_max = children[i].bounds.max;
+    }
+    return true;
+}
+
+static void make_leaf(Builder& builder, const Build_Task& task) {
+    // Leaf references the primitive range until the triangle packs are created.
+    BVH_Node& node = builder.nodes[task.node_index];
+    node.first = task.begin;
+    node.triangle_count = task.end - task.begin;
+}
+
+static void build_subtree(Builder& builder, const Build_Task& root_task) {
+    std::vector<Build_Task> stack { root_task };
+    while (!stack.empty()) {
+        Build_Task task = stack.back();
+        stack.pop_back();
+
+        Build_Task children[2];
+        if (split_task(builder, task, false, children)) {
+            stack.push_back(children[1]);
+            stack.push_back(children[0]);
+        } else {
+            make_leaf(builder, task);
+        }
+    }
+}
+
+BVH build_bvh(const Vector3* vertex_positions, uint32_t vertex_stride, const uint32_t* indices, uint32_t index_count, bool parallel) {
+    const uint32_t triangle_count = index_count / 3;
+    BVH bvh;
+    bvh.triangle_count = triangle_count;
+    if (triangle_count == 0)
+        return bvh;
+
+    Builder builder;
+    builder.vertex_positions = vertex_positions;
+    builder.vertex_stride = vertex_stride;
+    builder.indices = indices;
+    builder.primitives.resize(triangle_count);
+
+    auto get_position = [vertex_positions, vertex_stride, indices](uint32_t index) {
+        return index_array_with_stride(vertex_positions, vertex_stride, indices[index]);
+    };
+
+    auto init_primitive = [&builder, &get_position](uint32_t i) {
+        Build_Primitive& primitive = builder.primitives[i];
+        primitive.bounds = Bounds();
+        for (uint32_t k = 0; k < 3; k++)
+            primitive.bounds.add(get_position(i * 3 + k));
+        primitive.centroid = (primitive.bounds.min + primitive.bounds.max) * 0.5f;
+        primitive.triangle_index = i;
+    };
+    if (parallel) {
+        parallel_for(triangle_count, [&init_primitive](uint32_t i, uint32_t) { init_primitive(i); });
+    } else {
+        for (uint32_t i = 0; i < triangle_count; i++)
+            init_primitive(i);
+    }
+
+    Build_Task root;
+    root.node_index = 0;
+    root.begin = 0;
+    root.end = triangle_count;
+    root.depth = 0;
+    for (const Build_Primitive& primitive : builder.primitives) {
+        root.bounds.add(primitive.bounds);
+        root.centroid_bounds.add(primitive.centroid);
+    }
+
+    // Each split adds two nodes and there are at most triangle_count leaves.
+    builder.nodes.resize(2 * triangle_count - 1);
+    builder.node_count = 1;
+    builder.nodes[0].bounds_min = root.bounds.min;
+    builder.nodes[0].bounds_max = root.bounds.max;
+
+    // The nodes near the root are split one by one with parallel binning until there are enough
+    // subtrees to keep all threads busy, then the subtrees are built in parallel. Both phases use
+    // the same split decisions, so the tree does not depend on the parallel flag.
+    std::vector<Build_Task> subtrees;
+    if (parallel) {
+        const uint32_t subtree_size = std::max(4096u, triangle_count / (get_thread_count() * 8));
+        std::vector<Build_Task> tasks { root };
+        while (!tasks.empty()) {
+            Build_Task task = tasks.back();
+            tasks.pop_back();
+
+            Build_Task children[2];
+            if (task.end - task.begin <= subtree_size)
+                subtrees.push_back(task);
+            else if (split_task(builder, task, true, children)) {
+                tasks.push_back(children[1]);
+                tasks.push_back(children[0]);
+            } else
+                make_leaf(builder, task);
+        }
+        parallel_for(uint32_t(subtrees.size()), [&builder, &subtrees](uint32_t i, uint32_t) {
+            build_subtree(builder, subtrees[i]);
+        });
+    } else {
+        build_subtree(builder, root);
+    }
+
+    // Store the nodes in depth-first order and create triangle packs in the leaf order.
+    bvh.nodes.resize(builder.node_count);
+    bvh.nodes[0] = builder.nodes[0];
+
+    struct Stack_Entry {
+        uint32_t builder_node;
+        uint32_t node;
+        uint32_t depth;
+    };
+    std::vector<Stack_Entry> stack { {0, 0, 1} };
+    uint32_t node_count = 1;
+
+    while (!stack.empty()) {
+        Stack_Entry entry = stack.back();
+        stack.pop_back();
+        bvh.max_depth = std::max(bvh.max_depth, entry.depth);
+
+        const BVH_Node& builder_node = builder.nodes[entry.builder_node];
+        BVH_Node& node = bvh.nodes[entry.node];
+        node = builder_node;
+
+        if (builder_node.triangle_count == 0) {
+            node.first = node_count;
+            node_count += 2;
+            stack.push_back({ builder_node.first + 1, node.first + 1, entry.depth + 1 });
+            stack.push_back({ builder_node.first, node.first, entry.depth + 1 });
+            continue;
+        }
+
+        node.first = uint32_t(bvh.triangle_packs.size());
+        BVH_Triangle4& pack = bvh.triangle_packs.emplace_back();
+        for (uint32_t k = 0; k < 4; k++) {
+            if (k >= builder_node.triangle_count) {
+                for (int c = 0; c < 3; c++)
+                    pack.v0[c][k] = pack.edge1[c][k] = pack.edge2[c][k] = 0.f;
+                pack.triangle_index[k] = UINT32_MAX;
+                continue;
+            }
+            const uint32_t triangle = builder.primitives[builder_node.first + k].triangle_index;
+            const Vector3 v0 = get_position(triangle * 3 + 0);
+            const Vector3 edge1 = get_position(triangle * 3 + 1) - v0;
+            const Vector3 edge2 = get_position(triangle * 3 + 2) - v0;
+            for (int c = 0; c < 3; c++) {
+                pack.v0[c][k] = v0[c];
+                pack.edge1[c][k] = edge1[c];
+                pack.edge2[c][k] = edge2[c];
+            }
+            pack.triangle_index[k] = triangle;
+        }
+    }
+    assert(node_count == bvh.nodes.size());
+    if (bvh.max_depth > traversal_stack_size)
+        error("build_bvh: tree depth " + std::to_string(bvh.max_depth) + " exceeds the traversal stack size");
+    return bvh;
+}
+
+BVH build_bvh(const Mesh& mesh, bool parallel) {
+    return build_bvh(&mesh.vertices[0].pos, sizeof(Vertex), mesh.indices.data(), uint32_t(mesh.indices.size()), parallel);
+}
+
+//
+// Traversal.
+//
+namespace {
+struct SIMD_Ray {
+    __m128      origin; // xyz
+    __m128      inv_direction; // xyz
+    __m128      origin4[3]; // each coordinate broadcast to all lanes
+    __m128      direction4[3];
+    float       t_min;
+
+    SIMD_Ray(const BVH_Ray& ray) {
+        // Zero direction components are replaced by tiny values, so the slab test does not produce NaN.
+        float inv_direction_xyz[3];
+        for (int i = 0; i < 3; i++) {
+            const float d = ray.direction[i];
+            inv_direction_xyz[i] = 1.f / (std::abs(d) > 1e-30f ? d : std::copysign(1e-30f, d));
+            origin4[i] = _mm_set1_ps(ray.origin[i]);
+            direction4[i] = _mm_set1_ps(d);
+        }
+        origin = _mm_setr_ps(ray.origin.x, ray.origin.y, ray.origin.z, 0.f);
+        inv_direction = _mm_setr_ps(inv_direction_xyz[0], inv_direction_xyz[1], inv_direction_xyz[2], 0.f);
+        t_min = ray.t_min;
+    }
+};
+
+struct Stack_Entry {
+    uint32_t    node;
+    float       t; // entry distance
+};
+}
+
+// Slab test. The fourth lane of the loaded bounds contains the node data and is ignored.
+static inline bool intersect_node_bounds(const BVH_Node& node, const SIMD_Ray& ray, float t_max, float* t_entry) {
+    const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.bounds_min.x), ray.origin), ray.inv_direction);
+    const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.bounds_max.x), ray.origin), ray.inv_direction);
+    const __m128 t_near = _mm_min_ps(t0, t1);
+    const __m128 t_far = _mm_max_ps(t0, t1);
+
+    __m128 entry = _mm_max_ss(_mm_max_ss(t_near, _mm_shuffle_ps(t_near, t_near, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(t_near, t_near, _MM_SHUFFLE(2, 2, 2, 2)));
+    __m128 exit = _mm_min_ss(_mm_min_ss(t_far, _mm_shuffle_ps(t_far, t_far, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(t_far, t_far, _MM_SHUFFLE(2, 2, 2, 2)));
+    entry = _mm_max_ss(entry, _mm_set_ss(ray.t_min));
+    exit = _mm_min_ss(exit, _mm_set_ss(t_max));
+
+    *t_entry = _mm_cvtss_f32(entry);
+    return _mm_comile_ss(entry, exit) != 0;
+}
+
+// Moller-Trumbore test of 4 triangles. Returns the mask of the triangles hit in [t_min, t_max),
+// t, u and v receive the intersection parameters for each triangle.
+static inline int intersect_triangles(const BVH_Triangle4& pack, const SIMD_Ray& ray, float t_max, __m128* t, __m128* u, __m128* v) {
+    const __m128 e1[3] = { _mm_load_ps(pack.edge1[0]), _mm_load_ps(pack.edge1[1]), _mm_load_ps(pack.edge1[2]) };
+    const __m128 e2[3] = { _mm_load_ps(pack.edge2[0]), _mm_load_ps(pack.edge2[1]), _mm_load_ps(pack.edge2[2]) };
+    const __m128* d = ray.direction4;
+
+    // p = cross(d, e2)
+    const __m128 p[3] = {
+        _mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1])),
+        _mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2])),
+        _mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0])),
+    };
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], p[0]), _mm_mul_ps(e1[1], p[1])), _mm_mul_ps(e1[2], p[2]));
+    const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+    const __m128 s[3] = {
+        _mm_sub_ps(ray.origin4[0], _mm_load_ps(pack.v0[0])),
+        _mm_sub_ps(ray.origin4[1], _mm_load_ps(pack.v0[1])),
+        _mm_sub_ps(ray.origin4[2], _mm_load_ps(pack.v0[2])),
+    };
+    *u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s[0], p[0]), _mm_mul_ps(s[1], p[1])), _mm_mul_ps(s[2], p[2])), inv_det);
+
+    // q = cross(s, e1)
+    const __m128 q[3] = {
+        _mm_sub_ps(_mm_mul_ps(s[1], e1[2]), _mm_mul_ps(s[2], e1[1])),
+        _mm_sub_ps(_mm_mul_ps(s[2], e1[0]), _mm_mul_ps(s[0], e1[2])),
+        _mm_sub_ps(_mm_mul_ps(s[0], e1[1]), _mm_mul_ps(s[1], e1[0])),
+    };
+    *v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], q[0]), _mm_mul_ps(d[1], q[1])), _mm_mul_ps(d[2], q[2])), inv_det);
+    *t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], q[0]), _mm_mul_ps(e2[1], q[1])), _mm_mul_ps(e2[2], q[2])), inv_det);
+
+    // Degenerate triangles (zero det) get NaN or infinite values and fail the comparisons.
+    const __m128 zero = _mm_setzero_ps();
+    __m128 mask = _mm_cmpneq_ps(det, zero);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(*u, zero));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(*v, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(*u, *v), _mm_set1_ps(1.f)));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(*t, _mm_set1_ps(ray.t_min)));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(*t, _mm_set1_ps(t_max)));
+    return _mm_movemask_ps(mask);
+}
+
+bool intersect_bvh(const BVH& bvh, const BVH_Ray& ray, BVH_Hit& hit) {
+    hit.t = ray.t_max;
+    hit.triangle_index = UINT32_MAX;
+    if (bvh.nodes.empty())
+        return false;
+
+    const SIMD_Ray simd_ray(ray);
+    const BVH_Node* nodes = bvh.nodes.data();
+
+    Stack_Entry stack[traversal_stack_size];
+    uint32_t stack_size = 0;
+
+    float t_entry;
+    if (!intersect_node_bounds(nodes[0], simd_ray, hit.t, &t_entry))
+        return false;
+    uint32_t node_index = 0;
+
+    for (;;) {
+        const BVH_Node& node = nodes[node_index];
+
+        if (node.triangle_count == 0) {
+            // Visit the closer child first.
+            float t0, t1;
+            const bool hit0 = intersect_node_bounds(nodes[node.first], simd_ray, hit.t, &t0);
+            const bool hit1 = intersect_node_bounds(nodes[node.first + 1], simd_ray, hit.t, &t1);
+            if (hit0 && hit1) {
+                const bool first_is_closer = t0 <= t1;
+                stack[stack_size++] = Stack_Entry{ first_is_closer ? node.first + 1 : node.first, first_is_closer ? t1 : t0 };
+                node_index = first_is_closer ? node.first : node.first + 1;
+                continue;
+            }
+            if (hit0 || hit1) {
+                node_index = hit0 ? node.first : node.first + 1;
+                continue;
+            }
+        } else {
+            const BVH_Triangle4& pack = bvh.triangle_packs[node.first];
+            __m128 t, u, v;
+            int mask = intersect_triangles(pack, simd_ray, hit.t, &t, &u, &v);
+            if (mask) {
+                alignas(16) float t_values[4], u_values[4], v_values[4];
+                _mm_store_ps(t_values, t);
+                _mm_store_ps(u_values, u);
+                _mm_store_ps(v_values, v);
+                for (int k = 0; k < 4; k++) {
+                    if ((mask & (1 << k)) && t_values[k] < hit.t) {
+                        hit.t = t_values[k];
+                        hit.u = u_values[k];
+                        hit.v = v_values[k];
+                        hit.triangle_index = pack.triangle_index[k];
+                    }
+                }
+            }
+        }
+
+        // Nodes that are farther than the closest hit found so far are skipped.
+        do {
+            if (stack_size == 0)
+                return hit.triangle_index != UINT32_MAX;
+            const Stack_Entry& entry = stack[--stack_size];
+            node_index = entry.node;
+            t_entry = entry.t;
+        } while (t_entry > hit.t);
+    }
+}
+
+bool occluded_bvh(const BVH& bvh, const BVH_Ray& ray) {
+    if (bvh.nodes.empty())
+        return false;
+
+    const SIMD_Ray simd_ray(ray);
+    const BVH_Node* nodes = bvh.nodes.data();
+
+    uint32_t stack[traversal_stack_size];
+    uint32_t stack_size = 0;
+
+    float t_entry;
+    if (!intersect_node_bounds(nodes[0], simd_ray, ray.t_max, &t_entry))
+        return false;
+    uint32_t node_index = 0;
+
+    for (;;) {
+        const BVH_Node& node = nodes[node_index];
+
+        if (node.triangle_count == 0) {
+            float t0, t1;
+            const bool hit0 = intersect_node_bounds(nodes[node.first], simd_ray, ray.t_max, &t0);
+            const bool hit1 = intersect_node_bounds(nodes[node.first + 1], simd_ray, ray.t_max, &t1);
+            if (hit0 && hit1)
+                stack[stack_size++] = node.first + 1;
+            if (hit0 || hit1) {
+                node_index = hit0 ? node.first : node.first + 1;
+                continue;
+            }
+        } else {
+            __m128 t, u, v;
+            if (intersect_triangles(bvh.triangle_packs[node.first], simd_ray, ray.t_max, &t, &u, &v))
+                return true;
+        }
+
+        if (stack_size == 0)
+            return false;
+        node_index = stack[--stack_size];
+    }
+}
+
+void intersect_bvh(const BVH& bvh, const BVH_Ray* rays, uint32_t ray_count, BVH_Hit* hits, bool parallel) {
+    if (!parallel) {
+        for (uint32_t i = 0; i < ray_count; i++)
+            intersect_bvh(bvh, rays[i], hits[i]);
+        return;
+    }
+    parallel_for((ray_count + ray_chunk_size - 1) / ray_chunk_size, [&bvh, rays, ray_count, hits](uint32_t chunk, uint32_t) {
+        const uint32_t end = std::min(ray_count, (chunk + 1) * ray_chunk_size);
+        for (uint32_t i = chunk * ray_chunk_size; i < end; i++)
+            intersect_bvh(bvh, rays[i], hits[i]);
+    });
+}
+
+float compute_bvh_sah_cost(const BVH& bvh) {
+    if (bvh.nodes.empty())
+        return 0.f;
+
+    auto get_half_area = [](const BVH_Node& node) {
+        Vector3 d = node.bounds_max - node.bounds_min;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    };
+    const float root_area = get_half_area(bvh.nodes[0]);
+    if (root_area == 0.f)
+        return 0.f;
+
+    double cost = 0.0;
+    for (const BVH_Node& node : bvh.nodes)
+        cost += get_half_area(node) * (node.triangle_count == 0 ? traversal_cost : 1.f);
+    return float(cost / root_area);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "vector.h"
+
+#include <cstdint>
+#include <vector>
+
+struct Mesh;
+
+// Bounding volume hierarchy of triangles for the CPU ray queries. It does not depend on Vulkan,
+// so it is used to validate raytracing results and to measure acceleration structure quality
+// on machines without raytracing GPU.
+//
+// The tree is built with binned SAH. Large nodes near the root are binned in parallel, then
+// the subtrees are built in parallel. Nodes are stored in depth-first order, the children of
+// an inner node are stored next to each other. Leaves contain up to 4 triangles that are
+// intersected at once with SSE.
+
+// 32-byte node.
+struct BVH_Node {
+    Vector3     bounds_min;
+    uint32_t    first; // inner node: index of the first child, the second child follows it. Leaf: index of the triangle pack
+    Vector3     bounds_max;
+    uint32_t    triangle_count; // zero for inner nodes
+};
+static_assert(sizeof(BVH_Node) == 32, "BVH_Node should be 32 bytes");
+
+// Triangles of the leaf in SoA layout: [coordinate][triangle]. Unused slots contain degenerate
+// triangles that are never hit.
+struct alignas(16) BVH_Triangle4 {
+    float       v0[3][4];
+    float       edge1[3][4]; // v1 - v0
+    float       edge2[3][4]; // v2 - v0
+    uint32_t    triangle_index[4]; // triangle index in the source index buffer, UINT32_MAX for unused slots
+};
+
+struct BVH {
+    std::vector<BVH_Node>       nodes; // nodes[0] is the root
+    std::vector<BVH_Triangle4>  triangle_packs;
+    uint32_t                    triangle_count = 0;
+    uint32_t                    max_depth = 0;
+};
+
+struct BVH_Ray {
+    Vector3     origin;
+    float       t_min;
+    Vector3     direction; // does not need to be normalized
+    float       t_max;
+};
+
+struct BVH_Hit {
+    float       t;
+    float       u; // barycentric coordinate of the second triangle vertex
+    float       v; // barycentric coordinate of the third triangle vertex
+    uint32_t    triangle_index; // UINT32_MAX if there is no hit
+};
+
+// Builds BVH for the given triangles. Positions are read with the given vertex stride, so the
+// vertex buffer of any vertex layout can be used directly. The parallel version builds the same tree.
+BVH build_bvh(const Vector3* vertex_positions, uint32_t vertex_stride, const uint32_t* indices, uint32_t index_count, bool parallel);
+BVH build_bvh(const Mesh& mesh, bool parallel);
+
+// Finds the closest hit in [t_min, t_max] range of the ray. Returns false if there is no hit.
+bool intersect_bvh(const BVH& bvh, const BVH_Ray& ray, BVH_Hit& hit);
+
+// Returns true if there is any hit in [t_min, t_max] range of the ray.
+bool occluded_bvh(const BVH& bvh, const BVH_Ray& ray);
+
+// Finds the closest hits for the array of rays.
+void intersect_bvh(const BVH& bvh, const BVH_Ray* rays, uint32_t ray_count, BVH_Hit* hits, bool parallel);
+
+// Expected cost of the random ray query relative to the root bounds, traversal step and triangle
+// pack intersection have unit cost. Lower is better.
+float compute_bvh_sah_cost(const BVH& bvh);
@@ -1,4 +1,5 @@
 #include "common.h"
+#include <cstring>
 #include <fstream>
 #include <vector>
 
@@ -78,3 +79,48 @@ double get_base_cpu_frequency_ghz() {
     double frequency = ((rdtsc_end - rdtsc_start) / 1'000'000) / 1000.0;
     return frequency;
 }
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+uint64_t hash_memory(const void* data, size_t size, uint64_t seed) {
+    constexpr uint64_t k0 = 0x9e3779b97f4a7c15ull;
+    constexpr uint64_t k1 = 0xc2b2ae3d27d4eb4full;
+
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + size;
+
+    // Four independent lanes to hide multiplication latency.
+    uint64_t h[4] = { seed + k0, seed + k1, seed - k0, seed - k1 };
+    while (end - p >= 32) {
+        for (int i = 0; i < 4; i++) {
+            uint64_t w;
+            memcpy(&w, p + 8*i, 8);
+            h[i] = rotl64(h[i] ^ (w * k1), 31) * k0;
+        }
+        p += 32;
+    }
+
+    uint64_t hash = rotl64(h[0], 1) + rotl64(h[1], 7) + rotl64(h[2], 12) + rotl64(h[3], 18);
+    while (end - p >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        hash = rotl64(hash ^ (w * k1), 27) * k0;
+        p += 8;
+    }
+    while (p < end) {
+        hash = rotl64(hash ^ (*p * k1), 11) * k0;
+        p++;
+    }
+    return mix64(hash ^ size);
+}
@@ -33,6 +33,9 @@ int64_t elapsed_nanoseconds(Timestamp timestamp);
 
 double get_base_cpu_frequency_ghz();
 
+// Fast non-cryptographic 64-bit hash of a memory block.
+uint64_t hash_memory(const void* data, size_t size, uint64_t seed = 0);
+
 // Boost hash combine.
 template <typename T>
 inline void hash_combine(std::size_t& seed, T value) {
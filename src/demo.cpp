@@ -2,6 +2,7 @@
 #include "demo.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "scene_loader.h"
 #include "vk.h"
 #include "vk_utils.h"
 
@@ -11,11 +12,45 @@
 #include "imgui/impl/imgui_impl_vulkan.h"
 #include "imgui/impl/imgui_impl_glfw.h"
 
+#include <algorithm>
 #include <cinttypes>
 #include <chrono>
+#include <cstring>
+
+// Number of triangles drawn when each object uses the given LOD.
+static uint32_t get_lod_triangle_count(const std::vector<GPU_Mesh>& gpu_meshes, const std::vector<uint32_t>& lods) {
+    uint32_t triangle_count = 0;
+    for (auto [i, gpu_mesh] : enumerate(gpu_meshes))
+        triangle_count += gpu_mesh.lods[lods[i]].index_count / 3;
+    return triangle_count;
+}
+
+// Number of triangles drawn when all objects use the given LOD level. Objects with shorter LOD chain use their last LOD.
+static uint32_t get_lod_triangle_count(const std::vector<GPU_Mesh>& gpu_meshes, uint32_t level) {
+    uint32_t triangle_count = 0;
+    for (const GPU_Mesh& gpu_mesh : gpu_meshes)
+        triangle_count += gpu_mesh.lods[std::min(level, uint32_t(gpu_mesh.lods.size()) - 1)].index_count / 3;
+    return triangle_count;
+}
+
+// Combo box that selects one of the build preference flag combinations. Returns true if the selection has changed.
+static bool build_flags_combo(const char* label, VkBuildAccelerationStructureFlagsKHR* flags) {
+    bool changed = false;
+    if (ImGui::BeginCombo(label, get_build_preference_flags_name(*flags).c_str())) {
+        for (VkBuildAccelerationStructureFlagsKHR combination : build_preference_flag_combinations) {
+            if (ImGui::Selectable(get_build_preference_flags_name(combination).c_str(), combination == *flags) && combination != *flags) {
+                *flags = combination;
+                changed = true;
+            }
+        }
+        ImGui::EndCombo();
+    }
+    return changed;
+}
 
-void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
-    vk_initialize(window, enable_validation_layers);
+void Vk_Demo::initialize(GLFWwindow* window, const Command_Line_Options& options) {
+    start_time = Timestamp();
+    vk_initialize(window, options.enable_validation_layers, !options.disable_async_compute);
 
     // Device properties.
     {
@@ -47,27 +82,8 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
         }
     }
 
-    // Geometry buffers.
-    {
-        Mesh mesh = load_obj_mesh(get_resource_path("model/mesh.obj"), 1.25f);
-        {
-            VkDeviceSize size = mesh.vertices.size() * sizeof(mesh.vertices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-            gpu_mesh.vertex_buffer = vk_create_buffer(size, usage, mesh.vertices.data(), "vertex_buffer");
-            gpu_mesh.vertex_count = uint32_t(mesh.vertices.size());
-        }
-        {
-            VkDeviceSize size = mesh.indices.size() * sizeof(mesh.indices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-            gpu_mesh.index_buffer = vk_create_buffer(size, usage, mesh.indices.data(), "index_buffer");
-            gpu_mesh.index_count = uint32_t(mesh.indices.size());
-        }
-    }
-
-    // Texture.
+    // Sampler.
     {
-        texture = vk_load_texture("model/diffuse.jpg");
-
         VkSamplerCreateInfo create_info { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
         create_info.magFilter           = VK_FILTER_LINEAR;
         create_info.minFilter           = VK_FILTER_LINEAR;
@@ -85,6 +101,59 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
         vk_set_debug_name(sampler, "diffuse_texture_sampler");
     }
 
+    // The scene is loaded in the background. Frames are rendered while loading and the scene
+    // appears when the loader thread has finished (see upload_scene).
+    Vertex_Layout vertex_layout = vertex_layout_interleaved;
+    if (options.compact_vertex_format)
+        vertex_layout = vertex_layout_split_compact;
+    else if (options.split_positions)
+        vertex_layout = vertex_layout_split;
+
+    {
+        Scene_Load_Params params;
+        params.scene_path           = "model/mesh.obj";
+        params.scale                = 1.25f;
+        params.disable_mesh_cache   = options.disable_mesh_cache;
+        params.optimize_mesh        = options.optimize_mesh;
+        params.vertex_layout        = vertex_layout;
+        params.max_lod_count        = 6;
+        scene_loader.start(params);
+    }
+    compare_blas_builds = options.compare_blas_builds;
+    if (!options.disable_accel_cache)
+        accel_params.cache_path = get_resource_path(scene_loader.params.scene_path) + ".accel_cache";
+    accel_params.scratch_budget = VkDeviceSize(options.blas_scratch_budget_mb) << 20;
+    accel_params.compact = options.compact_blas;
+    accel_params.bottom_level_flags = options.blas_flags;
+    accel_params.top_level_flags = options.tlas_flags;
+    accel_params.host_build_max_triangles = options.host_build_max_triangles;
+    tlas_max_refit_count = options.tlas_max_refit_count;
+    instance_copies = std::max(options.instance_copies, 1u);
+    instance_layout = options.instance_layout;
+    deform = options.deform_meshes;
+    accel_params.allow_bottom_level_update = deform;
+    blas_max_refit_count = options.blas_max_refit_count;
+    if (deform && accel_params.compact)
+        printf("Bottom level structures are not compacted when the meshes are deformed\n");
+
+    // One benchmark runs at a time, the first one in this order.
+    auto request_benchmark = [this](uint32_t frame_count, const std::function<Benchmark()>& create_benchmark) {
+        if (frame_count == 0)
+            return;
+        Benchmark benchmark = create_benchmark();
+        if (benchmark_runner.requested) {
+            printf("%s benchmark can't run together with %s benchmark, %s benchmark is disabled\n", benchmark.name, benchmark_runner.benchmark.name, benchmark.name);
+            return;
+        }
+        benchmark_runner.benchmark = std::move(benchmark);
+        benchmark_runner.frame_count = frame_count;
+        benchmark_runner.requested = true;
+    };
+    request_benchmark(options.build_flags_benchmark_frames, [this]() { return create_build_flags_benchmark(); });
+    request_benchmark(options.instance_benchmark_frames, [this]() { return create_instance_benchmark(instance_copies); });
+    request_benchmark(options.adaptive_sampling_benchmark_frames, [this]() { return create_adaptive_sampling_benchmark(); });
+    request_benchmark(options.texture_lod_benchmark_frames, [this]() { return create_texture_lod_benchmark(); });
+
     // UI render pass.
     {
         VkAttachmentDescription attachments[1] = {};
@@ -116,12 +185,10 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
         vk_set_debug_name(ui_render_pass, "ui_render_pass");
     }
 
-    raster.create(texture.view, sampler);
-
-    if (vk.raytracing_supported)
-        rt.create(gpu_mesh, texture.view, sampler);
-
+    raster.create(sampler, vertex_layout);
     copy_to_swapchain.create();
+    instance_generator.create();
+    mesh_deformer.create();
     restore_resolution_dependent_resources();
 
     // ImGui setup.
@@ -147,27 +214,44 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
     }
 
     gpu_times.frame = time_keeper.allocate_time_interval();
+    gpu_times.compute = time_keeper.allocate_time_interval(true);
     gpu_times.draw = time_keeper.allocate_time_interval();
     gpu_times.ui = time_keeper.allocate_time_interval();
     gpu_times.compute_copy = time_keeper.allocate_time_interval();
+    gpu_times.instance_generation = time_keeper.allocate_time_interval(true);
+    gpu_times.deform = time_keeper.allocate_time_interval(true);
+    gpu_times.blas_build = time_keeper.allocate_time_interval(true);
+    gpu_times.tlas_build = time_keeper.allocate_time_interval(true);
+    gpu_times.trace = time_keeper.allocate_time_interval();
     time_keeper.initialize_time_intervals();
+
+    if (options.compare_geometry_uploads)
+        compare_geometry_uploads();
+
+    printf("\nInitialization time = %lld milliseconds\n", elapsed_milliseconds(start_time));
 }
 
 void Vk_Demo::shutdown() {
     VK_CHECK(vkDeviceWaitIdle(vk.device));
+    scene_loader.finish();
 
     ImGui_ImplVulkan_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
-    gpu_mesh.destroy();
-    texture.destroy();
+    for (GPU_Mesh& gpu_mesh : gpu_meshes)
+        geometry_arena.free_mesh(gpu_mesh);
+    geometry_arena.destroy();
+    for (Vk_Image& texture : textures)
+        texture.destroy();
     copy_to_swapchain.destroy();
+    instance_generator.destroy();
+    mesh_deformer.destroy();
     vkDestroySampler(vk.device, sampler, nullptr);
     vkDestroyRenderPass(vk.device, ui_render_pass, nullptr);
     release_resolution_dependent_resources();
     raster.destroy();
-    if (vk.raytracing_supported) rt.destroy();
+    if (scene_resident && vk.raytracing_supported) rt.destroy();
     
     vk_shutdown();
 }
@@ -178,6 +262,9 @@ void Vk_Demo::release_resolution_dependent_resources() {
 
     raster.destroy_framebuffer();
     output_image.destroy();
+    accumulation_image.destroy();
+    first_pass_image.destroy();
+    accumulation.sample_count = 0;
 }
 
 void Vk_Demo::restore_resolution_dependent_resources() {
@@ -196,6 +283,23 @@ void Vk_Demo::restore_resolution_dependent_resources() {
         }
     }
 
+    // accumulation and adaptive sampling images, stay in general layout
+    if (vk.raytracing_supported) {
+        accumulation_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, VK_FORMAT_R32G32B32A32_SFLOAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, "accumulation_image");
+        first_pass_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, VK_FORMAT_R16G16B16A16_SFLOAT,
+            VK_IMAGE_USAGE_STORAGE_BIT, "first_pass_image");
+
+        vk_execute(vk.command_pools[0], vk.queue, [this](VkCommandBuffer command_buffer) {
+            for (VkImage image : { accumulation_image.handle, first_pass_image.handle }) {
+                vk_cmd_image_barrier(command_buffer, image,
+                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                    0,                                  0,
+                    VK_IMAGE_LAYOUT_UNDEFINED,          VK_IMAGE_LAYOUT_GENERAL);
+            }
+        });
+    }
+
     // imgui framebuffer
     {
         VkFramebufferCreateInfo create_info { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
@@ -211,24 +315,78 @@ void Vk_Demo::restore_resolution_dependent_resources() {
 
     raster.create_framebuffer(output_image.view);
 
-    if (vk.raytracing_supported)
-        rt.update_output_image_descriptor(output_image.view);
+    if (scene_resident && vk.raytracing_supported)
+        rt.update_output_image_descriptors(output_image.view, accumulation_image.view, first_pass_image.view);
 
     copy_to_swapchain.update_resolution_dependent_descriptors(output_image.view);
     last_frame_time = Clock::now();
 }
 
 void Vk_Demo::run_frame() {
+    update_scene_residency();
+    update_benchmark();
+
+    // The top level structure is sized for the instance count, so it is rebuilt with the new instance buffer.
+    if (scene_resident && instance_copies != instance_generator.copy_count) {
+        VK_CHECK(vkDeviceWaitIdle(vk.device));
+        instance_generator.create_buffers((uint32_t)gpu_meshes.size(), instance_copies);
+        raster.update_instances(instance_generator.instance_buffer.handle);
+        accel_params.instance_buffer_address = instance_generator.instance_buffer.device_address;
+        accel_params.instance_count = instance_generator.get_instance_count();
+        accel_rebuild_requested |= vk.raytracing_supported;
+    }
+
+    if (accel_rebuild_requested) {
+        VK_CHECK(vkDeviceWaitIdle(vk.device));
+        rt.rebuild_accelerator(gpu_meshes, accel_params);
+        accel_rebuild_requested = false;
+    }
+
     Time current_time = Clock::now();
-    if (animate) {
-        double time_delta = std::chrono::duration_cast<std::chrono::microseconds>(current_time - last_frame_time).count() / 1e6;
+    double time_delta = std::chrono::duration_cast<std::chrono::microseconds>(current_time - last_frame_time).count() / 1e6;
+    if (animate)
         sim_time += time_delta;
-    }
+    if (deform)
+        deform_time += time_delta;
     last_frame_time = current_time;
 
     model_transform = rotate_y(Matrix3x4::identity, (float)sim_time * radians(20.0f));
     view_transform = look_at_transform(camera_pos, Vector3(0), Vector3(0, 1, 0));
-    raster.update(model_transform, view_transform);
+    raster.update(view_transform);
+
+    // Draw time statistics for the LOD that was used in the previous frames.
+    if (ui_result.raytracing_toggled)
+        std::fill(lod_stats.begin(), lod_stats.end(), LOD_Stats{});
+    if (!lod_stats.empty()) {
+        lod_stats[frame_lod].draw_time_sum_ms += gpu_times.draw->length_ms;
+        lod_stats[frame_lod].frame_count++;
+    }
+
+    // For each object select the coarsest LOD which error projected to the screen is below the threshold.
+    // The error is projected from the point of the object's bounding sphere that is the closest to the camera.
+    const float vertical_fov = radians(45.0f); // the same as used by raster and raytracing projections
+    const float pixels_per_unit_at_unit_distance = float(vk.surface_size.height) / (2.f * std::tan(vertical_fov * 0.5f));
+    frame_lod = std::max(lod_level_count, 1u) - 1;
+
+    for (auto [i, gpu_mesh] : enumerate(gpu_meshes)) {
+        const uint32_t last_lod = (uint32_t)gpu_mesh.lods.size() - 1;
+        uint32_t& lod = object_lods[i];
+
+        if (forced_lod >= 0) {
+            lod = std::min((uint32_t)forced_lod, last_lod);
+        } else {
+            const float distance = std::max((camera_pos - transform_point(model_transform, object_centers[i])).length() - object_radii[i], 0.1f);
+            lod = 0;
+            for (uint32_t k = last_lod; k > 0; k--) {
+                const float projected_error = gpu_mesh.lods[k].error / distance * pixels_per_unit_at_unit_distance;
+                if (projected_error <= lod_pixel_error) {
+                    lod = k;
+                    break;
+                }
+            }
+        }
+        frame_lod = std::min(frame_lod, lod);
+    }
 
     Matrix3x4 camera_to_world_transform;
     camera_to_world_transform.set_column(0, Vector3(view_transform.get_row(0)));
@@ -236,19 +394,62 @@ void Vk_Demo::run_frame() {
     camera_to_world_transform.set_column(2, Vector3(view_transform.get_row(2)));
     camera_to_world_transform.set_column(3, camera_pos);
 
-    if (vk.raytracing_supported)
-        rt.update(model_transform, camera_to_world_transform);
+    if (scene_resident && vk.raytracing_supported)
+        rt.update(camera_to_world_transform, gpu_meshes, object_lods, instance_generator.mapped_object_accels, instance_generator.mapped_object_sbt_offsets);
 
     bool old_raytracing = raytracing;
     do_imgui();
+
+    // The benchmarks measure raytracing.
+    if (benchmark_runner.started && !raytracing) {
+        raytracing = true;
+        ui_result.raytracing_toggled = true;
+    }
+    update_accumulation(camera_to_world_transform);
     draw_frame();
 }
 
+void Vk_Demo::update_accumulation(const Matrix3x4& camera_to_world_transform) {
+    Accumulation& acc = accumulation;
+
+    const bool state_changed =
+        memcmp(&acc.camera_to_world, &camera_to_world_transform, sizeof(Matrix3x4)) != 0 ||
+        memcmp(&acc.model_transform, &model_transform, sizeof(Matrix3x4)) != 0 ||
+        acc.lods != object_lods ||
+        acc.show_texture_lod != show_texture_lod ||
+        acc.ray_cones != ray_cones ||
+        acc.instance_layout != instance_layout ||
+        acc.instance_copies != instance_copies;
+
+    // The deformation changes the geometry every frame and the rest pose is restored in the frame after it is disabled.
+    const bool restart = !raytracing || !accumulate || ui_result.raytracing_toggled || state_changed || deform || meshes_deformed;
+
+    if (restart || acc.sample_count == 0) {
+        acc.sample_count        = 0;
+        acc.frame_count         = 0;
+        acc.start_time          = Timestamp();
+        acc.trace_time_sum_ms   = 0.0;
+        acc.camera_to_world     = camera_to_world_transform;
+        acc.model_transform     = model_transform;
+        acc.lods                = object_lods;
+        acc.show_texture_lod    = show_texture_lod;
+        acc.ray_cones           = ray_cones;
+        acc.instance_layout     = instance_layout;
+        acc.instance_copies     = instance_copies;
+    }
+}
+
 void Vk_Demo::draw_frame() {
     vk_begin_frame();
     time_keeper.next_frame();
+    update_async_compute_overlap();
     gpu_times.frame->begin();
 
+    if (!scene_uploaded && scene_loader.is_loaded())
+        upload_scene();
+
+    record_compute_work();
+
     if (raytracing && ui_result.raytracing_toggled) {
         vk_cmd_image_barrier(vk.command_buffer, output_image.handle,
             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
@@ -261,10 +462,476 @@ void Vk_Demo::draw_frame() {
     else
         draw_rasterized_image();
 
+    // The rest of the frame does not read the scene data.
+    vk_end_scene_commands();
+
     draw_imgui();
     copy_output_image_to_swapchain();
     gpu_times.frame->end();
     vk_end_frame();
+
+    if (!first_frame_drawn) {
+        printf("Time to first frame = %lld milliseconds\n", elapsed_milliseconds(start_time));
+        first_frame_drawn = true;
+    }
+}
+
+void Vk_Demo::record_compute_work() {
+    GPU_TIME_SCOPE(gpu_times.compute);
+    VkCommandBuffer command_buffer = vk.compute_command_buffer;
+
+    // Instance transforms depend on the model transform and the animation time, so they are generated every frame.
+    if (scene_uploaded) {
+        GPU_TIME_SCOPE(gpu_times.instance_generation);
+        instance_generator.cmd_generate_instances(command_buffer, instance_layout, model_transform, instance_spacing, (float)sim_time);
+    }
+
+    if (scene_resident && (deform || meshes_deformed)) {
+        GPU_TIME_SCOPE(gpu_times.deform);
+        // The rest pose is copied when the deformation is enabled for the first time,
+        // so the scenes that are never deformed do not pay for the vertex buffer copies.
+        if (!rest_pose_captured) {
+            std::vector<Vector3> bounds_min, bounds_max;
+            for (const Loaded_Object& object : scene_loader.objects) {
+                bounds_min.push_back(object.bounds_min);
+                bounds_max.push_back(object.bounds_max);
+            }
+            mesh_deformer.cmd_capture_rest_pose(command_buffer, gpu_meshes, bounds_min, bounds_max);
+            rest_pose_captured = true;
+        }
+        mesh_deformer.cmd_deform(command_buffer, gpu_meshes, (float)deform_time, deform ? deform_amount : 0.f);
+        meshes_deformed = deform;
+        blas_outdated = true;
+    }
+
+    if (!raytracing)
+        return;
+
+    // The deformed meshes keep the topology, so the bottom level structures are refitted
+    // and fully rebuilt from time to time, the same as the top level structure.
+    if (blas_outdated && (rt.accelerator.bottom_level_flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)) {
+        GPU_TIME_SCOPE(gpu_times.blas_build);
+        blas_refitted = cmd_build_bottom_level_accels(command_buffer, rt.accelerator, gpu_meshes, blas_max_refit_count);
+        blas_outdated = false;
+    }
+
+    // Only the instances change between the frames, so the top level structure is refitted
+    // and fully rebuilt from time to time to restore the tree quality.
+    {
+        GPU_TIME_SCOPE(gpu_times.tlas_build);
+        tlas_refitted = cmd_build_top_level_accel(command_buffer, rt.accelerator, instance_generator.get_instance_count(), tlas_max_refit_count);
+    }
+}
+
+void Vk_Demo::update_async_compute_overlap() {
+    // The compute work of the completed frame could start when the previous frame finished drawing
+    // the scene. The time it ran in parallel with the previous frame's UI and swapchain copy is the overlap.
+    const uint64_t overlap_begin = std::max(gpu_times.compute->begin_timestamp, prev_present_begin_timestamp);
+    const uint64_t overlap_end = std::min(gpu_times.compute->end_timestamp, prev_present_end_timestamp);
+    const float overlap_ms = overlap_end > overlap_begin ? float(double(overlap_end - overlap_begin) * vk.timestamp_period_ms) : 0.f;
+
+    const float influence = 0.25f;
+    async_compute_overlap_ms = (1.f - influence) * async_compute_overlap_ms + influence * overlap_ms;
+
+    prev_present_begin_timestamp = gpu_times.ui->begin_timestamp;
+    prev_present_end_timestamp = gpu_times.compute_copy->end_timestamp;
+}
+
+void Vk_Demo::upload_scene() {
+    if (!scene_loader.error_message.empty())
+        error("failed to load scene: " + scene_loader.error_message);
+
+    // The copies are executed by the current frame's command buffer before the scene is drawn.
+    scene_loader.record_upload(vk.command_buffer, geometry_arena, gpu_meshes, textures);
+    upload_frame_index = vk.frame_index;
+    scene_uploaded = true;
+
+    uint32_t vertex_count = 0;
+    Vector3 scene_bounds_min = scene_loader.objects[0].bounds_min;
+    Vector3 scene_bounds_max = scene_loader.objects[0].bounds_max;
+    for (const Loaded_Object& object : scene_loader.objects) {
+        scene_bounds_min = Vector3(std::min(scene_bounds_min.x, object.bounds_min.x), std::min(scene_bounds_min.y, object.bounds_min.y), std::min(scene_bounds_min.z, object.bounds_min.z));
+        scene_bounds_max = Vector3(std::max(scene_bounds_max.x, object.bounds_max.x), std::max(scene_bounds_max.y, object.bounds_max.y), std::max(scene_bounds_max.z, object.bounds_max.z));
+        object_textures.push_back(object.texture);
+        object_centers.push_back((object.bounds_min + object.bounds_max) * 0.5f);
+        object_radii.push_back((object.bounds_max - object.bounds_min).length() * 0.5f);
+        lod_level_count = std::max(lod_level_count, uint32_t(object.lods.size()));
+        vertex_count += object.vertex_count;
+    }
+    object_lods.resize(gpu_meshes.size());
+    lod_stats.resize(lod_level_count);
+
+    for (uint32_t level = 0; level < lod_level_count; level++) {
+        float max_error = 0.f;
+        for (const GPU_Mesh& gpu_mesh : gpu_meshes)
+            max_error = std::max(max_error, gpu_mesh.lods[std::min(level, uint32_t(gpu_mesh.lods.size()) - 1)].error);
+        printf("  LOD %d: %u triangles, error %.5f\n", (int)level, get_lod_triangle_count(gpu_meshes, level), max_error);
+    }
+
+    const uint32_t vertex_size = gpu_meshes[0].vertex_stride + gpu_meshes[0].attribute_stride;
+    printf("Vertex data size = %u KB (%u bytes per vertex, %s)\n", vertex_count * vertex_size / 1024, vertex_size, get_vertex_layout_name(gpu_meshes[0].vertex_layout));
+    if (vertex_size < sizeof(Vertex))
+        printf("Vertex data savings = %u KB compared to full format\n", vertex_count * uint32_t(sizeof(Vertex) - vertex_size) / 1024);
+
+    // The copies do not overlap for any rotation of the scene around Y axis.
+    const Vector3 scene_extent = scene_bounds_max - scene_bounds_min;
+    instance_spacing = 1.25f * std::sqrt(scene_extent.x * scene_extent.x + scene_extent.z * scene_extent.z);
+    instance_generator.create_buffers((uint32_t)gpu_meshes.size(), instance_copies);
+    printf("Instances = %u (%u copies of %d objects, %s layout)\n", instance_generator.get_instance_count(), instance_copies,
+        (int)gpu_meshes.size(), get_instance_layout_name(instance_layout));
+
+    // The raster descriptor set is not used by the frames drawn while loading, so it can be updated here.
+    std::vector<VkImageView> texture_views;
+    for (const Vk_Image& texture : textures)
+        texture_views.push_back(texture.view);
+    raster.update_textures(texture_views);
+    raster.update_instances(instance_generator.instance_buffer.handle);
+}
+
+void Vk_Demo::update_scene_residency() {
+    if (!scene_uploaded || scene_resident)
+        return;
+
+    // The fence of the upload frame is checked without waiting. It is reused only after it has
+    // been signaled, so the successful status always means that the upload has completed.
+    if (vkGetFenceStatus(vk.device, vk.frame_fence[upload_frame_index]) != VK_SUCCESS)
+        return;
+
+    scene_resident = true;
+
+    // Acceleration structures are built from the uploaded geometry. Host builds read the geometry
+    // from the staging buffer, it has the same layout as the GPU buffers.
+    if (vk.raytracing_supported) {
+        std::vector<VkImageView> texture_views;
+        for (const Vk_Image& texture : textures)
+            texture_views.push_back(texture.view);
+
+        accel_params.geometry_hash = scene_loader.geometry_hash;
+        accel_params.instance_buffer_address = instance_generator.instance_buffer.device_address;
+        accel_params.instance_count = instance_generator.get_instance_count();
+        accel_params.host_meshes.clear();
+        if (accel_params.host_build_max_triangles > 0) {
+            for (auto [i, object] : enumerate(scene_loader.objects)) {
+                accel_params.host_meshes.push_back(Host_Mesh_Geometry{ scene_loader.staging_data + object.vertex_offset, gpu_meshes[i].vertex_stride,
+                    reinterpret_cast<const uint32_t*>(scene_loader.staging_data + object.index_offset) });
+            }
+        }
+        std::vector<const float*> triangle_lod_constants;
+        for (const Loaded_Object& object : scene_loader.objects)
+            triangle_lod_constants.push_back(reinterpret_cast<const float*>(scene_loader.staging_data + object.triangle_lod_offset));
+
+        rt.create(gpu_meshes, object_textures, triangle_lod_constants, texture_views, sampler, accel_params);
+        accel_params.host_meshes.clear(); // staging data is released below
+        rt.update_output_image_descriptors(output_image.view, accumulation_image.view, first_pass_image.view);
+        if (compare_blas_builds)
+            compare_bottom_level_build_times();
+    }
+    scene_loader.finish();
+    const char* accel_cache_status = "acceleration structure cache disabled";
+    if (vk.raytracing_supported && !accel_params.cache_path.empty() && !accel_params.allow_bottom_level_update)
+        accel_cache_status = rt.accelerator.loaded_from_cache ? "warm start, acceleration structure cache hit" : "cold start, acceleration structure cache miss";
+    printf("Time to full quality = %lld milliseconds (%s)\n", elapsed_milliseconds(start_time), accel_cache_status);
+}
+
+void Vk_Demo::update_benchmark() {
+    Benchmark_Runner& runner = benchmark_runner;
+    if (!runner.requested || !scene_resident)
+        return;
+
+    const Benchmark& benchmark = runner.benchmark;
+    if (!vk.raytracing_supported) {
+        printf("%s benchmark requires raytracing support\n", benchmark.name);
+        runner.requested = false;
+        exit_requested_by_demo = true;
+        return;
+    }
+
+    if (!runner.started) {
+        runner.started = true;
+        runner.saved_settings.spp4                          = spp4;
+        runner.saved_settings.accumulate                    = accumulate;
+        runner.saved_settings.adaptive_sampling             = adaptive_sampling;
+        runner.saved_settings.adaptive_contrast_threshold   = adaptive_contrast_threshold;
+        runner.saved_settings.show_sample_heatmap           = show_sample_heatmap;
+        runner.saved_settings.store_linear_color            = store_linear_color;
+        runner.saved_settings.ray_cones                     = ray_cones;
+        runner.saved_settings.tlas_max_refit_count          = tlas_max_refit_count;
+        runner.saved_settings.accel_cache_path              = accel_params.cache_path;
+        benchmark.start();
+        begin_benchmark_configuration(0);
+        return;
+    }
+
+    const uint32_t reference_sample_count = benchmark.get_reference_sample_count ? benchmark.get_reference_sample_count(runner.configuration) : 0;
+    if (reference_sample_count > 0) {
+        if (accumulation.sample_count < reference_sample_count)
+            return;
+    } else {
+        if (runner.frame >= Benchmark_Runner::warmup_frame_count) {
+            runner.time_sums.instance_generation_ms += gpu_times.instance_generation->length_ms;
+            runner.time_sums.tlas_build_ms += gpu_times.tlas_build->length_ms;
+            runner.time_sums.trace_ms += gpu_times.trace->length_ms;
+        }
+        if (++runner.frame < Benchmark_Runner::warmup_frame_count + runner.frame_count)
+            return;
+    }
+
+    Benchmark_Times times;
+    times.instance_generation_ms    = runner.time_sums.instance_generation_ms / runner.frame_count;
+    times.tlas_build_ms             = runner.time_sums.tlas_build_ms / runner.frame_count;
+    times.trace_ms                  = runner.time_sums.trace_ms / runner.frame_count;
+    benchmark.report_configuration(runner.configuration, times);
+
+    if (runner.configuration + 1 < benchmark.configuration_count) {
+        begin_benchmark_configuration(runner.configuration + 1);
+        return;
+    }
+
+    if (benchmark.finish)
+        benchmark.finish();
+    spp4                        = runner.saved_settings.spp4;
+    accumulate                  = runner.saved_settings.accumulate;
+    adaptive_sampling           = runner.saved_settings.adaptive_sampling;
+    adaptive_contrast_threshold = runner.saved_settings.adaptive_contrast_threshold;
+    show_sample_heatmap         = runner.saved_settings.show_sample_heatmap;
+    store_linear_color          = runner.saved_settings.store_linear_color;
+    ray_cones                   = runner.saved_settings.ray_cones;
+    tlas_max_refit_count        = runner.saved_settings.tlas_max_refit_count;
+    accel_params.cache_path     = runner.saved_settings.accel_cache_path;
+    runner.requested = false;
+    exit_requested_by_demo = true;
+}
+
+void Vk_Demo::begin_benchmark_configuration(uint32_t configuration) {
+    Benchmark_Runner& runner = benchmark_runner;
+    runner.configuration = configuration;
+    runner.frame = 0;
+    runner.time_sums = Benchmark_Times{};
+    runner.benchmark.set_configuration(configuration);
+}
+
+Vk_Demo::Benchmark Vk_Demo::create_build_flags_benchmark() {
+    Benchmark benchmark;
+    benchmark.name = "Build flags";
+    benchmark.configuration_count = build_preference_flag_combination_count * build_preference_flag_combination_count;
+
+    benchmark.start = [this]() {
+        // The top level structure is rebuilt every frame to measure the build time with the given flags.
+        tlas_max_refit_count = 0;
+        // Each combination is built, not loaded from the cache.
+        accel_params.cache_path.clear();
+        printf("\nBuild flags benchmark (%u frames per combination):\n", benchmark_runner.frame_count);
+        printf("blas_flags,tlas_flags,blas_build_ms,tlas_build_ms,blas_memory_kb,tlas_memory_kb,trace_ms\n");
+    };
+    benchmark.set_configuration = [this](uint32_t combination) {
+        accel_params.bottom_level_flags = build_preference_flag_combinations[combination / build_preference_flag_combination_count];
+        accel_params.top_level_flags = build_preference_flag_combinations[combination % build_preference_flag_combination_count];
+        accel_rebuild_requested = true;
+    };
+    benchmark.report_configuration = [this](uint32_t, const Benchmark_Times& times) {
+        printf("%s,%s,%.3f,%.3f,%u,%u,%.3f\n",
+            get_build_preference_flags_name(accel_params.bottom_level_flags).c_str(),
+            get_build_preference_flags_name(accel_params.top_level_flags).c_str(),
+            rt.accelerator.bottom_level_build_time_ms,
+            times.tlas_build_ms,
+            uint32_t(rt.accelerator.bottom_level_memory_size / 1024),
+            uint32_t(rt.accelerator.top_level_memory_size / 1024),
+            times.trace_ms);
+    };
+    return benchmark;
+}
+
+Vk_Demo::Benchmark Vk_Demo::create_instance_benchmark(uint32_t max_copy_count) {
+    Benchmark benchmark;
+    benchmark.name = "Instance";
+    benchmark.configuration_count = 0;
+    for (uint32_t copy_count = 1; copy_count <= max_copy_count; copy_count *= 4)
+        benchmark.configuration_count++;
+
+    benchmark.start = [this]() {
+        tlas_max_refit_count = 0;
+        printf("\nInstance benchmark (%u frames per instance count, %s layout):\n", benchmark_runner.frame_count, get_instance_layout_name(instance_layout));
+        printf("instances,copies,instance_generation_ms,tlas_build_ms,tlas_memory_kb,trace_ms\n");
+    };
+    // The instance buffer and the top level structure are recreated by run_frame.
+    benchmark.set_configuration = [this](uint32_t configuration) {
+        instance_copies = 1u << (2 * configuration);
+    };
+    benchmark.report_configuration = [this](uint32_t, const Benchmark_Times& times) {
+        printf("%u,%u,%.3f,%.3f,%u,%.3f\n",
+            instance_generator.get_instance_count(),
+            instance_generator.copy_count,
+            times.instance_generation_ms,
+            times.tlas_build_ms,
+            uint32_t(rt.accelerator.top_level_memory_size / 1024),
+            times.trace_ms);
+    };
+    return benchmark;
+}
+
+// RMSE of the displayed (sRGB encoded) values of two linear rgba images. The alpha channel is ignored.
+static double compute_display_rmse(const std::vector<float>& pixels, const std::vector<float>& reference, double* max_difference = nullptr) {
+    assert(pixels.size() == reference.size());
+    const size_t pixel_count = pixels.size() / 4;
+    double error_sum = 0.0;
+    double max_d = 0.0;
+    for (size_t i = 0; i < pixel_count; i++) {
+        for (size_t c = 0; c < 3; c++) {
+            const double d = srgb_encode(std::clamp(pixels[i*4 + c], 0.f, 1.f)) - srgb_encode(std::clamp(reference[i*4 + c], 0.f, 1.f));
+            error_sum += d * d;
+            max_d = std::max(max_d, std::abs(d));
+        }
+    }
+    if (max_difference)
+        *max_difference = max_d;
+    return std::sqrt(error_sum / double(pixel_count * 3));
+}
+
+Vk_Demo::Benchmark Vk_Demo::create_adaptive_sampling_benchmark() {
+    static constexpr uint32_t reference_sample_count = 256;
+    static constexpr float contrast_thresholds[] = { 0.2f, 0.1f, 0.05f, 0.025f, 0.0125f };
+
+    // Configuration 0 accumulates the reference, 1 is uniform 4 spp, i > 1 is adaptive with contrast_thresholds[i-2].
+    struct Results {
+        std::vector<float>  reference; // linear rgba
+        double              uniform_rmse;
+        double              uniform_trace_time_ms;
+        int                 equal_quality_threshold = -1; // the fastest adaptive configuration with the error not above uniform 4 spp
+        double              equal_quality_trace_time_ms;
+    };
+    auto results = std::make_shared<Results>();
+
+    Benchmark benchmark;
+    benchmark.name = "Adaptive sampling";
+    benchmark.configuration_count = 2 + (uint32_t)std::size(contrast_thresholds);
+
+    benchmark.start = [this]() {
+        show_sample_heatmap = false;
+        printf("\nAdaptive sampling benchmark (%u frames per configuration, up to %d spp, reference %u spp):\n",
+            benchmark_runner.frame_count, adaptive_max_spp, reference_sample_count);
+        printf("mode,contrast_threshold,average_spp,trace_ms,rmse\n");
+    };
+    benchmark.get_reference_sample_count = [](uint32_t configuration) {
+        return configuration == 0 ? reference_sample_count : 0;
+    };
+    benchmark.set_configuration = [this](uint32_t configuration) {
+        if (configuration == 0) {
+            // The reference is accumulated with 4 samples per frame.
+            accumulate = true;
+            adaptive_sampling = false;
+            spp4 = true;
+            accumulation.sample_count = 0;
+            return;
+        }
+        accumulate = false;
+        store_linear_color = true;
+        spp4 = (configuration == 1);
+        adaptive_sampling = (configuration > 1);
+        if (adaptive_sampling)
+            adaptive_contrast_threshold = contrast_thresholds[configuration - 2];
+    };
+    benchmark.report_configuration = [this, results](uint32_t configuration, const Benchmark_Times& times) {
+        if (configuration == 0) {
+            results->reference = read_accumulation_image();
+            return;
+        }
+
+        // The last frame stored its linear color and samples per pixel in the accumulation image.
+        const std::vector<float> pixels = read_accumulation_image();
+        const double rmse = compute_display_rmse(pixels, results->reference);
+        const size_t pixel_count = pixels.size() / 4;
+        double sample_sum = 0.0;
+        for (size_t i = 0; i < pixel_count; i++)
+            sample_sum += pixels[i*4 + 3];
+
+        const bool adaptive = configuration > 1;
+        printf("%s,%.4f,%.2f,%.3f,%.5f\n", adaptive ? "adaptive" : "uniform_4spp", adaptive ? contrast_thresholds[configuration - 2] : 0.f,
+            sample_sum / double(pixel_count), times.trace_ms, rmse);
+
+        if (!adaptive) {
+            results->uniform_rmse = rmse;
+            results->uniform_trace_time_ms = times.trace_ms;
+        } else if (rmse <= results->uniform_rmse && (results->equal_quality_threshold < 0 || times.trace_ms < results->equal_quality_trace_time_ms)) {
+            results->equal_quality_threshold = int(configuration - 2);
+            results->equal_quality_trace_time_ms = times.trace_ms;
+        }
+    };
+    benchmark.finish = [results]() {
+        if (results->equal_quality_threshold >= 0) {
+            printf("Equal quality trace time: uniform 4 spp %.3f ms, adaptive %.3f ms (contrast threshold %.4f), %.2fx\n",
+                results->uniform_trace_time_ms, results->equal_quality_trace_time_ms, contrast_thresholds[results->equal_quality_threshold],
+                results->uniform_trace_time_ms / std::max(results->equal_quality_trace_time_ms, 1e-6));
+        } else {
+            printf("Equal quality trace time: no adaptive configuration reaches uniform 4 spp error %.5f\n", results->uniform_rmse);
+        }
+    };
+    return benchmark;
+}
+
+Vk_Demo::Benchmark Vk_Demo::create_texture_lod_benchmark() {
+    static const char* ray_type_names[rt_ray_type_count] = { "ray_differentials", "ray_cones" };
+    auto differentials_image = std::make_shared<std::vector<float>>(); // linear rgba of the ray differentials mode
+
+    // Configuration is Rt_Ray_Type.
+    Benchmark benchmark;
+    benchmark.name = "Texture LOD";
+    benchmark.configuration_count = rt_ray_type_count;
+
+    benchmark.start = [this]() {
+        // One sample per pixel at the pixel center, so both modes trace the same rays.
+        spp4 = false;
+        accumulate = false;
+        adaptive_sampling = false;
+        store_linear_color = true;
+        printf("\nTexture LOD benchmark (%u frames per mode):\n", benchmark_runner.frame_count);
+        printf("mode,payload_bytes,trace_ms\n");
+    };
+    benchmark.set_configuration = [this](uint32_t ray_type) {
+        ray_cones = (ray_type == rt_ray_type_cones);
+    };
+    benchmark.report_configuration = [this, differentials_image](uint32_t ray_type, const Benchmark_Times& times) {
+        printf("%s,%u,%.3f\n", ray_type_names[ray_type], rt_ray_payload_sizes[ray_type], times.trace_ms);
+
+        // The last frame stored its linear color in the accumulation image.
+        std::vector<float> pixels = read_accumulation_image();
+        if (ray_type == rt_ray_type_differentials) {
+            *differentials_image = std::move(pixels);
+        } else {
+            double max_difference;
+            const double rmse = compute_display_rmse(pixels, *differentials_image, &max_difference);
+            printf("Ray cones vs ray differentials: rmse %.5f, max difference %.5f\n", rmse, max_difference);
+        }
+    };
+    return benchmark;
+}
+
+std::vector<float> Vk_Demo::read_accumulation_image() {
+    VK_CHECK(vkDeviceWaitIdle(vk.device));
+
+    const VkDeviceSize size = VkDeviceSize(vk.surface_size.width) * vk.surface_size.height * 4 * sizeof(float);
+    float* mapped_data;
+    Vk_Buffer buffer = vk_create_mapped_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, (void**)&mapped_data, "accumulation_readback_buffer");
+
+    vk_execute(vk.command_pools[0], vk.queue, [this, &buffer](VkCommandBuffer command_buffer) {
+        vk_cmd_image_barrier(command_buffer, accumulation_image.handle,
+            VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,   VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT,                     VK_ACCESS_TRANSFER_READ_BIT,
+            VK_IMAGE_LAYOUT_GENERAL,                        VK_IMAGE_LAYOUT_GENERAL);
+
+        VkBufferImageCopy region{};
+        region.imageSubresource = VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.imageExtent = VkExtent3D{ vk.surface_size.width, vk.surface_size.height, 1 };
+        vkCmdCopyImageToBuffer(command_buffer, accumulation_image.handle, VK_IMAGE_LAYOUT_GENERAL, buffer.handle, 1, &region);
+
+        VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    });
+
+    std::vector<float> pixels(mapped_data, mapped_data + size / sizeof(float));
+    buffer.destroy();
+    return pixels;
 }
 
 void Vk_Demo::draw_rasterized_image() {
@@ -295,89 +962,98 @@ void Vk_Demo::draw_rasterized_image() {
     render_pass_begin_info.pClearValues      = clear_values;
 
     vkCmdBeginRenderPass(vk.command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-    const VkDeviceSize zero_offset = 0;
-    vkCmdBindVertexBuffers(vk.command_buffer, 0, 1, &gpu_mesh.vertex_buffer.handle, &zero_offset);
-    vkCmdBindIndexBuffer(vk.command_buffer, gpu_mesh.index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+
+    // While the scene is loading only the background is drawn.
+    if (gpu_meshes.empty()) {
+        vkCmdEndRenderPass(vk.command_buffer);
+        return;
+    }
     vkCmdBindDescriptorSets(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, raster.pipeline_layout, 0, 1, &raster.descriptor_set, 0, nullptr);
     vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, raster.pipeline);
-    uint32_t show_texture_lod_uint = show_texture_lod;
-    vkCmdPushConstants(vk.command_buffer, raster.pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 4, &show_texture_lod_uint);
-    vkCmdDrawIndexed(vk.command_buffer, gpu_mesh.index_count, 1, 0, 0, 0);
+
+    // The arena meshes share the buffers, so the buffers are bound once and the draws use the mesh offsets.
+    VkBuffer bound_vertex_buffer = VK_NULL_HANDLE;
+    for (auto [i, gpu_mesh] : enumerate(gpu_meshes)) {
+        if (gpu_mesh.vertex_buffer.handle != bound_vertex_buffer) {
+            const VkDeviceSize zero_offsets[2] = {};
+            const VkBuffer vertex_buffers[2] = { gpu_mesh.vertex_buffer.handle, gpu_mesh.attribute_buffer.handle };
+            vkCmdBindVertexBuffers(vk.command_buffer, 0, gpu_mesh.vertex_layout == vertex_layout_interleaved ? 1 : 2, vertex_buffers, zero_offsets);
+            vkCmdBindIndexBuffer(vk.command_buffer, gpu_mesh.index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+            bound_vertex_buffer = gpu_mesh.vertex_buffer.handle;
+        }
+
+        const uint32_t push_constants[2] = { show_texture_lod, object_textures[i] };
+        vkCmdPushConstants(vk.command_buffer, raster.pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(push_constants), push_constants);
+
+        // All copies of the object use the same LOD.
+        const Mesh_LOD& lod = gpu_mesh.lods[object_lods[i]];
+        vkCmdDrawIndexed(vk.command_buffer, lod.index_count, instance_generator.copy_count, gpu_mesh.first_index + lod.first_index,
+            int32_t(gpu_mesh.first_vertex), uint32_t(i) * instance_generator.copy_count);
+    }
     vkCmdEndRenderPass(vk.command_buffer);
 }
 
 void Vk_Demo::draw_raytraced_image() {
     GPU_TIME_SCOPE(gpu_times.draw);
 
-    VkAccelerationStructureGeometryKHR geometry { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
-    geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-    geometry.geometry.instances = VkAccelerationStructureGeometryInstancesDataKHR { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR };
-    geometry.geometry.instances.arrayOfPointers = VK_FALSE;
-    geometry.geometry.instances.data.deviceAddress = rt.accelerator.instance_buffer.device_address;
-
-    const VkAccelerationStructureGeometryKHR* p_geometry[1] = { &geometry };
-
-    VkAccelerationStructureBuildGeometryInfoKHR geometry_info { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
-    geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-    geometry_info.flags = 0;
-    geometry_info.update = VK_FALSE;
-    geometry_info.dstAccelerationStructure = rt.accelerator.top_level_accel;
-    geometry_info.geometryArrayOfPointers = VK_TRUE;
-    geometry_info.geometryCount = 1;
-    geometry_info.ppGeometries = p_geometry;
-    geometry_info.scratchData.deviceAddress = rt.accelerator.scratch_buffer.device_address;
-
-    VkAccelerationStructureBuildOffsetInfoKHR offset_info{};
-    offset_info.primitiveCount = 1;
-    offset_info.primitiveOffset = 0;
-
-    const VkAccelerationStructureBuildOffsetInfoKHR* p_offset_info[1] = { &offset_info };
-
-    vkCmdBuildAccelerationStructureKHR(vk.command_buffer, 1, &geometry_info, p_offset_info);
+    vkCmdBindDescriptorSets(vk.command_buffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rt.pipeline_layout, 0, 1, &rt.descriptor_set, 0, nullptr);
+    vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rt.pipeline);
 
-    VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
-    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    Rt_Raygen_Push_Constants raygen_push_constants;
+    raygen_push_constants.spp4                          = spp4;
+    raygen_push_constants.accumulate                    = accumulate;
+    raygen_push_constants.accumulated_sample_count      = accumulation.sample_count;
+    raygen_push_constants.adaptive_pass                 = rt_adaptive_pass_none;
+    raygen_push_constants.adaptive_max_spp              = (uint32_t)adaptive_max_spp;
+    raygen_push_constants.adaptive_contrast_threshold   = adaptive_contrast_threshold;
+    raygen_push_constants.show_sample_heatmap           = show_sample_heatmap;
+    raygen_push_constants.store_linear_color            = store_linear_color;
+    raygen_push_constants.ray_type                      = ray_cones ? rt_ray_type_cones : rt_ray_type_differentials;
+    const uint32_t show_texture_lod_value = show_texture_lod;
+    vkCmdPushConstants(vk.command_buffer, rt.pipeline_layout, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, sizeof(raygen_push_constants), 4, &show_texture_lod_value);
+
+    // The previous frame's trace has written the accumulation image.
+    if (accumulate || store_linear_color) {
+        vk_cmd_image_barrier(vk.command_buffer, accumulation_image.handle,
+            VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,   VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            VK_ACCESS_SHADER_WRITE_BIT,                     VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_GENERAL,                        VK_IMAGE_LAYOUT_GENERAL);
+    }
 
-    vkCmdPipelineBarrier(vk.command_buffer,
-        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
-        0, 1, &barrier, 0, nullptr, 0, nullptr);
+    const Shader_Binding_Table& sbt = rt.shader_binding_table;
+    const VkStridedBufferRegionKHR raygen_region = sbt.get_raygen_region();
+    auto trace_rays = [&raygen_push_constants, &raygen_region, &sbt, this](Rt_Adaptive_Pass adaptive_pass) {
+        raygen_push_constants.adaptive_pass = adaptive_pass;
+        vkCmdPushConstants(vk.command_buffer, rt.pipeline_layout, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, sizeof(raygen_push_constants), &raygen_push_constants);
+        vkCmdTraceRaysKHR(vk.command_buffer, &raygen_region, &sbt.get_miss_region(), &sbt.get_hit_region(), &sbt.get_callable_region(),
+            vk.surface_size.width, vk.surface_size.height, 1);
+    };
 
-    vkCmdBindDescriptorSets(vk.command_buffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rt.pipeline_layout, 0, 1, &rt.descriptor_set, 0, nullptr);
-    vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rt.pipeline);
+    {
+        GPU_TIME_SCOPE(gpu_times.trace);
+        if (adaptive_sampling && !accumulate) {
+            // The first pass overwrites the image read by the previous frame's second pass.
+            vk_cmd_image_barrier(vk.command_buffer, first_pass_image.handle,
+                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,   VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                0,                                              VK_ACCESS_SHADER_WRITE_BIT,
+                VK_IMAGE_LAYOUT_GENERAL,                        VK_IMAGE_LAYOUT_GENERAL);
+            trace_rays(rt_adaptive_pass_first);
+
+            vk_cmd_image_barrier(vk.command_buffer, first_pass_image.handle,
+                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,   VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                VK_ACCESS_SHADER_WRITE_BIT,                     VK_ACCESS_SHADER_READ_BIT,
+                VK_IMAGE_LAYOUT_GENERAL,                        VK_IMAGE_LAYOUT_GENERAL);
+            trace_rays(rt_adaptive_pass_second);
+        } else {
+            trace_rays(rt_adaptive_pass_none);
+        }
+    }
 
-    uint32_t push_constants[2] = { spp4, show_texture_lod };
-    vkCmdPushConstants(vk.command_buffer, rt.pipeline_layout, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, 4, &push_constants[0]);
-    vkCmdPushConstants(vk.command_buffer, rt.pipeline_layout, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 4, 4, &push_constants[1]);
-
-    const VkBuffer sbt = rt.shader_binding_table.handle;
-    const uint32_t sbt_slot_size = rt.properties.shaderGroupHandleSize;
-    const uint32_t miss_offset = round_up(sbt_slot_size /* raygen slot*/, rt.properties.shaderGroupBaseAlignment);
-    const uint32_t hit_offset = round_up(miss_offset + sbt_slot_size /* miss slot */, rt.properties.shaderGroupBaseAlignment);
-
-    VkStridedBufferRegionKHR raygen_sbt{};
-    raygen_sbt.buffer = rt.shader_binding_table.handle;
-    raygen_sbt.offset = 0;
-    raygen_sbt.stride = sbt_slot_size;
-    raygen_sbt.size = sbt_slot_size;
-
-    VkStridedBufferRegionKHR miss_sbt{};
-    miss_sbt.buffer = rt.shader_binding_table.handle;
-    miss_sbt.offset = miss_offset;
-    miss_sbt.stride = sbt_slot_size;
-    miss_sbt.size = sbt_slot_size;
-
-    VkStridedBufferRegionKHR chit_sbt{};
-    chit_sbt.buffer = rt.shader_binding_table.handle;
-    chit_sbt.offset = hit_offset;
-    chit_sbt.stride = sbt_slot_size;
-    chit_sbt.size = sbt_slot_size;
-
-    VkStridedBufferRegionKHR callable_sbt{};
-
-    vkCmdTraceRaysKHR(vk.command_buffer, &raygen_sbt, &miss_sbt, &chit_sbt, &callable_sbt,
-        vk.surface_size.width, vk.surface_size.height, 1);
+    if (accumulate) {
+        accumulation.sample_count += spp4 ? 4 : 1;
+        accumulation.frame_count++;
+        accumulation.trace_time_sum_ms += gpu_times.trace->length_ms; // time of the earlier frame, the same work per frame
+    }
 }
 
 void Vk_Demo::draw_imgui() {
@@ -507,19 +1183,81 @@ void Vk_Demo::do_imgui() {
             ImGui::Text("Draw time          : %.2f ms", gpu_times.draw->length_ms);
             ImGui::Text("UI time            : %.2f ms", gpu_times.ui->length_ms);
             ImGui::Text("Compute copy time  : %.2f ms", gpu_times.compute_copy->length_ms);
+            ImGui::Text("Compute time       : %.3f ms (%s)", gpu_times.compute->length_ms, vk.async_compute ? "async" : "graphics queue");
+            if (vk.async_compute)
+                ImGui::Text("Compute overlap    : %.3f ms (%.0f%%)", async_compute_overlap_ms, gpu_times.compute->length_ms > 0.f ? 100.f * async_compute_overlap_ms / gpu_times.compute->length_ms : 0.f);
+            ImGui::Text("Instance gen. time : %.3f ms", gpu_times.instance_generation->length_ms);
+            if (deform)
+                ImGui::Text("Deform time        : %.3f ms", gpu_times.deform->length_ms);
+            if (raytracing && deform)
+                ImGui::Text("BLAS build time    : %.3f ms (%s)", gpu_times.blas_build->length_ms, blas_refitted ? "refit" : "rebuild");
+            if (raytracing) {
+                ImGui::Text("TLAS build time    : %.3f ms (%s)", gpu_times.tlas_build->length_ms, tlas_refitted ? "refit" : "rebuild");
+                ImGui::Text("Trace time         : %.2f ms", gpu_times.trace->length_ms);
+                ImGui::Text("Ray payload        : %u bytes", rt_ray_payload_sizes[ray_cones ? rt_ray_type_cones : rt_ray_type_differentials]);
+            }
+            if (raytracing && accumulate) {
+                // Wall clock rate depends on vsync and CPU time, GPU rate is based on the trace time only.
+                const double seconds = elapsed_microseconds(accumulation.start_time) / 1e6;
+                const double pixel_count = double(vk.surface_size.width) * vk.surface_size.height;
+                ImGui::Text("Accumulated spp    : %u (%u frames)", accumulation.sample_count, accumulation.frame_count);
+                ImGui::Text("Convergence rate   : %.1f spp/s, %.1f Msamples/s GPU",
+                    seconds > 0.0 ? accumulation.sample_count / seconds : 0.0,
+                    accumulation.trace_time_sum_ms > 0.0 ? accumulation.sample_count * pixel_count / (accumulation.trace_time_sum_ms * 1e3) : 0.0);
+            }
+            if (scene_uploaded) {
+                ImGui::Text("Vertex layout      : %s", get_vertex_layout_name(gpu_meshes[0].vertex_layout));
+                ImGui::Text("Objects            : %d", (int)gpu_meshes.size());
+                ImGui::Text("Instances          : %u (%u copies)", instance_generator.get_instance_count(), instance_generator.copy_count);
+                ImGui::Text("LOD                : %u..%u (%u triangles)", frame_lod, *std::max_element(object_lods.begin(), object_lods.end()), get_lod_triangle_count(gpu_meshes, object_lods));
+            }
             ImGui::Separator();
             ImGui::Spacing();
             ImGui::Checkbox("Vertical sync", &vsync);
             ImGui::Checkbox("Animate", &animate);
+            int layout = instance_layout;
+            auto get_layout_name = [](void*, int index, const char** name) {
+                *name = get_instance_layout_name(Instance_Layout(index));
+                return true;
+            };
+            if (ImGui::Combo("Instance layout", &layout, get_layout_name, nullptr, instance_layout_count))
+                instance_layout = Instance_Layout(layout);
+            // Bottom level structures created without the allow-update flag are recreated for the refits.
+            if (ImGui::Checkbox("Deform meshes", &deform) && deform && !accel_params.allow_bottom_level_update) {
+                accel_params.allow_bottom_level_update = true;
+                accel_rebuild_requested |= scene_resident && vk.raytracing_supported;
+            }
+            ImGui::SliderFloat("Deform amount", &deform_amount, 0.f, 2.f, "%.2f");
             ImGui::Checkbox("Show texture lod", &show_texture_lod);
+            ImGui::SliderInt("Force LOD", &forced_lod, -1, (int)lod_level_count - 1, forced_lod < 0 ? "auto" : "%d");
+            ImGui::SliderFloat("LOD pixel error", &lod_pixel_error, 0.25f, 16.f, "%.2f");
+            if (ImGui::CollapsingHeader("LOD statistics")) {
+                for (uint32_t level = 0; level < lod_level_count; level++) {
+                    const LOD_Stats& stats = lod_stats[level];
+                    ImGui::Text("LOD %d: %6u triangles, draw time %.2f ms (%u frames)", (int)level, get_lod_triangle_count(gpu_meshes, level),
+                        stats.frame_count ? float(stats.draw_time_sum_ms / stats.frame_count) : 0.f, stats.frame_count);
+                }
+            }
 
-            if (!vk.raytracing_supported) {
+            // Raytracing is available when acceleration structures are built for the loaded scene.
+            const bool raytracing_available = vk.raytracing_supported && scene_resident;
+            if (!raytracing_available) {
                 ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
                 ImGui::PushStyleVar(ImGuiStyleVar_Alpha, ImGui::GetStyle().Alpha * 0.5f);
             }
             ui_result.raytracing_toggled = ImGui::Checkbox("Raytracing", &raytracing);
             ImGui::Checkbox("4 rays per pixel", &spp4);
-            if (!vk.raytracing_supported) {
+            int texture_lod_mode = ray_cones;
+            if (ImGui::Combo("Texture LOD", &texture_lod_mode, "Ray differentials\0Ray cones\0"))
+                ray_cones = texture_lod_mode != 0;
+            ImGui::Checkbox("Accumulate samples", &accumulate);
+            ImGui::Checkbox("Adaptive sampling", &adaptive_sampling);
+            ImGui::SliderInt("Max samples per pixel", &adaptive_max_spp, 2, 16);
+            ImGui::SliderFloat("Contrast threshold", &adaptive_contrast_threshold, 0.005f, 0.5f, "%.3f", 2.f);
+            ImGui::Checkbox("Show samples per pixel", &show_sample_heatmap);
+            accel_rebuild_requested |= build_flags_combo("BLAS build flags", &accel_params.bottom_level_flags);
+            accel_rebuild_requested |= build_flags_combo("TLAS build flags", &accel_params.top_level_flags);
+            if (!raytracing_available) {
                 ImGui::PopItemFlag();
                 ImGui::PopStyleVar();
             }
@@ -536,4 +1274,21 @@ void Vk_Demo::do_imgui() {
         }
         ImGui::End();
     }
+
+    // Loading progress is shown until all scene resources are resident on the GPU.
+    if (!scene_resident) {
+        ImGui::SetNextWindowPos(ImVec2(io.DisplaySize.x * 0.5f, io.DisplaySize.y * 0.5f), ImGuiCond_Always, ImVec2(0.5f, 0.5f));
+        ImGui::SetNextWindowBgAlpha(0.3f);
+
+        if (ImGui::Begin("Loading", nullptr,
+            ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize |
+            ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings |
+            ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav))
+        {
+            const Scene_Load_Stage stage = scene_uploaded ? scene_load_stage_finished : Scene_Load_Stage(scene_loader.stage.load());
+            ImGui::Text("Loading scene: %s", scene_uploaded ? "uploading to GPU" : get_scene_load_stage_name(stage));
+            ImGui::ProgressBar(float(stage) / float(scene_load_stage_finished), ImVec2(240.f, 0.f));
+        }
+        ImGui::End();
+    }
 }
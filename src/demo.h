@@ -1,29 +1,71 @@
 #pragma once
 
 #include "copy_to_swapchain.h"
+#include "geometry_arena.h"
+#include "instance_generator.h"
 #include "matrix.h"
+#include "mesh_deformer.h"
 #include "raster_resources.h"
 #include "rt_resources.h"
+#include "scene_loader.h"
 #include "vk_utils.h"
 #include "vk.h"
 
+#include <functional>
+#include <memory>
 #include <vector>
 
 struct GLFWwindow;
 
+struct Command_Line_Options {
+    bool enable_validation_layers;
+    bool disable_mesh_cache;
+    bool optimize_mesh;
+    bool split_positions;
+    bool compact_vertex_format;
+    bool compare_blas_builds;
+    bool compare_geometry_uploads; // prints allocation counts and upload times of the synthetic scenes with and without the geometry arena
+    bool compact_blas;
+    bool disable_accel_cache;
+    uint32_t host_build_max_triangles; // BLAS with at most this number of triangles are built on the CPU, 0 disables host builds
+    VkBuildAccelerationStructureFlagsKHR blas_flags; // build preference flags
+    VkBuildAccelerationStructureFlagsKHR tlas_flags;
+    uint32_t build_flags_benchmark_frames; // if not zero, runs build flags benchmark with the given number of traced frames per combination
+    uint32_t blas_scratch_budget_mb = uint32_t(default_bottom_level_scratch_budget >> 20); // scratch memory limit for one batch of BLAS builds
+    uint32_t tlas_max_refit_count = default_top_level_max_refit_count; // successive TLAS refits before the full rebuild
+    uint32_t instance_copies = 1; // copies of the scene placed by the instance generator
+    Instance_Layout instance_layout = instance_layout_grid;
+    uint32_t instance_benchmark_frames; // if not zero, runs instance count benchmark with the given number of traced frames per count
+    bool deform_meshes; // deforms the meshes with the compute shader and refits bottom level structures every frame
+    uint32_t blas_max_refit_count = default_bottom_level_max_refit_count; // successive BLAS refits of the deformed meshes before the full rebuild
+    uint32_t adaptive_sampling_benchmark_frames; // if not zero, compares adaptive sampling with uniform 4 spp at equal quality
+    uint32_t texture_lod_benchmark_frames; // if not zero, compares ray cone texture LOD with ray differentials
+    bool disable_async_compute; // records the compute work into the graphics command buffer even if the device has a compute queue
+    std::string benchmark; // runs CPU benchmark instead of the demo
+};
+
 class Vk_Demo {
 public:
-    void initialize(GLFWwindow* glfw_window, bool enable_validation_layers);
+    void initialize(GLFWwindow* glfw_window, const Command_Line_Options& options);
     void shutdown();
 
     void release_resolution_dependent_resources();
     void restore_resolution_dependent_resources();
     bool vsync_enabled() const { return vsync; }
+    bool exit_requested() const { return exit_requested_by_demo; }
 
     void run_frame();
 
 private:
     void draw_frame();
+    void record_compute_work();
+    void update_async_compute_overlap();
+    void upload_scene();
+    void update_scene_residency();
+    void update_benchmark();
+    void begin_benchmark_configuration(uint32_t configuration);
+    std::vector<float> read_accumulation_image();
+    void update_accumulation(const Matrix3x4& camera_to_world_transform);
     void draw_rasterized_image();
     void draw_raytraced_image();
     void draw_imgui();
@@ -35,6 +77,97 @@ private:
         bool raytracing_toggled;
     };
 
+    // Average draw time of the frames where the given LOD was the finest LOD among the scene objects.
+    // Reset when rendering mode changes.
+    struct LOD_Stats {
+        double      draw_time_sum_ms;
+        uint32_t    frame_count;
+    };
+
+    // GPU times averaged over the measured frames of the benchmark configuration.
+    struct Benchmark_Times {
+        double      instance_generation_ms;
+        double      tlas_build_ms;
+        double      trace_ms;
+    };
+
+    // Command line benchmark. Each configuration is traced for Benchmark_Runner::warmup_frame_count frames
+    // that are not measured and then for the benchmark's frame count. The callbacks apply the configuration's
+    // settings and print the results as CSV.
+    struct Benchmark {
+        const char*                                             name;
+        uint32_t                                                configuration_count;
+        std::function<void()>                                   start; // changes the settings shared by all configurations, prints the header
+        std::function<void(uint32_t)>                           set_configuration;
+        std::function<void(uint32_t, const Benchmark_Times&)>   report_configuration;
+        std::function<void()>                                   finish; // optional, prints the summary
+
+        // Optional. A configuration with non-zero reference sample count is not measured, it ends when
+        // the accumulation has that many samples per pixel. Used to accumulate the reference image.
+        std::function<uint32_t(uint32_t)>                       get_reference_sample_count;
+    };
+
+    // Runs the benchmark selected on the command line. The render settings changed by the benchmark
+    // are saved when it starts and restored when it finishes, then the demo exits.
+    struct Benchmark_Runner {
+        static constexpr uint32_t warmup_frame_count = 4; // skips GPU times measured before the new settings are applied
+
+        Benchmark       benchmark;
+        uint32_t        frame_count; // measured frames per configuration
+        bool            requested = false;
+        bool            started = false;
+        uint32_t        configuration;
+        uint32_t        frame;
+        Benchmark_Times time_sums;
+
+        struct {
+            bool        spp4;
+            bool        accumulate;
+            bool        adaptive_sampling;
+            float       adaptive_contrast_threshold;
+            bool        show_sample_heatmap;
+            bool        store_linear_color;
+            bool        ray_cones;
+            uint32_t    tlas_max_refit_count;
+            std::string accel_cache_path;
+        } saved_settings;
+    };
+
+    // Builds acceleration structures with each combination of bottom level and top level build
+    // preference flags and prints build times, memory sizes and trace time for each combination.
+    Benchmark create_build_flags_benchmark();
+
+    // Traces each power of 4 copy count up to max_copy_count and prints instance generation,
+    // top level build and trace times. The top level structure is fully rebuilt every frame.
+    Benchmark create_instance_benchmark(uint32_t max_copy_count);
+
+    // Accumulates the reference image, then traces uniform 4 spp and adaptive sampling with each contrast
+    // threshold. The linear color of the last frame of each configuration is read back and compared with the
+    // reference. Prints trace time, average samples per pixel and RMSE, and the adaptive configuration that
+    // matches the uniform 4 spp error.
+    Benchmark create_adaptive_sampling_benchmark();
+
+    // Traces ray differentials and ray cones texture LOD with one sample per pixel. Prints the payload size
+    // and trace time of each mode and the difference between the images of the last frames.
+    Benchmark create_texture_lod_benchmark();
+
+    // Progressive accumulation of the raytraced samples. The accumulation restarts when anything that
+    // affects the image changes, the fields below the counters are the state of the accumulated samples.
+    struct Accumulation {
+        uint32_t                sample_count = 0; // samples per pixel, zero restarts the accumulation
+        uint32_t                frame_count = 0;
+        Timestamp               start_time;
+        double                  trace_time_sum_ms = 0.0; // GPU trace time of the accumulated frames
+
+        Matrix3x4               camera_to_world;
+        Matrix3x4               model_transform;
+        std::vector<uint32_t>   lods;
+        bool                    show_texture_lod;
+        bool                    ray_cones;
+        Instance_Layout         instance_layout;
+        uint32_t                instance_copies;
+    };
+
     using Clock = std::chrono::high_resolution_clock;
     using Time  = std::chrono::time_point<Clock>;
 
@@ -43,20 +176,82 @@ private:
     bool                        animate                 = false;
     bool                        raytracing              = false;
     bool                        show_texture_lod        = false;
+    bool                        ray_cones               = false; // texture LOD from ray cones instead of ray differentials
     bool                        spp4                    = false;
+    bool                        accumulate              = false; // accumulates samples while the image does not change
+    bool                        adaptive_sampling       = false; // the second pass adds samples to high contrast pixels
+    int                         adaptive_max_spp        = 8;
+    float                       adaptive_contrast_threshold = 0.05f;
+    bool                        show_sample_heatmap     = false;
+    bool                        store_linear_color      = false; // lets the benchmarks read back the frame
+    int                         forced_lod              = -1; // -1 selects LOD by the screen-space error
+    float                       lod_pixel_error         = 1.0f;
+    uint32_t                    frame_lod               = 0; // the finest LOD used in the frame
 
     Time                        last_frame_time;
     double                      sim_time;
 
+    // The scene is loaded by the loader thread while the frames are drawn. The upload is recorded
+    // into the frame command buffer and the scene is resident when that frame has completed.
+    Timestamp                   start_time; // used to report time to the first frame and to full quality
+    Scene_Loader                scene_loader;
+    bool                        scene_uploaded          = false;
+    bool                        scene_resident          = false;
+    uint32_t                    upload_frame_index      = 0;
+    bool                        first_frame_drawn       = false;
+    bool                        compare_blas_builds     = false;
+    Accelerator_Build_Params    accel_params;
+    uint32_t                    tlas_max_refit_count    = default_top_level_max_refit_count;
+    bool                        tlas_refitted           = false; // the last TLAS build was a refit
+    bool                        accel_rebuild_requested = false; // build flags were changed in the UI
+    Benchmark_Runner            benchmark_runner;
+    bool                        exit_requested_by_demo  = false;
+
     UI_Result                   ui_result;
+    std::vector<LOD_Stats>      lod_stats;
 
     VkRenderPass                ui_render_pass;
     VkFramebuffer               ui_framebuffer;
     Vk_Image                    output_image;
+    Vk_Image                    accumulation_image;     // created when raytracing is supported
+    Vk_Image                    first_pass_image;       // samples of the first adaptive sampling pass
+    Accumulation                accumulation;
     Copy_To_Swapchain           copy_to_swapchain;
-    GPU_Mesh                    gpu_mesh;
-    Vk_Image                    texture;
     VkSampler                   sampler;
+    std::vector<Vk_Image>       textures;
+
+    // Scene objects. Each object has its own LOD chain and TLAS instance. The meshes are allocated from the geometry arena.
+    Geometry_Arena              geometry_arena;
+    std::vector<GPU_Mesh>       gpu_meshes;
+    std::vector<uint32_t>       object_textures;        // index in textures
+    std::vector<Vector3>        object_centers;         // bounding sphere used for LOD selection
+    std::vector<float>          object_radii;
+    std::vector<uint32_t>       object_lods;            // LOD selected for the current frame
+    uint32_t                    lod_level_count = 0;    // the longest LOD chain among the objects
+
+    // Each scene object has instance_copies instances. The instance buffer is recreated when the copy count changes.
+    Instance_Generator          instance_generator;
+    Instance_Layout             instance_layout         = instance_layout_grid;
+    uint32_t                    instance_copies         = 1;
+    float                       instance_spacing        = 1.f; // distance between the copies, derived from the scene bounds
+
+    // The deformation writes the vertex buffers every frame and the bottom level structures are refitted
+    // before the top level build. One more pass restores the rest pose when the deformation is disabled.
+    Mesh_Deformer               mesh_deformer;
+    bool                        deform                  = false;
+    float                       deform_amount           = 1.f;
+    double                      deform_time             = 0.0;
+    bool                        meshes_deformed         = false; // vertex buffers do not contain the rest pose
+    bool                        rest_pose_captured      = false; // mesh_deformer has the copy of the uploaded vertex buffers
+    bool                        blas_outdated           = false; // vertex buffers were modified after the last BLAS build
+    uint32_t                    blas_max_refit_count    = default_bottom_level_max_refit_count;
+    bool                        blas_refitted           = false; // the last BLAS build was a refit
+
+    // With async compute the frame's compute work runs on the compute queue while the graphics
+    // queue draws the previous frame's UI and copies it to the swapchain.
+    float                       async_compute_overlap_ms = 0.f;
+    uint64_t                    prev_present_begin_timestamp = 0; // UI and swapchain copy of the previous frame
+    uint64_t                    prev_present_end_timestamp = 0;
 
     Vector3                     camera_pos = Vector3(0, 0.5, 3.0);
     Matrix3x4                   model_transform;
@@ -68,8 +263,14 @@ private:
     GPU_Time_Keeper             time_keeper;
     struct {
         GPU_Time_Interval*      frame;
+        GPU_Time_Interval*      compute; // all compute work, the intervals below are nested in it
         GPU_Time_Interval*      draw;
         GPU_Time_Interval*      ui;
         GPU_Time_Interval*      compute_copy;
+        GPU_Time_Interval*      instance_generation;
+        GPU_Time_Interval*      deform;
+        GPU_Time_Interval*      blas_build;
+        GPU_Time_Interval*      tlas_build;
+        GPU_Time_Interval*      trace;
     } gpu_times;
 };
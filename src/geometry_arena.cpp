@@ -0,0 +1,244 @@
+#include "common.h"
+#include "geometry_arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+//
+// Range_Allocator
+//
+void Range_Allocator::initialize(uint32_t capacity) {
+    this->capacity = capacity;
+    allocated_size = 0;
+    free_ranges.clear();
+    if (capacity > 0)
+        free_ranges.push_back(Range{ 0, capacity });
+}
+
+bool Range_Allocator::allocate(uint32_t size, uint32_t* offset) {
+    if (size == 0) {
+        *offset = 0;
+        return true;
+    }
+    for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+        if (it->size < size)
+            continue;
+
+        *offset = it->offset;
+        it->offset += size;
+        it->size -= size;
+        if (it->size == 0)
+            free_ranges.erase(it);
+        allocated_size += size;
+        return true;
+    }
+    return false;
+}
+
+void Range_Allocator::free(uint32_t offset, uint32_t size) {
+    if (size == 0)
+        return;
+
+    assert(offset + size <= capacity && allocated_size >= size);
+    allocated_size -= size;
+
+    auto next = std::lower_bound(free_ranges.begin(), free_ranges.end(), offset,
+        [](const Range& range, uint32_t offset) { return range.offset < offset; });
+    assert(next == free_ranges.end() || offset + size <= next->offset);
+
+    // Merge with the previous and the next free ranges.
+    if (next != free_ranges.begin()) {
+        auto prev = next - 1;
+        assert(prev->offset + prev->size <= offset);
+        if (prev->offset + prev->size == offset) {
+            prev->size += size;
+            if (next != free_ranges.end() && prev->offset + prev->size == next->offset) {
+                prev->size += next->size;
+                free_ranges.erase(next);
+            }
+            return;
+        }
+    }
+    if (next != free_ranges.end() && offset + size == next->offset) {
+        next->offset = offset;
+        next->size += size;
+        return;
+    }
+    free_ranges.insert(next, Range{ offset, size });
+}
+
+//
+// Geometry_Arena
+//
+void Geometry_Arena::create(Vertex_Layout vertex_layout, uint32_t max_vertex_count, uint32_t max_index_count) {
+    this->vertex_layout = vertex_layout;
+    get_vertex_layout_strides(vertex_layout, &vertex_stride, &attribute_stride);
+
+    // The same usage as for the per-mesh buffers: the deformation writes the vertex buffer and copies it
+    // for the rest pose, the hit shaders read all buffers with the device addresses.
+    const VkBufferUsageFlags vertex_usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    const VkBufferUsageFlags index_usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    vertex_buffer = vk_create_buffer(std::max(VkDeviceSize(max_vertex_count) * vertex_stride, VkDeviceSize(4)), vertex_usage, nullptr, "arena_vertex_buffer");
+    if (attribute_stride)
+        attribute_buffer = vk_create_buffer(std::max(VkDeviceSize(max_vertex_count) * attribute_stride, VkDeviceSize(4)), vertex_usage, nullptr, "arena_attribute_buffer");
+    index_buffer = vk_create_buffer(std::max(VkDeviceSize(max_index_count) * sizeof(uint32_t), VkDeviceSize(4)), index_usage, nullptr, "arena_index_buffer");
+
+    vertex_ranges.initialize(max_vertex_count);
+    index_ranges.initialize(max_index_count);
+    mesh_count = 0;
+}
+
+void Geometry_Arena::destroy() {
+    assert(mesh_count == 0);
+    vertex_buffer.destroy();
+    attribute_buffer.destroy();
+    index_buffer.destroy();
+    *this = Geometry_Arena{};
+}
+
+bool Geometry_Arena::allocate_mesh(uint32_t vertex_count, uint32_t index_count, GPU_Mesh* gpu_mesh) {
+    uint32_t first_vertex, first_index;
+    if (!vertex_ranges.allocate(vertex_count, &first_vertex))
+        return false;
+    if (!index_ranges.allocate(index_count, &first_index)) {
+        vertex_ranges.free(first_vertex, vertex_count);
+        return false;
+    }
+
+    *gpu_mesh = GPU_Mesh{};
+    gpu_mesh->vertex_buffer = vertex_buffer;
+    gpu_mesh->attribute_buffer = attribute_buffer;
+    gpu_mesh->index_buffer = index_buffer;
+    gpu_mesh->vertex_count = vertex_count;
+    gpu_mesh->index_count = index_count;
+    gpu_mesh->vertex_layout = vertex_layout;
+    gpu_mesh->vertex_stride = vertex_stride;
+    gpu_mesh->attribute_stride = attribute_stride;
+    gpu_mesh->lods.push_back(Mesh_LOD{ 0, index_count, 0.f });
+    gpu_mesh->first_vertex = first_vertex;
+    gpu_mesh->first_index = first_index;
+    gpu_mesh->arena_mesh = true;
+    mesh_count++;
+    return true;
+}
+
+void Geometry_Arena::free_mesh(GPU_Mesh& gpu_mesh) {
+    assert(gpu_mesh.arena_mesh && gpu_mesh.vertex_buffer.handle == vertex_buffer.handle);
+    assert(mesh_count > 0);
+    vertex_ranges.free(gpu_mesh.first_vertex, gpu_mesh.vertex_count);
+    index_ranges.free(gpu_mesh.first_index, gpu_mesh.index_count);
+    mesh_count--;
+    gpu_mesh = GPU_Mesh{};
+}
+
+//
+// Upload comparison
+//
+namespace {
+struct Allocation_Counts {
+    uint32_t allocations; // VMA allocations, one per buffer
+    uint32_t blocks; // device memory allocations made by VMA
+};
+}
+
+static Allocation_Counts get_allocation_counts() {
+    VmaStats stats;
+    vmaCalculateStats(vk.allocator, &stats);
+    return Allocation_Counts{ stats.total.allocationCount, stats.total.blockCount };
+}
+
+void compare_geometry_uploads() {
+    const int grid_size = 8;
+    const uint32_t mesh_counts[] = { 256, 1024, 4096 };
+    const Vertex_Layout vertex_layout = vertex_layout_split;
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    create_grid_mesh(grid_size, vertices, indices);
+    const uint32_t vertex_count = uint32_t(vertices.size());
+    const uint32_t index_count = uint32_t(indices.size());
+
+    uint32_t vertex_stride, attribute_stride;
+    get_vertex_layout_strides(vertex_layout, &vertex_stride, &attribute_stride);
+
+    printf("\nGeometry upload comparison, %u triangles per mesh, %s layout:\n", index_count / 3, get_vertex_layout_name(vertex_layout));
+    printf("%10s %-18s %12s %12s %10s %12s\n", "meshes", "method", "allocations", "mem blocks", "submits", "time ms");
+
+    for (uint32_t mesh_count : mesh_counts) {
+        // A buffer per mesh, each buffer is uploaded with its own submit and wait.
+        {
+            const Allocation_Counts counts_before = get_allocation_counts();
+            Timestamp t;
+            std::vector<GPU_Mesh> gpu_meshes(mesh_count);
+            for (GPU_Mesh& gpu_mesh : gpu_meshes)
+                gpu_mesh = create_gpu_mesh(vertices.data(), vertex_count, indices.data(), index_count, vertex_layout);
+            const int64_t time = elapsed_microseconds(t);
+            const Allocation_Counts counts = get_allocation_counts();
+
+            printf("%10u %-18s %12u %12u %10u %12.3f\n", mesh_count, "buffer per mesh",
+                counts.allocations - counts_before.allocations, counts.blocks - counts_before.blocks,
+                mesh_count * (attribute_stride ? 3 : 2), double(time) / 1e3);
+
+            for (GPU_Mesh& gpu_mesh : gpu_meshes)
+                gpu_mesh.destroy();
+        }
+
+        // Geometry arena, the meshes are written to one staging buffer and copied with a single submit.
+        {
+            const Allocation_Counts counts_before = get_allocation_counts();
+            Timestamp t;
+            Geometry_Arena arena;
+            arena.create(vertex_layout, mesh_count * vertex_count, mesh_count * index_count);
+
+            const VkDeviceSize mesh_data_size = VkDeviceSize(vertex_count) * (vertex_stride + attribute_stride) + index_count * sizeof(uint32_t);
+            uint8_t* staging;
+            Vk_Buffer staging_buffer = vk_create_mapped_buffer(mesh_data_size * mesh_count, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, (void**)&staging, "geometry_staging_buffer");
+
+            std::vector<GPU_Mesh> gpu_meshes(mesh_count);
+            std::vector<VkBufferCopy> vertex_regions(mesh_count), attribute_regions(mesh_count), index_regions(mesh_count);
+            for (auto [i, gpu_mesh] : enumerate(gpu_meshes)) {
+                if (!arena.allocate_mesh(vertex_count, index_count, &gpu_mesh))
+                    error("compare_geometry_uploads: geometry arena is full");
+
+                const VkDeviceSize vertex_offset = mesh_data_size * i;
+                const VkDeviceSize attribute_offset = vertex_offset + VkDeviceSize(vertex_count) * vertex_stride;
+                const VkDeviceSize index_offset = attribute_offset + VkDeviceSize(vertex_count) * attribute_stride;
+                write_vertex_streams(vertices.data(), vertex_count, vertex_layout, staging + vertex_offset, staging + attribute_offset);
+                memcpy(staging + index_offset, indices.data(), index_count * sizeof(uint32_t));
+
+                vertex_regions[i] = VkBufferCopy{ vertex_offset, gpu_mesh.get_vertex_offset(), VkDeviceSize(vertex_count) * vertex_stride };
+                attribute_regions[i] = VkBufferCopy{ attribute_offset, gpu_mesh.get_attribute_offset(), VkDeviceSize(vertex_count) * attribute_stride };
+                index_regions[i] = VkBufferCopy{ index_offset, gpu_mesh.get_index_offset(), index_count * sizeof(uint32_t) };
+            }
+
+            vk_execute(vk.command_pools[0], vk.queue, [&](VkCommandBuffer command_buffer) {
+                vkCmdCopyBuffer(command_buffer, staging_buffer.handle, arena.vertex_buffer.handle, mesh_count, vertex_regions.data());
+                if (attribute_stride)
+                    vkCmdCopyBuffer(command_buffer, staging_buffer.handle, arena.attribute_buffer.handle, mesh_count, attribute_regions.data());
+                vkCmdCopyBuffer(command_buffer, staging_buffer.handle, arena.index_buffer.handle, mesh_count, index_regions.data());
+            });
+            const int64_t time = elapsed_microseconds(t);
+            const Allocation_Counts counts = get_allocation_counts();
+
+            printf("%10u %-18s %12u %12u %10u %12.3f\n", mesh_count, "geometry arena",
+                counts.allocations - counts_before.allocations, counts.blocks - counts_before.blocks, 1u, double(time) / 1e3);
+
+            // Free and allocate every other mesh again, the freed ranges are reused without growing the arena.
+            for (uint32_t i = 0; i < mesh_count; i += 2)
+                arena.free_mesh(gpu_meshes[i]);
+            for (uint32_t i = 0; i < mesh_count; i += 2) {
+                if (!arena.allocate_mesh(vertex_count, index_count, &gpu_meshes[i]))
+                    error("compare_geometry_uploads: freed arena ranges are not reused");
+            }
+            assert(arena.vertex_ranges.allocated_size == arena.vertex_ranges.capacity);
+
+            for (GPU_Mesh& gpu_mesh : gpu_meshes)
+                arena.free_mesh(gpu_mesh);
+            assert(arena.vertex_ranges.free_ranges.size() == 1 && arena.index_ranges.free_ranges.size() == 1);
+            arena.destroy();
+            staging_buffer.destroy();
+        }
+    }
+}
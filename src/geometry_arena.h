@@ -0,0 +1,56 @@
+#pragma once
+
+#include "vk_utils.h"
+
+#include <vector>
+
+// Sub-allocates element ranges of a fixed capacity. Free ranges are sorted by offset and merged
+// with the neighbours when a range is freed, allocation takes the first free range that fits.
+struct Range_Allocator {
+    struct Range {
+        uint32_t offset;
+        uint32_t size;
+    };
+    std::vector<Range>  free_ranges;
+    uint32_t            capacity = 0;
+    uint32_t            allocated_size = 0;
+
+    void initialize(uint32_t capacity);
+
+    // Returns false if there is no free range of the given size.
+    bool allocate(uint32_t size, uint32_t* offset);
+    void free(uint32_t offset, uint32_t size);
+};
+
+// Geometry of all scene meshes in shared device-local buffers: vertex buffer, attribute buffer for the split
+// layouts and index buffer. Each mesh gets a vertex range (the same range in the vertex and attribute buffers)
+// and an index range, so thousands of meshes need only three buffer allocations and the uploads of all meshes
+// can be recorded as a few copy commands. Indices are local to the mesh, the draws use the mesh's first vertex
+// as the vertex offset and the acceleration structure builds and the hit shaders use the offset addresses.
+struct Geometry_Arena {
+    Vertex_Layout       vertex_layout = vertex_layout_interleaved;
+    uint32_t            vertex_stride = 0;
+    uint32_t            attribute_stride = 0;
+
+    Vk_Buffer           vertex_buffer;
+    Vk_Buffer           attribute_buffer; // only for split layouts
+    Vk_Buffer           index_buffer;
+
+    Range_Allocator     vertex_ranges;
+    Range_Allocator     index_ranges;
+    uint32_t            mesh_count = 0;
+
+    void create(Vertex_Layout vertex_layout, uint32_t max_vertex_count, uint32_t max_index_count);
+    void destroy();
+
+    // Allocates the ranges for the mesh data. The data is written with transfer commands at the mesh offsets.
+    // Returns false if the arena does not have enough free space.
+    bool allocate_mesh(uint32_t vertex_count, uint32_t index_count, GPU_Mesh* gpu_mesh);
+
+    // Returns the mesh ranges to the arena. The device should not use the mesh anymore.
+    void free_mesh(GPU_Mesh& gpu_mesh);
+};
+
+// Uploads synthetic scenes of many small meshes with a buffer per mesh (create_gpu_mesh) and with the geometry
+// arena, prints buffer allocations, device memory blocks, queue submits and upload time for each approach.
+void compare_geometry_uploads();
@@ -0,0 +1,167 @@
+#include "instance_generator.h"
+#include "matrix.h"
+#include "vk_utils.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace {
+// Push_Constants in generate_instances.comp.glsl.
+struct Push_Constants {
+    float       model_transform[3][4];
+    uint32_t    object_count;
+    uint32_t    copy_count;
+    uint32_t    grid_size; // copies per grid row
+    uint32_t    layout;
+    float       spacing;
+    float       time;
+};
+
+constexpr uint32_t group_size = 64;
+}
+
+const char* get_instance_layout_name(Instance_Layout layout) {
+    switch (layout) {
+        case instance_layout_grid: return "grid";
+        case instance_layout_scatter: return "scatter";
+        case instance_layout_animated: return "animated";
+        default: return "unknown";
+    }
+}
+
+bool parse_instance_layout(const std::string& str, Instance_Layout* layout) {
+    for (int i = 0; i < instance_layout_count; i++) {
+        if (str == get_instance_layout_name(Instance_Layout(i))) {
+            *layout = Instance_Layout(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Instance_Generator::create() {
+    descriptor_set_layout = Descriptor_Set_Layout()
+        .storage_buffer (0, VK_SHADER_STAGE_COMPUTE_BIT)
+        .storage_buffer (1, VK_SHADER_STAGE_COMPUTE_BIT)
+        .storage_buffer (2, VK_SHADER_STAGE_COMPUTE_BIT)
+        .create         ("generate_instances_set_layout");
+
+    // pipeline layout
+    {
+        VkPushConstantRange range;
+        range.stageFlags    = VK_SHADER_STAGE_COMPUTE_BIT;
+        range.offset        = 0;
+        range.size          = sizeof(Push_Constants);
+
+        VkPipelineLayoutCreateInfo create_info { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+        create_info.setLayoutCount          = 1;
+        create_info.pSetLayouts             = &descriptor_set_layout;
+        create_info.pushConstantRangeCount  = 1;
+        create_info.pPushConstantRanges     = &range;
+
+        VK_CHECK(vkCreatePipelineLayout(vk.device, &create_info, nullptr, &pipeline_layout));
+    }
+
+    // pipeline
+    {
+        VkShaderModule shader = vk_load_spirv("spirv/generate_instances.comp.spv");
+
+        VkPipelineShaderStageCreateInfo compute_stage { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+        compute_stage.stage    = VK_SHADER_STAGE_COMPUTE_BIT;
+        compute_stage.module   = shader;
+        compute_stage.pName    = "main";
+
+        VkComputePipelineCreateInfo create_info{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+        create_info.stage = compute_stage;
+        create_info.layout = pipeline_layout;
+        VK_CHECK(vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
+
+        vkDestroyShaderModule(vk.device, shader, nullptr);
+    }
+
+    // descriptor set, updated when the buffers are created
+    {
+        VkDescriptorSetAllocateInfo alloc_info { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+        alloc_info.descriptorPool     = vk.descriptor_pool;
+        alloc_info.descriptorSetCount = 1;
+        alloc_info.pSetLayouts        = &descriptor_set_layout;
+        VK_CHECK(vkAllocateDescriptorSets(vk.device, &alloc_info, &descriptor_set));
+    }
+}
+
+void Instance_Generator::destroy() {
+    instance_buffer.destroy();
+    object_accel_buffer.destroy();
+    object_sbt_offset_buffer.destroy();
+    vkDestroyDescriptorSetLayout(vk.device, descriptor_set_layout, nullptr);
+    vkDestroyPipelineLayout(vk.device, pipeline_layout, nullptr);
+    vkDestroyPipeline(vk.device, pipeline, nullptr);
+    *this = Instance_Generator{};
+}
+
+void Instance_Generator::create_buffers(uint32_t object_count, uint32_t copy_count) {
+    assert(object_count > 0 && copy_count > 0);
+    instance_buffer.destroy();
+    object_accel_buffer.destroy();
+    object_sbt_offset_buffer.destroy();
+
+    this->object_count = object_count;
+    this->copy_count = copy_count;
+
+    const VkDeviceSize instance_buffer_size = VkDeviceSize(get_instance_count()) * sizeof(VkAccelerationStructureInstanceKHR);
+    VkBufferUsageFlags instance_usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    if (vk.raytracing_supported)
+        instance_usage |= VK_BUFFER_USAGE_RAY_TRACING_BIT_KHR;
+    instance_buffer = vk_create_buffer(instance_buffer_size, instance_usage, nullptr, "instance_buffer");
+
+    object_accel_buffer = vk_create_mapped_buffer(object_count * sizeof(VkDeviceAddress),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &(void*&)mapped_object_accels, "object_accel_buffer");
+    memset(mapped_object_accels, 0, object_count * sizeof(VkDeviceAddress));
+
+    object_sbt_offset_buffer = vk_create_mapped_buffer(object_count * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &(void*&)mapped_object_sbt_offsets, "object_sbt_offset_buffer");
+    memset(mapped_object_sbt_offsets, 0, object_count * sizeof(uint32_t));
+
+    Descriptor_Writes(descriptor_set)
+        .storage_buffer(0, instance_buffer.handle, 0, VK_WHOLE_SIZE)
+        .storage_buffer(1, object_accel_buffer.handle, 0, VK_WHOLE_SIZE)
+        .storage_buffer(2, object_sbt_offset_buffer.handle, 0, VK_WHOLE_SIZE);
+}
+
+void Instance_Generator::cmd_generate_instances(VkCommandBuffer command_buffer, Instance_Layout layout, const Matrix3x4& model_transform, float spacing, float time) {
+    // The instances are read by the vertex shaders and by the top level build. On the compute
+    // queue the vertex shaders are synchronized with the frame semaphores.
+    VkPipelineStageFlags reader_stages = 0;
+    VkAccessFlags reader_access = 0;
+    if (!vk_is_async_compute_command_buffer(command_buffer)) {
+        reader_stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+        reader_access |= VK_ACCESS_SHADER_READ_BIT;
+    }
+    if (vk.raytracing_supported) {
+        reader_stages |= VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+        reader_access |= VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    }
+
+    // The previous frame can still read the instances.
+    vkCmdPipelineBarrier(command_buffer, reader_stages, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    Push_Constants push_constants;
+    memcpy(push_constants.model_transform, model_transform.a, sizeof(push_constants.model_transform));
+    push_constants.object_count = object_count;
+    push_constants.copy_count   = copy_count;
+    push_constants.grid_size    = (uint32_t)std::ceil(std::sqrt(double(copy_count)));
+    push_constants.layout       = layout;
+    push_constants.spacing      = spacing;
+    push_constants.time         = time;
+
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &descriptor_set, 0, nullptr);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+    vkCmdDispatch(command_buffer, (get_instance_count() + group_size - 1) / group_size, 1, 1);
+
+    VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = reader_access;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, reader_stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
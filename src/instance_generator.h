@@ -0,0 +1,50 @@
+#pragma once
+
+#include "vk.h"
+
+#include <string>
+
+struct Matrix3x4;
+
+// Placement of the scene copies. Copy 0 is always placed at the origin.
+enum Instance_Layout {
+    instance_layout_grid,       // square grid in XZ plane
+    instance_layout_scatter,    // random positions in the grid area and random rotations around Y axis
+    instance_layout_animated,   // grid, each copy moves up and down and rotates with its own phase
+    instance_layout_count
+};
+
+const char* get_instance_layout_name(Instance_Layout layout);
+bool parse_instance_layout(const std::string& str, Instance_Layout* layout);
+
+// Writes top level instances for copies of the scene objects with a compute shader. The instance buffer
+// is the top level build input and also provides per-instance transforms to the instanced raster draws.
+// Instances of one object are stored sequentially: instance index = object index * copy_count + copy index,
+// so each object is drawn with a single instanced draw call.
+struct Instance_Generator {
+    VkDescriptorSetLayout   descriptor_set_layout;
+    VkPipelineLayout        pipeline_layout;
+    VkPipeline              pipeline;
+    VkDescriptorSet         descriptor_set;
+
+    Vk_Buffer               instance_buffer; // array of VkAccelerationStructureInstanceKHR
+    Vk_Buffer               object_accel_buffer; // bottom level accel referenced by the instances of each object
+    VkDeviceAddress*        mapped_object_accels = nullptr;
+    Vk_Buffer               object_sbt_offset_buffer; // instance SBT record offset of each object's hit record
+    uint32_t*               mapped_object_sbt_offsets = nullptr;
+    uint32_t                object_count = 0;
+    uint32_t                copy_count = 0;
+
+    void create();
+    void destroy();
+
+    // Recreates the buffers for copy_count copies of object_count objects. The device should be idle
+    // if the buffers were already created. Object accels and SBT offsets are initialized with zero,
+    // instances that reference null accel are inactive.
+    void create_buffers(uint32_t object_count, uint32_t copy_count);
+    uint32_t get_instance_count() const { return object_count * copy_count; }
+
+    // Each instance transform is the copy placement applied after model_transform. spacing is
+    // the distance between the neighbor copies, time drives the animated layout.
+    void cmd_generate_instances(VkCommandBuffer command_buffer, Instance_Layout layout, const Matrix3x4& model_transform, float spacing, float time);
+};
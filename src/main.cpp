@@ -1,3 +1,4 @@
+#include "benchmarks.h"
 #include "demo.h"
 #include "platform.h"
 
@@ -5,16 +6,145 @@
 
 #include <cassert>
 
-struct Command_Line_Options {
-    bool enable_validation_layers;
-};
-
 static bool parse_command_line(int argc, char** argv, Command_Line_Options& options) {
     bool found_unknown_option = false;
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--validation-layers") == 0) {
             options.enable_validation_layers = true;
         }
+        else if (strcmp(argv[i], "--no-mesh-cache") == 0) {
+            options.disable_mesh_cache = true;
+        }
+        else if (strcmp(argv[i], "--optimize-mesh") == 0) {
+            options.optimize_mesh = true;
+        }
+        else if (strcmp(argv[i], "--split-positions") == 0) {
+            options.split_positions = true;
+        }
+        else if (strcmp(argv[i], "--compare-blas-builds") == 0) {
+            options.compare_blas_builds = true;
+        }
+        else if (strcmp(argv[i], "--compare-geometry-uploads") == 0) {
+            options.compare_geometry_uploads = true;
+        }
+        else if (strcmp(argv[i], "--no-accel-cache") == 0) {
+            options.disable_accel_cache = true;
+        }
+        else if (strcmp(argv[i], "--compact-blas") == 0) {
+            options.compact_blas = true;
+        }
+        else if (strcmp(argv[i], "--compact-vertices") == 0) {
+            options.compact_vertex_format = true;
+        }
+        else if (strcmp(argv[i], "--blas-scratch-budget") == 0) {
+            if (i == argc-1) {
+                printf("--blas-scratch-budget value is missing\n");
+            } else {
+                options.blas_scratch_budget_mb = (uint32_t)atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--tlas-max-refits") == 0) {
+            if (i == argc-1) {
+                printf("--tlas-max-refits value is missing\n");
+            } else {
+                options.tlas_max_refit_count = (uint32_t)atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--blas-flags") == 0 || strcmp(argv[i], "--tlas-flags") == 0) {
+            if (i == argc-1) {
+                printf("%s value is missing\n", argv[i]);
+            } else {
+                VkBuildAccelerationStructureFlagsKHR flags;
+                if (!parse_build_preference_flags(argv[i+1], &flags))
+                    printf("Invalid %s value: %s\n", argv[i], argv[i+1]);
+                else if (strcmp(argv[i], "--blas-flags") == 0)
+                    options.blas_flags = flags;
+                else
+                    options.tlas_flags = flags;
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--host-build-triangles") == 0) {
+            if (i == argc-1) {
+                printf("--host-build-triangles value is missing\n");
+            } else {
+                options.host_build_max_triangles = (uint32_t)atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--build-flags-benchmark") == 0) {
+            if (i == argc-1) {
+                printf("--build-flags-benchmark value is missing\n");
+            } else {
+                options.build_flags_benchmark_frames = (uint32_t)atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--instances") == 0) {
+            if (i == argc-1) {
+                printf("--instances value is missing\n");
+            } else {
+                options.instance_copies = (uint32_t)atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--instance-layout") == 0) {
+            if (i == argc-1) {
+                printf("--instance-layout value is missing\n");
+            } else {
+                if (!parse_instance_layout(argv[i+1], &options.instance_layout))
+                    printf("Invalid --instance-layout value: %s\n", argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--instance-benchmark") == 0) {
+            if (i == argc-1) {
+                printf("--instance-benchmark value is missing\n");
+            } else {
+                options.instance_benchmark_frames = (uint32_t)atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--adaptive-sampling-benchmark") == 0) {
+            if (i == argc-1) {
+                printf("--adaptive-sampling-benchmark value is missing\n");
+            } else {
+                options.adaptive_sampling_benchmark_frames = (uint32_t)atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--texture-lod-benchmark") == 0) {
+            if (i == argc-1) {
+                printf("--texture-lod-benchmark value is missing\n");
+            } else {
+                options.texture_lod_benchmark_frames = (uint32_t)atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--deform") == 0) {
+            options.deform_meshes = true;
+        }
+        else if (strcmp(argv[i], "--blas-max-refits") == 0) {
+            if (i == argc-1) {
+                printf("--blas-max-refits value is missing\n");
+            } else {
+                options.blas_max_refit_count = (uint32_t)atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--no-async-compute") == 0) {
+            options.disable_async_compute = true;
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0) {
+            if (i == argc-1) {
+                printf("--benchmark value is missing\n");
+            } else {
+                options.benchmark = argv[i+1];
+                i++;
+            }
+        }
         else if (strcmp(argv[i], "--data-dir") == 0) {
             if (i == argc-1) {
                 printf("--data-dir value is missing\n");
@@ -28,6 +158,30 @@ static bool parse_command_line(int argc, char** argv, Command_Line_Options& opti
             printf("%-25s Path to the data directory. Default is ./data.\n", "--data-dir");
             printf("%-25s Enables Vulkan validation layers.\n", "--validation-layers");
             printf("%-25s Allows to assign debug names to Vulkan objects.\n", "--debug-names");
+            printf("%-25s Always parses the mesh file, does not read or write binary mesh cache.\n", "--no-mesh-cache");
+            printf("%-25s Reorders mesh triangles and vertices for vertex cache, overdraw and vertex fetch efficiency.\n", "--optimize-mesh");
+            printf("%-25s Stores vertex positions and other attributes in separate buffers.\n", "--split-positions");
+            printf("%-25s Prints bottom level acceleration structure build times for interleaved and split vertex layouts, serial and batched builds, host and device builds.\n", "--compare-blas-builds");
+            printf("%-25s Scratch memory limit in megabytes for one batch of bottom level builds. 0 builds them one by one. Default is %u.\n", "--blas-scratch-budget <mb>", uint32_t(default_bottom_level_scratch_budget >> 20));
+            printf("%-25s Number of successive top level refits before the full rebuild. 0 rebuilds every frame. Default is %u.\n", "--tlas-max-refits <n>", default_top_level_max_refit_count);
+            printf("%-25s Bottom level build preference: default, fast-trace, fast-build, low-memory or '+' combination.\n", "--blas-flags <flags>");
+            printf("%-25s Top level build preference, the same values as for --blas-flags.\n", "--tlas-flags <flags>");
+            printf("%-25s Traces the given number of frames for each combination of build flags and prints CSV results.\n", "--build-flags-benchmark <n>");
+            printf("%-25s Prints buffer allocations and upload times of synthetic scenes with thousands of meshes, with a buffer per mesh and with the geometry arena.\n", "--compare-geometry-uploads");
+            printf("%-25s Builds bottom level structures with up to n triangles on the CPU if the device supports host builds.\n", "--host-build-triangles <n>");
+            printf("%-25s Always builds acceleration structures, does not read or write serialized acceleration structure cache.\n", "--no-accel-cache");
+            printf("%-25s Compacts bottom level acceleration structures after the build and prints memory savings.\n", "--compact-blas");
+            printf("%-25s Uses compact vertex format: float positions, octahedral-encoded normals and half-float uvs.\n", "--compact-vertices");
+            printf("%-25s Number of scene copies placed by the compute shader, each copy adds a top level instance per object. Default is 1.\n", "--instances <n>");
+            printf("%-25s Placement of the scene copies: grid, scatter or animated. Default is grid.\n", "--instance-layout <name>");
+            printf("%-25s Traces the given number of frames for each power of 4 copy count up to --instances value and prints CSV results.\n", "--instance-benchmark <n>");
+            printf("%-25s Accumulates a reference image, traces the given number of frames with uniform 4 spp and with adaptive sampling for several contrast thresholds and prints CSV results with the equal quality trace time.\n", "--adaptive-sampling-benchmark <n>");
+            printf("%-25s Traces the given number of frames with ray differentials and with ray cones texture LOD and prints payload size, trace time and the image difference.\n", "--texture-lod-benchmark <n>");
+            printf("%-25s Deforms the meshes with a compute shader every frame and refits bottom level structures.\n", "--deform");
+            printf("%-25s Number of successive bottom level refits of the deformed meshes before the full rebuild. Default is %u.\n", "--blas-max-refits <n>", default_bottom_level_max_refit_count);
+            printf("%-25s Records acceleration structure builds and other compute work into the graphics command buffer instead of the dedicated compute queue.\n", "--no-async-compute");
+            printf("%-25s Runs CPU benchmark and exits. Available benchmarks:\n", "--benchmark <name>");
+            print_benchmark_names();
             printf("%-25s Shows this information.\n", "--help");
             return false;
         }
@@ -77,6 +231,12 @@ int main(int argc, char** argv) {
     if (!parse_command_line(argc, argv, options))
         return 0;
 
+    if (!options.benchmark.empty()) {
+        if (!run_benchmark(options.benchmark))
+            printf("Unknown benchmark: %s\n", options.benchmark.c_str());
+        return 0;
+    }
+
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit())
         error("glfwInit failed");
@@ -87,13 +247,13 @@ int main(int argc, char** argv) {
     glfwSetKeyCallback(glfw_window, glfw_key_callback);
 
     Vk_Demo demo{};
-    demo.initialize(glfw_window, options.enable_validation_layers);
+    demo.initialize(glfw_window, options);
 
     bool prev_vsync = demo.vsync_enabled();
 
     bool window_active = true;
 
-    while (!glfwWindowShouldClose(glfw_window)) {
+    while (!glfwWindowShouldClose(glfw_window) && !demo.exit_requested()) {
         if (window_active)
             demo.run_frame();
 
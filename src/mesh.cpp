@@ -1,163 +1,509 @@
 #include "mesh.h"
+#include "obj_reader.h"
+#include "thread_pool.h"
 
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
 #include <unordered_map>
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
+static inline bool operator==(const Vertex& v1, const Vertex& v2) {
+    return v1.pos == v2.pos && v1.normal == v2.normal && v1.uv == v2.uv;
+}
 
-namespace std {
-template<> struct hash<Vertex> {
-    size_t operator()(Vertex const& v) const {
-        size_t hash = 0;
-        hash_combine(hash, v.pos);
-        hash_combine(hash, v.normal);
-        hash_combine(hash, v.uv);
-        return hash;
+static inline uint32_t float_bits(float f) {
+    f += 0.f; // -0 -> +0, they compare equal
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+template <int N>
+static inline uint32_t hash_floats(const float (&components)[N]) {
+    uint64_t h = 0x9e3779b97f4a7c15ull;
+    for (float f : components) {
+        h ^= float_bits(f);
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
     }
-};
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 29;
+    return uint32_t(h);
 }
 
-static inline bool operator==(const Vertex& v1, const Vertex& v2) {
-    return v1.pos == v2.pos && v1.normal == v2.normal && v1.uv == v2.uv;
+static inline uint32_t hash_vertex(const Vertex& v) {
+    const float components[8] = { v.pos.x, v.pos.y, v.pos.z, v.normal.x, v.normal.y, v.normal.z, v.uv.x, v.uv.y };
+    return hash_floats(components);
 }
 
-Mesh load_obj_mesh(const std::string& path, float additional_scale) {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string err;
+static inline uint32_t hash_position(const Vector3& p) {
+    const float components[3] = { p.x, p.y, p.z };
+    return hash_floats(components);
+}
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str()))
-        error("failed to load obj model: " + path);
+namespace {
+// Open-addressing hash table with linear probing that maps element to the id of the first equal element.
+// Stores the hash together with the id, so the element data is accessed only for probable matches
+// and the table can grow without touching the elements.
+template <typename T>
+class Weld_Table {
+public:
+    static constexpr uint32_t empty_id = 0xffffffff;
 
-    std::unordered_map<Vertex, std::size_t> unique_vertices;
-    Vector3 mesh_min(Infinity);
-    Vector3 mesh_max(-Infinity);
+    // The table memory is reported to counter if it is not null.
+    explicit Weld_Table(uint32_t expected_count, Allocation_Counter* counter = nullptr) : entries(Counting_Allocator<Entry>(counter)) {
+        uint32_t capacity = 16;
+        while (capacity * 3 < expected_count * 4)
+            capacity *= 2;
+        entries.resize(capacity, Entry{ 0, empty_id });
+        mask = capacity - 1;
+    }
 
-    Mesh mesh;
+    // Returns id of the element equal to elements[id] that was inserted earlier or inserts the element and returns id.
+    uint32_t find_or_insert(const T* elements, uint32_t id, uint32_t hash) {
+        const T& v = elements[id];
+        uint32_t slot = hash & mask;
+        for (;; slot = (slot + 1) & mask) {
+            const Entry& entry = entries[slot];
+            if (entry.id == empty_id)
+                break;
+            if (entry.hash == hash && elements[entry.id] == v)
+                return entry.id;
+        }
+        entries[slot] = Entry{ hash, id };
+        if (++count * 4 > entries.size() * 3)
+            grow();
+        return id;
+    }
+
+private:
+    struct Entry {
+        uint32_t hash;
+        uint32_t id;
+    };
+
+    void grow() {
+        Entry_Vector old_entries(entries.size() * 2, Entry{ 0, empty_id }, entries.get_allocator());
+        old_entries.swap(entries);
+        mask = (uint32_t)entries.size() - 1;
+        for (const Entry& entry : old_entries) {
+            if (entry.id == empty_id)
+                continue;
+            uint32_t slot = entry.hash & mask;
+            while (entries[slot].id != empty_id)
+                slot = (slot + 1) & mask;
+            entries[slot] = entry;
+        }
+    }
 
-    for (const auto& shape : shapes) {
-        for (const auto& index : shape.mesh.indices) {
-            Vertex vertex;
-
-            vertex.pos = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2]
-            };
-
-            if (!attrib.normals.empty()) {
-                assert(index.normal_index != -1);
-                vertex.normal = {
-                    attrib.normals[3 * index.normal_index + 0],
-                    attrib.normals[3 * index.normal_index + 1],
-                    attrib.normals[3 * index.normal_index + 2],
-                };
+    using Entry_Vector = std::vector<Entry, Counting_Allocator<Entry>>;
+    Entry_Vector entries;
+    uint32_t mask;
+    uint32_t count = 0;
+};
+}
+
+void weld_vertices(const std::vector<Vertex>& corner_vertices, bool parallel, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+    Allocation_Counter* working_memory_counter) {
+    const uint32_t corner_count = (uint32_t)corner_vertices.size();
+    const Vertex* corners = corner_vertices.data();
+    vertices.clear();
+    indices.resize(corner_count);
+
+    // In a typical mesh each vertex is shared by several triangles.
+    const uint32_t corners_per_vertex_estimate = 4;
+
+    if (!parallel) {
+        vertices.reserve(corner_count / corners_per_vertex_estimate);
+        Weld_Table<Vertex> table(corner_count / corners_per_vertex_estimate, working_memory_counter);
+        for (uint32_t i = 0; i < corner_count; i++) {
+            uint32_t first = table.find_or_insert(corners, i, hash_vertex(corners[i]));
+            if (first == i) {
+                indices[i] = (uint32_t)vertices.size();
+                vertices.push_back(corners[i]);
             } else {
-                vertex.normal = Vector3_Zero;
+                indices[i] = indices[first];
             }
+        }
+        return;
+    }
+
+    // Equal vertices have equal hashes, so the corners can be partitioned by hash prefix and
+    // each partition welded independently. The result is the same as for the serial version:
+    // vertex ids are assigned in the order of the first occurrence.
+    const uint32_t partition_bits = 6;
+    const uint32_t partition_count = 1 << partition_bits;
+    const uint32_t chunk_count = std::max(1u, std::min(get_thread_count() * 4, corner_count / 16384));
+    auto chunk_begin = [corner_count, chunk_count](uint32_t chunk) { return uint32_t(uint64_t(corner_count) * chunk / chunk_count); };
+
+    // Temporary arrays are counted as working memory.
+    using Uint32_Vector = std::vector<uint32_t, Counting_Allocator<uint32_t>>;
+    const Counting_Allocator<uint32_t> allocator(working_memory_counter);
+
+    Uint32_Vector hashes(corner_count, allocator);
+    Uint32_Vector histograms(chunk_count * partition_count, allocator);
+    parallel_for(chunk_count, [&](uint32_t chunk, uint32_t) {
+        uint32_t* histogram = &histograms[chunk * partition_count];
+        for (uint32_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++) {
+            hashes[i] = hash_vertex(corners[i]);
+            histogram[hashes[i] >> (32 - partition_bits)]++;
+        }
+    });
+
+    // Convert histograms to scatter offsets. Corners in each partition are sorted by index.
+    Uint32_Vector partition_offsets(partition_count + 1, allocator);
+    uint32_t offset = 0;
+    for (uint32_t p = 0; p < partition_count; p++) {
+        partition_offsets[p] = offset;
+        for (uint32_t chunk = 0; chunk < chunk_count; chunk++) {
+            uint32_t count = histograms[chunk * partition_count + p];
+            histograms[chunk * partition_count + p] = offset;
+            offset += count;
+        }
+    }
+    partition_offsets[partition_count] = offset;
+
+    Uint32_Vector partitioned_corners(corner_count, allocator);
+    parallel_for(chunk_count, [&](uint32_t chunk, uint32_t) {
+        uint32_t* scatter_offsets = &histograms[chunk * partition_count];
+        for (uint32_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++)
+            partitioned_corners[scatter_offsets[hashes[i] >> (32 - partition_bits)]++] = i;
+    });
+
+    // For each corner find the first corner with the same vertex. The result is temporarily stored in indices.
+    parallel_for(partition_count, [&](uint32_t p, uint32_t) {
+        const uint32_t begin = partition_offsets[p];
+        const uint32_t end = partition_offsets[p + 1];
+        Weld_Table<Vertex> table((end - begin) / corners_per_vertex_estimate, working_memory_counter);
+        for (uint32_t k = begin; k < end; k++) {
+            uint32_t i = partitioned_corners[k];
+            indices[i] = table.find_or_insert(corners, i, hashes[i]);
+        }
+    });
+    hashes = Uint32_Vector(allocator);
+    partitioned_corners = Uint32_Vector(allocator);
+
+    // Assign vertex ids to the first occurrences (prefix sum over chunks).
+    Uint32_Vector chunk_vertex_offsets(chunk_count + 1, allocator);
+    parallel_for(chunk_count, [&](uint32_t chunk, uint32_t) {
+        uint32_t count = 0;
+        for (uint32_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++)
+            count += (indices[i] == i);
+        chunk_vertex_offsets[chunk + 1] = count;
+    });
+    for (uint32_t chunk = 0; chunk < chunk_count; chunk++)
+        chunk_vertex_offsets[chunk + 1] += chunk_vertex_offsets[chunk];
 
-            if (!attrib.texcoords.empty()) {
-                vertex.uv = {
-                    attrib.texcoords[2 * index.texcoord_index + 0],
-                    1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-                };
+    vertices.resize(chunk_vertex_offsets[chunk_count]);
+    std::vector<uint8_t, Counting_Allocator<uint8_t>> is_first(corner_count, allocator);
+    parallel_for(chunk_count, [&](uint32_t chunk, uint32_t) {
+        uint32_t id = chunk_vertex_offsets[chunk];
+        for (uint32_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++) {
+            if (indices[i] == i) {
+                is_first[i] = 1;
+                vertices[id] = corners[i];
+                indices[i] = id++;
+            }
+        }
+    });
+    // Other corners reference the first occurrence which already stores vertex id.
+    parallel_for(chunk_count, [&](uint32_t chunk, uint32_t) {
+        for (uint32_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++) {
+            if (!is_first[i])
+                indices[i] = indices[indices[i]];
+        }
+    });
+}
+
+Mesh create_obj_mesh(const Obj_Data& obj, uint32_t first_corner, uint32_t corner_count) {
+    // Build vertex for each face corner and then remove duplicates.
+    std::vector<Vertex> corner_vertices(corner_count);
+    const uint32_t chunk_count = std::max(1u, std::min(get_thread_count() * 4, corner_count / 16384));
+    parallel_for(chunk_count, [&obj, &corner_vertices, first_corner, corner_count, chunk_count](uint32_t chunk, uint32_t) {
+        const size_t begin = size_t(corner_count) * chunk / chunk_count;
+        const size_t end = size_t(corner_count) * (chunk + 1) / chunk_count;
+        for (size_t i = begin; i < end; i++) {
+            const Obj_Index& index = obj.corners[first_corner + i];
+            Vertex& vertex = corner_vertices[i];
+            vertex.pos = obj.positions[index.position];
+
+            if (!obj.normals.empty()) {
+                assert(index.normal != -1);
+                vertex.normal = obj.normals[index.normal];
             } else {
-                vertex.uv = Vector2_Zero;
+                vertex.normal = Vector3_Zero;
             }
 
-            if (unique_vertices.count(vertex) == 0) {
-                unique_vertices[vertex] = mesh.vertices.size();
-                mesh.vertices.push_back(vertex);
-
-                // update mesh bounds
-                mesh_min.x = std::min(mesh_min.x, vertex.pos.x);
-                mesh_min.y = std::min(mesh_min.y, vertex.pos.y);
-                mesh_min.z = std::min(mesh_min.z, vertex.pos.z);
-                mesh_max.x = std::max(mesh_max.x, vertex.pos.x);
-                mesh_max.y = std::max(mesh_max.y, vertex.pos.y);
-                mesh_max.z = std::max(mesh_max.z, vertex.pos.z);
+            if (!obj.texcoords.empty()) {
+                const Vector2& uv = obj.texcoords[index.texcoord];
+                vertex.uv = { uv.x, 1.0f - uv.y };
+            } else {
+                vertex.uv = Vector2_Zero;
             }
-            mesh.indices.push_back((uint32_t)unique_vertices[vertex]);
         }
+    });
+
+    Mesh mesh;
+    weld_vertices(corner_vertices, get_thread_count() > 1 && corner_vertices.size() >= 65536, mesh.vertices, mesh.indices);
+    corner_vertices = std::vector<Vertex>();
+
+    // compute mesh bounds
+    Vector3 mesh_min(Infinity);
+    Vector3 mesh_max(-Infinity);
+    for (const Vertex& vertex : mesh.vertices) {
+        mesh_min.x = std::min(mesh_min.x, vertex.pos.x);
+        mesh_min.y = std::min(mesh_min.y, vertex.pos.y);
+        mesh_min.z = std::min(mesh_min.z, vertex.pos.z);
+        mesh_max.x = std::max(mesh_max.x, vertex.pos.x);
+        mesh_max.y = std::max(mesh_max.y, vertex.pos.y);
+        mesh_max.z = std::max(mesh_max.z, vertex.pos.z);
     }
+    mesh.bounds_min = mesh_min;
+    mesh.bounds_max = mesh_max;
 
-    if (attrib.normals.empty())
-        compute_normals(&mesh.vertices[0].pos, (int)mesh.vertices.size(), (int)sizeof(Vertex), mesh.indices.data(), (int)mesh.indices.size(), &mesh.vertices[0].normal);
+    if (obj.normals.empty())
+        compute_normals(&mesh.vertices[0].pos, (int)mesh.vertices.size(), (int)sizeof(Vertex), mesh.indices.data(), (int)mesh.indices.size(), &mesh.vertices[0].normal, true);
 
-    // scale and center the mesh
-    Vector3 diag = mesh_max - mesh_min;
-    float max_size = std::max(diag.x, std::max(diag.y, diag.z));
-    float scale = (2.f / max_size) * additional_scale;
+    return mesh;
+}
 
-    Vector3 center = (mesh_min + mesh_max) * 0.5f;
+void transform_mesh(Mesh& mesh, Vector3 center, float scale) {
     for (auto& v : mesh.vertices) {
         v.pos -= center;
         v.pos *= scale;
     }
+    mesh.bounds_min = (mesh.bounds_min - center) * scale;
+    mesh.bounds_max = (mesh.bounds_max - center) * scale;
+}
+
+Mesh load_obj_mesh(const std::string& path, float additional_scale) {
+    Obj_Data obj;
+    if (!read_obj_file(path, obj))
+        error("failed to load obj model: " + path);
+
+    Mesh mesh = create_obj_mesh(obj, 0, (uint32_t)obj.corners.size());
+
+    // scale and center the mesh
+    Vector3 diag = mesh.bounds_max - mesh.bounds_min;
+    float max_size = std::max(diag.x, std::max(diag.y, diag.z));
+    float scale = (2.f / max_size) * additional_scale;
+
+    Vector3 center = (mesh.bounds_min + mesh.bounds_max) * 0.5f;
+    transform_mesh(mesh, center, scale);
     return mesh;
 }
 
-void compute_normals(const Vector3* vertex_positions, uint32_t vertex_count, uint32_t vertex_stride, const uint32_t* indices, uint32_t index_count, Vector3* normals) {
-    std::unordered_map<Vector3, std::vector<uint32_t>> duplicated_vertices; // due to different texture coordinates
+static uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+
+    const uint16_t sign = uint16_t((x >> 16) & 0x8000);
+    const uint32_t abs_x = x & 0x7fffffff;
+
+    if (abs_x >= 0x7f800000) // inf or nan
+        return sign | 0x7c00 | (abs_x > 0x7f800000 ? 0x200 : 0);
+    if (abs_x >= 0x477ff000) // rounds to value that is too large for half
+        return sign | 0x7c00;
+    if (abs_x < 0x38800000) { // half denormal
+        float abs_f;
+        memcpy(&abs_f, &abs_x, sizeof(abs_f));
+        return sign | uint16_t(std::nearbyint(abs_f * 16777216.f)); // divide by 2^-24
+    }
+    // Rebias exponent and round mantissa to nearest even.
+    return sign | uint16_t((abs_x - 0x38000000 + 0xfff + ((abs_x >> 13) & 1)) >> 13);
+}
+
+static int16_t float_to_snorm16(float f) {
+    return int16_t(std::round(std::clamp(f, -1.f, 1.f) * 32767.f));
+}
+
+// Octahedral encoding of the unit vector (Cigolle et al., A Survey of Efficient Representations for Independent Unit Vectors).
+static void oct_encode(const Vector3& n, int16_t encoded[2]) {
+    float l1_norm = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (!(l1_norm > 0.f)) {
+        encoded[0] = encoded[1] = 0;
+        return;
+    }
+    float x = n.x / l1_norm;
+    float y = n.y / l1_norm;
+    if (n.z < 0.f) {
+        float wrapped_x = (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f);
+        float wrapped_y = (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = wrapped_x;
+        y = wrapped_y;
+    }
+    encoded[0] = float_to_snorm16(x);
+    encoded[1] = float_to_snorm16(y);
+}
+
+void create_split_vertex_streams(const Vertex* vertices, uint32_t vertex_count, std::vector<Vector3>& positions, std::vector<Vertex_Attributes>& attributes) {
+    positions.resize(vertex_count);
+    attributes.resize(vertex_count);
     for (uint32_t i = 0; i < vertex_count; i++) {
-        const Vector3& pos = index_array_with_stride(vertex_positions, vertex_stride, i);
-        duplicated_vertices[pos].push_back(i);
+        positions[i] = vertices[i].pos;
+        attributes[i].normal = vertices[i].normal;
+        attributes[i].uv = vertices[i].uv;
     }
+}
 
-    std::vector<bool> has_duplicates(vertex_count);
+void create_compact_vertex_streams(const Vertex* vertices, uint32_t vertex_count, std::vector<Vector3>& positions, std::vector<Compact_Vertex_Attributes>& attributes) {
+    positions.resize(vertex_count);
+    attributes.resize(vertex_count);
     for (uint32_t i = 0; i < vertex_count; i++) {
-        const Vector3& pos = index_array_with_stride(vertex_positions, vertex_stride, i);
-        uint32_t vertex_count = (uint32_t)duplicated_vertices[pos].size();
-        assert(vertex_count > 0);
-        has_duplicates[i] = vertex_count > 1;
+        const Vertex& v = vertices[i];
+        positions[i] = v.pos;
+        oct_encode(v.normal, attributes[i].normal);
+        attributes[i].uv[0] = float_to_half(v.uv.x);
+        attributes[i].uv[1] = float_to_half(v.uv.y);
     }
+}
 
+void compute_normals(const Vector3* vertex_positions, uint32_t vertex_count, uint32_t vertex_stride, const uint32_t* indices, uint32_t index_count, Vector3* normals, bool parallel) {
+    // Vertices with the same position (duplicated due to different texture coordinates) share the normal.
+    // Assign position group to each vertex.
+    std::vector<Vector3> positions(vertex_count);
     for (uint32_t i = 0; i < vertex_count; i++)
-        index_array_with_stride(normals, vertex_stride, i) = Vector3_Zero;
+        positions[i] = index_array_with_stride(vertex_positions, vertex_stride, i);
+
+    std::vector<uint32_t> vertex_groups(vertex_count);
+    uint32_t group_count = 0;
+    {
+        Weld_Table<Vector3> table(vertex_count);
+        for (uint32_t i = 0; i < vertex_count; i++) {
+            uint32_t first = table.find_or_insert(positions.data(), i, hash_position(positions[i]));
+            vertex_groups[i] = (first == i) ? group_count++ : vertex_groups[first];
+        }
+    }
+    positions = std::vector<Vector3>();
+
+    // Accumulate face normals for each group. In parallel mode each thread processes
+    // a range of triangles and has its own accumulators that are summed in fixed order.
+    const uint32_t triangle_count = index_count / 3;
+    const uint32_t range_count = parallel ? std::max(1u, std::min(get_thread_count(), triangle_count / 4096)) : 1;
 
-    for (uint32_t i = 0; i < index_count; i += 3) {
-        uint32_t i0 = indices[i + 0];
-        uint32_t i1 = indices[i + 1];
-        uint32_t i2 = indices[i + 2];
+    std::vector<Vector3> group_normals(size_t(group_count) * range_count, Vector3_Zero);
+    parallel_for(range_count, [&](uint32_t range, uint32_t) {
+        Vector3* range_normals = &group_normals[size_t(group_count) * range];
+        const uint32_t begin = uint32_t(uint64_t(triangle_count) * range / range_count);
+        const uint32_t end = uint32_t(uint64_t(triangle_count) * (range + 1) / range_count);
 
-        Vector3 a = index_array_with_stride(vertex_positions, vertex_stride, i0);
-        Vector3 b = index_array_with_stride(vertex_positions, vertex_stride, i1);
-        Vector3 c = index_array_with_stride(vertex_positions, vertex_stride, i2);
+        for (uint32_t t = begin; t < end; t++) {
+            uint32_t i0 = indices[t * 3 + 0];
+            uint32_t i1 = indices[t * 3 + 1];
+            uint32_t i2 = indices[t * 3 + 2];
 
-        Vector3 d1 = b - a;
-        assert(d1.length() > 1e-6f);
-        Vector3 d2 = c - a;
-        assert(d2.length() > 1e-6f);
+            Vector3 a = index_array_with_stride(vertex_positions, vertex_stride, i0);
+            Vector3 b = index_array_with_stride(vertex_positions, vertex_stride, i1);
+            Vector3 c = index_array_with_stride(vertex_positions, vertex_stride, i2);
 
-        Vector3 n = cross(d1, d2).normalized();
+            // Degenerate triangles have no orientation and do not contribute.
+            Vector3 n = cross(b - a, c - a);
+            if (!(n.length() > 1e-12f))
+                continue;
+            n.normalize();
 
-        if (has_duplicates[i0]) {
-            for (uint32_t vi : duplicated_vertices[a])
-                index_array_with_stride(normals, vertex_stride, vi) += n;
-        } else {
-            index_array_with_stride(normals, vertex_stride, i0) += n;
+            range_normals[vertex_groups[i0]] += n;
+            range_normals[vertex_groups[i1]] += n;
+            range_normals[vertex_groups[i2]] += n;
         }
+    });
 
-        if (has_duplicates[i1]) {
-            for (uint32_t vi : duplicated_vertices[b])
-                index_array_with_stride(normals, vertex_stride, vi) += n;
-        } else {
-            index_array_with_stride(normals, vertex_stride, i1) += n;
+    if (range_count > 1) {
+        const uint32_t group_chunk_count = std::min(range_count * 4, std::max(1u, group_count / 1024));
+        parallel_for(group_chunk_count, [&](uint32_t chunk, uint32_t) {
+            const uint32_t begin = uint32_t(uint64_t(group_count) * chunk / group_chunk_count);
+            const uint32_t end = uint32_t(uint64_t(group_count) * (chunk + 1) / group_chunk_count);
+            for (uint32_t range = 1; range < range_count; range++) {
+                const Vector3* range_normals = &group_normals[size_t(group_count) * range];
+                for (uint32_t g = begin; g < end; g++)
+                    group_normals[g] += range_normals[g];
+            }
+        });
+    }
+
+    // Face normals can cancel out (two-sided geometry, degenerate triangles). Such groups get the normal
+    // of the first non-degenerate triangle that references them, or a fixed axis if there is none.
+    const float min_normal_sum_length = 1e-6f;
+    std::vector<bool> use_face_normal(group_count);
+    bool has_cancelled_normals = false;
+    for (uint32_t g = 0; g < group_count; g++) {
+        if (!(group_normals[g].length() > min_normal_sum_length)) {
+            group_normals[g] = Vector3_Zero;
+            use_face_normal[g] = true;
+            has_cancelled_normals = true;
         }
+    }
+    if (has_cancelled_normals) {
+        for (uint32_t t = 0; t < triangle_count; t++) {
+            const uint32_t* vi = &indices[t * 3];
+            if (!use_face_normal[vertex_groups[vi[0]]] && !use_face_normal[vertex_groups[vi[1]]] && !use_face_normal[vertex_groups[vi[2]]])
+                continue;
+
+            Vector3 a = index_array_with_stride(vertex_positions, vertex_stride, vi[0]);
+            Vector3 b = index_array_with_stride(vertex_positions, vertex_stride, vi[1]);
+            Vector3 c = index_array_with_stride(vertex_positions, vertex_stride, vi[2]);
+            Vector3 n = cross(b - a, c - a);
+            if (!(n.length() > 1e-12f))
+                continue;
 
-        if (has_duplicates[i2]) {
-            for (uint32_t vi : duplicated_vertices[c])
-                index_array_with_stride(normals, vertex_stride, vi) += n;
-        } else {
-            index_array_with_stride(normals, vertex_stride, i2) += n;
+            for (int k = 0; k < 3; k++) {
+                uint32_t g = vertex_groups[vi[k]];
+                if (use_face_normal[g] && group_normals[g] == Vector3_Zero)
+                    group_normals[g] = n;
+            }
+        }
+        for (uint32_t g = 0; g < group_count; g++) {
+            if (group_normals[g] == Vector3_Zero)
+                group_normals[g] = Vector3(0, 0, 1);
         }
     }
 
-    for (uint32_t i = 0; i < vertex_count; i++) {
-        Vector3& n = index_array_with_stride(normals, vertex_stride, i);
-        assert(n.length() > 1e-6f);
-        n.normalize();
+    for (uint32_t i = 0; i < vertex_count; i++)
+        index_array_with_stride(normals, vertex_stride, i) = group_normals[vertex_groups[i]].normalized();
+}
+
+void compute_triangle_lod_constants(const Vertex* vertices, const uint32_t* indices, uint32_t index_count, float* lod_constants) {
+    assert(index_count % 3 == 0);
+    for (uint32_t i = 0; i < index_count / 3; i++) {
+        const Vertex& v0 = vertices[indices[i*3 + 0]];
+        const Vertex& v1 = vertices[indices[i*3 + 1]];
+        const Vertex& v2 = vertices[indices[i*3 + 2]];
+
+        // Both areas are doubled, it cancels out in the ratio.
+        const float area = cross(v1.pos - v0.pos, v2.pos - v0.pos).length();
+        const float uv_area = std::abs((v1.uv.x - v0.uv.x) * (v2.uv.y - v0.uv.y) - (v2.uv.x - v0.uv.x) * (v1.uv.y - v0.uv.y));
+
+        if (area == 0.f)
+            lod_constants[i] = 0.f;
+        else if (uv_area == 0.f)
+            lod_constants[i] = -32.f;
+        else
+            lod_constants[i] = 0.5f * std::log2(uv_area / area);
+    }
+}
+
+void create_grid_mesh(int grid_size, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    vertices.resize(size_t(grid_size + 1) * (grid_size + 1));
+    for (int y = 0; y <= grid_size; y++) {
+        for (int x = 0; x <= grid_size; x++) {
+            Vertex& v = vertices[y * (grid_size + 1) + x];
+            const float u = float(x) / float(grid_size);
+            const float w = float(y) / float(grid_size);
+            v.pos = Vector3(u, 0.05f * std::sin(20.f * u) * std::cos(20.f * w), w);
+            v.normal = Vector3(0, 1, 0);
+            v.uv = Vector2(u, w);
+        }
+    }
+    indices.clear();
+    indices.reserve(size_t(grid_size) * grid_size * 6);
+    for (int y = 0; y < grid_size; y++) {
+        for (int x = 0; x < grid_size; x++) {
+            const uint32_t i0 = uint32_t(y * (grid_size + 1) + x);
+            const uint32_t i1 = i0 + 1;
+            const uint32_t i2 = i0 + grid_size + 1;
+            const uint32_t i3 = i2 + 1;
+            indices.insert(indices.end(), { i0, i2, i1, i1, i2, i3 });
+        }
     }
 }
@@ -1,18 +1,121 @@
 #pragma once
 
 #include "vector.h"
+#include <atomic>
 #include <vector>
 
+struct Obj_Data;
+
 struct Vertex {
     Vector3 pos;
     Vector3 normal;
     Vector2 uv;
 };
 
+// Vertex attributes of the compact vertex format: octahedral-encoded normal (2 x snorm16)
+// and texture coordinates (2 x half). Positions are stored in a separate stream with full
+// precision, so they can be used directly for acceleration structure builds.
+struct Compact_Vertex_Attributes {
+    int16_t     normal[2];
+    uint16_t    uv[2];
+};
+
+// Vertex attributes stored separately from positions.
+struct Vertex_Attributes {
+    Vector3 normal;
+    Vector2 uv;
+};
+
+// Range of the index buffer that contains triangles of one level of detail.
+// All levels share the vertex buffer. error is the distance to the original surface in object space.
+struct Mesh_LOD {
+    uint32_t    first_index;
+    uint32_t    index_count;
+    float       error;
+};
+
 struct Mesh {
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
+    Vector3 bounds_min = Vector3_Zero;
+    Vector3 bounds_max = Vector3_Zero;
 };
 
+// Loads all OBJ objects as a single mesh that is centered and scaled to fit
+// into [-additional_scale, additional_scale] cube.
 Mesh load_obj_mesh(const std::string& path, float additional_scale);
-void compute_normals(const Vector3* vertex_positions, uint32_t vertex_count, uint32_t vertex_stride, const uint32_t* indices, uint32_t index_count, Vector3* normals);
+
+// Creates mesh from the range of OBJ corners. Bounds are computed, the mesh is not transformed.
+Mesh create_obj_mesh(const Obj_Data& obj, uint32_t first_corner, uint32_t corner_count);
+
+// Translates mesh by -center and then scales it. Bounds are updated.
+void transform_mesh(Mesh& mesh, Vector3 center, float scale);
+
+// Tracks current and peak size of the allocations made through Counting_Allocator. Used by the benchmarks
+// to measure working memory of an algorithm without replacing the global allocator.
+struct Allocation_Counter {
+    std::atomic<int64_t> allocated_bytes{0};
+    std::atomic<int64_t> peak_bytes{0};
+
+    void add(int64_t size) {
+        const int64_t allocated = allocated_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+        int64_t peak = peak_bytes.load(std::memory_order_relaxed);
+        while (allocated > peak && !peak_bytes.compare_exchange_weak(peak, allocated, std::memory_order_relaxed)) {}
+    }
+    void sub(int64_t size) {
+        allocated_bytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+};
+
+// Standard allocator that reports allocations to the counter. Null counter disables counting.
+template <typename T>
+struct Counting_Allocator {
+    using value_type = T;
+
+    Allocation_Counter* counter = nullptr;
+
+    Counting_Allocator() = default;
+    explicit Counting_Allocator(Allocation_Counter* counter) : counter(counter) {}
+    template <typename U>
+    Counting_Allocator(const Counting_Allocator<U>& other) : counter(other.counter) {}
+
+    T* allocate(size_t n) {
+        if (counter)
+            counter->add(int64_t(n * sizeof(T)));
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        if (counter)
+            counter->sub(int64_t(n * sizeof(T)));
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const Counting_Allocator<U>& other) const { return counter == other.counter; }
+    template <typename U>
+    bool operator!=(const Counting_Allocator<U>& other) const { return counter != other.counter; }
+};
+
+// Removes duplicated vertices from the per-corner vertex list. Unique vertices are stored in the
+// order of their first occurrence, so the result does not depend on the parallel flag.
+// Working memory of the weld is reported to working_memory_counter if it is not null.
+void weld_vertices(const std::vector<Vertex>& corner_vertices, bool parallel, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+    Allocation_Counter* working_memory_counter = nullptr);
+
+void create_split_vertex_streams(const Vertex* vertices, uint32_t vertex_count, std::vector<Vector3>& positions, std::vector<Vertex_Attributes>& attributes);
+void create_compact_vertex_streams(const Vertex* vertices, uint32_t vertex_count, std::vector<Vector3>& positions, std::vector<Compact_Vertex_Attributes>& attributes);
+
+// Computes smooth vertex normals. Vertices with the same position get the same normal.
+// If the face normals around a position cancel out, the normal of one of the adjacent faces is used.
+// In parallel mode the face normals are summed in different order, so the result can differ
+// from the serial version in the last bits.
+void compute_normals(const Vector3* vertex_positions, uint32_t vertex_count, uint32_t vertex_stride, const uint32_t* indices, uint32_t index_count, Vector3* normals, bool parallel);
+
+// Computes 0.5 * log2(uv area / object space area) for each triangle. This is the triangle's part of the ray cone
+// texture LOD that does not depend on the ray, texture size and cone width are added by the hit shader.
+// Triangles without uv area get a large negative value (the finest mip level), triangles without area get zero.
+void compute_triangle_lod_constants(const Vertex* vertices, const uint32_t* indices, uint32_t index_count, float* lod_constants);
+
+// Regular grid in [0, 1] XZ square with a bit of height variation, so the acceleration structure builders
+// have to deal with non-planar geometry. Used as synthetic geometry by the comparisons.
+void create_grid_mesh(int grid_size, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
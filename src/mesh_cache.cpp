@@ -0,0 +1,236 @@
+#include "mesh_cache.h"
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+
+namespace {
+// Increment version each time the file layout or mesh processing algorithm changes.
+constexpr uint32_t mesh_cache_magic = 0x4853454d; // 'MESH'
+constexpr uint32_t mesh_cache_version = 4;
+
+// The header is followed by object records, material records, LOD records, vertices of all objects and indices of all objects.
+struct Mesh_Cache_Header {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    vertex_size;
+    uint32_t    vertex_count;
+    uint32_t    index_count;
+    float       additional_scale;
+    uint32_t    optimize_mesh;
+    uint32_t    max_lod_count;
+    uint32_t    object_count;
+    uint32_t    material_count;
+    uint32_t    lod_count;
+    uint32_t    reserved;
+    uint64_t    source_file_size;
+    uint64_t    source_file_time;
+    uint64_t    source_content_hash;
+    Vector3     bounds_min;
+    Vector3     bounds_max;
+};
+
+// Object indices are local to the object's vertex range. index_count includes all LOD levels,
+// LOD index ranges are relative to first_index.
+struct Mesh_Cache_Object {
+    uint32_t    first_vertex;
+    uint32_t    vertex_count;
+    uint32_t    first_index;
+    uint32_t    index_count;
+    uint32_t    first_lod;
+    uint32_t    lod_count;
+    int32_t     material;
+    Vector3     bounds_min;
+    Vector3     bounds_max;
+};
+
+// Strings are null-terminated.
+struct Mesh_Cache_Material {
+    char        name[64];
+    Vector3     diffuse;
+    char        diffuse_texture[256];
+};
+}
+static bool compute_file_hash(const std::string& path, uint64_t& hash) {
+    platform::Mapped_File file;
+    if (!platform::map_file(path, file))
+        return false;
+
+    hash = hash_memory(file.data, file.size);
+    platform::unmap_file(file);
+    return true;
+}
+
+void Mesh_Cache::release() {
+    platform::unmap_file(file);
+    *this = Mesh_Cache{};
+}
+
+std::string get_mesh_cache_path(const std::string& source_path) {
+    return source_path + ".cache";
+}
+
+bool open_mesh_cache(const std::string& source_path, const Mesh_Cache_Params& params, Mesh_Cache& cache) {
+    cache = Mesh_Cache{};
+
+    platform::Mapped_File file;
+    if (!platform::map_file(get_mesh_cache_path(source_path), file))
+        return false;
+
+    auto reject = [&file, &cache]() {
+        platform::unmap_file(file);
+        cache = Mesh_Cache{};
+        return false;
+    };
+
+    if (file.size < sizeof(Mesh_Cache_Header))
+        return reject();
+
+    Mesh_Cache_Header header;
+    memcpy(&header, file.data, sizeof(header));
+
+    if (header.magic != mesh_cache_magic || header.version != mesh_cache_version ||
+        header.vertex_size != sizeof(Vertex) || header.additional_scale != params.additional_scale ||
+        header.optimize_mesh != uint32_t(params.optimize_mesh) || header.max_lod_count != params.max_lod_count)
+        return reject();
+
+    const uint64_t expected_size = sizeof(Mesh_Cache_Header) +
+        uint64_t(header.object_count) * sizeof(Mesh_Cache_Object) + uint64_t(header.material_count) * sizeof(Mesh_Cache_Material) +
+        uint64_t(header.lod_count) * sizeof(Mesh_LOD) +
+        uint64_t(header.vertex_count) * sizeof(Vertex) + uint64_t(header.index_count) * sizeof(uint32_t);
+    if (file.size != expected_size)
+        return reject();
+
+    // Cheap checks first, the content hash requires reading the entire source file.
+    uint64_t source_size, source_time;
+    if (!platform::get_file_info(source_path, source_size, source_time) ||
+        source_size != header.source_file_size || source_time != header.source_file_time)
+        return reject();
+
+    uint64_t content_hash;
+    if (!compute_file_hash(source_path, content_hash) || content_hash != header.source_content_hash)
+        return reject();
+
+    static_assert(sizeof(Mesh_Cache_Header) % alignof(Vertex) == 0 && sizeof(Mesh_Cache_Object) % alignof(Vertex) == 0 &&
+        sizeof(Mesh_Cache_Material) % alignof(Vertex) == 0 && sizeof(Mesh_LOD) % alignof(Vertex) == 0, "vertex data in the cache file is not aligned");
+
+    const Mesh_Cache_Object* objects = reinterpret_cast<const Mesh_Cache_Object*>(file.data + sizeof(Mesh_Cache_Header));
+    const Mesh_Cache_Material* materials = reinterpret_cast<const Mesh_Cache_Material*>(objects + header.object_count);
+    const Mesh_LOD* lods = reinterpret_cast<const Mesh_LOD*>(materials + header.material_count);
+    const Vertex* vertices = reinterpret_cast<const Vertex*>(lods + header.lod_count);
+    const uint32_t* indices = reinterpret_cast<const uint32_t*>(vertices + header.vertex_count);
+
+    for (uint32_t i = 0; i < header.object_count; i++) {
+        const Mesh_Cache_Object& object = objects[i];
+        if (uint64_t(object.first_vertex) + object.vertex_count > header.vertex_count ||
+            uint64_t(object.first_index) + object.index_count > header.index_count ||
+            object.material < -1 || object.material >= int32_t(header.material_count) ||
+            object.lod_count == 0 || uint64_t(object.first_lod) + object.lod_count > header.lod_count)
+            return reject();
+
+        const Mesh_LOD* object_lods = lods + object.first_lod;
+        if (object_lods[0].first_index != 0)
+            return reject();
+        for (uint32_t k = 0; k < object.lod_count; k++) {
+            if (uint64_t(object_lods[k].first_index) + object_lods[k].index_count > object.index_count)
+                return reject();
+        }
+        cache.object_lods.push_back(std::vector<Mesh_LOD>(object_lods, object_lods + object.lod_count));
+
+        Scene_Object_Ref ref;
+        ref.vertices        = vertices + object.first_vertex;
+        ref.indices         = indices + object.first_index;
+        ref.vertex_count    = object.vertex_count;
+        ref.index_count     = object_lods[0].index_count;
+        ref.material        = object.material;
+        ref.bounds_min      = object.bounds_min;
+        ref.bounds_max      = object.bounds_max;
+        cache.objects.push_back(ref);
+    }
+
+    for (uint32_t i = 0; i < header.material_count; i++) {
+        const Mesh_Cache_Material& cached_material = materials[i];
+        Material material;
+        material.name = std::string(cached_material.name, strnlen(cached_material.name, sizeof(cached_material.name)));
+        material.diffuse = cached_material.diffuse;
+        material.diffuse_texture = std::string(cached_material.diffuse_texture, strnlen(cached_material.diffuse_texture, sizeof(cached_material.diffuse_texture)));
+        cache.materials.push_back(material);
+    }
+
+    cache.bounds_min    = header.bounds_min;
+    cache.bounds_max    = header.bounds_max;
+    cache.file          = file;
+    return true;
+}
+
+void write_mesh_cache(const std::string& source_path, const Mesh_Cache_Params& params, const Scene& scene,
+    const std::vector<std::vector<Mesh_LOD>>& object_lods, const std::vector<std::vector<uint32_t>>& object_lod_indices)
+{
+    assert(object_lods.size() == scene.objects.size() && object_lod_indices.size() == scene.objects.size());
+
+    Mesh_Cache_Header header{};
+    header.magic            = mesh_cache_magic;
+    header.version          = mesh_cache_version;
+    header.vertex_size      = sizeof(Vertex);
+    header.additional_scale = params.additional_scale;
+    header.optimize_mesh    = uint32_t(params.optimize_mesh);
+    header.max_lod_count    = params.max_lod_count;
+    header.object_count     = (uint32_t)scene.objects.size();
+    header.material_count   = (uint32_t)scene.materials.size();
+    header.bounds_min       = scene.bounds_min;
+    header.bounds_max       = scene.bounds_max;
+
+    std::vector<Mesh_Cache_Object> objects(scene.objects.size());
+    for (auto [i, object] : enumerate(scene.objects)) {
+        objects[i].first_vertex = header.vertex_count;
+        objects[i].vertex_count = (uint32_t)object.mesh.vertices.size();
+        objects[i].first_index  = header.index_count;
+        objects[i].index_count  = (uint32_t)object_lod_indices[i].size();
+        objects[i].first_lod    = header.lod_count;
+        objects[i].lod_count    = (uint32_t)object_lods[i].size();
+        objects[i].material     = object.material;
+        objects[i].bounds_min   = object.mesh.bounds_min;
+        objects[i].bounds_max   = object.mesh.bounds_max;
+        header.vertex_count += objects[i].vertex_count;
+        header.index_count  += objects[i].index_count;
+        header.lod_count    += objects[i].lod_count;
+    }
+
+    std::vector<Mesh_Cache_Material> materials(scene.materials.size());
+    for (auto [i, material] : enumerate(scene.materials)) {
+        Mesh_Cache_Material& cached_material = materials[i];
+        cached_material = Mesh_Cache_Material{};
+        if (material.name.size() >= sizeof(cached_material.name) || material.diffuse_texture.size() >= sizeof(cached_material.diffuse_texture)) {
+            printf("material name or texture path is too long, mesh cache is not written: %s\n", material.name.c_str());
+            return;
+        }
+        memcpy(cached_material.name, material.name.c_str(), material.name.size());
+        cached_material.diffuse = material.diffuse;
+        memcpy(cached_material.diffuse_texture, material.diffuse_texture.c_str(), material.diffuse_texture.size());
+    }
+
+    if (!platform::get_file_info(source_path, header.source_file_size, header.source_file_time) ||
+        !compute_file_hash(source_path, header.source_content_hash)) {
+        printf("failed to query mesh file stats, mesh cache is not written: %s\n", source_path.c_str());
+        return;
+    }
+
+    // The cache is only an optimization, so failure to write it is not an error.
+    std::string cache_path = get_mesh_cache_path(source_path);
+    std::ofstream file(cache_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!file) {
+        printf("failed to create mesh cache file: %s\n", cache_path.c_str());
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(objects.data()), objects.size() * sizeof(Mesh_Cache_Object));
+    file.write(reinterpret_cast<const char*>(materials.data()), materials.size() * sizeof(Mesh_Cache_Material));
+    for (const std::vector<Mesh_LOD>& lods : object_lods)
+        file.write(reinterpret_cast<const char*>(lods.data()), lods.size() * sizeof(Mesh_LOD));
+    for (const Scene_Object& object : scene.objects)
+        file.write(reinterpret_cast<const char*>(object.mesh.vertices.data()), object.mesh.vertices.size() * sizeof(Vertex));
+    for (const std::vector<uint32_t>& lod_indices : object_lod_indices)
+        file.write(reinterpret_cast<const char*>(lod_indices.data()), lod_indices.size() * sizeof(uint32_t));
+    if (!file)
+        printf("failed to write mesh cache file: %s\n", cache_path.c_str());
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "platform.h"
+#include "scene.h"
+
+// Binary scene cache stored next to the source mesh file.
+//
+// The cache file is memory-mapped and object vertex/index pointers reference the mapped
+// memory directly, so the data can be uploaded to the GPU without additional copies.
+// The cache is invalidated when source file size, modification time or content
+// changes, or when the mesh is requested with different load parameters.
+//
+// The cache also stores the LOD chain of each object. The object's index data contains the indices
+// of all levels, Scene_Object_Ref::index_count is the index count of the first level.
+struct Mesh_Cache {
+    std::vector<Scene_Object_Ref>       objects;
+    std::vector<std::vector<Mesh_LOD>>  object_lods;
+    std::vector<Material>               materials;
+    Vector3                             bounds_min = Vector3_Zero;
+    Vector3                             bounds_max = Vector3_Zero;
+    platform::Mapped_File               file;
+
+    void release();
+};
+
+// Mesh load parameters that affect the data stored in the cache.
+struct Mesh_Cache_Params {
+    float       additional_scale;
+    bool        optimize_mesh;
+    uint32_t    max_lod_count;
+};
+
+std::string get_mesh_cache_path(const std::string& source_path);
+
+// Returns false if cache file does not exist or it is not valid for the given source file and parameters.
+bool open_mesh_cache(const std::string& source_path, const Mesh_Cache_Params& params, Mesh_Cache& cache);
+
+// object_lod_indices contains the indices of all levels of each object as returned by generate_lod_chain.
+void write_mesh_cache(const std::string& source_path, const Mesh_Cache_Params& params, const Scene& scene,
+    const std::vector<std::vector<Mesh_LOD>>& object_lods, const std::vector<std::vector<uint32_t>>& object_lod_indices);
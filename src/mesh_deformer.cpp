@@ -0,0 +1,136 @@
+#include "common.h"
+#include "mesh_deformer.h"
+#include "vk_utils.h"
+
+#include <cassert>
+
+namespace {
+// Push_Constants in deform_mesh.comp.glsl.
+struct Push_Constants {
+    VkDeviceAddress rest_vertex_buffer;
+    VkDeviceAddress vertex_buffer;
+    uint32_t        vertex_count;
+    uint32_t        vertex_stride; // in floats
+    float           bounds_min_y;
+    float           height;
+    float           time;
+    float           amount;
+};
+
+constexpr uint32_t group_size = 64;
+}
+
+void Mesh_Deformer::create() {
+    // pipeline layout
+    {
+        VkPushConstantRange range;
+        range.stageFlags    = VK_SHADER_STAGE_COMPUTE_BIT;
+        range.offset        = 0;
+        range.size          = sizeof(Push_Constants);
+
+        VkPipelineLayoutCreateInfo create_info { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+        create_info.pushConstantRangeCount  = 1;
+        create_info.pPushConstantRanges     = &range;
+
+        VK_CHECK(vkCreatePipelineLayout(vk.device, &create_info, nullptr, &pipeline_layout));
+    }
+
+    // pipeline
+    {
+        VkShaderModule shader = vk_load_spirv("spirv/deform_mesh.comp.spv");
+
+        VkPipelineShaderStageCreateInfo compute_stage { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+        compute_stage.stage    = VK_SHADER_STAGE_COMPUTE_BIT;
+        compute_stage.module   = shader;
+        compute_stage.pName    = "main";
+
+        VkComputePipelineCreateInfo create_info{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+        create_info.stage = compute_stage;
+        create_info.layout = pipeline_layout;
+        VK_CHECK(vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
+
+        vkDestroyShaderModule(vk.device, shader, nullptr);
+    }
+}
+
+void Mesh_Deformer::destroy() {
+    for (Mesh& mesh : meshes)
+        mesh.rest_vertex_buffer.destroy();
+    vkDestroyPipelineLayout(vk.device, pipeline_layout, nullptr);
+    vkDestroyPipeline(vk.device, pipeline, nullptr);
+    *this = Mesh_Deformer{};
+}
+
+void Mesh_Deformer::cmd_capture_rest_pose(VkCommandBuffer command_buffer, const std::vector<GPU_Mesh>& gpu_meshes,
+    const std::vector<Vector3>& bounds_min, const std::vector<Vector3>& bounds_max) {
+    assert(bounds_min.size() == gpu_meshes.size() && bounds_max.size() == gpu_meshes.size());
+    for (Mesh& mesh : meshes)
+        mesh.rest_vertex_buffer.destroy();
+    meshes.resize(gpu_meshes.size());
+
+    // The whole vertex buffer is copied, with the interleaved layout the other attributes are
+    // copied too but the shader reads positions with the same stride as in the vertex buffer.
+    for (auto [i, gpu_mesh] : enumerate(gpu_meshes)) {
+        Mesh& mesh = meshes[i];
+        const VkDeviceSize size = VkDeviceSize(gpu_mesh.vertex_count) * gpu_mesh.vertex_stride;
+        mesh.rest_vertex_buffer = vk_create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, nullptr, "rest_vertex_buffer");
+        mesh.vertex_count = gpu_mesh.vertex_count;
+        mesh.vertex_stride = gpu_mesh.vertex_stride;
+        mesh.bounds_min_y = bounds_min[i].y;
+        mesh.height = bounds_max[i].y - bounds_min[i].y;
+
+        VkBufferCopy region;
+        region.srcOffset = gpu_mesh.get_vertex_offset();
+        region.dstOffset = 0;
+        region.size = size;
+        vkCmdCopyBuffer(command_buffer, gpu_mesh.vertex_buffer.handle, mesh.rest_vertex_buffer.handle, 1, &region);
+    }
+
+    // The vertex buffers are overwritten by the first deformation.
+    VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void Mesh_Deformer::cmd_deform(VkCommandBuffer command_buffer, const std::vector<GPU_Mesh>& gpu_meshes, float time, float amount) {
+    assert(meshes.size() == gpu_meshes.size());
+
+    // On the compute queue the vertex input is synchronized with the frame semaphores.
+    VkPipelineStageFlags reader_stages = 0;
+    VkAccessFlags reader_access = 0;
+    if (!vk_is_async_compute_command_buffer(command_buffer)) {
+        reader_stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+        reader_access |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    }
+    if (vk.raytracing_supported) {
+        reader_stages |= VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+        reader_access |= VK_ACCESS_SHADER_READ_BIT;
+    }
+
+    // The previous frame can still read the vertex buffers.
+    vkCmdPipelineBarrier(command_buffer, reader_stages, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    for (auto [i, gpu_mesh] : enumerate(gpu_meshes)) {
+        const Mesh& mesh = meshes[i];
+
+        Push_Constants push_constants;
+        push_constants.rest_vertex_buffer   = mesh.rest_vertex_buffer.device_address;
+        push_constants.vertex_buffer        = gpu_mesh.vertex_buffer.device_address + gpu_mesh.get_vertex_offset();
+        push_constants.vertex_count         = mesh.vertex_count;
+        push_constants.vertex_stride        = mesh.vertex_stride / sizeof(float);
+        push_constants.bounds_min_y         = mesh.bounds_min_y;
+        push_constants.height               = mesh.height;
+        push_constants.time                 = time;
+        push_constants.amount               = amount;
+
+        vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+        vkCmdDispatch(command_buffer, (mesh.vertex_count + group_size - 1) / group_size, 1, 1);
+    }
+
+    VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = reader_access;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, reader_stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "vector.h"
+#include "vk.h"
+
+#include <vector>
+
+struct GPU_Mesh;
+
+// Deforms the scene meshes with a compute shader that writes the deformed positions to the vertex buffers,
+// so the raster pipeline and the bottom level builds read the deformed geometry without additional copies.
+// The deformation is a procedural skinning-like motion: the mesh is twisted around the vertical axis and
+// bent along X axis, both proportionally to the vertex height in the mesh bounds, plus a travelling wave.
+// Normals are not updated, so the shading uses the rest pose normals.
+struct Mesh_Deformer {
+    VkPipelineLayout        pipeline_layout;
+    VkPipeline              pipeline;
+
+    struct Mesh {
+        Vk_Buffer           rest_vertex_buffer; // copy of the vertex buffer made by cmd_capture_rest_pose
+        uint32_t            vertex_count;
+        uint32_t            vertex_stride;
+        float               bounds_min_y;
+        float               height;
+    };
+    std::vector<Mesh>       meshes;
+
+    void create();
+    void destroy();
+
+    // Copies the vertex buffers of gpu_meshes as the rest pose, bounds are the rest pose bounds of each mesh.
+    // Should be recorded before the first cmd_deform, after the mesh data upload has completed.
+    void cmd_capture_rest_pose(VkCommandBuffer command_buffer, const std::vector<GPU_Mesh>& gpu_meshes,
+        const std::vector<Vector3>& bounds_min, const std::vector<Vector3>& bounds_max);
+
+    // Writes the rest pose deformed according to time into the vertex buffers. amount scales the deformation,
+    // zero restores the rest pose. The barriers make the previous frame finish reading the vertex buffers and
+    // make the deformed positions visible to the vertex shaders, the acceleration structure builds and the hit shaders.
+    void cmd_deform(VkCommandBuffer command_buffer, const std::vector<GPU_Mesh>& gpu_meshes, float time, float amount);
+};
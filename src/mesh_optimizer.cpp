@@ -0,0 +1,371 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// Cache size used by the optimizer and for statistics. Typical for the modern GPUs.
+constexpr uint32_t vertex_cache_size = 16;
+
+Vertex_Cache_Stats analyze_vertex_cache(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size) {
+    assert(index_count % 3 == 0);
+
+    // Timestamp based FIFO: vertex is in the cache if it was inserted less than cache_size insertions ago.
+    std::vector<uint32_t> insert_time(vertex_count, 0);
+    uint32_t time = cache_size + 1;
+    uint32_t misses = 0;
+
+    for (uint32_t i = 0; i < index_count; i++) {
+        uint32_t v = indices[i];
+        if (time - insert_time[v] > cache_size) {
+            insert_time[v] = time++;
+            misses++;
+        }
+    }
+
+    Vertex_Cache_Stats stats{};
+    if (index_count > 0)
+        stats.acmr = float(misses) / float(index_count / 3);
+    if (vertex_count > 0)
+        stats.atvr = float(misses) / float(vertex_count);
+    return stats;
+}
+
+//
+// Tom Forsyth, Linear-Speed Vertex Cache Optimisation.
+// https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+//
+namespace {
+constexpr uint32_t forsyth_cache_size = 32;
+constexpr uint32_t forsyth_max_valence = 32;
+
+struct Forsyth_Score_Table {
+    float cache_position[forsyth_cache_size];
+    float valence[forsyth_max_valence + 1];
+
+    Forsyth_Score_Table() {
+        const float cache_decay_power = 1.5f;
+        const float last_triangle_score = 0.75f;
+        const float valence_boost_scale = 2.0f;
+        const float valence_boost_power = 0.5f;
+
+        for (uint32_t i = 0; i < forsyth_cache_size; i++) {
+            if (i < 3) {
+                // Vertices of the last triangle get fixed score, so there is no preference for which
+                // of them is reused first.
+                cache_position[i] = last_triangle_score;
+            } else {
+                const float scaler = 1.f / float(forsyth_cache_size - 3);
+                cache_position[i] = std::pow(1.f - float(i - 3) * scaler, cache_decay_power);
+            }
+        }
+        valence[0] = 0.f;
+        for (uint32_t i = 1; i <= forsyth_max_valence; i++)
+            valence[i] = valence_boost_scale * std::pow(float(i), -valence_boost_power);
+    }
+};
+}
+
+static const Forsyth_Score_Table forsyth_scores;
+
+static inline float get_vertex_score(int cache_position, uint32_t live_triangle_count) {
+    if (live_triangle_count == 0)
+        return -1.f; // no triangles need this vertex
+
+    float score = cache_position >= 0 ? forsyth_scores.cache_position[cache_position] : 0.f;
+    return score + forsyth_scores.valence[std::min(live_triangle_count, forsyth_max_valence)];
+}
+
+void optimize_vertex_cache(uint32_t* indices, uint32_t index_count, uint32_t vertex_count) {
+    assert(index_count % 3 == 0);
+    const uint32_t triangle_count = index_count / 3;
+    if (triangle_count == 0)
+        return;
+
+    // Vertex -> triangles adjacency in CSR format.
+    std::vector<uint32_t> live_triangle_counts(vertex_count, 0);
+    for (uint32_t i = 0; i < index_count; i++)
+        live_triangle_counts[indices[i]]++;
+
+    std::vector<uint32_t> adjacency_offsets(vertex_count + 1);
+    adjacency_offsets[0] = 0;
+    for (uint32_t v = 0; v < vertex_count; v++)
+        adjacency_offsets[v + 1] = adjacency_offsets[v] + live_triangle_counts[v];
+
+    std::vector<uint32_t> adjacency(index_count);
+    {
+        std::vector<uint32_t> fill_offsets(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (uint32_t i = 0; i < index_count; i++)
+            adjacency[fill_offsets[indices[i]]++] = i / 3;
+    }
+
+    std::vector<float> vertex_scores(vertex_count);
+    for (uint32_t v = 0; v < vertex_count; v++)
+        vertex_scores[v] = get_vertex_score(-1, live_triangle_counts[v]);
+
+    std::vector<float> triangle_scores(triangle_count);
+    for (uint32_t t = 0; t < triangle_count; t++)
+        triangle_scores[t] = vertex_scores[indices[t*3 + 0]] + vertex_scores[indices[t*3 + 1]] + vertex_scores[indices[t*3 + 2]];
+
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<uint32_t> output(index_count);
+
+    // LRU cache. New triangle vertices are added to the front, so the cache can temporarily
+    // contain 3 more entries than the simulated size.
+    uint32_t cache[forsyth_cache_size + 3];
+    uint32_t cache_count = 0;
+
+    uint32_t input_cursor = 0;
+    uint32_t best_triangle = 0;
+    for (uint32_t t = 1; t < triangle_count; t++) {
+        if (triangle_scores[t] > triangle_scores[best_triangle])
+            best_triangle = t;
+    }
+
+    for (uint32_t output_triangle = 0; output_triangle < triangle_count; output_triangle++) {
+        // No adjacent triangles in the cache, continue with the next not emitted triangle in the input order.
+        if (best_triangle == ~0u) {
+            while (emitted[input_cursor])
+                input_cursor++;
+            best_triangle = input_cursor;
+        }
+
+        const uint32_t* tri = &indices[best_triangle * 3];
+        output[output_triangle*3 + 0] = tri[0];
+        output[output_triangle*3 + 1] = tri[1];
+        output[output_triangle*3 + 2] = tri[2];
+        emitted[best_triangle] = true;
+
+        // Update cache: put triangle vertices to the front.
+        uint32_t new_cache[forsyth_cache_size + 3];
+        uint32_t new_cache_count = 0;
+        for (int k = 0; k < 3; k++)
+            new_cache[new_cache_count++] = tri[k];
+        for (uint32_t i = 0; i < cache_count; i++) {
+            uint32_t v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                new_cache[new_cache_count++] = v;
+        }
+
+        // Remove emitted triangle from the adjacency of its vertices.
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = tri[k];
+            uint32_t* begin = &adjacency[adjacency_offsets[v]];
+            uint32_t* end = begin + live_triangle_counts[v];
+            uint32_t* it = std::find(begin, end, best_triangle);
+            assert(it != end);
+            std::swap(*it, *(end - 1));
+            live_triangle_counts[v]--;
+        }
+
+        // Update scores of the vertices in the cache and the triangles that use them.
+        // Vertices that were pushed out of the cache also get updated score.
+        for (uint32_t i = 0; i < new_cache_count; i++) {
+            uint32_t v = new_cache[i];
+            int cache_position = i < forsyth_cache_size ? int(i) : -1;
+            float new_score = get_vertex_score(cache_position, live_triangle_counts[v]);
+            float score_delta = new_score - vertex_scores[v];
+            vertex_scores[v] = new_score;
+
+            const uint32_t* adjacent = &adjacency[adjacency_offsets[v]];
+            for (uint32_t a = 0; a < live_triangle_counts[v]; a++)
+                triangle_scores[adjacent[a]] += score_delta;
+        }
+
+        // Select the best triangle among the triangles adjacent to the cached vertices.
+        best_triangle = ~0u;
+        float best_score = -1.f;
+        cache_count = std::min(new_cache_count, forsyth_cache_size);
+        for (uint32_t i = 0; i < cache_count; i++) {
+            uint32_t v = new_cache[i];
+            cache[i] = v;
+
+            const uint32_t* adjacent = &adjacency[adjacency_offsets[v]];
+            for (uint32_t a = 0; a < live_triangle_counts[v]; a++) {
+                uint32_t t = adjacent[a];
+                if (triangle_scores[t] > best_score) {
+                    best_score = triangle_scores[t];
+                    best_triangle = t;
+                }
+            }
+        }
+    }
+    std::copy(output.begin(), output.end(), indices);
+}
+
+//
+// Overdraw optimization is based on the approach from meshoptimizer library:
+// Sander, Nehab, Barczak, Fast Triangle Reordering for Vertex Locality and Reduced Overdraw, 2007.
+//
+static void find_hard_boundaries(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, std::vector<uint32_t>& cluster_starts) {
+    // New cluster starts when the cache simulation reports cache flush: all 3 vertices of the triangle are misses.
+    std::vector<uint32_t> insert_time(vertex_count, 0);
+    uint32_t time = vertex_cache_size + 1;
+
+    for (uint32_t t = 0; t < index_count / 3; t++) {
+        uint32_t misses = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = indices[t*3 + k];
+            if (time - insert_time[v] > vertex_cache_size) {
+                insert_time[v] = time++;
+                misses++;
+            }
+        }
+        if (t == 0 || misses == 3)
+            cluster_starts.push_back(t);
+    }
+}
+
+static void find_soft_boundaries(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, const std::vector<uint32_t>& hard_cluster_starts, float threshold, std::vector<uint32_t>& cluster_starts) {
+    std::vector<uint32_t> insert_time(vertex_count, 0);
+    uint32_t time = vertex_cache_size + 1;
+
+    const uint32_t triangle_count = index_count / 3;
+    for (size_t c = 0; c < hard_cluster_starts.size(); c++) {
+        const uint32_t start = hard_cluster_starts[c];
+        const uint32_t end = c + 1 < hard_cluster_starts.size() ? hard_cluster_starts[c + 1] : triangle_count;
+        assert(start < end);
+
+        // ACMR of the entire hard cluster with the cache simulated from scratch.
+        time += vertex_cache_size + 1;
+        uint32_t cluster_misses = 0;
+        for (uint32_t i = start * 3; i < end * 3; i++) {
+            uint32_t v = indices[i];
+            if (time - insert_time[v] > vertex_cache_size) {
+                insert_time[v] = time++;
+                cluster_misses++;
+            }
+        }
+        const float cluster_threshold = threshold * float(cluster_misses) / float(end - start);
+
+        // Split when the soft cluster ACMR is below the threshold, the cache is reset at each split.
+        time += vertex_cache_size + 1;
+        cluster_starts.push_back(start);
+        uint32_t misses = 0;
+        uint32_t soft_start = start;
+        for (uint32_t t = start; t < end; t++) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[t*3 + k];
+                if (time - insert_time[v] > vertex_cache_size) {
+                    insert_time[v] = time++;
+                    misses++;
+                }
+            }
+            const uint32_t soft_triangle_count = t + 1 - soft_start;
+            if (t + 1 < end && float(misses) / float(soft_triangle_count) <= cluster_threshold) {
+                cluster_starts.push_back(t + 1);
+                time += vertex_cache_size + 1;
+                misses = 0;
+                soft_start = t + 1;
+            }
+        }
+    }
+}
+
+void optimize_overdraw(uint32_t* indices, uint32_t index_count, const Vertex* vertices, uint32_t vertex_count, float threshold) {
+    assert(index_count % 3 == 0);
+    const uint32_t triangle_count = index_count / 3;
+    if (triangle_count == 0)
+        return;
+
+    std::vector<uint32_t> hard_cluster_starts;
+    find_hard_boundaries(indices, index_count, vertex_count, hard_cluster_starts);
+
+    std::vector<uint32_t> cluster_starts;
+    find_soft_boundaries(indices, index_count, vertex_count, hard_cluster_starts, threshold, cluster_starts);
+    const uint32_t cluster_count = (uint32_t)cluster_starts.size();
+
+    // Area weighted centroid and normal of each cluster and of the entire mesh.
+    std::vector<Vector3> cluster_centroids(cluster_count, Vector3_Zero);
+    std::vector<Vector3> cluster_normals(cluster_count, Vector3_Zero);
+    Vector3 mesh_centroid = Vector3_Zero;
+    float mesh_area = 0.f;
+
+    for (uint32_t c = 0; c < cluster_count; c++) {
+        const uint32_t start = cluster_starts[c];
+        const uint32_t end = c + 1 < cluster_count ? cluster_starts[c + 1] : triangle_count;
+
+        float cluster_area = 0.f;
+        for (uint32_t t = start; t < end; t++) {
+            const Vector3& p0 = vertices[indices[t*3 + 0]].pos;
+            const Vector3& p1 = vertices[indices[t*3 + 1]].pos;
+            const Vector3& p2 = vertices[indices[t*3 + 2]].pos;
+
+            Vector3 n = cross(p1 - p0, p2 - p0);
+            float area = n.length();
+            Vector3 centroid = (p0 + p1 + p2) * (1.f / 3.f);
+
+            cluster_centroids[c] += centroid * area;
+            cluster_normals[c] += n;
+            cluster_area += area;
+        }
+        mesh_centroid += cluster_centroids[c];
+        mesh_area += cluster_area;
+
+        if (cluster_area > 0.f)
+            cluster_centroids[c] = cluster_centroids[c] * (1.f / cluster_area);
+        float normal_length = cluster_normals[c].length();
+        if (normal_length > 0.f)
+            cluster_normals[c] = cluster_normals[c] * (1.f / normal_length);
+    }
+    if (mesh_area > 0.f)
+        mesh_centroid = mesh_centroid * (1.f / mesh_area);
+
+    // Clusters that face away from the mesh center are more likely to occlude other clusters.
+    std::vector<float> sort_keys(cluster_count);
+    for (uint32_t c = 0; c < cluster_count; c++)
+        sort_keys[c] = dot(cluster_centroids[c] - mesh_centroid, cluster_normals[c]);
+
+    std::vector<uint32_t> cluster_order(cluster_count);
+    for (uint32_t c = 0; c < cluster_count; c++)
+        cluster_order[c] = c;
+    std::stable_sort(cluster_order.begin(), cluster_order.end(), [&sort_keys](uint32_t c1, uint32_t c2) {
+        return sort_keys[c1] > sort_keys[c2];
+    });
+
+    std::vector<uint32_t> output;
+    output.reserve(index_count);
+    for (uint32_t c : cluster_order) {
+        const uint32_t start = cluster_starts[c];
+        const uint32_t end = c + 1 < cluster_count ? cluster_starts[c + 1] : triangle_count;
+        output.insert(output.end(), indices + start * 3, indices + end * 3);
+    }
+    std::copy(output.begin(), output.end(), indices);
+}
+
+void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    const uint32_t unused = ~0u;
+    std::vector<uint32_t> remap(vertices.size(), unused);
+    std::vector<Vertex> new_vertices;
+    new_vertices.reserve(vertices.size());
+
+    for (uint32_t& index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = (uint32_t)new_vertices.size();
+            new_vertices.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(new_vertices);
+}
+
+void optimize_mesh(Mesh& mesh) {
+    uint32_t* indices = mesh.indices.data();
+    const uint32_t index_count = (uint32_t)mesh.indices.size();
+    const uint32_t vertex_count = (uint32_t)mesh.vertices.size();
+
+    Timestamp t;
+    Vertex_Cache_Stats stats_before = analyze_vertex_cache(indices, index_count, vertex_count, vertex_cache_size);
+
+    optimize_vertex_cache(indices, index_count, vertex_count);
+    Vertex_Cache_Stats stats_vertex_cache = analyze_vertex_cache(indices, index_count, vertex_count, vertex_cache_size);
+
+    optimize_overdraw(indices, index_count, mesh.vertices.data(), vertex_count, 1.05f);
+    optimize_vertex_fetch(mesh.vertices, mesh.indices);
+    Vertex_Cache_Stats stats_after = analyze_vertex_cache(mesh.indices.data(), index_count, (uint32_t)mesh.vertices.size(), vertex_cache_size);
+
+    printf("Mesh optimization time = %lld milliseconds\n", elapsed_milliseconds(t));
+    printf("  vertex cache (FIFO %u): ACMR %.3f -> %.3f (after overdraw pass %.3f), ATVR %.3f -> %.3f (after overdraw pass %.3f)\n",
+        vertex_cache_size, stats_before.acmr, stats_vertex_cache.acmr, stats_after.acmr,
+        stats_before.atvr, stats_vertex_cache.atvr, stats_after.atvr);
+}
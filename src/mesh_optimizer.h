@@ -0,0 +1,27 @@
+#pragma once
+
+#include "mesh.h"
+
+// Post-transform vertex cache statistics computed by simulating FIFO cache.
+// ACMR - average number of cache misses per triangle (0.5 is the ideal for large regular meshes).
+// ATVR - average number of transformed vertices per vertex (1.0 is the ideal).
+struct Vertex_Cache_Stats {
+    float acmr;
+    float atvr;
+};
+
+Vertex_Cache_Stats analyze_vertex_cache(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size);
+
+// Reorders triangles to improve post-transform vertex cache reuse (Tom Forsyth's algorithm).
+void optimize_vertex_cache(uint32_t* indices, uint32_t index_count, uint32_t vertex_count);
+
+// Splits triangles into clusters without sacrificing too much vertex cache efficiency and sorts clusters
+// so that outward-facing clusters are rendered first. Expects indices optimized for vertex cache.
+// threshold specifies how much ACMR is allowed to degrade (1.05 = 5%).
+void optimize_overdraw(uint32_t* indices, uint32_t index_count, const Vertex* vertices, uint32_t vertex_count, float threshold);
+
+// Reorders vertices in the order of first use by the index buffer and removes unreferenced vertices.
+void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+// Runs all optimization passes and prints vertex cache statistics before and after.
+void optimize_mesh(Mesh& mesh);
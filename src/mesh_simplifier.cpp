@@ -0,0 +1,606 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+//
+// Michael Garland, Paul S. Heckbert. Surface Simplification Using Quadric Error Metrics.
+// Topology classification and the collapse rules for borders and attribute seams follow
+// the approach used in meshoptimizer (https://github.com/zeux/meshoptimizer).
+//
+namespace {
+constexpr uint32_t invalid_vertex = 0xffffffff;
+
+// Border edges get larger weight, so silhouette of the open mesh parts is preserved.
+constexpr double border_edge_weight = 10.0;
+
+enum Vertex_Kind : uint8_t {
+    vertex_kind_manifold,   // interior vertex without attribute seams
+    vertex_kind_border,     // vertex on the open border of the mesh
+    vertex_kind_seam,       // vertex on the attribute seam, has exactly one seam pair
+    vertex_kind_locked,     // non-manifold or complex seam topology, never collapsed
+    vertex_kind_count
+};
+
+// can_collapse[k0][k1]: vertex of kind k0 can be collapsed onto vertex of kind k1.
+const bool can_collapse[vertex_kind_count][vertex_kind_count] = {
+    { true,  true,  true,  true  },
+    { false, true,  false, false },
+    { false, false, true,  false },
+    { false, false, false, false },
+};
+
+// has_opposite[k0][k1]: edge between vertices of kinds k0 and k1 has both half-edges in the index buffer
+// (when the vertices are compared by position).
+const bool has_opposite[vertex_kind_count][vertex_kind_count] = {
+    { true,  true,  true,  false },
+    { true,  false, true,  false },
+    { true,  true,  true,  false },
+    { false, false, false, false },
+};
+
+// Symmetric 4x4 matrix that represents sum of squared distances to a set of weighted planes.
+struct Quadric {
+    double a00, a11, a22, a01, a02, a12;
+    double b0, b1, b2;
+    double c;
+    double weight;
+
+    void add_plane(const Vector3& n, double d, double w) {
+        a00 += w * n.x * n.x;
+        a11 += w * n.y * n.y;
+        a22 += w * n.z * n.z;
+        a01 += w * n.x * n.y;
+        a02 += w * n.x * n.z;
+        a12 += w * n.y * n.z;
+        b0 += w * n.x * d;
+        b1 += w * n.y * d;
+        b2 += w * n.z * d;
+        c += w * d * d;
+        weight += w;
+    }
+
+    void add(const Quadric& q) {
+        a00 += q.a00; a11 += q.a11; a22 += q.a22;
+        a01 += q.a01; a02 += q.a02; a12 += q.a12;
+        b0 += q.b0; b1 += q.b1; b2 += q.b2;
+        c += q.c;
+        weight += q.weight;
+    }
+
+    // Weighted mean squared distance from the point to the planes.
+    double error(const Vector3& p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        double e = a00*x*x + a11*y*y + a22*z*z + 2.0*(a01*x*y + a02*x*z + a12*y*z) + 2.0*(b0*x + b1*y + b2*z) + c;
+        return weight > 0.0 ? std::abs(e) / weight : 0.0;
+    }
+};
+
+struct Edge_Collapse {
+    uint32_t v0; // vertex that is removed
+    uint32_t v1; // vertex that v0 is collapsed onto
+    bool bidirectional;
+    float error; // squared distance
+};
+
+// Compressed adjacency list: outgoing half-edges of each vertex.
+struct Edge_Adjacency {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> targets;
+
+    void build(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count) {
+        offsets.assign(vertex_count + 1, 0);
+        for (uint32_t i = 0; i < index_count; i++)
+            offsets[indices[i] + 1]++;
+        for (uint32_t v = 0; v < vertex_count; v++)
+            offsets[v + 1] += offsets[v];
+
+        targets.resize(index_count);
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (uint32_t i = 0; i < index_count; i += 3) {
+            for (uint32_t k = 0; k < 3; k++) {
+                uint32_t a = indices[i + k];
+                uint32_t b = indices[i + (k + 1) % 3];
+                targets[fill[a]++] = b;
+            }
+        }
+    }
+
+    bool has_edge(uint32_t a, uint32_t b) const {
+        for (uint32_t i = offsets[a]; i < offsets[a + 1]; i++) {
+            if (targets[i] == b)
+                return true;
+        }
+        return false;
+    }
+};
+
+struct Simplifier {
+    uint32_t vertex_count;
+    const Vector3* positions_base;
+    uint32_t vertex_stride;
+
+    std::vector<uint32_t> remap; // the first vertex with the same position
+    std::vector<uint32_t> wedge; // next vertex with the same position (cyclic list)
+    std::vector<Vertex_Kind> kind;
+    std::vector<uint32_t> loop; // next vertex along the open edge, invalid_vertex if none
+    std::vector<uint32_t> loopback; // previous vertex along the open edge, invalid_vertex if none
+    std::vector<Quadric> quadrics; // indexed by remap[v]
+
+    const Vector3& position(uint32_t v) const {
+        return *(const Vector3*)((const uint8_t*)positions_base + size_t(v) * vertex_stride);
+    }
+
+    void build_position_remap(const uint32_t* indices, uint32_t index_count);
+    void classify_vertices(const uint32_t* indices, uint32_t index_count);
+    void fill_quadrics(const uint32_t* indices, uint32_t index_count);
+    bool has_triangle_flips(const uint32_t* indices, const std::vector<uint32_t>& triangle_offsets,
+        const std::vector<uint32_t>& triangles, const std::vector<uint32_t>& collapse_remap, uint32_t v0, uint32_t v1) const;
+};
+
+// Groups vertices with the same position. Only vertices referenced by the index buffer are grouped,
+// so unused vertices of the shared vertex buffer do not create fake attribute seams.
+void Simplifier::build_position_remap(const uint32_t* indices, uint32_t index_count) {
+    remap.resize(vertex_count);
+    wedge.resize(vertex_count);
+
+    std::vector<uint8_t> used(vertex_count, 0);
+    for (uint32_t i = 0; i < index_count; i++)
+        used[indices[i]] = 1;
+
+    std::vector<uint32_t> order;
+    for (uint32_t v = 0; v < vertex_count; v++) {
+        remap[v] = v;
+        wedge[v] = v;
+        if (used[v])
+            order.push_back(v);
+    }
+
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        const Vector3& pa = position(a);
+        const Vector3& pb = position(b);
+        if (pa.x != pb.x) return pa.x < pb.x;
+        if (pa.y != pb.y) return pa.y < pb.y;
+        if (pa.z != pb.z) return pa.z < pb.z;
+        return a < b;
+    });
+
+    const uint32_t used_count = (uint32_t)order.size();
+    for (uint32_t begin = 0; begin < used_count;) {
+        uint32_t end = begin + 1;
+        while (end < used_count && position(order[end]) == position(order[begin]))
+            end++;
+        for (uint32_t i = begin; i < end; i++) {
+            remap[order[i]] = order[begin];
+            wedge[order[i]] = order[i + 1 < end ? i + 1 : begin];
+        }
+        begin = end;
+    }
+}
+
+void Simplifier::classify_vertices(const uint32_t* indices, uint32_t index_count) {
+    Edge_Adjacency adjacency;
+    adjacency.build(indices, index_count, vertex_count);
+
+    // Find open half-edges: edges that do not have the opposite half-edge with the same vertices.
+    // For vertex v: loop[v] is the target of the outgoing open edge, loopback[v] is the source of the
+    // incoming open edge. If there are several such edges the value is v itself.
+    loop.assign(vertex_count, invalid_vertex);
+    loopback.assign(vertex_count, invalid_vertex);
+
+    for (uint32_t a = 0; a < vertex_count; a++) {
+        for (uint32_t i = adjacency.offsets[a]; i < adjacency.offsets[a + 1]; i++) {
+            uint32_t b = adjacency.targets[i];
+            if (adjacency.has_edge(b, a))
+                continue;
+            loop[a] = (loop[a] == invalid_vertex) ? b : a;
+            loopback[b] = (loopback[b] == invalid_vertex) ? a : b;
+        }
+    }
+
+    // Checks if there is an edge between the positions of a and b.
+    auto has_position_edge = [this, &adjacency](uint32_t a, uint32_t b) {
+        uint32_t w = a;
+        do {
+            for (uint32_t i = adjacency.offsets[w]; i < adjacency.offsets[w + 1]; i++) {
+                if (remap[adjacency.targets[i]] == remap[b])
+                    return true;
+            }
+            w = wedge[w];
+        } while (w != a);
+        return false;
+    };
+
+    kind.resize(vertex_count);
+    for (uint32_t v = 0; v < vertex_count; v++) {
+        if (wedge[v] == v) {
+            // No attribute seam, check whether the vertex is on the border.
+            // Vertices without open edges are classified as manifold, even if the edge is shared by more than two triangles.
+            // Open edges that have the opposite half-edge by position end on the seam, such vertices are locked.
+            const uint32_t open_out = loop[v], open_in = loopback[v];
+            if (open_out == invalid_vertex && open_in == invalid_vertex)
+                kind[v] = vertex_kind_manifold;
+            else if (open_out != invalid_vertex && open_in != invalid_vertex && open_out != v && open_in != v &&
+                !has_position_edge(open_out, v) && !has_position_edge(v, open_in))
+                kind[v] = vertex_kind_border;
+            else
+                kind[v] = vertex_kind_locked;
+        }
+        else if (wedge[wedge[v]] == v) {
+            // Two-vertex seam. Each vertex should have one incoming and one outgoing open edge, and the
+            // open edges of both vertices should connect the same positions.
+            const uint32_t w = wedge[v];
+            const uint32_t open_out_v = loop[v], open_in_v = loopback[v];
+            const uint32_t open_out_w = loop[w], open_in_w = loopback[w];
+
+            if (open_out_v != invalid_vertex && open_out_v != v && open_in_v != invalid_vertex && open_in_v != v &&
+                open_out_w != invalid_vertex && open_out_w != w && open_in_w != invalid_vertex && open_in_w != w &&
+                remap[open_in_v] == remap[open_out_w] && remap[open_out_v] == remap[open_in_w])
+            {
+                kind[v] = vertex_kind_seam;
+            } else {
+                kind[v] = vertex_kind_locked;
+            }
+        }
+        else {
+            kind[v] = vertex_kind_locked;
+        }
+    }
+}
+
+void Simplifier::fill_quadrics(const uint32_t* indices, uint32_t index_count) {
+    quadrics.assign(vertex_count, Quadric{});
+
+    for (uint32_t i = 0; i < index_count; i += 3) {
+        const uint32_t v[3] = { indices[i + 0], indices[i + 1], indices[i + 2] };
+        const Vector3& p0 = position(v[0]);
+        const Vector3& p1 = position(v[1]);
+        const Vector3& p2 = position(v[2]);
+
+        Vector3 normal = cross(p1 - p0, p2 - p0);
+        const float double_area = normal.length();
+        if (double_area == 0.f)
+            continue;
+        normal = normal * (1.f / double_area);
+
+        // Plane of the triangle weighted by the triangle area.
+        Quadric triangle_quadric{};
+        triangle_quadric.add_plane(normal, -dot(normal, p0), 0.5 * double_area);
+        for (uint32_t k = 0; k < 3; k++)
+            quadrics[remap[v[k]]].add(triangle_quadric);
+
+        // Border edges get a plane that is perpendicular to the triangle, so border vertices stay on the border line.
+        for (uint32_t k = 0; k < 3; k++) {
+            const uint32_t a = v[k];
+            const uint32_t b = v[(k + 1) % 3];
+            if (kind[a] != vertex_kind_border || loop[a] != b)
+                continue;
+
+            const Vector3 edge = position(b) - position(a);
+            const float edge_length = edge.length();
+            if (edge_length == 0.f)
+                continue;
+            const Vector3 edge_normal = cross(edge, normal) * (1.f / edge_length);
+
+            Quadric edge_quadric{};
+            edge_quadric.add_plane(edge_normal, -dot(edge_normal, position(a)), border_edge_weight * edge_length * edge_length);
+            quadrics[remap[a]].add(edge_quadric);
+            quadrics[remap[b]].add(edge_quadric);
+        }
+    }
+}
+
+// Checks if moving vertex v0 to the position of v1 flips any triangle adjacent to v0.
+bool Simplifier::has_triangle_flips(const uint32_t* indices, const std::vector<uint32_t>& triangle_offsets,
+    const std::vector<uint32_t>& triangles, const std::vector<uint32_t>& collapse_remap, uint32_t v0, uint32_t v1) const
+{
+    const uint32_t r0 = remap[v0];
+    const uint32_t r1 = remap[v1];
+    const Vector3& new_position = position(v1);
+
+    for (uint32_t i = triangle_offsets[r0]; i < triangle_offsets[r0 + 1]; i++) {
+        const uint32_t* tri = &indices[triangles[i] * 3];
+        const uint32_t a = collapse_remap[tri[0]], b = collapse_remap[tri[1]], c = collapse_remap[tri[2]];
+
+        // Triangles that contain both vertices are removed by the collapse.
+        if (remap[a] == r1 || remap[b] == r1 || remap[c] == r1)
+            continue;
+
+        const Vector3 pa = position(a), pb = position(b), pc = position(c);
+        const Vector3 old_normal = cross(pb - pa, pc - pa);
+
+        const Vector3 qa = remap[a] == r0 ? new_position : pa;
+        const Vector3 qb = remap[b] == r0 ? new_position : pb;
+        const Vector3 qc = remap[c] == r0 ? new_position : pc;
+        const Vector3 new_normal = cross(qb - qa, qc - qa);
+
+        if (dot(old_normal, new_normal) <= 0.f)
+            return true;
+    }
+    return false;
+}
+}
+
+uint32_t simplify_mesh(uint32_t* destination, const uint32_t* indices, uint32_t index_count,
+    const Vector3* vertex_positions, uint32_t vertex_count, uint32_t vertex_stride,
+    uint32_t target_index_count, float target_error, float* result_error)
+{
+    assert(index_count % 3 == 0);
+    assert(target_index_count <= index_count);
+
+    Simplifier s;
+    s.vertex_count = vertex_count;
+    s.positions_base = vertex_positions;
+    s.vertex_stride = vertex_stride;
+
+    s.build_position_remap(indices, index_count);
+    s.classify_vertices(indices, index_count);
+    s.fill_quadrics(indices, index_count);
+
+    // Destination keeps the current state of the simplified mesh.
+    std::copy(indices, indices + index_count, destination);
+    uint32_t result_count = index_count;
+
+    std::vector<Edge_Collapse> collapses;
+    std::vector<uint32_t> collapse_remap(vertex_count);
+    std::vector<uint8_t> collapse_locked(vertex_count);
+    std::vector<uint32_t> triangle_offsets;
+    std::vector<uint32_t> triangles;
+
+    const double error_limit = double(target_error) * double(target_error);
+    double max_error = 0.0;
+
+    while (result_count > target_index_count) {
+        // Collect edges that can be collapsed.
+        collapses.clear();
+        for (uint32_t i = 0; i < result_count; i += 3) {
+            for (uint32_t k = 0; k < 3; k++) {
+                const uint32_t i0 = destination[i + k];
+                const uint32_t i1 = destination[i + (k + 1) % 3];
+
+                // Zero length edges can be produced by collapses of complex seam topology, keep them.
+                if (s.remap[i0] == s.remap[i1])
+                    continue;
+
+                const Vertex_Kind k0 = s.kind[i0];
+                const Vertex_Kind k1 = s.kind[i1];
+                if (!can_collapse[k0][k1] && !can_collapse[k1][k0])
+                    continue;
+
+                // Edges that have the opposite half-edge are processed once.
+                if (has_opposite[k0][k1] && s.remap[i1] > s.remap[i0])
+                    continue;
+
+                // Border and seam vertices can be collapsed only along the border or seam edge.
+                if (k0 == k1 && (k0 == vertex_kind_border || k0 == vertex_kind_seam) && s.loop[i0] != i1)
+                    continue;
+
+                Edge_Collapse collapse;
+                collapse.bidirectional = can_collapse[k0][k1] && can_collapse[k1][k0];
+                collapse.v0 = can_collapse[k0][k1] ? i0 : i1;
+                collapse.v1 = can_collapse[k0][k1] ? i1 : i0;
+                collapses.push_back(collapse);
+            }
+        }
+        if (collapses.empty())
+            break;
+
+        // Rank collapses by the error of the merged quadric at the target position.
+        for (Edge_Collapse& collapse : collapses) {
+            Quadric q = s.quadrics[s.remap[collapse.v0]];
+            q.add(s.quadrics[s.remap[collapse.v1]]);
+            double error = q.error(s.position(collapse.v1));
+
+            if (collapse.bidirectional) {
+                const double reverse_error = q.error(s.position(collapse.v0));
+                if (reverse_error < error) {
+                    std::swap(collapse.v0, collapse.v1);
+                    error = reverse_error;
+                }
+            }
+            collapse.error = float(error);
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Edge_Collapse& a, const Edge_Collapse& b) {
+            return a.error < b.error;
+        });
+
+        // Triangles adjacent to each position, used for the triangle flip test.
+        triangle_offsets.assign(vertex_count + 1, 0);
+        for (uint32_t i = 0; i < result_count; i++)
+            triangle_offsets[s.remap[destination[i]] + 1]++;
+        for (uint32_t v = 0; v < vertex_count; v++)
+            triangle_offsets[v + 1] += triangle_offsets[v];
+        triangles.resize(result_count);
+        {
+            std::vector<uint32_t> fill(triangle_offsets.begin(), triangle_offsets.end() - 1);
+            for (uint32_t i = 0; i < result_count; i++)
+                triangles[fill[s.remap[destination[i]]]++] = i / 3;
+        }
+
+        // Each collapse removes up to two triangles. Vertices that participate in a collapse are locked
+        // until the next pass, so we do not have to update the adjacency. The error limit prevents
+        // collapses with high error in the current pass when cheaper collapses can become available
+        // in the next pass.
+        const uint32_t triangle_collapse_goal = (result_count - target_index_count) / 3;
+        const size_t edge_collapse_goal = std::max<size_t>(triangle_collapse_goal / 2, 1);
+        const double pass_error_limit = std::min(error_limit,
+            edge_collapse_goal < collapses.size() ? double(collapses[edge_collapse_goal].error) * 1.5 : std::numeric_limits<double>::max());
+
+        for (uint32_t v = 0; v < vertex_count; v++)
+            collapse_remap[v] = v;
+        std::fill(collapse_locked.begin(), collapse_locked.end(), uint8_t(0));
+
+        uint32_t triangle_collapses = 0;
+        uint32_t edge_collapses = 0;
+        for (const Edge_Collapse& collapse : collapses) {
+            if (triangle_collapses >= triangle_collapse_goal)
+                break;
+            if (collapse.error > pass_error_limit)
+                break;
+
+            const uint32_t i0 = collapse.v0;
+            const uint32_t i1 = collapse.v1;
+            const uint32_t r0 = s.remap[i0];
+            const uint32_t r1 = s.remap[i1];
+            if (collapse_locked[r0] || collapse_locked[r1])
+                continue;
+
+            if (s.has_triangle_flips(destination, triangle_offsets, triangles, collapse_remap, i0, i1))
+                continue;
+
+            s.quadrics[r1].add(s.quadrics[r0]);
+
+            if (s.kind[i0] == vertex_kind_seam) {
+                // Seam pair of v0 is collapsed onto the seam pair of v1 on the other side of the seam.
+                const uint32_t s0 = s.wedge[i0];
+                const uint32_t s1 = (s.loop[i0] == i1) ? s.loopback[s0] : s.loop[s0];
+                assert(s0 != i0 && s.wedge[s0] == i0);
+                assert(s1 != invalid_vertex && s.remap[s1] == r1);
+                collapse_remap[i0] = i1;
+                collapse_remap[s0] = s1;
+            } else {
+                assert(s.wedge[i0] == i0);
+                collapse_remap[i0] = i1;
+            }
+
+            collapse_locked[r0] = 1;
+            collapse_locked[r1] = 1;
+            triangle_collapses += (s.kind[i0] == vertex_kind_border) ? 1 : 2;
+            edge_collapses++;
+            max_error = std::max(max_error, double(collapse.error));
+        }
+        if (edge_collapses == 0)
+            break;
+
+        // Apply collapses and remove degenerate triangles.
+        uint32_t write = 0;
+        for (uint32_t i = 0; i < result_count; i += 3) {
+            const uint32_t a = collapse_remap[destination[i + 0]];
+            const uint32_t b = collapse_remap[destination[i + 1]];
+            const uint32_t c = collapse_remap[destination[i + 2]];
+            if (s.remap[a] == s.remap[b] || s.remap[a] == s.remap[c] || s.remap[b] == s.remap[c])
+                continue;
+            destination[write + 0] = a;
+            destination[write + 1] = b;
+            destination[write + 2] = c;
+            write += 3;
+        }
+        result_count = write;
+
+        // Open edges now connect the collapse targets.
+        for (std::vector<uint32_t>* edge_loop : { &s.loop, &s.loopback }) {
+            std::vector<uint32_t>& l = *edge_loop;
+            for (uint32_t v = 0; v < vertex_count; v++) {
+                if (l[v] == invalid_vertex)
+                    continue;
+                const uint32_t target = collapse_remap[l[v]];
+                // The seam edge collapsed in the direction opposite to the loop direction.
+                l[v] = (target == v) ? l[l[v]] : target;
+            }
+        }
+    }
+
+    if (result_error)
+        *result_error = float(std::sqrt(max_error));
+    return result_count;
+}
+
+std::vector<Mesh_LOD> generate_lod_chain(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+    uint32_t max_lod_count, std::vector<uint32_t>& lod_indices)
+{
+    // Do not create levels that are too small to make a difference.
+    const uint32_t min_lod_index_count = 3 * 64;
+
+    // Vertices that differ only by normal (hard edges) are merged before simplification. Otherwise
+    // the points where several hard edges meet are locked and the mesh can't be simplified much.
+    // Vertices with different texture coordinates are kept separate, so the texture is not distorted.
+    std::vector<uint32_t> weld_remap(vertex_count);
+    std::vector<uint32_t> weld_next(vertex_count); // cyclic list of vertices merged together
+    {
+        std::vector<uint8_t> used(vertex_count, 0);
+        for (uint32_t i = 0; i < index_count; i++)
+            used[indices[i]] = 1;
+
+        std::vector<uint32_t> order;
+        for (uint32_t v = 0; v < vertex_count; v++) {
+            weld_remap[v] = v;
+            weld_next[v] = v;
+            if (used[v])
+                order.push_back(v);
+        }
+        auto same_position_and_uv = [vertices](uint32_t a, uint32_t b) {
+            return vertices[a].pos == vertices[b].pos && vertices[a].uv == vertices[b].uv;
+        };
+        std::sort(order.begin(), order.end(), [vertices](uint32_t a, uint32_t b) {
+            const float ka[5] = { vertices[a].pos.x, vertices[a].pos.y, vertices[a].pos.z, vertices[a].uv.x, vertices[a].uv.y };
+            const float kb[5] = { vertices[b].pos.x, vertices[b].pos.y, vertices[b].pos.z, vertices[b].uv.x, vertices[b].uv.y };
+            for (int k = 0; k < 5; k++) {
+                if (ka[k] != kb[k])
+                    return ka[k] < kb[k];
+            }
+            return a < b;
+        });
+        const uint32_t used_count = (uint32_t)order.size();
+        for (uint32_t begin = 0; begin < used_count;) {
+            uint32_t end = begin + 1;
+            while (end < used_count && same_position_and_uv(order[begin], order[end]))
+                end++;
+            for (uint32_t i = begin; i < end; i++) {
+                weld_remap[order[i]] = order[begin];
+                weld_next[order[i]] = order[i + 1 < end ? i + 1 : begin];
+            }
+            begin = end;
+        }
+    }
+
+    lod_indices.assign(indices, indices + index_count);
+    std::vector<Mesh_LOD> lods;
+    lods.push_back(Mesh_LOD{ 0, index_count, 0.f });
+
+    std::vector<uint32_t> welded_indices(index_count);
+    for (uint32_t i = 0; i < index_count; i++)
+        welded_indices[i] = weld_remap[indices[i]];
+
+    std::vector<uint32_t> simplified(index_count);
+    while (lods.size() < max_lod_count) {
+        const Mesh_LOD previous = lods.back();
+        const uint32_t previous_index_count = (uint32_t)welded_indices.size();
+        const uint32_t target_index_count = previous_index_count / 6 * 3;
+        if (target_index_count < min_lod_index_count)
+            break;
+
+        float error;
+        const uint32_t simplified_count = simplify_mesh(simplified.data(), welded_indices.data(), previous_index_count,
+            &vertices[0].pos, vertex_count, sizeof(Vertex), target_index_count, std::numeric_limits<float>::max(), &error);
+
+        // Stop when the topology does not allow to remove a noticeable number of triangles.
+        if (simplified_count == 0 || simplified_count > previous_index_count / 4 * 3)
+            break;
+
+        welded_indices.assign(simplified.begin(), simplified.begin() + simplified_count);
+
+        // For each triangle corner select the merged vertex with the normal closest to the triangle normal.
+        const uint32_t first_index = (uint32_t)lod_indices.size();
+        lod_indices.resize(first_index + simplified_count);
+        for (uint32_t i = 0; i < simplified_count; i += 3) {
+            const uint32_t* tri = &welded_indices[i];
+            const Vector3 face_normal = cross(vertices[tri[1]].pos - vertices[tri[0]].pos, vertices[tri[2]].pos - vertices[tri[0]].pos);
+            for (uint32_t k = 0; k < 3; k++) {
+                uint32_t best_vertex = tri[k];
+                float best_dot = dot(vertices[best_vertex].normal, face_normal);
+                for (uint32_t v = weld_next[tri[k]]; v != tri[k]; v = weld_next[v]) {
+                    const float d = dot(vertices[v].normal, face_normal);
+                    if (d > best_dot) {
+                        best_dot = d;
+                        best_vertex = v;
+                    }
+                }
+                lod_indices[first_index + i + k] = best_vertex;
+            }
+        }
+        lods.push_back(Mesh_LOD{ first_index, simplified_count, previous.error + error });
+    }
+    return lods;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "mesh.h"
+
+// Simplifies the mesh by collapsing edges in the order of increasing quadric error.
+//
+// Vertices are not modified: the simplified triangles reference a subset of the input vertices,
+// so the simplified mesh can share the vertex buffer with the original one. Vertices on mesh borders
+// can only slide along the border and vertices on attribute seams are collapsed together with their
+// seam pairs. Vertices with more complex topology are locked.
+//
+// destination should have space for index_count indices. Returns the number of written indices.
+// result_error is set to the estimated distance between the original and simplified surfaces.
+uint32_t simplify_mesh(uint32_t* destination, const uint32_t* indices, uint32_t index_count,
+    const Vector3* vertex_positions, uint32_t vertex_count, uint32_t vertex_stride,
+    uint32_t target_index_count, float target_error, float* result_error);
+
+// Generates LOD chain where each level has about half of the triangles of the previous level.
+// lod_indices receives the indices of all levels, the first level is the original index buffer.
+// The error of each level is accumulated over the chain.
+std::vector<Mesh_LOD> generate_lod_chain(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+    uint32_t max_lod_count, std::vector<uint32_t>& lod_indices);
@@ -0,0 +1,512 @@
+#include "obj_reader.h"
+#include "platform.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+
+namespace {
+enum Obj_Statement_Type : uint32_t {
+    obj_statement_object,           // 'o' or 'g'
+    obj_statement_material,         // 'usemtl'
+    obj_statement_material_library  // 'mtllib'
+};
+
+// Statement that affects the faces that follow it. corner is the number of chunk corners before the statement.
+struct Obj_Statement {
+    Obj_Statement_Type  type;
+    uint32_t            corner;
+    std::string         name;
+};
+
+// Data parsed from a line-aligned part of the file.
+// Relative (negative) OBJ indices can't be resolved until the number of elements
+// in the preceding chunks is known, so they are stored relative to the chunk start and
+// their locations are remembered in relative_indices (corner_index * 3 + attribute).
+struct Obj_Chunk {
+    std::vector<Vector3>    positions;
+    std::vector<Vector3>    normals;
+    std::vector<Vector2>    texcoords;
+    std::vector<Obj_Index>  corners;
+    std::vector<uint32_t>   relative_indices;
+    std::vector<Obj_Statement> statements;
+    bool                    failed = false;
+};
+
+enum Obj_Attribute : uint32_t {
+    obj_attribute_position,
+    obj_attribute_normal,
+    obj_attribute_texcoord
+};
+}
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static inline bool is_digit(char c) {
+    return uint32_t(c - '0') < 10;
+}
+
+static inline const char* skip_spaces(const char* p, const char* end) {
+    while (p < end && is_space(*p))
+        p++;
+    return p;
+}
+
+static inline const char* skip_line(const char* p, const char* end) {
+    while (p < end && *p != '\n')
+        p++;
+    return p < end ? p + 1 : end;
+}
+
+// Returns pointer after the keyword if the line starts with the keyword followed by a space, otherwise nullptr.
+static inline const char* match_keyword(const char* p, const char* end, const char* keyword) {
+    const size_t length = strlen(keyword);
+    if (size_t(end - p) <= length || memcmp(p, keyword, length) != 0 || !is_space(p[length]))
+        return nullptr;
+    return p + length + 1;
+}
+
+// Returns the rest of the line without leading and trailing spaces.
+static std::string parse_name(const char* p, const char* end) {
+    p = skip_spaces(p, end);
+    const char* name_end = p;
+    while (name_end < end && *name_end != '\n')
+        name_end++;
+    while (name_end > p && (is_space(name_end[-1]) || name_end[-1] == '\r'))
+        name_end--;
+    return std::string(p, name_end);
+}
+
+// Parses floating point number in the decimal notation. Returns nullptr if there is no number at the current position.
+static const char* parse_float(const char* p, const char* end, float& result) {
+    static const double powers_of_10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    p = skip_spaces(p, end);
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+
+    // Accumulate up to 19 significant digits, that fits into 64-bit integer.
+    uint64_t mantissa = 0;
+    int significant_digits = 0;
+    int exponent = 0;
+    bool has_digits = false;
+
+    for (; p < end && is_digit(*p); p++) {
+        has_digits = true;
+        if (significant_digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            significant_digits += (mantissa != 0);
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++) {
+            has_digits = true;
+            if (significant_digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                significant_digits += (mantissa != 0);
+                exponent--;
+            }
+        }
+    }
+    if (!has_digits)
+        return nullptr;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* exponent_start = p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative_exponent = (*p == '-');
+            p++;
+        }
+        if (p < end && is_digit(*p)) {
+            int e = 0;
+            for (; p < end && is_digit(*p); p++)
+                e = std::min(e * 10 + (*p - '0'), 10000);
+            exponent += negative_exponent ? -e : e;
+        } else {
+            p = exponent_start; // not an exponent
+        }
+    }
+
+    double value = double(mantissa);
+    if (exponent < 0)
+        value = (-exponent <= 22) ? value / powers_of_10[-exponent] : value * std::pow(10.0, exponent);
+    else if (exponent > 0)
+        value = (exponent <= 22) ? value * powers_of_10[exponent] : value * std::pow(10.0, exponent);
+
+    result = float(negative ? -value : value);
+    return p;
+}
+
+static inline const char* parse_int(const char* p, const char* end, int64_t& result) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p == end || !is_digit(*p))
+        return nullptr;
+
+    int64_t value = 0;
+    for (; p < end && is_digit(*p); p++)
+        value = std::min<int64_t>(value * 10 + (*p - '0'), INT32_MAX);
+
+    result = negative ? -value : value;
+    return p;
+}
+
+// Converts 1-based or negative OBJ index to zero-based index. Returns false for invalid index.
+// Negative index is resolved relative to the chunk start and the attribute bit is set in relative_mask.
+static inline bool resolve_index(int64_t obj_index, size_t chunk_element_count, Obj_Attribute attribute, int32_t& index, uint32_t& relative_mask) {
+    if (obj_index > 0) {
+        index = int32_t(obj_index - 1);
+        return true;
+    }
+    if (obj_index < 0) {
+        index = int32_t(int64_t(chunk_element_count) + obj_index);
+        relative_mask |= 1u << attribute;
+        return true;
+    }
+    return false;
+}
+
+static const char* parse_face_corner(const char* p, const char* end, const Obj_Chunk& chunk, Obj_Index& corner, uint32_t& relative_mask) {
+    corner = Obj_Index{ -1, -1, -1 };
+    relative_mask = 0;
+
+    int64_t value;
+    if ((p = parse_int(p, end, value)) == nullptr ||
+        !resolve_index(value, chunk.positions.size(), obj_attribute_position, corner.position, relative_mask))
+        return nullptr;
+
+    if (p < end && *p == '/') {
+        p++;
+        if (p < end && *p != '/') {
+            if ((p = parse_int(p, end, value)) == nullptr ||
+                !resolve_index(value, chunk.texcoords.size(), obj_attribute_texcoord, corner.texcoord, relative_mask))
+                return nullptr;
+        }
+        if (p < end && *p == '/') {
+            p++;
+            if ((p = parse_int(p, end, value)) == nullptr ||
+                !resolve_index(value, chunk.normals.size(), obj_attribute_normal, corner.normal, relative_mask))
+                return nullptr;
+        }
+    }
+    return p;
+}
+
+static inline void add_corner(Obj_Chunk& chunk, const Obj_Index& corner, uint32_t relative_mask) {
+    const uint32_t corner_index = uint32_t(chunk.corners.size());
+    for (uint32_t attribute = 0; attribute < 3; attribute++) {
+        if (relative_mask & (1u << attribute))
+            chunk.relative_indices.push_back(corner_index * 3 + attribute);
+    }
+    chunk.corners.push_back(corner);
+}
+
+static void parse_obj_chunk(const char* p, const char* end, Obj_Chunk& chunk) {
+    while (p < end) {
+        p = skip_spaces(p, end);
+        if (p + 1 >= end)
+            break;
+
+        const char c0 = p[0];
+        const char c1 = p[1];
+        bool ok = true;
+
+        if (c0 == 'v' && is_space(c1)) {
+            Vector3 v;
+            ok = (p = parse_float(p + 2, end, v.x)) && (p = parse_float(p, end, v.y)) && (p = parse_float(p, end, v.z));
+            chunk.positions.push_back(v);
+        }
+        else if (c0 == 'v' && c1 == 'n' && p + 2 < end && is_space(p[2])) {
+            Vector3 n;
+            ok = (p = parse_float(p + 3, end, n.x)) && (p = parse_float(p, end, n.y)) && (p = parse_float(p, end, n.z));
+            chunk.normals.push_back(n);
+        }
+        else if (c0 == 'v' && c1 == 't' && p + 2 < end && is_space(p[2])) {
+            Vector2 uv;
+            ok = (p = parse_float(p + 3, end, uv.x)) != nullptr;
+            if (ok && parse_float(p, end, uv.y) == nullptr)
+                uv.y = 0.f; // 1D texture coordinate
+            chunk.texcoords.push_back(uv);
+        }
+        else if (c0 == 'f' && is_space(c1)) {
+            // Triangulate polygon as a fan.
+            Obj_Index first, prev;
+            uint32_t first_mask = 0, prev_mask = 0;
+            uint32_t face_corner_count = 0;
+            p += 2;
+            for (;;) {
+                p = skip_spaces(p, end);
+                if (p == end || *p == '\r' || *p == '\n')
+                    break;
+
+                Obj_Index corner;
+                uint32_t relative_mask;
+                if ((p = parse_face_corner(p, end, chunk, corner, relative_mask)) == nullptr) {
+                    ok = false;
+                    break;
+                }
+
+                if (face_corner_count == 0) {
+                    first = corner;
+                    first_mask = relative_mask;
+                }
+                else if (face_corner_count >= 2) {
+                    add_corner(chunk, first, first_mask);
+                    add_corner(chunk, prev, prev_mask);
+                    add_corner(chunk, corner, relative_mask);
+                }
+                prev = corner;
+                prev_mask = relative_mask;
+                face_corner_count++;
+            }
+            ok = ok && face_corner_count >= 3;
+        }
+        else if ((c0 == 'o' || c0 == 'g') && is_space(c1)) {
+            chunk.statements.push_back(Obj_Statement{ obj_statement_object, uint32_t(chunk.corners.size()), parse_name(p + 2, end) });
+        }
+        else if (const char* name = match_keyword(p, end, "usemtl")) {
+            chunk.statements.push_back(Obj_Statement{ obj_statement_material, uint32_t(chunk.corners.size()), parse_name(name, end) });
+        }
+        else if (const char* name = match_keyword(p, end, "mtllib")) {
+            chunk.statements.push_back(Obj_Statement{ obj_statement_material_library, uint32_t(chunk.corners.size()), parse_name(name, end) });
+        }
+
+        if (!ok) {
+            chunk.failed = true;
+            return;
+        }
+        p = skip_line(p, end);
+    }
+}
+
+static std::string get_directory(const std::string& path) {
+    const size_t pos = path.find_last_of("/\\");
+    return pos == std::string::npos ? std::string() : path.substr(0, pos + 1);
+}
+
+// MTL files are small compared to OBJ files, so they are parsed serially.
+static bool read_mtl_file(const std::string& path, std::vector<Obj_Material>& materials) {
+    platform::Mapped_File file;
+    if (!platform::map_file(path, file))
+        return false;
+
+    const char* p = reinterpret_cast<const char*>(file.data);
+    const char* end = p + file.size;
+    Obj_Material* material = nullptr;
+
+    for (; p < end; p = skip_line(p, end)) {
+        p = skip_spaces(p, end);
+        if (const char* name = match_keyword(p, end, "newmtl")) {
+            materials.push_back(Obj_Material{});
+            material = &materials.back();
+            material->name = parse_name(name, end);
+        }
+        else if (material == nullptr) {
+            continue;
+        }
+        else if (const char* values = match_keyword(p, end, "Kd")) {
+            Vector3 kd;
+            const char* q;
+            if ((q = parse_float(values, end, kd.x)) && (q = parse_float(q, end, kd.y)) && parse_float(q, end, kd.z))
+                material->diffuse = kd;
+        }
+        else if (const char* file_name = match_keyword(p, end, "map_Kd")) {
+            // Texture options are not supported, the rest of the line is a file name.
+            material->diffuse_texture = parse_name(file_name, end);
+        }
+    }
+    platform::unmap_file(file);
+    return true;
+}
+
+// Splits corners into groups at each object and material statement, loads referenced material libraries.
+static void create_obj_groups(const std::string& obj_path, const std::vector<std::pair<uint32_t, const Obj_Statement*>>& statements,
+    uint32_t corner_count, Obj_Data& obj_data)
+{
+    std::string object_name;
+    std::string material_name;
+    std::vector<std::string> group_material_names;
+    uint32_t group_first_corner = 0;
+
+    auto close_group = [&](uint32_t end_corner) {
+        if (end_corner > group_first_corner) {
+            obj_data.groups.push_back(Obj_Group{ object_name, -1, group_first_corner, end_corner - group_first_corner });
+            group_material_names.push_back(material_name);
+        }
+        group_first_corner = end_corner;
+    };
+
+    for (auto [corner, statement] : statements) {
+        if (statement->type == obj_statement_material_library) {
+            const std::string mtl_path = get_directory(obj_path) + statement->name;
+            if (!read_mtl_file(mtl_path, obj_data.materials))
+                printf("failed to read material library: %s\n", mtl_path.c_str());
+            continue;
+        }
+        close_group(corner);
+        if (statement->type == obj_statement_object)
+            object_name = statement->name;
+        else
+            material_name = statement->name;
+    }
+    close_group(corner_count);
+
+    std::unordered_map<std::string, int32_t> material_indices;
+    for (auto [i, material] : enumerate(obj_data.materials))
+        material_indices.emplace(material.name, int32_t(i));
+
+    for (auto [i, group] : enumerate(obj_data.groups)) {
+        auto it = material_indices.find(group_material_names[i]);
+        if (it != material_indices.end())
+            group.material = it->second;
+    }
+}
+
+bool read_obj_file(const std::string& path, Obj_Data& obj_data) {
+    platform::Mapped_File file;
+    if (!platform::map_file(path, file))
+        return false;
+
+    const char* file_begin = reinterpret_cast<const char*>(file.data);
+    const char* file_end = file_begin + file.size;
+
+    // Split file into line-aligned chunks. Use more chunks than threads for load balancing.
+    const uint64_t min_chunk_size = 256 * 1024;
+    const uint64_t chunk_count = std::max<uint64_t>(1, std::min<uint64_t>(file.size / min_chunk_size, get_thread_count() * 8));
+
+    std::vector<const char*> chunk_starts(chunk_count + 1);
+    chunk_starts[0] = file_begin;
+    chunk_starts[chunk_count] = file_end;
+    for (uint64_t i = 1; i < chunk_count; i++) {
+        const char* p = file_begin + file.size * i / chunk_count;
+        chunk_starts[i] = std::max(chunk_starts[i - 1], skip_line(p - 1, file_end));
+    }
+
+    std::vector<Obj_Chunk> chunks(chunk_count);
+    parallel_for(uint32_t(chunk_count), [&chunk_starts, &chunks](uint32_t i, uint32_t) {
+        parse_obj_chunk(chunk_starts[i], chunk_starts[i + 1], chunks[i]);
+    });
+    platform::unmap_file(file);
+
+    // Compute location of each chunk's data in the merged arrays.
+    struct Chunk_Offsets {
+        size_t positions, normals, texcoords, corners;
+    };
+    std::vector<Chunk_Offsets> offsets(chunk_count + 1);
+    offsets[0] = Chunk_Offsets{};
+    for (uint64_t i = 0; i < chunk_count; i++) {
+        if (chunks[i].failed)
+            return false;
+        offsets[i + 1].positions  = offsets[i].positions + chunks[i].positions.size();
+        offsets[i + 1].normals    = offsets[i].normals + chunks[i].normals.size();
+        offsets[i + 1].texcoords  = offsets[i].texcoords + chunks[i].texcoords.size();
+        offsets[i + 1].corners    = offsets[i].corners + chunks[i].corners.size();
+    }
+
+    const Chunk_Offsets& totals = offsets[chunk_count];
+    if (totals.positions > size_t(INT32_MAX) || totals.normals > size_t(INT32_MAX) || totals.texcoords > size_t(INT32_MAX))
+        return false;
+
+    std::vector<std::pair<uint32_t, const Obj_Statement*>> statements;
+    for (uint64_t i = 0; i < chunk_count; i++) {
+        for (const Obj_Statement& statement : chunks[i].statements)
+            statements.push_back({ uint32_t(offsets[i].corners + statement.corner), &statement });
+    }
+    create_obj_groups(path, statements, uint32_t(totals.corners), obj_data);
+
+    obj_data.positions.resize(totals.positions);
+    obj_data.normals.resize(totals.normals);
+    obj_data.texcoords.resize(totals.texcoords);
+    obj_data.corners.resize(totals.corners);
+
+    std::vector<uint8_t> chunk_valid(chunk_count);
+    parallel_for(uint32_t(chunk_count), [&chunks, &offsets, &obj_data, &chunk_valid](uint32_t i, uint32_t) {
+        Obj_Chunk& chunk = chunks[i];
+        const Chunk_Offsets& offset = offsets[i];
+
+        std::copy(chunk.positions.begin(), chunk.positions.end(), obj_data.positions.begin() + offset.positions);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), obj_data.normals.begin() + offset.normals);
+        std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), obj_data.texcoords.begin() + offset.texcoords);
+
+        Obj_Index* corners = obj_data.corners.data() + offset.corners;
+        std::copy(chunk.corners.begin(), chunk.corners.end(), corners);
+
+        const int32_t bases[3] = { int32_t(offset.positions), int32_t(offset.normals), int32_t(offset.texcoords) };
+        for (uint32_t location : chunk.relative_indices) {
+            const uint32_t attribute = location % 3;
+            (&corners[location / 3].position)[attribute] += bases[attribute];
+        }
+
+        bool valid = true;
+        for (size_t k = 0; k < chunk.corners.size(); k++) {
+            const Obj_Index& corner = corners[k];
+            valid &= corner.position >= 0 && size_t(corner.position) < obj_data.positions.size();
+            valid &= corner.normal >= -1 && (corner.normal == -1 || size_t(corner.normal) < obj_data.normals.size());
+            valid &= corner.texcoord >= -1 && (corner.texcoord == -1 || size_t(corner.texcoord) < obj_data.texcoords.size());
+        }
+        chunk_valid[i] = valid;
+        chunk = Obj_Chunk{};
+    });
+    return std::all_of(chunk_valid.begin(), chunk_valid.end(), [](uint8_t valid) { return valid != 0; });
+}
+
+bool read_obj_file_tinyobj(const std::string& path, Obj_Data& obj_data) {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string err;
+
+    const std::string mtl_base_dir = get_directory(path);
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str(), mtl_base_dir.c_str()))
+        return false;
+
+    obj_data.positions.resize(attrib.vertices.size() / 3);
+    memcpy(obj_data.positions.data(), attrib.vertices.data(), obj_data.positions.size() * sizeof(Vector3));
+
+    obj_data.normals.resize(attrib.normals.size() / 3);
+    memcpy(obj_data.normals.data(), attrib.normals.data(), obj_data.normals.size() * sizeof(Vector3));
+
+    obj_data.texcoords.resize(attrib.texcoords.size() / 2);
+    memcpy(obj_data.texcoords.data(), attrib.texcoords.data(), obj_data.texcoords.size() * sizeof(Vector2));
+
+    obj_data.materials.clear();
+    for (const auto& material : materials)
+        obj_data.materials.push_back(Obj_Material{ material.name, Vector3(material.diffuse[0], material.diffuse[1], material.diffuse[2]), material.diffuse_texname });
+
+    // Shapes are split into groups by the runs of faces with the same material.
+    obj_data.corners.clear();
+    obj_data.groups.clear();
+    for (const auto& shape : shapes) {
+        for (const auto& index : shape.mesh.indices)
+            obj_data.corners.push_back(Obj_Index{ index.vertex_index, index.normal_index, index.texcoord_index });
+
+        const uint32_t shape_first_corner = uint32_t(obj_data.corners.size() - shape.mesh.indices.size());
+        for (size_t face = 0; face < shape.mesh.material_ids.size(); face++) {
+            const int32_t material = shape.mesh.material_ids[face];
+            if (face == 0 || material != obj_data.groups.back().material)
+                obj_data.groups.push_back(Obj_Group{ shape.name, material, shape_first_corner + uint32_t(face * 3), 0 });
+            obj_data.groups.back().corner_count += 3;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "vector.h"
+
+#include <string>
+#include <vector>
+
+// Zero-based indices of face corner attributes, -1 if attribute is not specified.
+struct Obj_Index {
+    int32_t position;
+    int32_t normal;
+    int32_t texcoord;
+};
+
+// Material from the MTL library referenced by the OBJ file. Only diffuse properties are loaded.
+// Texture path is relative to the directory of the OBJ file, empty if there is no texture.
+struct Obj_Material {
+    std::string name;
+    Vector3     diffuse = Vector3(1);
+    std::string diffuse_texture;
+};
+
+// Range of corners that belong to the same object ('o' or 'g' statement) and use the same material.
+// material is an index in Obj_Data::materials or -1 if the material is not specified or not found.
+struct Obj_Group {
+    std::string object_name;
+    int32_t     material;
+    uint32_t    first_corner;
+    uint32_t    corner_count;
+};
+
+// Raw OBJ file attributes. Faces are triangulated, each triangle is represented by 3 consecutive corners.
+// Groups cover all corners in the file order.
+struct Obj_Data {
+    std::vector<Vector3>        positions;
+    std::vector<Vector3>        normals;
+    std::vector<Vector2>        texcoords;
+    std::vector<Obj_Index>      corners;
+    std::vector<Obj_Group>      groups;
+    std::vector<Obj_Material>   materials;
+};
+
+// Memory-maps the file and parses it in parallel by splitting it into line-aligned chunks.
+bool read_obj_file(const std::string& path, Obj_Data& obj_data);
+
+// Reference implementation based on tinyobjloader. Used for benchmarking and validation.
+bool read_obj_file_tinyobj(const std::string& path, Obj_Data& obj_data);
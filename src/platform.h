@@ -2,10 +2,27 @@
 
 #include "vk.h"
 
+#include <cstdint>
+#include <string>
+
 struct GLFWwindow;
 
 namespace platform
 {
 VkSurfaceKHR create_surface(VkInstance instance, GLFWwindow* window);
 void sleep(int milliseconds);
+
+// Read-only view of the file contents mapped into the address space of the process.
+struct Mapped_File {
+    const uint8_t*  data            = nullptr;
+    uint64_t        size            = 0;
+    void*           file_handle     = nullptr;
+    void*           mapping_handle  = nullptr;
+};
+
+bool map_file(const std::string& path, Mapped_File& mapped_file);
+void unmap_file(Mapped_File& mapped_file);
+
+// Returns file size in bytes and last write time in platform specific units.
+bool get_file_info(const std::string& path, uint64_t& size, uint64_t& last_write_time);
 }
@@ -3,29 +3,32 @@
 #include "raster_resources.h"
 #include "vk_utils.h"
 
+#include <cassert>
+
 namespace {
 struct Uniform_Buffer {
-    Matrix4x4   model_view_proj;
-    Matrix4x4   model_view;
+    Matrix4x4   view_proj;
+    Matrix4x4   view;
 };
 }
 
-void Rasterization_Resources::create(VkImageView texture_view, VkSampler sampler) {
+void Rasterization_Resources::create(VkSampler sampler, Vertex_Layout vertex_layout) {
     uniform_buffer = vk_create_mapped_buffer(static_cast<VkDeviceSize>(sizeof(Uniform_Buffer)),
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &mapped_uniform_buffer, "raster_uniform_buffer");
 
     descriptor_set_layout = Descriptor_Set_Layout()
         .uniform_buffer (0, VK_SHADER_STAGE_VERTEX_BIT)
-        .sampled_image  (1, VK_SHADER_STAGE_FRAGMENT_BIT)
+        .sampled_image  (1, VK_SHADER_STAGE_FRAGMENT_BIT, max_textures)
         .sampler        (2, VK_SHADER_STAGE_FRAGMENT_BIT)
+        .storage_buffer (3, VK_SHADER_STAGE_VERTEX_BIT)
         .create         ("raster_set_layout");
 
     // Pipeline layout.
     {
-        VkPushConstantRange push_constant_range; // show_texture_lods value
+        VkPushConstantRange push_constant_range; // show_texture_lods and texture_index values
         push_constant_range.stageFlags  = VK_SHADER_STAGE_FRAGMENT_BIT;
         push_constant_range.offset      = 0;
-        push_constant_range.size        = 4;
+        push_constant_range.size        = 8;
 
         VkPipelineLayoutCreateInfo create_info{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
         create_info.setLayoutCount          = 1;
@@ -89,30 +92,68 @@ void Rasterization_Resources::create(VkImageView texture_view, VkSampler sampler
 
         Vk_Graphics_Pipeline_State state = get_default_graphics_pipeline_state();
 
-        // VkVertexInputBindingDescription
-        state.vertex_bindings[0].binding = 0;
-        state.vertex_bindings[0].stride = sizeof(Vertex);
-        state.vertex_bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        state.vertex_binding_count = 1;
-
-        // VkVertexInputAttributeDescription
-        state.vertex_attributes[0].location = 0; // vertex
-        state.vertex_attributes[0].binding = 0;
-        state.vertex_attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        state.vertex_attributes[0].offset = 0;
-
-        state.vertex_attributes[1].location = 1; // normal
-        state.vertex_attributes[1].binding = 0;
-        state.vertex_attributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        state.vertex_attributes[1].offset = 12;
-
-        state.vertex_attributes[2].location = 2; // uv
-        state.vertex_attributes[2].binding = 0;
-        state.vertex_attributes[2].format = VK_FORMAT_R32G32_SFLOAT;
-        state.vertex_attributes[2].offset = 24;
-        state.vertex_attribute_count = 3;
-
-        pipeline = vk_create_graphics_pipeline(state, pipeline_layout, render_pass, vertex_shader, fragment_shader);
+        if (vertex_layout == vertex_layout_interleaved) {
+            // VkVertexInputBindingDescription
+            state.vertex_bindings[0].binding = 0;
+            state.vertex_bindings[0].stride = sizeof(Vertex);
+            state.vertex_bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            state.vertex_binding_count = 1;
+
+            // VkVertexInputAttributeDescription
+            state.vertex_attributes[0].location = 0; // vertex
+            state.vertex_attributes[0].binding = 0;
+            state.vertex_attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+            state.vertex_attributes[0].offset = 0;
+
+            state.vertex_attributes[1].location = 1; // normal
+            state.vertex_attributes[1].binding = 0;
+            state.vertex_attributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+            state.vertex_attributes[1].offset = 12;
+
+            state.vertex_attributes[2].location = 2; // uv
+            state.vertex_attributes[2].binding = 0;
+            state.vertex_attributes[2].format = VK_FORMAT_R32G32_SFLOAT;
+            state.vertex_attributes[2].offset = 24;
+            state.vertex_attribute_count = 3;
+        } else {
+            const bool compact = (vertex_layout == vertex_layout_split_compact);
+
+            // VkVertexInputBindingDescription
+            state.vertex_bindings[0].binding = 0; // positions
+            state.vertex_bindings[0].stride = sizeof(Vector3);
+            state.vertex_bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            state.vertex_bindings[1].binding = 1; // attributes
+            state.vertex_bindings[1].stride = compact ? sizeof(Compact_Vertex_Attributes) : sizeof(Vertex_Attributes);
+            state.vertex_bindings[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            state.vertex_binding_count = 2;
+
+            // VkVertexInputAttributeDescription
+            state.vertex_attributes[0].location = 0; // vertex
+            state.vertex_attributes[0].binding = 0;
+            state.vertex_attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+            state.vertex_attributes[0].offset = 0;
+
+            state.vertex_attributes[1].location = 1; // normal, octahedral-encoded for compact layout
+            state.vertex_attributes[1].binding = 1;
+            state.vertex_attributes[1].format = compact ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
+            state.vertex_attributes[1].offset = 0;
+
+            state.vertex_attributes[2].location = 2; // uv
+            state.vertex_attributes[2].binding = 1;
+            state.vertex_attributes[2].format = compact ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
+            state.vertex_attributes[2].offset = compact ? 4 : 12;
+            state.vertex_attribute_count = 3;
+        }
+
+        uint32_t vertex_layout_constant = vertex_layout;
+        VkSpecializationMapEntry specialization_entry { 0, 0, sizeof(uint32_t) };
+        VkSpecializationInfo specialization_info;
+        specialization_info.mapEntryCount   = 1;
+        specialization_info.pMapEntries     = &specialization_entry;
+        specialization_info.dataSize        = sizeof(uint32_t);
+        specialization_info.pData           = &vertex_layout_constant;
+
+        pipeline = vk_create_graphics_pipeline(state, pipeline_layout, render_pass, vertex_shader, fragment_shader, &specialization_info);
 
         vkDestroyShaderModule(vk.device, vertex_shader, nullptr);
         vkDestroyShaderModule(vk.device, fragment_shader, nullptr);
@@ -128,13 +169,26 @@ void Rasterization_Resources::create(VkImageView texture_view, VkSampler sampler
         desc.pSetLayouts        = &descriptor_set_layout;
         VK_CHECK(vkAllocateDescriptorSets(vk.device, &desc, &descriptor_set));
 
-        Descriptor_Writes(descriptor_set)
+        Descriptor_Writes descriptor_writes(descriptor_set);
+        descriptor_writes
             .uniform_buffer (0, uniform_buffer.handle, 0, sizeof(Uniform_Buffer))
-            .sampled_image  (1, texture_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
             .sampler        (2, sampler);
     }
 }
 
+void Rasterization_Resources::update_textures(const std::vector<VkImageView>& texture_views) {
+    Descriptor_Writes descriptor_writes(descriptor_set);
+
+    // Unused array elements reference the first texture, so all descriptors are valid.
+    assert(!texture_views.empty() && texture_views.size() <= max_textures);
+    for (uint32_t i = 0; i < max_textures; i++)
+        descriptor_writes.sampled_image(1, texture_views[i < texture_views.size() ? i : 0], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, i);
+}
+
+void Rasterization_Resources::update_instances(VkBuffer instance_buffer) {
+    Descriptor_Writes(descriptor_set).storage_buffer(3, instance_buffer, 0, VK_WHOLE_SIZE);
+}
+
 void Rasterization_Resources::destroy() {
     uniform_buffer.destroy();
     vkDestroyDescriptorSetLayout(vk.device, descriptor_set_layout, nullptr);
@@ -164,11 +218,11 @@ void Rasterization_Resources::destroy_framebuffer() {
     framebuffer = VK_NULL_HANDLE;
 }
 
-void Rasterization_Resources::update(const Matrix3x4& model_transform, const Matrix3x4& view_transform) {
+void Rasterization_Resources::update(const Matrix3x4& view_transform) {
     float aspect_ratio = (float)vk.surface_size.width / (float)vk.surface_size.height;
     Matrix4x4 proj = perspective_transform_opengl_z01(radians(45.0f), aspect_ratio, 0.1f, 50.0f);
-    Matrix4x4 model_view = Matrix4x4::identity * view_transform * model_transform;
-    Matrix4x4 model_view_proj = proj * view_transform * model_transform;
-    static_cast<Uniform_Buffer*>(mapped_uniform_buffer)->model_view_proj = model_view_proj;
-    static_cast<Uniform_Buffer*>(mapped_uniform_buffer)->model_view = model_view;
+    Matrix4x4 view = Matrix4x4::identity * view_transform;
+    Matrix4x4 view_proj = proj * view_transform;
+    static_cast<Uniform_Buffer*>(mapped_uniform_buffer)->view_proj = view_proj;
+    static_cast<Uniform_Buffer*>(mapped_uniform_buffer)->view = view;
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "vk.h"
+#include "vk_utils.h"
+
+#include <vector>
 
 struct Matrix3x4;
 
@@ -16,9 +19,19 @@ struct Rasterization_Resources {
     Vk_Buffer                   uniform_buffer;
     void*                       mapped_uniform_buffer;
 
-    void create(VkImageView texture_view, VkSampler sample);
+    // Textures are provided separately with update_textures, so the resources can be created
+    // before the scene textures are loaded.
+    void create(VkSampler sampler, Vertex_Layout vertex_layout);
     void destroy();
+
+    // texture_views is the material texture array, draws select the texture with push constants.
+    // The descriptor set should not be used by the pending command buffers.
+    void update_textures(const std::vector<VkImageView>& texture_views);
+
+    // Instanced draws read object-to-world transforms from the instance buffer (array of VkAccelerationStructureInstanceKHR)
+    // indexed by the instance index. The descriptor set should not be used by the pending command buffers.
+    void update_instances(VkBuffer instance_buffer);
     void create_framebuffer(VkImageView output_image_view);
     void destroy_framebuffer();
-    void update(const Matrix3x4& model_transform, const Matrix3x4& view_transform);
+    void update(const Matrix3x4& view_transform);
 };
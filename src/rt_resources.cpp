@@ -1,5 +1,6 @@
 #include "mesh.h"
 #include "rt_resources.h"
+#include "shader_binding_table.h"
 #include "vk_utils.h"
 
 #include <algorithm>
@@ -9,36 +10,91 @@ struct Rt_Uniform_Buffer {
     Matrix3x4 camera_to_world;
 };
 
-void Raytracing_Resources::create(const GPU_Mesh& gpu_mesh, VkImageView texture_view, VkSampler sampler) {
-    uniform_buffer = vk_create_mapped_buffer(static_cast<VkDeviceSize>(sizeof(Rt_Uniform_Buffer)),
-        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &(void*&)mapped_uniform_buffer, "rt_uniform_buffer");
+// Shader groups of the pipeline, one shader per group.
+enum : uint32_t {
+    raygen_group,
+    miss_group,
+    ray_cone_miss_group,
+    mesh_hit_group,
+    ray_cone_mesh_hit_group,
+    shader_group_count
+};
 
-    accelerator = create_intersection_accelerator({gpu_mesh}, true);
-    create_pipeline(gpu_mesh, texture_view, sampler);
+// Per-object data that depends on the selected LOD (Objects in rt_mesh.rchit.glsl).
+struct Rt_Object {
+    uint32_t        first_triangle; // first triangle of the selected LOD
+};
 
-    // Shader binding table.
-    {
-        uint32_t miss_offset = round_up(properties.shaderGroupHandleSize /* raygen slot*/, properties.shaderGroupBaseAlignment);
-        uint32_t hit_offset = round_up(miss_offset + properties.shaderGroupHandleSize /* miss slot */, properties.shaderGroupBaseAlignment);
+// Inline data of the object's hit records (Hit_Record in rt_mesh_hit.glsl).
+struct Rt_Hit_Record {
+    VkDeviceAddress index_buffer;
+    VkDeviceAddress vertex_buffer;
+    VkDeviceAddress attribute_buffer;
+    VkDeviceAddress triangle_lods; // ray cone LOD constants, one per triangle of the index buffer
+    uint32_t        texture_index;
+};
+
+void Raytracing_Resources::create(const std::vector<GPU_Mesh>& gpu_meshes, const std::vector<uint32_t>& texture_indices, const std::vector<const float*>& triangle_lod_constants,
+    const std::vector<VkImageView>& texture_views, VkSampler sampler, const Accelerator_Build_Params& accel_params) {
+    assert(!gpu_meshes.empty() && gpu_meshes.size() == texture_indices.size() && gpu_meshes.size() == triangle_lod_constants.size());
 
-        uint32_t sbt_buffer_size = hit_offset + properties.shaderGroupHandleSize;
+    uniform_buffer = vk_create_mapped_buffer(static_cast<VkDeviceSize>(sizeof(Rt_Uniform_Buffer)),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &(void*&)mapped_uniform_buffer, "rt_uniform_buffer");
 
-        void* mapped_memory;
-        shader_binding_table = vk_create_mapped_buffer(sbt_buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &mapped_memory, "shader_binding_table");
+    object_buffer = vk_create_mapped_buffer(static_cast<VkDeviceSize>(gpu_meshes.size() * sizeof(Rt_Object)),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &(void*&)mapped_object_buffer, "rt_object_buffer");
 
-        // raygen slot
-        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 0, 1, properties.shaderGroupHandleSize, mapped_memory));
+    for (uint32_t i = 0; i < (uint32_t)gpu_meshes.size(); i++)
+        mapped_object_buffer[i].first_triangle = 0;
 
-        // miss slot
-        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 1, 1, properties.shaderGroupHandleSize, (uint8_t*)mapped_memory + miss_offset));
+    // Ray cone LOD constants of all objects in one buffer.
+    std::vector<VkDeviceSize> triangle_lod_offsets(gpu_meshes.size());
+    {
+        std::vector<float> lod_constants;
+        for (auto [i, gpu_mesh] : enumerate(gpu_meshes)) {
+            triangle_lod_offsets[i] = lod_constants.size() * sizeof(float);
+            lod_constants.insert(lod_constants.end(), triangle_lod_constants[i], triangle_lod_constants[i] + gpu_mesh.index_count / 3);
+        }
+        triangle_lod_buffer = vk_create_buffer(lod_constants.size() * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            lod_constants.data(), "triangle_lod_buffer");
+    }
+
+    accelerator = create_intersection_accelerator(gpu_meshes, true, accel_params);
+    create_pipeline(gpu_meshes[0].vertex_layout, texture_views, sampler);
 
-        // hit slot
-        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 2, 1, properties.shaderGroupHandleSize, (uint8_t*)mapped_memory + hit_offset));
+    // Shader binding table. Each object has its own hit records with the object's buffers and texture, one
+    // record per ray type. The instances of the object select them with the instance SBT record offset, the
+    // ray type is the SBT record offset of the trace call. The miss records are indexed by the ray type.
+    {
+        Shader_Binding_Table_Builder sbt_builder;
+        sbt_builder
+            .raygen (raygen_group)
+            .miss   (miss_group)
+            .miss   (ray_cone_miss_group);
+
+        object_hit_record_offsets.resize(gpu_meshes.size());
+        for (auto [i, gpu_mesh] : enumerate(gpu_meshes)) {
+            assert(gpu_mesh.vertex_layout == gpu_meshes[0].vertex_layout);
+            Rt_Hit_Record record;
+            record.index_buffer     = gpu_mesh.index_buffer.device_address + gpu_mesh.get_index_offset();
+            record.vertex_buffer    = gpu_mesh.vertex_buffer.device_address + gpu_mesh.get_vertex_offset();
+            record.attribute_buffer = (gpu_mesh.vertex_layout != vertex_layout_interleaved) ? gpu_mesh.attribute_buffer.device_address + gpu_mesh.get_attribute_offset() : record.vertex_buffer;
+            record.triangle_lods    = triangle_lod_buffer.device_address + triangle_lod_offsets[i];
+            record.texture_index    = texture_indices[i];
+
+            object_hit_record_offsets[i] = sbt_builder.get_hit_record_count();
+            sbt_builder
+                .hit(mesh_hit_group, &record, sizeof(record))
+                .hit(ray_cone_mesh_hit_group, &record, sizeof(record));
+        }
+        shader_binding_table = sbt_builder.create(pipeline, shader_group_count, properties, "shader_binding_table");
     }
 }
 
 void Raytracing_Resources::destroy() {
     uniform_buffer.destroy();
+    object_buffer.destroy();
+    triangle_lod_buffer.destroy();
     shader_binding_table.destroy();
     accelerator.destroy();
 
@@ -47,44 +103,57 @@ void Raytracing_Resources::destroy() {
     vkDestroyPipeline(vk.device, pipeline, nullptr);
 }
 
-void Raytracing_Resources::update_output_image_descriptor(VkImageView output_image_view) {
-    Descriptor_Writes(descriptor_set).storage_image(0, output_image_view);
+void Raytracing_Resources::rebuild_accelerator(const std::vector<GPU_Mesh>& gpu_meshes, const Accelerator_Build_Params& accel_params) {
+    accelerator.destroy();
+    accelerator = create_intersection_accelerator(gpu_meshes, true, accel_params);
+    Descriptor_Writes(descriptor_set).accelerator(1, accelerator.top_level_accel);
 }
 
-void Raytracing_Resources::update(const Matrix3x4& model_transform, const Matrix3x4& camera_to_world_transform) {
-    assert(accelerator.bottom_level_accels.size() == 1);
+void Raytracing_Resources::update_output_image_descriptors(VkImageView output_image_view, VkImageView accumulation_image_view, VkImageView first_pass_image_view) {
+    Descriptor_Writes(descriptor_set)
+        .storage_image(0, output_image_view)
+        .storage_image(6, accumulation_image_view)
+        .storage_image(7, first_pass_image_view);
+}
 
-    VkAccelerationStructureInstanceKHR& instance = *accelerator.mapped_instance_buffer;
-    memcpy(&instance.transform.matrix[0][0], &model_transform.a[0][0], 12 * sizeof(float));
-    instance.instanceCustomIndex                        = 0;
-    instance.mask                                       = 0xff;
-    instance.instanceShaderBindingTableRecordOffset     = 0;
-    instance.flags                                      = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-    instance.accelerationStructureReference             = accelerator.bottom_level_accel_device_addresses[0];
+void Raytracing_Resources::update(const Matrix3x4& camera_to_world_transform, const std::vector<GPU_Mesh>& gpu_meshes, const std::vector<uint32_t>& lods,
+    VkDeviceAddress* object_accels, uint32_t* object_sbt_offsets) {
+    assert(accelerator.mesh_first_accel.size() == gpu_meshes.size() && lods.size() == gpu_meshes.size());
+
+    // The instances of each object reference bottom level accel of the LOD selected for the object.
+    // The hit shader gets the first triangle of the LOD from the object buffer and the object's
+    // geometry and texture from the hit record selected by the instance SBT record offset.
+    for (auto [i, gpu_mesh] : enumerate(gpu_meshes)) {
+        assert(lods[i] < gpu_mesh.lods.size());
+        object_accels[i] = accelerator.bottom_level_accel_device_addresses[accelerator.mesh_first_accel[i] + lods[i]];
+        object_sbt_offsets[i] = object_hit_record_offsets[i];
+        mapped_object_buffer[i].first_triangle = gpu_mesh.lods[lods[i]].first_index / 3;
+    }
 
     Rt_Uniform_Buffer& uniform_buffer = *mapped_uniform_buffer;
     uniform_buffer.camera_to_world = camera_to_world_transform;
 }
 
-void Raytracing_Resources::create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView texture_view, VkSampler sampler) {
+void Raytracing_Resources::create_pipeline(Vertex_Layout vertex_layout, const std::vector<VkImageView>& texture_views, VkSampler sampler) {
     descriptor_set_layout = Descriptor_Set_Layout()
         .storage_image  (0, VK_SHADER_STAGE_RAYGEN_BIT_KHR)
         .accelerator    (1, VK_SHADER_STAGE_RAYGEN_BIT_KHR)
         .uniform_buffer (2, VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
         .storage_buffer (3, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
-        .storage_buffer (4, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
-        .sampled_image  (5, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
-        .sampler        (6, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
+        .sampled_image  (4, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, max_textures)
+        .sampler        (5, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
+        .storage_image  (6, VK_SHADER_STAGE_RAYGEN_BIT_KHR)
+        .storage_image  (7, VK_SHADER_STAGE_RAYGEN_BIT_KHR)
         .create         ("rt_set_layout");
 
     // pipeline layout
     {
-        VkPushConstantRange push_constant_ranges[2]; // show_texture_lods value
-        push_constant_ranges[0].stageFlags  = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
+        VkPushConstantRange push_constant_ranges[2];
+        push_constant_ranges[0].stageFlags  = VK_SHADER_STAGE_RAYGEN_BIT_KHR; // Rt_Raygen_Push_Constants
         push_constant_ranges[0].offset      = 0;
-        push_constant_ranges[0].size        = 4;
-        push_constant_ranges[1].stageFlags  = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
-        push_constant_ranges[1].offset      = 4;
+        push_constant_ranges[0].size        = sizeof(Rt_Raygen_Push_Constants);
+        push_constant_ranges[1].stageFlags  = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR; // show_texture_lods value
+        push_constant_ranges[1].offset      = sizeof(Rt_Raygen_Push_Constants);
         push_constant_ranges[1].size        = 4;
 
         VkPipelineLayoutCreateInfo create_info { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
@@ -98,52 +167,40 @@ void Raytracing_Resources::create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView
 
     // pipeline
     {
-        VkShaderModule rgen_shader = vk_load_spirv("spirv/rt_mesh.rgen.spv");
-        VkShaderModule miss_shader = vk_load_spirv("spirv/rt_mesh.rmiss.spv");
-        VkShaderModule chit_shader = vk_load_spirv("spirv/rt_mesh.rchit.spv");
-
-        VkPipelineShaderStageCreateInfo stage_infos[3] {};
-        stage_infos[0].sType    = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        stage_infos[0].stage    = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
-        stage_infos[0].module   = rgen_shader;
-        stage_infos[0].pName    = "main";
-
-        stage_infos[1].sType    = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        stage_infos[1].stage    = VK_SHADER_STAGE_MISS_BIT_KHR;
-        stage_infos[1].module   = miss_shader;
-        stage_infos[1].pName    = "main";
-
-        stage_infos[2].sType    = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        stage_infos[2].stage    = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
-        stage_infos[2].module   = chit_shader;
-        stage_infos[2].pName    = "main";
-
-        VkRayTracingShaderGroupCreateInfoKHR shader_groups[3];
-
-        {
-            auto& group = shader_groups[0];
-            group = VkRayTracingShaderGroupCreateInfoKHR { VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR };
-            group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
-            group.generalShader = 0;
-            group.closestHitShader = VK_SHADER_UNUSED_KHR;
-            group.anyHitShader = VK_SHADER_UNUSED_KHR;
-            group.intersectionShader = VK_SHADER_UNUSED_KHR;
-        }
-        {
-            auto& group = shader_groups[1];
+        // Shader stages in the order of the shader groups. Each ray type has its own miss and hit shaders.
+        const struct { VkShaderStageFlagBits stage; const char* spirv_file; } shaders[shader_group_count] = {
+            { VK_SHADER_STAGE_RAYGEN_BIT_KHR,       "spirv/rt_mesh.rgen.spv" },
+            { VK_SHADER_STAGE_MISS_BIT_KHR,         "spirv/rt_mesh.rmiss.spv" },
+            { VK_SHADER_STAGE_MISS_BIT_KHR,         "spirv/rt_mesh_ray_cones.rmiss.spv" },
+            { VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,  "spirv/rt_mesh.rchit.spv" },
+            { VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,  "spirv/rt_mesh_ray_cones.rchit.spv" },
+        };
+
+        uint32_t vertex_layout_constant = vertex_layout;
+        VkSpecializationMapEntry specialization_entry { 0, 0, sizeof(uint32_t) };
+        VkSpecializationInfo specialization_info;
+        specialization_info.mapEntryCount   = 1;
+        specialization_info.pMapEntries     = &specialization_entry;
+        specialization_info.dataSize        = sizeof(uint32_t);
+        specialization_info.pData           = &vertex_layout_constant;
+
+        VkPipelineShaderStageCreateInfo stage_infos[shader_group_count] {};
+        VkRayTracingShaderGroupCreateInfoKHR shader_groups[shader_group_count];
+
+        for (uint32_t i = 0; i < shader_group_count; i++) {
+            const bool hit_shader = shaders[i].stage == VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+
+            stage_infos[i].sType                = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            stage_infos[i].stage                = shaders[i].stage;
+            stage_infos[i].module               = vk_load_spirv(shaders[i].spirv_file);
+            stage_infos[i].pName                = "main";
+            stage_infos[i].pSpecializationInfo  = hit_shader ? &specialization_info : nullptr;
+
+            auto& group = shader_groups[i];
             group = VkRayTracingShaderGroupCreateInfoKHR { VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR };
-            group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
-            group.generalShader = 1;
-            group.closestHitShader = VK_SHADER_UNUSED_KHR;
-            group.anyHitShader = VK_SHADER_UNUSED_KHR;
-            group.intersectionShader = VK_SHADER_UNUSED_KHR;
-        }
-        {
-            auto& group = shader_groups[2];
-            group = VkRayTracingShaderGroupCreateInfoKHR { VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR };
-            group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR;
-            group.generalShader = VK_SHADER_UNUSED_KHR;
-            group.closestHitShader = 2;
+            group.type = hit_shader ? VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR : VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
+            group.generalShader = hit_shader ? VK_SHADER_UNUSED_KHR : i;
+            group.closestHitShader = hit_shader ? i : VK_SHADER_UNUSED_KHR;
             group.anyHitShader = VK_SHADER_UNUSED_KHR;
             group.intersectionShader = VK_SHADER_UNUSED_KHR;
         }
@@ -158,9 +215,8 @@ void Raytracing_Resources::create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView
         create_info.layout              = pipeline_layout;
         VK_CHECK(vkCreateRayTracingPipelinesKHR(vk.device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
 
-        vkDestroyShaderModule(vk.device, rgen_shader, nullptr);
-        vkDestroyShaderModule(vk.device, miss_shader, nullptr);
-        vkDestroyShaderModule(vk.device, chit_shader, nullptr);
+        for (const VkPipelineShaderStageCreateInfo& stage_info : stage_infos)
+            vkDestroyShaderModule(vk.device, stage_info.module, nullptr);
     }
 
     // descriptor set
@@ -171,21 +227,16 @@ void Raytracing_Resources::create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView
         desc.pSetLayouts        = &descriptor_set_layout;
         VK_CHECK(vkAllocateDescriptorSets(vk.device, &desc, &descriptor_set));
 
-        Descriptor_Writes(descriptor_set)
+        Descriptor_Writes descriptor_writes(descriptor_set);
+        descriptor_writes
             .accelerator(1, accelerator.top_level_accel)
             .uniform_buffer(2, uniform_buffer.handle, 0, sizeof(Rt_Uniform_Buffer))
+            .storage_buffer(3, object_buffer.handle, 0, VK_WHOLE_SIZE)
+            .sampler(5, sampler);
 
-            .storage_buffer(3,
-                gpu_mesh.index_buffer.handle,
-                0,
-                gpu_mesh.index_count * 4 /*VK_INDEX_TYPE_UINT32*/)
-
-            .storage_buffer(4,
-                gpu_mesh.vertex_buffer.handle,
-                0, /* assume that position is the first vertex attribute */
-                gpu_mesh.vertex_count * sizeof(Vertex))
-
-            .sampled_image(5, texture_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-            .sampler(6, sampler);
+        // Unused array elements reference the first texture, so all descriptors are valid.
+        assert(!texture_views.empty() && texture_views.size() <= max_textures);
+        for (uint32_t i = 0; i < max_textures; i++)
+            descriptor_writes.sampled_image(4, texture_views[i < texture_views.size() ? i : 0], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, i);
     }
 }
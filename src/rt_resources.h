@@ -2,11 +2,47 @@
 
 #include "acceleration_structure.h"
 #include "matrix.h"
+#include "shader_binding_table.h"
 #include "vk.h"
+#include "vk_utils.h"
 
-struct GPU_Mesh;
+#include <vector>
+
+struct Rt_Object;
 struct Rt_Uniform_Buffer;
 
+// Ray type selects the miss and hit records and the payload used for texture LOD. The ray differentials payload
+// carries the directions of the neighbor pixel rays, the ray cone payload carries the cone spread angle and width.
+enum Rt_Ray_Type : uint32_t {
+    rt_ray_type_differentials,
+    rt_ray_type_cones,
+    rt_ray_type_count
+};
+
+// Sizes of Ray_Payload and Ray_Cone_Payload in rt_utils.glsl.
+constexpr uint32_t rt_ray_payload_sizes[rt_ray_type_count] = { 9 * sizeof(float), 5 * sizeof(float) };
+
+// Adaptive sampling traces one sample per pixel in the first pass. The second pass adds samples
+// to the pixels with high contrast in the neighborhood of the first pass result.
+enum Rt_Adaptive_Pass : uint32_t {
+    rt_adaptive_pass_none,
+    rt_adaptive_pass_first,
+    rt_adaptive_pass_second
+};
+
+// Push_Constants in rt_mesh.rgen.glsl. The closest hit shader constants follow this range.
+struct Rt_Raygen_Push_Constants {
+    uint32_t spp4;
+    uint32_t accumulate; // averages the frame's samples with the accumulation image
+    uint32_t accumulated_sample_count; // samples per pixel in the accumulation image before this frame
+    uint32_t adaptive_pass; // Rt_Adaptive_Pass
+    uint32_t adaptive_max_spp;
+    float    adaptive_contrast_threshold; // each multiple of this luminance contrast adds a sample
+    uint32_t show_sample_heatmap; // the second adaptive pass outputs samples per pixel
+    uint32_t store_linear_color; // writes the linear color and the sample count to the accumulation image
+    uint32_t ray_type; // Rt_Ray_Type of the camera rays
+};
+
 struct Raytracing_Resources {
     VkPhysicalDeviceRayTracingPropertiesKHR properties;
     Vk_Intersection_Accelerator accelerator;
@@ -14,15 +50,34 @@ struct Raytracing_Resources {
     VkPipelineLayout pipeline_layout;
     VkPipeline pipeline;
     VkDescriptorSet descriptor_set;
-    Vk_Buffer shader_binding_table;
+    Shader_Binding_Table shader_binding_table; // hit record per scene object and ray type
+    std::vector<uint32_t> object_hit_record_offsets; // instance SBT record offset of each object
     Vk_Buffer uniform_buffer;
     Rt_Uniform_Buffer* mapped_uniform_buffer;
+    Vk_Buffer object_buffer; // array of Rt_Object, one per scene object
+    Rt_Object* mapped_object_buffer;
+    Vk_Buffer triangle_lod_buffer; // ray cone LOD constants of the triangles of all objects
 
-    void create(const GPU_Mesh& gpu_mesh, VkImageView texture_view, VkSampler sampler);
+    // Each mesh is a separate scene object. texture_indices selects the texture from texture_views for each mesh.
+    // accel_params controls acceleration structure build flags, batching and compaction of the bottom level builds,
+    // and provides the instance buffer written by the instance generator.
+    // triangle_lod_constants provides compute_triangle_lod_constants values for all triangles of each mesh.
+    void create(const std::vector<GPU_Mesh>& gpu_meshes, const std::vector<uint32_t>& texture_indices, const std::vector<const float*>& triangle_lod_constants,
+        const std::vector<VkImageView>& texture_views, VkSampler sampler, const Accelerator_Build_Params& accel_params);
     void destroy();
-    void update_output_image_descriptor(VkImageView output_image_view);
-    void update(const Matrix3x4& model_transform, const Matrix3x4& camera_to_world_transform);
+
+    // Rebuilds acceleration structures with new build parameters. The device should be idle.
+    void rebuild_accelerator(const std::vector<GPU_Mesh>& gpu_meshes, const Accelerator_Build_Params& accel_params);
+
+    // The accumulation image keeps the running average of the accumulated samples,
+    // the first pass image keeps the samples of the first adaptive sampling pass.
+    void update_output_image_descriptors(VkImageView output_image_view, VkImageView accumulation_image_view, VkImageView first_pass_image_view);
+
+    // object_accels receives the bottom level accel of the selected LOD for each object,
+    // object_sbt_offsets receives the instance SBT record offset of the object's first hit record.
+    void update(const Matrix3x4& camera_to_world_transform, const std::vector<GPU_Mesh>& gpu_meshes, const std::vector<uint32_t>& lods,
+        VkDeviceAddress* object_accels, uint32_t* object_sbt_offsets);
 
 private:
-    void create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView texture_view, VkSampler sampler);
+    void create_pipeline(Vertex_Layout vertex_layout, const std::vector<VkImageView>& texture_views, VkSampler sampler);
 };
@@ -0,0 +1,72 @@
+#include "obj_reader.h"
+#include "scene.h"
+
+#include <algorithm>
+
+Scene load_obj_scene(const std::string& resource_relative_path, float additional_scale) {
+    const std::string path = get_resource_path(resource_relative_path);
+    Obj_Data obj;
+    if (!read_obj_file(path, obj))
+        error("failed to load obj model: " + path);
+
+    // Texture paths in the material library are relative to the OBJ file.
+    const size_t separator_pos = resource_relative_path.find_last_of("/\\");
+    const std::string obj_directory = (separator_pos == std::string::npos) ? std::string() : resource_relative_path.substr(0, separator_pos + 1);
+
+    Scene scene;
+    for (const Obj_Material& obj_material : obj.materials) {
+        Material material;
+        material.name = obj_material.name;
+        material.diffuse = obj_material.diffuse;
+        if (!obj_material.diffuse_texture.empty())
+            material.diffuse_texture = obj_directory + obj_material.diffuse_texture;
+        scene.materials.push_back(material);
+    }
+
+    Vector3 scene_min(Infinity);
+    Vector3 scene_max(-Infinity);
+    for (const Obj_Group& group : obj.groups) {
+        Scene_Object object;
+        object.name = group.object_name;
+        object.mesh = create_obj_mesh(obj, group.first_corner, group.corner_count);
+        object.material = group.material;
+
+        scene_min.x = std::min(scene_min.x, object.mesh.bounds_min.x);
+        scene_min.y = std::min(scene_min.y, object.mesh.bounds_min.y);
+        scene_min.z = std::min(scene_min.z, object.mesh.bounds_min.z);
+        scene_max.x = std::max(scene_max.x, object.mesh.bounds_max.x);
+        scene_max.y = std::max(scene_max.y, object.mesh.bounds_max.y);
+        scene_max.z = std::max(scene_max.z, object.mesh.bounds_max.z);
+        scene.objects.push_back(std::move(object));
+    }
+    if (scene.objects.empty())
+        error("obj model does not contain faces: " + path);
+
+    // scale and center the scene
+    Vector3 diag = scene_max - scene_min;
+    float max_size = std::max(diag.x, std::max(diag.y, diag.z));
+    float scale = (2.f / max_size) * additional_scale;
+    Vector3 center = (scene_min + scene_max) * 0.5f;
+
+    for (Scene_Object& object : scene.objects)
+        transform_mesh(object.mesh, center, scale);
+
+    scene.bounds_min = (scene_min - center) * scale;
+    scene.bounds_max = (scene_max - center) * scale;
+    return scene;
+}
+
+std::vector<Scene_Object_Ref> get_scene_object_refs(const Scene& scene) {
+    std::vector<Scene_Object_Ref> refs(scene.objects.size());
+    for (auto [i, object] : enumerate(scene.objects)) {
+        Scene_Object_Ref& ref = refs[i];
+        ref.vertices        = object.mesh.vertices.data();
+        ref.indices         = object.mesh.indices.data();
+        ref.vertex_count    = uint32_t(object.mesh.vertices.size());
+        ref.index_count     = uint32_t(object.mesh.indices.size());
+        ref.material        = object.material;
+        ref.bounds_min      = object.mesh.bounds_min;
+        ref.bounds_max      = object.mesh.bounds_max;
+    }
+    return refs;
+}
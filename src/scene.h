@@ -0,0 +1,47 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <string>
+#include <vector>
+
+// Texture path is relative to the data directory. Empty path means that the material
+// has no texture and only the diffuse color is used.
+struct Material {
+    std::string name;
+    Vector3     diffuse = Vector3(1);
+    std::string diffuse_texture;
+};
+
+// Scene object is a part of the OBJ object that uses single material.
+// material is an index in Scene::materials or -1 if the object has no material.
+struct Scene_Object {
+    std::string name;
+    Mesh        mesh;
+    int32_t     material = -1;
+};
+
+struct Scene {
+    std::vector<Scene_Object>   objects;
+    std::vector<Material>       materials;
+    Vector3                     bounds_min = Vector3_Zero;
+    Vector3                     bounds_max = Vector3_Zero;
+};
+
+// Loads each OBJ object/material group as a separate mesh. The scene is centered and scaled
+// as a whole to fit into [-additional_scale, additional_scale] cube, so the objects keep their
+// relative placement. resource_relative_path is relative to the data directory.
+Scene load_obj_scene(const std::string& resource_relative_path, float additional_scale);
+
+// Scene object geometry that references memory owned by Scene or by the memory-mapped cache file.
+struct Scene_Object_Ref {
+    const Vertex*   vertices;
+    const uint32_t* indices;
+    uint32_t        vertex_count;
+    uint32_t        index_count;
+    int32_t         material;
+    Vector3         bounds_min;
+    Vector3         bounds_max;
+};
+
+std::vector<Scene_Object_Ref> get_scene_object_refs(const Scene& scene);
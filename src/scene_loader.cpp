@@ -0,0 +1,293 @@
+#include "common.h"
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "scene_loader.h"
+#include "thread_pool.h"
+
+#include "stb_image.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace {
+// Texture file to decode or 1x1 texture with the given color if the path is empty.
+struct Texture_Source {
+    std::string name;
+    std::string path;
+    uint8_t     color[4];
+};
+}
+
+static void load_scene(Scene_Loader& loader) {
+    const Scene_Load_Params& params = loader.params;
+    Timestamp load_time;
+
+    // Geometry.
+    loader.stage = scene_load_stage_geometry;
+
+    const std::string mesh_path = get_resource_path(params.scene_path);
+    const Mesh_Cache_Params cache_params { params.scale, params.optimize_mesh, params.max_lod_count };
+
+    Timestamp t;
+    Scene scene;
+    Mesh_Cache mesh_cache;
+    const bool cache_hit = !params.disable_mesh_cache && open_mesh_cache(mesh_path, cache_params, mesh_cache);
+
+    if (!cache_hit) {
+        scene = load_obj_scene(params.scene_path, params.scale);
+        if (params.optimize_mesh) {
+            for (Scene_Object& object : scene.objects)
+                optimize_mesh(object.mesh);
+        }
+    }
+    printf("\nMesh load time = %lld milliseconds (%s)\n", elapsed_milliseconds(t),
+        params.disable_mesh_cache ? "cache disabled" : (cache_hit ? "cache hit" : "cache miss"));
+
+    // On cache hit the data is copied to the staging buffer directly from the memory-mapped cache file.
+    const std::vector<Scene_Object_Ref> objects = cache_hit ? mesh_cache.objects : get_scene_object_refs(scene);
+    const std::vector<Material> materials = cache_hit ? mesh_cache.materials : scene.materials;
+    printf("Scene objects = %d, materials = %d\n", (int)objects.size(), (int)materials.size());
+
+    // Each object has its own LOD chain. LODs share the vertex buffer, the index buffer contains all levels.
+    // The chains are stored in the mesh cache, so they are generated only on cache miss.
+    loader.stage = scene_load_stage_lods;
+
+    Timestamp lod_time;
+    std::vector<std::vector<Mesh_LOD>> object_lods(objects.size());
+    std::vector<std::vector<uint32_t>> object_lod_indices(objects.size());
+    std::vector<const uint32_t*> object_lod_index_data(objects.size());
+
+    if (cache_hit) {
+        object_lods = mesh_cache.object_lods;
+        for (auto [i, object] : enumerate(objects))
+            object_lod_index_data[i] = object.indices;
+    } else {
+        parallel_for(uint32_t(objects.size()), [&objects, &object_lods, &object_lod_indices, &params](uint32_t i, uint32_t) {
+            const Scene_Object_Ref& object = objects[i];
+            std::vector<Mesh_LOD>& lods = object_lods[i];
+            std::vector<uint32_t>& lod_indices = object_lod_indices[i];
+
+            lods = generate_lod_chain(object.vertices, object.vertex_count, object.indices, object.index_count, params.max_lod_count, lod_indices);
+            if (params.optimize_mesh) {
+                for (size_t k = 1; k < lods.size(); k++)
+                    optimize_vertex_cache(lod_indices.data() + lods[k].first_index, lods[k].index_count, object.vertex_count);
+            }
+        });
+        for (auto [i, lod_indices] : enumerate(object_lod_indices))
+            object_lod_index_data[i] = lod_indices.data();
+        if (!params.disable_mesh_cache)
+            write_mesh_cache(mesh_path, cache_params, scene, object_lods, object_lod_indices);
+    }
+
+    loader.objects.resize(objects.size());
+    for (auto [i, object] : enumerate(objects)) {
+        Loaded_Object& loaded_object = loader.objects[i];
+        loaded_object.lods = object_lods[i];
+        loaded_object.vertex_count = object.vertex_count;
+        loaded_object.index_count = object_lods[i].back().first_index + object_lods[i].back().index_count;
+        loaded_object.bounds_min = object.bounds_min;
+        loaded_object.bounds_max = object.bounds_max;
+    }
+    printf("LOD chain generation time = %lld milliseconds (%s)\n", elapsed_milliseconds(lod_time), cache_hit ? "cache hit" : "generated");
+
+    // Textures. Materials without texture get 1x1 texture with the diffuse color.
+    // Objects without material use the default texture.
+    loader.stage = scene_load_stage_textures;
+
+    Timestamp texture_time;
+    std::vector<Texture_Source> texture_sources;
+    std::vector<uint32_t> material_textures(materials.size());
+
+    for (auto [i, material] : enumerate(materials)) {
+        material_textures[i] = (uint32_t)texture_sources.size();
+        if (!material.diffuse_texture.empty()) {
+            texture_sources.push_back(Texture_Source{ material.diffuse_texture, material.diffuse_texture });
+        } else {
+            texture_sources.push_back(Texture_Source{ material.name, std::string(), {
+                uint8_t(srgb_encode(material.diffuse.x) * 255.f + 0.5f),
+                uint8_t(srgb_encode(material.diffuse.y) * 255.f + 0.5f),
+                uint8_t(srgb_encode(material.diffuse.z) * 255.f + 0.5f),
+                255
+            }});
+        }
+    }
+
+    uint32_t default_texture = UINT32_MAX;
+    for (auto [i, object] : enumerate(objects)) {
+        if (object.material < 0 && default_texture == UINT32_MAX) {
+            default_texture = (uint32_t)texture_sources.size();
+            texture_sources.push_back(Texture_Source{ "model/diffuse.jpg", "model/diffuse.jpg" });
+        }
+        loader.objects[i].texture = object.material < 0 ? default_texture : material_textures[object.material];
+    }
+
+    if (texture_sources.size() > max_textures)
+        error("scene uses too many textures: " + std::to_string(texture_sources.size()) + " (max " + std::to_string(max_textures) + ")");
+
+    // Textures are decoded in parallel. Errors are reported after parallel_for since error() throws.
+    std::vector<uint8_t*> texture_pixels(texture_sources.size());
+    loader.textures.resize(texture_sources.size());
+
+    parallel_for(uint32_t(texture_sources.size()), [&texture_sources, &texture_pixels, &loader](uint32_t i, uint32_t) {
+        const Texture_Source& source = texture_sources[i];
+        Loaded_Texture& texture = loader.textures[i];
+        texture.name = source.name;
+
+        if (source.path.empty()) {
+            texture.width = 1;
+            texture.height = 1;
+            texture.mip_levels = 1;
+            return;
+        }
+        int component_count;
+        texture_pixels[i] = stbi_load(get_resource_path(source.path).c_str(), &texture.width, &texture.height, &component_count, STBI_rgb_alpha);
+        if (texture_pixels[i] != nullptr)
+            texture.mip_levels = vk_get_mip_level_count(texture.width, texture.height);
+    });
+
+    for (auto [i, source] : enumerate(texture_sources)) {
+        if (!source.path.empty() && texture_pixels[i] == nullptr) {
+            for (uint8_t* pixels : texture_pixels)
+                stbi_image_free(pixels);
+            error("failed to load image file: " + get_resource_path(source.path));
+        }
+    }
+    printf("Texture decode time = %lld milliseconds (%d textures)\n", elapsed_milliseconds(texture_time), (int)texture_sources.size());
+
+    // Write all GPU data into a single staging buffer.
+    loader.stage = scene_load_stage_staging;
+
+    uint32_t vertex_stride, attribute_stride;
+    get_vertex_layout_strides(params.vertex_layout, &vertex_stride, &attribute_stride);
+
+    VkDeviceSize staging_size = 0;
+    auto allocate_staging_range = [&staging_size](VkDeviceSize size) {
+        VkDeviceSize offset = round_up(staging_size, VkDeviceSize(16));
+        staging_size = offset + size;
+        return offset;
+    };
+    for (Loaded_Object& object : loader.objects) {
+        object.vertex_offset = allocate_staging_range(object.vertex_count * vertex_stride);
+        object.attribute_offset = attribute_stride ? allocate_staging_range(object.vertex_count * attribute_stride) : 0;
+        object.index_offset = allocate_staging_range(object.index_count * sizeof(uint32_t));
+        object.triangle_lod_offset = allocate_staging_range(object.index_count / 3 * sizeof(float));
+    }
+    for (Loaded_Texture& texture : loader.textures)
+        texture.offset = allocate_staging_range(texture.width * texture.height * 4);
+
+    void* staging_ptr;
+    loader.staging_buffer = vk_create_mapped_buffer(staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &staging_ptr, "scene_staging_buffer");
+    uint8_t* staging = (uint8_t*)staging_ptr;
+    loader.staging_data = staging;
+
+    parallel_for(uint32_t(objects.size()), [&objects, &object_lod_index_data, &loader, staging](uint32_t i, uint32_t) {
+        const Loaded_Object& object = loader.objects[i];
+        write_vertex_streams(objects[i].vertices, object.vertex_count, loader.params.vertex_layout,
+            staging + object.vertex_offset, staging + object.attribute_offset);
+        memcpy(staging + object.index_offset, object_lod_index_data[i], object.index_count * sizeof(uint32_t));
+        compute_triangle_lod_constants(objects[i].vertices, object_lod_index_data[i], object.index_count,
+            reinterpret_cast<float*>(staging + object.triangle_lod_offset));
+    });
+
+    // The hash identifies the geometry in the acceleration structure cache.
+    loader.geometry_hash = 0;
+    for (const Loaded_Object& object : loader.objects) {
+        loader.geometry_hash = hash_memory(staging + object.vertex_offset, object.vertex_count * vertex_stride, loader.geometry_hash);
+        loader.geometry_hash = hash_memory(staging + object.index_offset, object.index_count * sizeof(uint32_t), loader.geometry_hash);
+    }
+
+    for (auto [i, texture] : enumerate(loader.textures)) {
+        const uint8_t* pixels = texture_pixels[i] ? texture_pixels[i] : texture_sources[i].color;
+        memcpy(staging + texture.offset, pixels, texture.width * texture.height * 4);
+        stbi_image_free(texture_pixels[i]);
+    }
+
+    if (cache_hit)
+        mesh_cache.release();
+
+    printf("Scene load time = %lld milliseconds (loader thread), staging data size = %u KB\n",
+        elapsed_milliseconds(load_time), uint32_t(staging_size / 1024));
+    loader.stage = scene_load_stage_finished;
+}
+
+const char* get_scene_load_stage_name(Scene_Load_Stage stage) {
+    switch (stage) {
+        case scene_load_stage_geometry: return "loading geometry";
+        case scene_load_stage_lods: return "generating LODs";
+        case scene_load_stage_textures: return "decoding textures";
+        case scene_load_stage_staging: return "preparing upload";
+        case scene_load_stage_finished: return "finished";
+        default: return "unknown";
+    }
+}
+
+void Scene_Loader::start(const Scene_Load_Params& load_params) {
+    params = load_params;
+    stage = scene_load_stage_geometry;
+
+    thread = std::thread([this]() {
+        try {
+            load_scene(*this);
+        } catch (const std::exception& e) {
+            error_message = e.what();
+            stage = scene_load_stage_finished;
+        }
+    });
+}
+
+void Scene_Loader::finish() {
+    if (thread.joinable())
+        thread.join();
+    staging_buffer.destroy();
+    staging_data = nullptr;
+}
+
+void Scene_Loader::record_upload(VkCommandBuffer command_buffer, Geometry_Arena& geometry_arena, std::vector<GPU_Mesh>& gpu_meshes, std::vector<Vk_Image>& gpu_textures) {
+    assert(is_loaded() && error_message.empty());
+
+    uint32_t total_vertex_count = 0;
+    uint32_t total_index_count = 0;
+    for (const Loaded_Object& object : objects) {
+        total_vertex_count += object.vertex_count;
+        total_index_count += object.index_count;
+    }
+    geometry_arena.create(params.vertex_layout, total_vertex_count, total_index_count);
+
+    std::vector<VkBufferCopy> vertex_regions, attribute_regions, index_regions;
+    for (const Loaded_Object& object : objects) {
+        GPU_Mesh gpu_mesh;
+        if (!geometry_arena.allocate_mesh(object.vertex_count, object.index_count, &gpu_mesh))
+            error("record_upload: geometry arena is full");
+        gpu_mesh.lods = object.lods;
+
+        vertex_regions.push_back(VkBufferCopy{ object.vertex_offset, gpu_mesh.get_vertex_offset(), VkDeviceSize(object.vertex_count) * gpu_mesh.vertex_stride });
+        if (gpu_mesh.attribute_stride)
+            attribute_regions.push_back(VkBufferCopy{ object.attribute_offset, gpu_mesh.get_attribute_offset(), VkDeviceSize(object.vertex_count) * gpu_mesh.attribute_stride });
+        index_regions.push_back(VkBufferCopy{ object.index_offset, gpu_mesh.get_index_offset(), VkDeviceSize(object.index_count) * sizeof(uint32_t) });
+
+        gpu_meshes.push_back(gpu_mesh);
+    }
+
+    vkCmdCopyBuffer(command_buffer, staging_buffer.handle, geometry_arena.vertex_buffer.handle, (uint32_t)vertex_regions.size(), vertex_regions.data());
+    if (!attribute_regions.empty())
+        vkCmdCopyBuffer(command_buffer, staging_buffer.handle, geometry_arena.attribute_buffer.handle, (uint32_t)attribute_regions.size(), attribute_regions.data());
+    vkCmdCopyBuffer(command_buffer, staging_buffer.handle, geometry_arena.index_buffer.handle, (uint32_t)index_regions.size(), index_regions.data());
+
+    for (const Loaded_Texture& texture : textures) {
+        Vk_Image image = vk_create_texture_image(texture.width, texture.height, VK_FORMAT_R8G8B8A8_SRGB, texture.mip_levels, texture.name.c_str());
+        vk_cmd_upload_texture(command_buffer, image.handle, texture.width, texture.height, texture.mip_levels, staging_buffer.handle, texture.offset);
+        gpu_textures.push_back(image);
+    }
+
+    // Geometry is read by the vertex input stage and as storage buffers by the raytracing shaders.
+    VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
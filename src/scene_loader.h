@@ -0,0 +1,85 @@
+#pragma once
+
+#include "geometry_arena.h"
+#include "vk.h"
+#include "vk_utils.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Scene_Load_Params {
+    std::string     scene_path; // relative to the data directory
+    float           scale;
+    bool            disable_mesh_cache;
+    bool            optimize_mesh;
+    Vertex_Layout   vertex_layout;
+    uint32_t        max_lod_count;
+};
+
+enum Scene_Load_Stage : uint32_t {
+    scene_load_stage_geometry,
+    scene_load_stage_lods,
+    scene_load_stage_textures,
+    scene_load_stage_staging,
+    scene_load_stage_finished,
+    scene_load_stage_count
+};
+
+const char* get_scene_load_stage_name(Scene_Load_Stage stage);
+
+// Object data prepared by the loader thread. Offsets point into the staging buffer.
+struct Loaded_Object {
+    std::vector<Mesh_LOD>   lods;
+    uint32_t                vertex_count;
+    uint32_t                index_count; // indices of all LODs
+    uint32_t                texture; // index in Scene_Loader::textures
+    Vector3                 bounds_min;
+    Vector3                 bounds_max;
+    VkDeviceSize            vertex_offset;
+    VkDeviceSize            attribute_offset;
+    VkDeviceSize            index_offset;
+    VkDeviceSize            triangle_lod_offset; // compute_triangle_lod_constants for all triangles of the index buffer
+};
+
+// Texture decoded by the loader thread, RGBA8 pixels are stored in the staging buffer.
+struct Loaded_Texture {
+    std::string             name;
+    int                     width;
+    int                     height;
+    uint32_t                mip_levels;
+    VkDeviceSize            offset;
+};
+
+// Loads the scene on the background thread, so the frame loop keeps running while the assets are loaded.
+//
+// The loader thread reads the geometry (or the mesh cache), generates LOD chains, decodes textures
+// and writes all GPU data into a single staging buffer. When is_loaded() returns true the main thread
+// records the copies into the frame command buffer with record_upload. The staging buffer should be
+// kept until that command buffer has completed, there is no queue wait during the upload.
+struct Scene_Loader {
+    Scene_Load_Params               params;
+    std::thread                     thread;
+    std::atomic<uint32_t>           stage; // Scene_Load_Stage
+    std::string                     error_message; // set by the loader thread if loading failed
+
+    std::vector<Loaded_Object>      objects;
+    std::vector<Loaded_Texture>     textures;
+    Vk_Buffer                       staging_buffer;
+    const uint8_t*                  staging_data = nullptr; // mapped staging buffer, valid until finish()
+    uint64_t                        geometry_hash = 0; // hash of the vertex and index data of all objects
+
+    void start(const Scene_Load_Params& params);
+
+    // Waits for the loader thread and releases the staging buffer.
+    // The staging data can be used by the CPU until this call.
+    void finish();
+
+    bool is_loaded() const { return stage.load() == scene_load_stage_finished; }
+
+    // Creates the geometry arena for all objects, allocates GPU meshes from it, creates textures and records
+    // the copies from the staging buffer to command_buffer. The geometry of all objects is copied with one
+    // copy command per arena buffer. The resources can be used by the commands recorded after this call.
+    void record_upload(VkCommandBuffer command_buffer, Geometry_Arena& geometry_arena, std::vector<GPU_Mesh>& gpu_meshes, std::vector<Vk_Image>& gpu_textures);
+};
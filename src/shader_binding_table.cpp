@@ -0,0 +1,105 @@
+#include "common.h"
+#include "shader_binding_table.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+static const char* shader_record_kind_names[shader_record_kind_count] = { "raygen", "miss", "hit", "callable" };
+
+//
+// Shader_Binding_Table
+//
+void Shader_Binding_Table::destroy() {
+    buffer.destroy();
+    *this = Shader_Binding_Table{};
+}
+
+VkStridedBufferRegionKHR Shader_Binding_Table::get_raygen_region(uint32_t index) const {
+    VkStridedBufferRegionKHR region = regions[shader_record_raygen];
+    assert(region.stride > 0 && (index + 1) * region.stride <= region.size);
+    region.offset += index * region.stride;
+    region.size = region.stride;
+    return region;
+}
+
+//
+// Shader_Binding_Table_Builder
+//
+Shader_Binding_Table_Builder& Shader_Binding_Table_Builder::add_record(Shader_Record_Kind kind, uint32_t group_index, const void* record_data, uint32_t record_data_size) {
+    assert(record_data != nullptr || record_data_size == 0);
+    Record record;
+    record.group_index  = group_index;
+    record.data_offset  = (uint32_t)data.size();
+    record.data_size    = record_data_size;
+    records[kind].push_back(record);
+    data.insert(data.end(), (const uint8_t*)record_data, (const uint8_t*)record_data + record_data_size);
+    return *this;
+}
+
+Shader_Binding_Table_Builder& Shader_Binding_Table_Builder::raygen(uint32_t group_index, const void* record_data, uint32_t record_data_size) {
+    return add_record(shader_record_raygen, group_index, record_data, record_data_size);
+}
+
+Shader_Binding_Table_Builder& Shader_Binding_Table_Builder::miss(uint32_t group_index, const void* record_data, uint32_t record_data_size) {
+    return add_record(shader_record_miss, group_index, record_data, record_data_size);
+}
+
+Shader_Binding_Table_Builder& Shader_Binding_Table_Builder::hit(uint32_t group_index, const void* record_data, uint32_t record_data_size) {
+    return add_record(shader_record_hit, group_index, record_data, record_data_size);
+}
+
+Shader_Binding_Table_Builder& Shader_Binding_Table_Builder::callable(uint32_t group_index, const void* record_data, uint32_t record_data_size) {
+    return add_record(shader_record_callable, group_index, record_data, record_data_size);
+}
+
+Shader_Binding_Table Shader_Binding_Table_Builder::create(VkPipeline pipeline, uint32_t group_count, const VkPhysicalDeviceRayTracingPropertiesKHR& properties, const char* name) {
+    assert(!records[shader_record_raygen].empty());
+    const uint32_t handle_size = properties.shaderGroupHandleSize;
+
+    std::vector<uint8_t> handles(size_t(group_count) * handle_size);
+    VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 0, group_count, handles.size(), handles.data()));
+
+    // Region layout. The stride of the region is defined by its largest record.
+    Shader_Binding_Table sbt;
+    VkDeviceSize buffer_size = 0;
+    for (uint32_t kind = 0; kind < shader_record_kind_count; kind++) {
+        VkStridedBufferRegionKHR& region = sbt.regions[kind];
+        region = VkStridedBufferRegionKHR{};
+        if (records[kind].empty())
+            continue;
+
+        uint32_t max_data_size = 0;
+        for (const Record& record : records[kind])
+            max_data_size = std::max(max_data_size, record.data_size);
+
+        const uint32_t stride = round_up(handle_size + max_data_size, handle_size);
+        if (stride > properties.maxShaderGroupStride)
+            error(std::string("Shader_Binding_Table_Builder: ") + shader_record_kind_names[kind] + " record size exceeds maxShaderGroupStride");
+
+        region.offset   = round_up(buffer_size, VkDeviceSize(properties.shaderGroupBaseAlignment));
+        region.stride   = stride;
+        region.size     = VkDeviceSize(stride) * records[kind].size();
+        buffer_size     = region.offset + region.size;
+    }
+
+    uint8_t* mapped_memory;
+    sbt.buffer = vk_create_mapped_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, (void**)&mapped_memory, name);
+    memset(mapped_memory, 0, buffer_size);
+
+    for (uint32_t kind = 0; kind < shader_record_kind_count; kind++) {
+        VkStridedBufferRegionKHR& region = sbt.regions[kind];
+        if (records[kind].empty())
+            continue;
+
+        region.buffer = sbt.buffer.handle;
+        for (auto [i, record] : enumerate(records[kind])) {
+            assert(record.group_index < group_count);
+            uint8_t* dst = mapped_memory + region.offset + i * region.stride;
+            memcpy(dst, handles.data() + size_t(record.group_index) * handle_size, handle_size);
+            if (record.data_size)
+                memcpy(dst + handle_size, data.data() + record.data_offset, record.data_size);
+        }
+    }
+    return sbt;
+}
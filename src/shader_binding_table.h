@@ -0,0 +1,59 @@
+#pragma once
+
+#include "vk_utils.h"
+
+#include <vector>
+
+enum Shader_Record_Kind : uint32_t {
+    shader_record_raygen,
+    shader_record_miss,
+    shader_record_hit,
+    shader_record_callable,
+    shader_record_kind_count
+};
+
+// Shader binding table with raygen, miss, hit and callable regions. Each region starts at shaderGroupBaseAlignment.
+// A shader record is the shader group handle followed by the record's inline data, which the shaders read through
+// a shaderRecordEXT buffer. All records of a region have the same stride: the largest record of the region rounded
+// up to the handle size. The regions are computed when the table is created and are passed to vkCmdTraceRaysKHR as is.
+struct Shader_Binding_Table {
+    Vk_Buffer                   buffer;
+    VkStridedBufferRegionKHR    regions[shader_record_kind_count];
+
+    void destroy();
+
+    // Region for vkCmdTraceRaysKHR, which uses the first raygen record. Other raygen records are selected with index.
+    VkStridedBufferRegionKHR get_raygen_region(uint32_t index = 0) const;
+    const VkStridedBufferRegionKHR& get_miss_region() const { return regions[shader_record_miss]; }
+    const VkStridedBufferRegionKHR& get_hit_region() const { return regions[shader_record_hit]; }
+    const VkStridedBufferRegionKHR& get_callable_region() const { return regions[shader_record_callable]; }
+};
+
+// Collects shader records and writes them to the shader binding table. group_index is the index of the shader group
+// in VkRayTracingPipelineCreateInfoKHR::pGroups, several records can reference the same group with different data.
+//
+// Hit records are indexed with the instance SBT record offset (instanceShaderBindingTableRecordOffset), so each
+// instance selects its own hit group and data. The record offset for the next hit record is get_hit_record_count().
+struct Shader_Binding_Table_Builder {
+    struct Record {
+        uint32_t group_index;
+        uint32_t data_offset; // in data
+        uint32_t data_size;
+    };
+
+    std::vector<Record>     records[shader_record_kind_count];
+    std::vector<uint8_t>    data;
+
+    Shader_Binding_Table_Builder& raygen    (uint32_t group_index, const void* record_data = nullptr, uint32_t record_data_size = 0);
+    Shader_Binding_Table_Builder& miss      (uint32_t group_index, const void* record_data = nullptr, uint32_t record_data_size = 0);
+    Shader_Binding_Table_Builder& hit       (uint32_t group_index, const void* record_data = nullptr, uint32_t record_data_size = 0);
+    Shader_Binding_Table_Builder& callable  (uint32_t group_index, const void* record_data = nullptr, uint32_t record_data_size = 0);
+
+    uint32_t get_hit_record_count() const { return (uint32_t)records[shader_record_hit].size(); }
+
+    // group_count is the number of shader groups in the pipeline.
+    Shader_Binding_Table create(VkPipeline pipeline, uint32_t group_count, const VkPhysicalDeviceRayTracingPropertiesKHR& properties, const char* name);
+
+private:
+    Shader_Binding_Table_Builder& add_record(Shader_Record_Kind kind, uint32_t group_index, const void* record_data, uint32_t record_data_size);
+};
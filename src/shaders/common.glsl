@@ -1,5 +1,8 @@
 layout(row_major) uniform;
 
+// Size of the material texture array (max_textures in vk_utils.h).
+const uint max_textures = 16;
+
 struct Frag_In {
     vec3 normal;
     vec2 uv;
@@ -39,3 +42,15 @@ void coordinate_system_from_vector(vec3 v, out vec3 v1, out vec3 v2) {
     v1 = normalize(abs(v.x) > abs(v.y) ? vec3(-v.z, 0, v.x) : vec3(0, -v.z, v.y));
     v2 = cross(v, v1);
 }
+
+vec2 sign_not_zero(vec2 v) {
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Decodes unit vector stored with octahedral encoding (Cigolle et al., A Survey of Efficient Representations for Independent Unit Vectors).
+vec3 oct_decode(vec2 e) {
+    vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * sign_not_zero(v.xy);
+    return normalize(v);
+}
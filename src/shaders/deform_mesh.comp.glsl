@@ -0,0 +1,52 @@
+#version 460
+#extension GL_EXT_buffer_reference : require
+
+layout(local_size_x = 64) in;
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Rest_Vertex_Buffer {
+    float rest_vertices[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) writeonly buffer Vertex_Buffer {
+    float vertices[];
+};
+
+// Push_Constants in mesh_deformer.cpp.
+layout(push_constant) uniform Push_Constants {
+    Rest_Vertex_Buffer  rest_vertex_buffer;
+    Vertex_Buffer       vertex_buffer;
+    uint                vertex_count;
+    uint                vertex_stride; // in floats, position is stored in the first 3 floats
+    float               bounds_min_y;
+    float               height;
+    float               time;
+    float               amount;
+};
+
+void main() {
+    uint vertex_index = gl_GlobalInvocationID.x;
+    if (vertex_index >= vertex_count)
+        return;
+
+    uint offset = vertex_index * vertex_stride;
+    vec3 p = vec3(rest_vertex_buffer.rest_vertices[offset + 0],
+                  rest_vertex_buffer.rest_vertices[offset + 1],
+                  rest_vertex_buffer.rest_vertices[offset + 2]);
+
+    // Normalized height, the bottom of the mesh stays in place like the root of a skeleton.
+    float h = height > 0.0 ? clamp((p.y - bounds_min_y) / height, 0.0, 1.0) : 0.0;
+
+    // Twist around the vertical axis.
+    float angle = amount * 0.6 * h * sin(1.3 * time);
+    float c = cos(angle);
+    float s = sin(angle);
+    p.xz = vec2(c * p.x + s * p.z, -s * p.x + c * p.z);
+
+    // Bend along X axis and the travelling wave.
+    p.x += amount * 0.15 * height * h * h * sin(0.9 * time);
+    p.z += amount * 0.02 * height * sin(12.0 * h - 4.0 * time);
+
+    vertex_buffer.vertices[offset + 0] = p.x;
+    vertex_buffer.vertices[offset + 1] = p.y;
+    vertex_buffer.vertices[offset + 2] = p.z;
+}
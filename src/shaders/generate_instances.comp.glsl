@@ -0,0 +1,104 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "common.glsl"
+
+layout(local_size_x = 64) in;
+
+// Instance_Layout.
+const uint instance_layout_scatter = 1;
+const uint instance_layout_animated = 2;
+
+// Push_Constants in instance_generator.cpp.
+layout(push_constant) uniform Push_Constants {
+    vec4    model_transform[3]; // rows of 3x4 matrix
+    uint    object_count;
+    uint    copy_count;
+    uint    grid_size;
+    uint    instance_layout;
+    float   spacing;
+    float   time;
+};
+
+// VkAccelerationStructureInstanceKHR.
+struct Instance {
+    vec4    transform[3];
+    uint    custom_index_and_mask;
+    uint    sbt_offset_and_flags;
+    uvec2   accel_reference;
+};
+
+layout(std430, binding=0) writeonly buffer Instances {
+    Instance instances[];
+};
+
+layout(std430, binding=1) readonly buffer Object_Accels {
+    uvec2 object_accels[];
+};
+
+// Instance SBT record offset of the object's hit record.
+layout(std430, binding=2) readonly buffer Object_Sbt_Offsets {
+    uint object_sbt_offsets[];
+};
+
+const float pi = 3.14159265;
+const uint geometry_instance_triangle_facing_cull_disable_bit = 1;
+
+uint hash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Random value in [0, 1).
+float random_float(uint seed) {
+    return float(hash(seed) >> 8) * (1.0 / 16777216.0);
+}
+
+void main() {
+    uint instance_index = gl_GlobalInvocationID.x;
+    if (instance_index >= object_count * copy_count)
+        return;
+
+    // All objects of the copy get the same placement.
+    uint object_index = instance_index / copy_count;
+    uint copy_index = instance_index % copy_count;
+
+    // Copies fill the grid around the origin starting from the center, so copy 0 stays at the origin.
+    uvec2 cell = uvec2(copy_index % grid_size, copy_index / grid_size);
+    uvec2 center_cell = uvec2(grid_size / 2);
+    if (cell == uvec2(0))
+        cell = center_cell;
+    else if (cell == center_cell)
+        cell = uvec2(0);
+
+    vec3 offset = vec3(float(cell.x) - float(center_cell.x), 0, float(cell.y) - float(center_cell.y)) * spacing;
+    float angle = 0.0;
+
+    if (instance_layout == instance_layout_scatter && copy_index != 0) {
+        offset.xz = (vec2(random_float(copy_index * 3 + 0), random_float(copy_index * 3 + 1)) - 0.5) * float(grid_size) * spacing;
+        angle = random_float(copy_index * 3 + 2) * 2.0 * pi;
+    } else if (instance_layout == instance_layout_animated) {
+        float phase = random_float(copy_index) * 2.0 * pi;
+        offset.y = 0.25 * spacing * sin(2.0 * time + phase);
+        angle = time * (0.5 + random_float(copy_index + copy_count)) + phase;
+    }
+
+    // transform = translate(offset) * rotate_y(angle) * model_transform
+    float c = cos(angle);
+    float s = sin(angle);
+    mat3 rotation = mat3(c, 0, -s, 0, 1, 0, s, 0, c);
+
+    Instance instance;
+    for (int i = 0; i < 3; i++) {
+        instance.transform[i] = rotation[0][i] * model_transform[0] + rotation[1][i] * model_transform[1] + rotation[2][i] * model_transform[2];
+        instance.transform[i].w += offset[i];
+    }
+    instance.custom_index_and_mask = object_index | (0xffu << 24); // custom index is the scene object index
+    instance.sbt_offset_and_flags = (object_sbt_offsets[object_index] & 0xffffffu) | (geometry_instance_triangle_facing_cull_disable_bit << 24);
+    instance.accel_reference = object_accels[object_index];
+    instances[instance_index] = instance;
+}
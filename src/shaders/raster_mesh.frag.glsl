@@ -5,12 +5,13 @@
 
 layout(push_constant) uniform Push_Constants {
     uint show_texture_lods;
+    uint texture_index; // material texture of the drawn object
 };
 
 layout(location=0) in Frag_In frag_in;
 layout(location = 0) out vec4 color_attachment0;
 
-layout(binding=1) uniform texture2D image;
+layout(binding=1) uniform texture2D images[max_textures];
 layout(binding=2) uniform sampler image_sampler;
 
 void main() {
@@ -23,12 +24,12 @@ void main() {
         // vec2 uvdx = abs(dFdx(frag_in.uv));
         // vec2 uvdy = abs(dFdy(frag_in.uv));
         // float filter_width = max(max(uvdx[0], uvdx[1]), max(uvdy[0], uvdy[1]));
-        // float lod = textureQueryLevels(sampler2D(image, image_sampler)) - 1 + log2(filter_width);
+        // float lod = textureQueryLevels(sampler2D(images[texture_index], image_sampler)) - 1 + log2(filter_width);
 
-        float lod = textureQueryLod(sampler2D(image, image_sampler), frag_in.uv).y;
+        float lod = textureQueryLod(sampler2D(images[texture_index], image_sampler), frag_in.uv).y;
         color = color_encode_lod(lod);
     } else {
-        color = texture(sampler2D(image, image_sampler), frag_in.uv).xyz;
+        color = texture(sampler2D(images[texture_index], image_sampler), frag_in.uv).xyz;
     }
     color_attachment0 = vec4(srgb_encode(color), 1);
 }
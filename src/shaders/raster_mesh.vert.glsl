@@ -3,18 +3,38 @@
 
 #include "common.glsl"
 
+// Vertex_Layout. Compact layout: normal is octahedral-encoded snorm16x2 (xy components), uv is half2.
+layout(constant_id = 0) const uint vertex_layout = 0;
+const uint vertex_layout_split_compact = 2;
+
 layout(location=0) in vec4 in_position;
-layout(location=1) in vec3 in_normal;
+layout(location=1) in vec4 in_normal;
 layout(location=2) in vec2 in_uv;
 layout(location = 0) out Frag_In frag_in;
 
 layout(std140, binding=0) uniform Uniform_Block {
-    mat4x4 model_view_proj;
-    mat4x4 model_view;
+    mat4x4 view_proj;
+    mat4x4 view;
+};
+
+// VkAccelerationStructureInstanceKHR. Only the transform is used.
+struct Instance {
+    vec4    transform[3]; // rows of object-to-world 3x4 matrix
+    uint    custom_index_and_mask;
+    uint    sbt_offset_and_flags;
+    uvec2   accel_reference;
+};
+
+layout(std430, binding=3) readonly buffer Instances {
+    Instance instances[];
 };
 
 void main() {
-    frag_in.normal = vec3(model_view * vec4(in_normal, 0.0));
+    Instance instance = instances[gl_InstanceIndex];
+    mat4x3 object_to_world = transpose(mat3x4(instance.transform[0], instance.transform[1], instance.transform[2]));
+
+    vec3 normal = (vertex_layout == vertex_layout_split_compact) ? oct_decode(in_normal.xy) : in_normal.xyz;
+    frag_in.normal = vec3(view * vec4(mat3(object_to_world) * normal, 0.0));
     frag_in.uv = in_uv;
-    gl_Position = model_view_proj * in_position;
+    gl_Position = view_proj * vec4(object_to_world * vec4(in_position.xyz, 1.0), 1.0);
 }
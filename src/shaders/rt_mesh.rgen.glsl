@@ -7,10 +7,29 @@
 #define RGEN_SHADER
 #include "rt_utils.glsl"
 
+// Rt_Raygen_Push_Constants in rt_resources.h.
 layout(push_constant) uniform Push_Constants {
       layout(offset = 0) uint spp4;
+      layout(offset = 4) uint accumulate;
+      layout(offset = 8) uint accumulated_sample_count; // samples per pixel in the accumulation image before this frame
+      layout(offset = 12) uint adaptive_pass;
+      layout(offset = 16) uint adaptive_max_spp;
+      layout(offset = 20) float adaptive_contrast_threshold;
+      layout(offset = 24) uint show_sample_heatmap;
+      layout(offset = 28) uint store_linear_color;
+      layout(offset = 32) uint ray_type;
 };
 
+// Rt_Ray_Type. Selects the miss record and the hit record of the object.
+const uint ray_type_differentials = 0;
+const uint ray_type_cones = 1;
+const uint ray_type_count = 2;
+
+// Rt_Adaptive_Pass.
+const uint adaptive_pass_none = 0;
+const uint adaptive_pass_first = 1;
+const uint adaptive_pass_second = 2;
+
 layout(binding = 0, rgba8) uniform image2D image;
 layout(set=0, binding = 1) uniform accelerationStructureEXT accel;
 
@@ -18,24 +37,124 @@ layout(std140, binding=2) uniform Uniform_Block {
     mat4x3 camera_to_world;
 };
 
+// Running average of the accumulated samples in linear color space. Without accumulation, when store_linear_color
+// is set, it receives the linear color of the frame and the number of samples of the pixel in alpha.
+layout(binding = 6, rgba32f) uniform image2D accumulation_image;
+
+// Linear color of the first adaptive pass, one sample per pixel.
+layout(binding = 7, rgba16f) uniform image2D first_pass_image;
+
 layout(location = 0) rayPayloadEXT Ray_Payload payload;
+layout(location = 1) rayPayloadEXT Ray_Cone_Payload cone_payload;
 
 const float tmin = 1e-3f;
 const float tmax = 1e+3f;
 
 vec3 trace_ray(vec2 sample_pos) {
     Ray ray = generate_ray(camera_to_world, sample_pos);
+
+    // The ray type is the SBT record offset, the object's hit records are interleaved by ray type.
+    if (ray_type == ray_type_cones) {
+        // The cone starts at the camera with zero width and spans one pixel vertically.
+        cone_payload.spread_angle = atan(2.0 * tan_fovy_over_2 / float(gl_LaunchSizeEXT.y));
+        cone_payload.cone_width = 0.0;
+        traceRayEXT(accel, gl_RayFlagsOpaqueEXT, 0xff, ray_type_cones, ray_type_count, ray_type_cones, ray.origin, tmin, ray.dir, tmax, 1);
+        return cone_payload.color;
+    }
+
     payload.rx_dir = ray.rx_dir;
     payload.ry_dir = ray.ry_dir;
-    traceRayEXT(accel, gl_RayFlagsOpaqueEXT, 0xff, 0, 0, 0, ray.origin, tmin, ray.dir, tmax, 0);
+    traceRayEXT(accel, gl_RayFlagsOpaqueEXT, 0xff, ray_type_differentials, ray_type_count, ray_type_differentials, ray.origin, tmin, ray.dir, tmax, 0);
     return payload.color;
 }
 
+// Halton sequence point in [0, 1)^2 (bases 2 and 3).
+vec2 halton_2_3(uint index) {
+    float x = float(bitfieldReverse(index)) * 2.3283064365386963e-10; // 2^-32
+
+    float y = 0.0;
+    float inv_base = 1.0 / 3.0;
+    float f = inv_base;
+    while (index > 0) {
+        y += f * float(index % 3);
+        index /= 3;
+        f *= inv_base;
+    }
+    return vec2(x, y);
+}
+
+float luminance(vec3 c) {
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Blue for a single sample through green and yellow to red for the sample budget.
+vec3 heatmap_color(float t) {
+    t = clamp(t, 0.0, 1.0);
+    if (t < 0.5)
+        return mix(vec3(0, 0, 1), vec3(0, 1, 0), t * 2.0);
+    else
+        return mix(vec3(1, 1, 0), vec3(1, 0, 0), t * 2.0 - 1.0);
+}
+
+// The second adaptive pass takes the first pass sample of the pixel and traces additional samples.
+// The sample count grows with the luminance contrast of the 3x3 neighborhood measured in the first pass:
+// each multiple of the contrast threshold adds a sample, so flat regions keep a single sample.
+vec3 trace_adaptive_samples(ivec2 pixel, out uint sample_count) {
+    const ivec2 max_pixel = ivec2(gl_LaunchSizeEXT.xy) - 1;
+    vec3 first_sample = imageLoad(first_pass_image, pixel).rgb;
+
+    // Contrast is measured on sRGB encoded values to match the perceived differences.
+    float min_luminance = 1e+30;
+    float max_luminance = 0.0;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            vec3 c = imageLoad(first_pass_image, clamp(pixel + ivec2(x, y), ivec2(0), max_pixel)).rgb;
+            float l = luminance(srgb_encode(max(c, vec3(0))));
+            min_luminance = min(min_luminance, l);
+            max_luminance = max(max_luminance, l);
+        }
+    }
+    float contrast = max_luminance - min_luminance;
+    sample_count = clamp(uint(contrast / max(adaptive_contrast_threshold, 1e-4)) + 1u, 1u, max(adaptive_max_spp, 1u));
+
+    vec3 color = first_sample;
+    for (uint i = 1; i < sample_count; i++)
+        color += trace_ray(vec2(pixel) + halton_2_3(i));
+    return color / float(sample_count);
+}
+
 void main() {
     const vec2 sample_origin = vec2(gl_LaunchIDEXT.xy);
+    const uint sample_count = (spp4 != 0) ? 4u : 1u;
     vec3 color = vec3(0);
 
-    if (spp4 != 0) {
+    if (accumulate != 0) {
+        // Each frame continues the low-discrepancy sequence of the pixel sample positions.
+        // Index 0 of the sequence is skipped, it is the pixel corner.
+        for (uint i = 0; i < sample_count; i++)
+            color += trace_ray(sample_origin + halton_2_3(accumulated_sample_count + i + 1));
+        color /= float(sample_count);
+
+        if (accumulated_sample_count > 0) {
+            vec3 accumulated_color = imageLoad(accumulation_image, ivec2(gl_LaunchIDEXT.xy)).rgb;
+            color = mix(accumulated_color, color, float(sample_count) / float(accumulated_sample_count + sample_count));
+        }
+        imageStore(accumulation_image, ivec2(gl_LaunchIDEXT.xy), vec4(color, 1.0));
+    } else if (adaptive_pass == adaptive_pass_first) {
+        color = trace_ray(sample_origin + vec2(0.5));
+        imageStore(first_pass_image, ivec2(gl_LaunchIDEXT.xy), vec4(color, 1.0));
+        return;
+    } else if (adaptive_pass == adaptive_pass_second) {
+        uint adaptive_sample_count;
+        color = trace_adaptive_samples(ivec2(gl_LaunchIDEXT.xy), adaptive_sample_count);
+        if (store_linear_color != 0)
+            imageStore(accumulation_image, ivec2(gl_LaunchIDEXT.xy), vec4(color, float(adaptive_sample_count)));
+        if (show_sample_heatmap != 0) {
+            float t = adaptive_max_spp > 1 ? float(adaptive_sample_count - 1) / float(adaptive_max_spp - 1) : 0.0;
+            imageStore(image, ivec2(gl_LaunchIDEXT.xy), vec4(heatmap_color(t), 1.0));
+            return;
+        }
+    } else if (spp4 != 0) {
         color += trace_ray(sample_origin + vec2(0.125, 0.375));
         color += trace_ray(sample_origin + vec2(0.375, 0.875));
         color += trace_ray(sample_origin + vec2(0.625, 0.125));
@@ -44,5 +163,8 @@ void main() {
     } else
         color = trace_ray(sample_origin + vec2(0.5));
 
-    imageStore(image, ivec2(gl_LaunchIDEXT.xy), vec4(color, 1.0));
+    if (store_linear_color != 0 && accumulate == 0 && adaptive_pass == adaptive_pass_none)
+        imageStore(accumulation_image, ivec2(gl_LaunchIDEXT.xy), vec4(color, float(sample_count)));
+
+    imageStore(image, ivec2(gl_LaunchIDEXT.xy), vec4(srgb_encode(color), 1.0));
 }
@@ -8,5 +8,5 @@
 layout (location=0) rayPayloadInEXT Ray_Payload payload;
 
 void main() {
-    payload.color = srgb_encode(vec3(0.32f, 0.32f, 0.4f));
+    payload.color = vec3(0.32f, 0.32f, 0.4f);
 }
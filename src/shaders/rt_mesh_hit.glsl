@@ -0,0 +1,100 @@
+// Hit record, scene data and vertex fetch shared by the mesh closest hit shaders.
+// Included after rt_utils.glsl with HIT_SHADER defined.
+
+hitAttributeEXT vec2 attribs;
+
+// Vertex_Layout.
+// Interleaved: vertex buffer contains position, normal and uv (8 floats per vertex).
+// Split: vertex buffer contains positions (3 floats per vertex), attribute buffer contains normal and uv (5 floats).
+// Split compact: the same positions, attribute buffer contains octahedral-encoded normal (snorm16x2) and uv (half2).
+layout(constant_id = 0) const uint vertex_layout = 0;
+const uint vertex_layout_interleaved = 0;
+const uint vertex_layout_split = 1;
+
+layout(push_constant) uniform Push_Constants {
+      layout(offset = 36) uint show_texture_lods; // follows Rt_Raygen_Push_Constants
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Index_Buffer {
+    uint indices[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Vertex_Buffer {
+    float vertices[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Attribute_Buffer {
+    uint attributes[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Triangle_Lods {
+    float lod_constants[]; // compute_triangle_lod_constants in mesh.cpp
+};
+
+// Rt_Hit_Record in rt_resources.cpp. Inline data of the object's hit records, the instances of the object
+// select the records with the instance SBT record offset. Attribute buffer is not used with interleaved layout.
+layout(shaderRecordEXT, std430) readonly buffer Hit_Record {
+    Index_Buffer        index_buffer;
+    Vertex_Buffer       vertex_buffer;
+    Attribute_Buffer    attribute_buffer;
+    Triangle_Lods       triangle_lods;
+    uint                texture_index;
+};
+
+// Rt_Object in rt_resources.cpp.
+layout(std430, binding=3) readonly buffer Objects {
+    uint first_triangles[]; // first triangle of the selected LOD in the index buffer
+};
+
+layout(binding=4) uniform texture2D images[max_textures];
+layout(binding=5) uniform sampler image_sampler;
+
+Vertex fetch_vertex(uint vertex_index) {
+    uint i = index_buffer.indices[vertex_index];
+
+    Vertex v;
+    if (vertex_layout == vertex_layout_interleaved) {
+        Vertex_Buffer vb = vertex_buffer;
+        v.p = vec3(vb.vertices[i*8 + 0], vb.vertices[i*8 + 1], vb.vertices[i*8 + 2]);
+        v.n = vec3(vb.vertices[i*8 + 3], vb.vertices[i*8 + 4], vb.vertices[i*8 + 5]);
+        v.uv = fract(vec2(vb.vertices[i*8 + 6], vb.vertices[i*8 + 7]));
+    } else if (vertex_layout == vertex_layout_split) {
+        Vertex_Buffer vb = vertex_buffer;
+        Attribute_Buffer ab = attribute_buffer;
+        v.p = vec3(vb.vertices[i*3 + 0], vb.vertices[i*3 + 1], vb.vertices[i*3 + 2]);
+        v.n = uintBitsToFloat(uvec3(ab.attributes[i*5 + 0], ab.attributes[i*5 + 1], ab.attributes[i*5 + 2]));
+        v.uv = fract(uintBitsToFloat(uvec2(ab.attributes[i*5 + 3], ab.attributes[i*5 + 4])));
+    } else {
+        Vertex_Buffer vb = vertex_buffer;
+        Attribute_Buffer ab = attribute_buffer;
+        v.p = vec3(vb.vertices[i*3 + 0], vb.vertices[i*3 + 1], vb.vertices[i*3 + 2]);
+        v.n = oct_decode(unpackSnorm2x16(ab.attributes[i*2 + 0]));
+        v.uv = fract(unpackHalf2x16(ab.attributes[i*2 + 1]));
+    }
+    return v;
+}
+
+// Index of the hit triangle in the object's index buffer. Custom index is the scene object index.
+uint get_hit_triangle() {
+    return first_triangles[gl_InstanceCustomIndexEXT] + gl_PrimitiveID;
+}
+
+// Fetches the vertices of the triangle, positions are transformed to world space.
+void fetch_world_triangle(uint triangle, out Vertex v0, out Vertex v1, out Vertex v2) {
+    v0 = fetch_vertex(triangle*3 + 0);
+    v1 = fetch_vertex(triangle*3 + 1);
+    v2 = fetch_vertex(triangle*3 + 2);
+
+    v0.p = gl_ObjectToWorldEXT * vec4(v0.p, 1);
+    v1.p = gl_ObjectToWorldEXT * vec4(v1.p, 1);
+    v2.p = gl_ObjectToWorldEXT * vec4(v2.p, 1);
+}
+
+// Linear color of the hit point sampled with the given texture LOD, or the LOD itself when show_texture_lods is set.
+vec3 shade_hit(Vertex v0, Vertex v1, Vertex v2, float lod) {
+    if (show_texture_lods != 0)
+        return color_encode_lod(lod);
+
+    vec2 uv = fract(barycentric_interpolate(attribs.x, attribs.y, v0.uv, v1.uv, v2.uv));
+    return textureLod(sampler2D(images[nonuniformEXT(texture_index)], image_sampler), uv, lod).rgb;
+}
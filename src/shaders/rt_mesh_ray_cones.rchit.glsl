@@ -0,0 +1,29 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_ray_tracing : require
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_EXT_buffer_reference : require
+
+#include "common.glsl"
+
+#define HIT_SHADER
+#include "rt_utils.glsl"
+
+#include "rt_mesh_hit.glsl"
+
+layout (location=0) rayPayloadInEXT Ray_Cone_Payload payload;
+
+// Texture LOD from the ray cone: the cone width at the hit distance and the triangle's precomputed uv/world area ratio.
+void main() {
+    uint triangle = get_hit_triangle();
+    Vertex v0, v1, v2;
+    fetch_world_triangle(triangle, v0, v1, v2);
+
+    ivec2 texture_size = textureSize(sampler2D(images[nonuniformEXT(texture_index)], image_sampler), 0);
+    int mip_levels = textureQueryLevels(sampler2D(images[nonuniformEXT(texture_index)], image_sampler));
+
+    float lod = compute_texture_lod_ray_cone(v0, v1, v2, triangle_lods.lod_constants[triangle],
+        payload.cone_width, payload.spread_angle, texture_size, mip_levels);
+
+    payload.color = shade_hit(v0, v1, v2, lod); // linear color, encoded by the raygen shader
+}
@@ -0,0 +1,12 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_ray_tracing : require
+
+#include "common.glsl"
+#include "rt_utils.glsl"
+
+layout (location=0) rayPayloadInEXT Ray_Cone_Payload payload;
+
+void main() {
+    payload.color = vec3(0.32f, 0.32f, 0.4f);
+}
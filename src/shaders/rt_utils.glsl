@@ -1,7 +1,14 @@
 struct Ray_Payload {
     vec3 rx_dir;
     vec3 ry_dir;
-    vec3 color;
+    vec3 color; // linear
+};
+
+// Payload of the ray cone texture LOD mode: the cone replaces the two auxiliary ray directions.
+struct Ray_Cone_Payload {
+    vec3 color; // linear
+    float spread_angle; // cone angle, the width grows by this value per unit of distance
+    float cone_width; // width at the ray origin
 };
 
 struct Vertex {
@@ -18,9 +25,9 @@ struct Ray {
 };
 
 #ifdef RGEN_SHADER
-vec3 get_direction(vec2 film_position) {
-    const float tan_fovy_over_2 = 0.414; // tan(45/2)
+const float tan_fovy_over_2 = 0.414; // tan(45/2)
 
+vec3 get_direction(vec2 film_position) {
     vec2 uv = 2.0 * (film_position / vec2(gl_LaunchSizeEXT.xy)) - 1.0;
     float aspect_ratio = float(gl_LaunchSizeEXT.x) / float(gl_LaunchSizeEXT.y);
 
@@ -114,4 +121,18 @@ float compute_texture_lod(Vertex v0, Vertex v1, Vertex v2, vec3 rx_dir, vec3 ry_
 
     return mip_levels - 1 + log2(clamp(filter_width, 1e-6, 1.0));
 }
+
+// Ray cone texture LOD (Ray Tracing Gems, chapter 20). triangle_lod is 0.5 * log2(uv area / area) of the triangle
+// computed in object space at load time, the object to world scale is taken into account assuming it is uniform.
+float compute_texture_lod_ray_cone(Vertex v0, Vertex v1, Vertex v2, float triangle_lod, float cone_width, float spread_angle,
+    ivec2 texture_size, int mip_levels) {
+    vec3 face_normal = normalize(cross(v1.p - v0.p, v2.p - v0.p));
+    float width = abs(cone_width + spread_angle * gl_HitTEXT);
+    float cos_angle = max(abs(dot(face_normal, gl_WorldRayDirectionEXT)), 1e-4);
+    float object_to_world_scale = length(gl_ObjectToWorldEXT[0]);
+
+    float lod = triangle_lod - log2(object_to_world_scale) + 0.5 * log2(float(texture_size.x * texture_size.y));
+    lod += log2(max(width, 1e-10) / cos_angle);
+    return clamp(lod, 0.0, float(mip_levels - 1));
+}
 #endif // HIT_SHADER
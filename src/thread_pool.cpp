@@ -0,0 +1,138 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+// 0 for threads that do not belong to the pool, otherwise 1-based worker index.
+thread_local uint32_t current_thread_index = 0;
+
+struct Parallel_For_Job {
+    const std::function<void(uint32_t, uint32_t)>* func;
+    uint32_t count;
+    std::atomic<uint32_t> next_index;
+    std::atomic<uint32_t> finished_count;
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    void run_iterations() {
+        uint32_t finished_by_this_thread = 0;
+        for (uint32_t i = next_index++; i < count; i = next_index++) {
+            (*func)(i, current_thread_index);
+            finished_by_this_thread++;
+        }
+        if (finished_by_this_thread > 0 && finished_count.fetch_add(finished_by_this_thread) + finished_by_this_thread == count) {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.notify_one();
+        }
+    }
+};
+
+class Thread_Pool {
+public:
+    Thread_Pool() {
+        uint32_t hardware_threads = std::thread::hardware_concurrency();
+        uint32_t worker_count = hardware_threads > 1 ? hardware_threads - 1 : 0;
+
+        workers.reserve(worker_count);
+        for (uint32_t i = 0; i < worker_count; i++) {
+            workers.emplace_back([this, i]() {
+                current_thread_index = i + 1;
+                worker_loop();
+            });
+        }
+    }
+
+    ~Thread_Pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake_up.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    uint32_t thread_count() const {
+        return uint32_t(workers.size()) + 1;
+    }
+
+    void submit(std::function<void()> task, uint32_t copies) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (uint32_t i = 0; i < copies; i++)
+                tasks.push_back(task);
+        }
+        if (copies == 1)
+            wake_up.notify_one();
+        else
+            wake_up.notify_all();
+    }
+
+private:
+    void worker_loop() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake_up.wait(lock, [this]() { return stop || !tasks.empty(); });
+                if (stop && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake_up;
+    bool stop = false;
+};
+
+Thread_Pool& get_thread_pool() {
+    static Thread_Pool thread_pool;
+    return thread_pool;
+}
+} // namespace
+
+uint32_t get_thread_count() {
+    return get_thread_pool().thread_count();
+}
+
+void parallel_for(uint32_t count, const std::function<void(uint32_t index, uint32_t thread_index)>& func) {
+    if (count == 0)
+        return;
+
+    Thread_Pool& thread_pool = get_thread_pool();
+    const uint32_t helper_count = std::min(thread_pool.thread_count() - 1, count - 1);
+
+    if (helper_count == 0) {
+        for (uint32_t i = 0; i < count; i++)
+            func(i, current_thread_index);
+        return;
+    }
+
+    // The job is shared with the helper tasks because a helper can be scheduled
+    // after all iterations are already finished and this function has returned.
+    auto job = std::make_shared<Parallel_For_Job>();
+    job->func = &func;
+    job->count = count;
+    job->next_index = 0;
+    job->finished_count = 0;
+
+    thread_pool.submit([job]() { job->run_iterations(); }, helper_count);
+    job->run_iterations();
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&job]() { return job->finished_count.load() == job->count; });
+}
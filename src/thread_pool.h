@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+// Number of threads that participate in parallel_for (worker threads + calling thread).
+uint32_t get_thread_count();
+
+// Calls func(index, thread_index) for each index in [0, count) using worker threads.
+// The calling thread also executes iterations and the function returns when all
+// iterations are finished. thread_index is in [0, get_thread_count()) and it is unique
+// among the threads that run iterations of the same parallel_for call, so it can
+// be used to address per-thread data.
+void parallel_for(uint32_t count, const std::function<void(uint32_t index, uint32_t thread_index)>& func);
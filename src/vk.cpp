@@ -16,7 +16,8 @@
 
 static const VkDescriptorPoolSize descriptor_pool_sizes[] = {
     {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,             16},
-    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,              16},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,             16},
+    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,              64}, // material texture arrays
     {VK_DESCRIPTOR_TYPE_SAMPLER,                    16},
     {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,              16},
     {VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 16},
@@ -169,7 +170,7 @@ static void create_instance(bool enable_validation_layers) {
     VK_CHECK(vkCreateInstance(&desc, nullptr, &vk.instance));
 }
 
-static void create_device(GLFWwindow* window) {
+static void create_device(GLFWwindow* window, bool enable_async_compute) {
     // select physical device
     {
         uint32_t count;
@@ -222,6 +223,19 @@ static void create_device(GLFWwindow* window) {
         }
         if (vk.queue_family_index == -1)
             error("Vulkan: failed to find queue family");
+
+        // Compute-only family runs in parallel with the graphics queue. Its timestamps are used
+        // to measure how much the compute work overlaps with the graphics work.
+        vk.compute_queue_family_index = vk.queue_family_index;
+        if (enable_async_compute) {
+            for (uint32_t i = 0; i < queue_family_count; i++) {
+                const VkQueueFlags flags = queue_families[i].queueFlags;
+                if ((flags & VK_QUEUE_COMPUTE_BIT) != 0 && (flags & VK_QUEUE_GRAPHICS_BIT) == 0 && queue_families[i].timestampValidBits > 0) {
+                    vk.compute_queue_family_index = i;
+                    break;
+                }
+            }
+        }
     }
 
     // create VkDevice
@@ -265,19 +279,52 @@ static void create_device(GLFWwindow* window) {
             vk.raytracing_supported = true;
         }
 
+        // Timestamps of both queues are reset on the host, so the reset does not have to be ordered
+        // with the timestamp writes of the other queue.
+        bool host_query_reset_supported = false;
+        {
+            VkPhysicalDeviceVulkan12Features supported_vulkan12_features { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+            VkPhysicalDeviceFeatures2 supported_features { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+            supported_features.pNext = &supported_vulkan12_features;
+            vkGetPhysicalDeviceFeatures2(vk.physical_device, &supported_features);
+            host_query_reset_supported = supported_vulkan12_features.hostQueryReset == VK_TRUE;
+        }
+
+        // Acceleration structure builds are the main compute work, so async compute is used only with raytracing.
+        vk.async_compute = vk.compute_queue_family_index != vk.queue_family_index && vk.raytracing_supported && host_query_reset_supported;
+        if (!vk.async_compute)
+            vk.compute_queue_family_index = vk.queue_family_index;
+        vk.buffer_queue_family_indices[0] = vk.queue_family_index;
+        vk.buffer_queue_family_indices[1] = vk.compute_queue_family_index;
+
         const float priority = 1.0;
-        VkDeviceQueueCreateInfo queue_create_info { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
-        queue_create_info.queueFamilyIndex = vk.queue_family_index;
-        queue_create_info.queueCount = 1;
-        queue_create_info.pQueuePriorities = &priority;
+        VkDeviceQueueCreateInfo queue_create_infos[2];
+        for (VkDeviceQueueCreateInfo& queue_create_info : queue_create_infos) {
+            queue_create_info = VkDeviceQueueCreateInfo{ VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
+            queue_create_info.queueCount = 1;
+            queue_create_info.pQueuePriorities = &priority;
+        }
+        queue_create_infos[0].queueFamilyIndex = vk.queue_family_index;
+        queue_create_infos[1].queueFamilyIndex = vk.compute_queue_family_index;
 
         VkPhysicalDeviceVulkan12Features vulkan12_features { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
         vulkan12_features.bufferDeviceAddress = VK_TRUE;
+        vulkan12_features.hostQueryReset = vk.async_compute ? VK_TRUE : VK_FALSE;
 
         VkPhysicalDeviceRayTracingFeaturesKHR ray_tracing_features { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_FEATURES_KHR };
         if (vk.raytracing_supported) {
+            // Host acceleration structure commands are optional.
+            VkPhysicalDeviceFeatures2 supported_features { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+            supported_features.pNext = &ray_tracing_features;
+            vkGetPhysicalDeviceFeatures2(vk.physical_device, &supported_features);
+            vk.host_accel_builds_supported = ray_tracing_features.rayTracingHostAccelerationStructureCommands == VK_TRUE;
+
+            ray_tracing_features = VkPhysicalDeviceRayTracingFeaturesKHR{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_FEATURES_KHR };
             ray_tracing_features.rayTracing = VK_TRUE;
+            ray_tracing_features.rayTracingHostAccelerationStructureCommands = vk.host_accel_builds_supported ? VK_TRUE : VK_FALSE;
             vulkan12_features.pNext = &ray_tracing_features;
+            // Hit shader indexes material texture array with the per-object texture index.
+            vulkan12_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
         }
 
         VkPhysicalDeviceFeatures2 features2 { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
@@ -285,11 +332,13 @@ static void create_device(GLFWwindow* window) {
         // to shut up improper validation warning (image store is in the raygen
         // shader not in the vertex stage)
         features2.features.vertexPipelineStoresAndAtomics = VK_TRUE;
+        // Fragment shader indexes material texture array with the texture index from push constants.
+        features2.features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
 
         VkDeviceCreateInfo device_create_info { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
         device_create_info.pNext = &features2;
-        device_create_info.queueCreateInfoCount = 1;
-        device_create_info.pQueueCreateInfos = &queue_create_info;
+        device_create_info.queueCreateInfoCount = vk.async_compute ? 2 : 1;
+        device_create_info.pQueueCreateInfos = queue_create_infos;
         device_create_info.enabledExtensionCount = (uint32_t)device_extensions.size();
         device_create_info.ppEnabledExtensionNames = device_extensions.data();
 
@@ -398,7 +447,7 @@ void Vk_Buffer::destroy() {
     *this = Vk_Buffer{};
 }
 
-void vk_initialize(GLFWwindow* window, bool enable_validation_layers) {
+void vk_initialize(GLFWwindow* window, bool enable_validation_layers, bool enable_async_compute) {
     VK_CHECK(volkInitialize());
     uint32_t instance_version = volkGetInstanceVersion();
 
@@ -426,10 +475,11 @@ void vk_initialize(GLFWwindow* window, bool enable_validation_layers) {
         VK_CHECK(vkCreateDebugUtilsMessengerEXT(vk.instance, &desc, nullptr, &vk.debug_utils_messenger));
     }
 
-    create_device(window);
+    create_device(window, enable_async_compute);
     volkLoadDevice(vk.device);
 
     vkGetDeviceQueue(vk.device, vk.queue_family_index, 0, &vk.queue);
+    vkGetDeviceQueue(vk.device, vk.compute_queue_family_index, 0, &vk.compute_queue);
 
     VmaVulkanFunctions alloc_funcs{};
     alloc_funcs.vkGetPhysicalDeviceProperties       = vkGetPhysicalDeviceProperties;
@@ -467,6 +517,10 @@ void vk_initialize(GLFWwindow* window, bool enable_validation_layers) {
         VK_CHECK(vkCreateSemaphore(vk.device, &desc, nullptr, &vk.image_acquired_semaphore[1]));
         VK_CHECK(vkCreateSemaphore(vk.device, &desc, nullptr, &vk.rendering_finished_semaphore[0]));
         VK_CHECK(vkCreateSemaphore(vk.device, &desc, nullptr, &vk.rendering_finished_semaphore[1]));
+        VK_CHECK(vkCreateSemaphore(vk.device, &desc, nullptr, &vk.compute_finished_semaphore[0]));
+        VK_CHECK(vkCreateSemaphore(vk.device, &desc, nullptr, &vk.compute_finished_semaphore[1]));
+        VK_CHECK(vkCreateSemaphore(vk.device, &desc, nullptr, &vk.scene_finished_semaphore[0]));
+        VK_CHECK(vkCreateSemaphore(vk.device, &desc, nullptr, &vk.scene_finished_semaphore[1]));
 
         VkFenceCreateInfo fence_desc { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
         fence_desc.flags = VK_FENCE_CREATE_SIGNALED_BIT;
@@ -481,6 +535,10 @@ void vk_initialize(GLFWwindow* window, bool enable_validation_layers) {
         desc.queueFamilyIndex = vk.queue_family_index;
         VK_CHECK(vkCreateCommandPool(vk.device, &desc, nullptr, &vk.command_pools[0]));
         VK_CHECK(vkCreateCommandPool(vk.device, &desc, nullptr, &vk.command_pools[1]));
+
+        desc.queueFamilyIndex = vk.compute_queue_family_index;
+        VK_CHECK(vkCreateCommandPool(vk.device, &desc, nullptr, &vk.compute_command_pools[0]));
+        VK_CHECK(vkCreateCommandPool(vk.device, &desc, nullptr, &vk.compute_command_pools[1]));
     }
 
     // Command buffer.
@@ -492,8 +550,21 @@ void vk_initialize(GLFWwindow* window, bool enable_validation_layers) {
         VK_CHECK(vkAllocateCommandBuffers(vk.device, &alloc_info, &vk.command_buffers[0]));
         alloc_info.commandPool = vk.command_pools[1];
         VK_CHECK(vkAllocateCommandBuffers(vk.device, &alloc_info, &vk.command_buffers[1]));
+
+        alloc_info.commandPool = vk.command_pools[0];
+        VK_CHECK(vkAllocateCommandBuffers(vk.device, &alloc_info, &vk.present_command_buffers[0]));
+        alloc_info.commandPool = vk.command_pools[1];
+        VK_CHECK(vkAllocateCommandBuffers(vk.device, &alloc_info, &vk.present_command_buffers[1]));
+
+        alloc_info.commandPool = vk.compute_command_pools[0];
+        VK_CHECK(vkAllocateCommandBuffers(vk.device, &alloc_info, &vk.compute_command_buffers[0]));
+        alloc_info.commandPool = vk.compute_command_pools[1];
+        VK_CHECK(vkAllocateCommandBuffers(vk.device, &alloc_info, &vk.compute_command_buffers[1]));
     }
 
+    if (vk.async_compute)
+        printf("Async compute: queue family %u\n", vk.compute_queue_family_index);
+
     // Descriptor pool.
     {
         std::vector<VkDescriptorPoolSize> pool_sizes;
@@ -568,11 +639,17 @@ void vk_shutdown() {
 
     vkDestroyCommandPool(vk.device, vk.command_pools[0], nullptr);
     vkDestroyCommandPool(vk.device, vk.command_pools[1], nullptr);
+    vkDestroyCommandPool(vk.device, vk.compute_command_pools[0], nullptr);
+    vkDestroyCommandPool(vk.device, vk.compute_command_pools[1], nullptr);
     vkDestroyDescriptorPool(vk.device, vk.descriptor_pool, nullptr);
     vkDestroySemaphore(vk.device, vk.image_acquired_semaphore[0], nullptr);
     vkDestroySemaphore(vk.device, vk.image_acquired_semaphore[1], nullptr);
     vkDestroySemaphore(vk.device, vk.rendering_finished_semaphore[0], nullptr);
     vkDestroySemaphore(vk.device, vk.rendering_finished_semaphore[1], nullptr);
+    vkDestroySemaphore(vk.device, vk.compute_finished_semaphore[0], nullptr);
+    vkDestroySemaphore(vk.device, vk.compute_finished_semaphore[1], nullptr);
+    vkDestroySemaphore(vk.device, vk.scene_finished_semaphore[0], nullptr);
+    vkDestroySemaphore(vk.device, vk.scene_finished_semaphore[1], nullptr);
     vkDestroyFence(vk.device, vk.frame_fence[0], nullptr);
     vkDestroyFence(vk.device, vk.frame_fence[1], nullptr);
     vkDestroyQueryPool(vk.device, vk.timestamp_query_pools[0], nullptr);
@@ -596,6 +673,18 @@ void vk_restore_resolution_dependent_resources(bool vsync) {
     create_depth_buffer();
 }
 
+// With async compute the buffers are accessed by both queue families. Concurrent sharing avoids
+// queue family ownership transfers, the images are used only by the graphics queue.
+static void set_buffer_sharing_mode(VkBufferCreateInfo& buffer_create_info) {
+    if (vk.async_compute) {
+        buffer_create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        buffer_create_info.queueFamilyIndexCount = 2;
+        buffer_create_info.pQueueFamilyIndices = vk.buffer_queue_family_indices;
+    } else {
+        buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+}
+
 void vk_ensure_staging_buffer_allocation(VkDeviceSize size) {
     if (vk.staging_buffer_size >= size)
         return;
@@ -606,7 +695,7 @@ void vk_ensure_staging_buffer_allocation(VkDeviceSize size) {
     VkBufferCreateInfo buffer_desc { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
     buffer_desc.size        = size;
     buffer_desc.usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    buffer_desc.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    set_buffer_sharing_mode(buffer_desc);
 
     VmaAllocationCreateInfo alloc_create_info{};
     alloc_create_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
@@ -623,7 +712,7 @@ Vk_Buffer vk_create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, const vo
     VkBufferCreateInfo buffer_create_info { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
     buffer_create_info.size = size;
     buffer_create_info.usage = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
-    buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    set_buffer_sharing_mode(buffer_create_info);
 
     VmaAllocationCreateInfo alloc_create_info{};
     alloc_create_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
@@ -655,6 +744,7 @@ Vk_Buffer vk_create_mapped_buffer(VkDeviceSize size, VkBufferUsageFlags usage, v
     VkBufferCreateInfo buffer_create_info { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
     buffer_create_info.size = size;
     buffer_create_info.usage = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    set_buffer_sharing_mode(buffer_create_info);
 
     VmaAllocationCreateInfo alloc_create_info{};
     alloc_create_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
@@ -674,15 +764,15 @@ Vk_Buffer vk_create_mapped_buffer(VkDeviceSize size, VkBufferUsageFlags usage, v
     return buffer;
 }
 
-Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate_mipmaps, const uint8_t* pixels, int bytes_per_pixel, const char* name) {
-    Vk_Image image;
+uint32_t vk_get_mip_level_count(int width, int height) {
+    uint32_t mip_levels = 0;
+    for (int k = std::max(width, height); k > 0; k >>= 1)
+        mip_levels++;
+    return mip_levels;
+}
 
-    uint32_t mip_levels = 1;
-    if (generate_mipmaps) {
-        mip_levels = 0;
-        for (int k = std::max(width, height); k > 0; k >>= 1)
-            mip_levels++;
-    }
+Vk_Image vk_create_texture_image(int width, int height, VkFormat format, uint32_t mip_levels, const char* name) {
+    Vk_Image image;
 
     // create image
     {
@@ -696,7 +786,7 @@ Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate
         image_create_info.arrayLayers    = 1;
         image_create_info.samples        = VK_SAMPLE_COUNT_1_BIT;
         image_create_info.tiling         = VK_IMAGE_TILING_OPTIMAL;
-        image_create_info.usage          = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | (generate_mipmaps ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+        image_create_info.usage          = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | (mip_levels > 1 ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
         image_create_info.sharingMode    = VK_SHARING_MODE_EXCLUSIVE;
         image_create_info.initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
 
@@ -726,102 +816,109 @@ Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate
         vk_set_debug_name(image.view, (name + std::string(" (ImageView)")).c_str());
     }
 
-    // upload image data
-    {
-        int buffer_size = width * height * bytes_per_pixel;
-        vk_ensure_staging_buffer_allocation(buffer_size);
-        memcpy(vk.staging_buffer_ptr, pixels, buffer_size);
-
-        VkBufferImageCopy region;
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0;
-        region.bufferImageHeight = 0;
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-        region.imageOffset = VkOffset3D{ 0, 0, 0 };
-        region.imageExtent = VkExtent3D{ (uint32_t)width, (uint32_t)height, 1 };
-
-        VkImageSubresourceRange subresource_range{};
-        subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        subresource_range.levelCount = 1;
-        subresource_range.layerCount = VK_REMAINING_ARRAY_LAYERS;
-
-        vk_execute(vk.command_pools[0], vk.queue,
-            [&image, &region, &subresource_range, width, height, mip_levels](VkCommandBuffer command_buffer) {
-
-            subresource_range.baseMipLevel = 0;
-
-            vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,  VK_PIPELINE_STAGE_TRANSFER_BIT,
-                0,                                  VK_ACCESS_TRANSFER_WRITE_BIT,
-                VK_IMAGE_LAYOUT_UNDEFINED,          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-            vkCmdCopyBufferToImage(command_buffer, vk.staging_buffer, image.handle,
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-            if (mip_levels == 1) {
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                    VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                    VK_ACCESS_TRANSFER_WRITE_BIT,           0,
-                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-                return;
-            }
+    return image;
+}
 
-            VkImageBlit blit{};
-            blit.srcSubresource.aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT;
-            blit.srcSubresource.baseArrayLayer  = 0;
-            blit.srcSubresource.layerCount      = 1;
-            blit.dstSubresource.aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT;
-            blit.dstSubresource.baseArrayLayer  = 0;
-            blit.dstSubresource.layerCount      = 1;
-
-            int32_t w = (int32_t)width;
-            int32_t h = (int32_t)height;
-
-            for (uint32_t i = 1; i < mip_levels; i++) {
-                blit.srcSubresource.mipLevel = i - 1;
-                blit.srcOffsets[1] = VkOffset3D { w, h, 1 };
-
-                w = std::max(w >> 1, 1);
-                h = std::max(h >> 1, 1);
-
-                blit.dstSubresource.mipLevel = i;
-                blit.dstOffsets[1] = VkOffset3D { w, h, 1 };
-
-                subresource_range.baseMipLevel = i-1;
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                    VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_TRANSFER_BIT,
-                    VK_ACCESS_TRANSFER_WRITE_BIT,           VK_ACCESS_TRANSFER_READ_BIT,
-                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-
-                subresource_range.baseMipLevel = i;
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,      VK_PIPELINE_STAGE_TRANSFER_BIT,
-                    0,                                      VK_ACCESS_TRANSFER_WRITE_BIT,
-                    VK_IMAGE_LAYOUT_UNDEFINED,              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-                vkCmdBlitImage(command_buffer,
-                    image.handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                    image.handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    1, &blit, VK_FILTER_LINEAR);
-
-                subresource_range.baseMipLevel = i-1;
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                    VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                    VK_ACCESS_TRANSFER_READ_BIT,            0,
-                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-            }
+void vk_cmd_upload_texture(VkCommandBuffer command_buffer, VkImage image, int width, int height, uint32_t mip_levels, VkBuffer src_buffer, VkDeviceSize src_offset) {
+    VkBufferImageCopy region;
+    region.bufferOffset = src_offset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = VkOffset3D{ 0, 0, 0 };
+    region.imageExtent = VkExtent3D{ (uint32_t)width, (uint32_t)height, 1 };
 
-            subresource_range.baseMipLevel = mip_levels - 1;
-            vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                VK_ACCESS_TRANSFER_WRITE_BIT,           0,
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        });
+    VkImageSubresourceRange subresource_range{};
+    subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresource_range.levelCount = 1;
+    subresource_range.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+    // The final transitions wait for all commands, so the texture can be sampled by the commands
+    // recorded after the upload in the same command buffer.
+    subresource_range.baseMipLevel = 0;
+
+    vk_cmd_image_barrier_for_subresource(command_buffer, image, subresource_range,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,  VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,                                  VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED,          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    vkCmdCopyBufferToImage(command_buffer, src_buffer, image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    if (mip_levels == 1) {
+        vk_cmd_image_barrier_for_subresource(command_buffer, image, subresource_range,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT,           VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        return;
     }
 
+    VkImageBlit blit{};
+    blit.srcSubresource.aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.baseArrayLayer  = 0;
+    blit.srcSubresource.layerCount      = 1;
+    blit.dstSubresource.aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.dstSubresource.baseArrayLayer  = 0;
+    blit.dstSubresource.layerCount      = 1;
+
+    int32_t w = (int32_t)width;
+    int32_t h = (int32_t)height;
+
+    for (uint32_t i = 1; i < mip_levels; i++) {
+        blit.srcSubresource.mipLevel = i - 1;
+        blit.srcOffsets[1] = VkOffset3D { w, h, 1 };
+
+        w = std::max(w >> 1, 1);
+        h = std::max(h >> 1, 1);
+
+        blit.dstSubresource.mipLevel = i;
+        blit.dstOffsets[1] = VkOffset3D { w, h, 1 };
+
+        subresource_range.baseMipLevel = i-1;
+        vk_cmd_image_barrier_for_subresource(command_buffer, image, subresource_range,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT,           VK_ACCESS_TRANSFER_READ_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+        subresource_range.baseMipLevel = i;
+        vk_cmd_image_barrier_for_subresource(command_buffer, image, subresource_range,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,      VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,                                      VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED,              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        vkCmdBlitImage(command_buffer,
+            image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit, VK_FILTER_LINEAR);
+
+        subresource_range.baseMipLevel = i-1;
+        vk_cmd_image_barrier_for_subresource(command_buffer, image, subresource_range,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            VK_ACCESS_TRANSFER_READ_BIT,            VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+
+    subresource_range.baseMipLevel = mip_levels - 1;
+    vk_cmd_image_barrier_for_subresource(command_buffer, image, subresource_range,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT,           VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate_mipmaps, const uint8_t* pixels, int bytes_per_pixel, const char* name) {
+    const uint32_t mip_levels = generate_mipmaps ? vk_get_mip_level_count(width, height) : 1;
+    Vk_Image image = vk_create_texture_image(width, height, format, mip_levels, name);
+
+    int buffer_size = width * height * bytes_per_pixel;
+    vk_ensure_staging_buffer_allocation(buffer_size);
+    memcpy(vk.staging_buffer_ptr, pixels, buffer_size);
+
+    vk_execute(vk.command_pools[0], vk.queue, [&image, width, height, mip_levels](VkCommandBuffer command_buffer) {
+        vk_cmd_upload_texture(command_buffer, image.handle, width, height, mip_levels, vk.staging_buffer, 0);
+    });
     return image;
 }
 
@@ -976,7 +1073,8 @@ VkPipeline vk_create_graphics_pipeline(
     VkPipelineLayout                    pipeline_layout,
     VkRenderPass                        render_pass,
     VkShaderModule                      vertex_shader,
-    VkShaderModule                      fragment_shader)
+    VkShaderModule                      fragment_shader,
+    const VkSpecializationInfo*         vertex_shader_specialization)
 {
     auto get_shader_stage_create_info = [](VkShaderStageFlagBits stage, VkShaderModule shader_module) {
         VkPipelineShaderStageCreateInfo create_info{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
@@ -990,6 +1088,7 @@ VkPipeline vk_create_graphics_pipeline(
         get_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, vertex_shader),
         get_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragment_shader)
     };
+    shader_stages_state[0].pSpecializationInfo = vertex_shader_specialization;
 
     VkPipelineVertexInputStateCreateInfo vertex_input_state{ VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
     vertex_input_state.vertexBindingDescriptionCount    = state.vertex_binding_count;
@@ -1033,6 +1132,15 @@ void vk_begin_frame() {
     vkResetCommandPool(vk.device, vk.command_pools[vk.frame_index], 0);
     vk.command_buffer = vk.command_buffers[vk.frame_index];
     vk.timestamp_query_pool = vk.timestamp_query_pools[vk.frame_index];
+    vk.scene_commands_submitted = false;
+
+    // The graphics submission of the frame waits for the compute submission, so the fence also guards the compute command buffer.
+    if (vk.async_compute) {
+        vkResetCommandPool(vk.device, vk.compute_command_pools[vk.frame_index], 0);
+        vk.compute_command_buffer = vk.compute_command_buffers[vk.frame_index];
+    } else {
+        vk.compute_command_buffer = vk.command_buffer;
+    }
 
     START_TIMER
     VK_CHECK(vkAcquireNextImageKHR(vk.device, vk.swapchain_info.handle, UINT64_MAX, vk.image_acquired_semaphore[vk.frame_index], VK_NULL_HANDLE, &vk.swapchain_image_index));
@@ -1041,9 +1149,69 @@ void vk_begin_frame() {
     VkCommandBufferBeginInfo begin_info { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     VK_CHECK(vkBeginCommandBuffer(vk.command_buffer, &begin_info));
+    if (vk.async_compute)
+        VK_CHECK(vkBeginCommandBuffer(vk.compute_command_buffer, &begin_info));
+}
+
+void vk_end_scene_commands() {
+    if (!vk.async_compute || vk.scene_commands_submitted)
+        return;
+
+    // Compute work of this frame starts when the previous frame no longer reads the scene data.
+    {
+        VK_CHECK(vkEndCommandBuffer(vk.compute_command_buffer));
+
+        const VkPipelineStageFlags wait_dst_stage_mask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+        VkSubmitInfo submit_info { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+        if (vk.scene_finished_semaphore_signaled) {
+            submit_info.waitSemaphoreCount  = 1;
+            submit_info.pWaitSemaphores     = &vk.scene_finished_semaphore[1 - vk.frame_index];
+            submit_info.pWaitDstStageMask   = &wait_dst_stage_mask;
+        }
+        submit_info.commandBufferCount      = 1;
+        submit_info.pCommandBuffers         = &vk.compute_command_buffer;
+        submit_info.signalSemaphoreCount    = 1;
+        submit_info.pSignalSemaphores       = &vk.compute_finished_semaphore[vk.frame_index];
+
+        VK_CHECK(vkQueueSubmit(vk.compute_queue, 1, &submit_info, VK_NULL_HANDLE));
+    }
+
+    // The scene is read by the vertex and raytracing shaders. The commands before them, like the
+    // scene upload copies, do not wait for the compute queue.
+    {
+        VK_CHECK(vkEndCommandBuffer(vk.command_buffer));
+
+        const VkPipelineStageFlags wait_dst_stage_mask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+
+        VkSubmitInfo submit_info { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+        submit_info.waitSemaphoreCount      = 1;
+        submit_info.pWaitSemaphores         = &vk.compute_finished_semaphore[vk.frame_index];
+        submit_info.pWaitDstStageMask       = &wait_dst_stage_mask;
+        submit_info.commandBufferCount      = 1;
+        submit_info.pCommandBuffers         = &vk.command_buffer;
+        submit_info.signalSemaphoreCount    = 1;
+        submit_info.pSignalSemaphores       = &vk.scene_finished_semaphore[vk.frame_index];
+
+        VK_CHECK(vkQueueSubmit(vk.queue, 1, &submit_info, VK_NULL_HANDLE));
+        vk.scene_finished_semaphore_signaled = true;
+    }
+
+    vk.command_buffer = vk.present_command_buffers[vk.frame_index];
+    vk.compute_command_buffer = VK_NULL_HANDLE;
+    vk.scene_commands_submitted = true;
+
+    VkCommandBufferBeginInfo begin_info { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkBeginCommandBuffer(vk.command_buffer, &begin_info));
+}
+
+bool vk_is_async_compute_command_buffer(VkCommandBuffer command_buffer) {
+    return vk.async_compute && (command_buffer == vk.compute_command_buffers[0] || command_buffer == vk.compute_command_buffers[1]);
 }
 
 void vk_end_frame() {
+    vk_end_scene_commands();
     VK_CHECK(vkEndCommandBuffer(vk.command_buffer));
 
     const VkPipelineStageFlags wait_dst_stage_mask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
@@ -55,7 +55,8 @@ struct GLFWwindow;
 
 // Initializes VK_Instance structure.
 // After calling this function we get fully functional vulkan subsystem.
-void vk_initialize(GLFWwindow* window, bool enable_validation_layers);
+// Async compute uses the dedicated compute queue if the device has one.
+void vk_initialize(GLFWwindow* window, bool enable_validation_layers, bool enable_async_compute);
 
 // Shutdown vulkan subsystem by releasing resources acquired by Vk_Instance.
 void vk_shutdown();
@@ -68,6 +69,11 @@ Vk_Buffer vk_create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, const vo
 Vk_Buffer vk_create_mapped_buffer(VkDeviceSize size, VkBufferUsageFlags usage, void** buffer_ptr, const char* name = nullptr);
 Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate_mipmaps, const uint8_t* pixels, int bytes_per_pixel, const char*  name);
 Vk_Image vk_create_image(int width, int height, VkFormat format, VkImageCreateFlags usage_flags, const char* name);
+
+// Creates sampled image and its view without initializing the image data. The data is provided
+// with vk_cmd_upload_texture, so the upload can be recorded into any command buffer.
+Vk_Image vk_create_texture_image(int width, int height, VkFormat format, uint32_t mip_levels, const char* name);
+uint32_t vk_get_mip_level_count(int width, int height);
 Vk_Image vk_load_texture(const std::string& texture_file);
 VkShaderModule vk_load_spirv(const std::string& spirv_file);
 
@@ -78,15 +84,29 @@ VkPipeline vk_create_graphics_pipeline(
     VkPipelineLayout                    pipeline_layout,
     VkRenderPass                        render_pass,
     VkShaderModule                      vertex_shader,
-    VkShaderModule                      fragment_shader
+    VkShaderModule                      fragment_shader,
+    const VkSpecializationInfo*         vertex_shader_specialization = nullptr
 );
 
 
 void vk_begin_frame();
 void vk_end_frame();
 
+// Submits the compute command buffer and the part of the frame recorded so far. The rest of the frame
+// is recorded into a separate command buffer, so the next frame's compute work can start as soon as
+// the scene is drawn and overlap with the UI and the swapchain copy. Does nothing without async compute.
+void vk_end_scene_commands();
+
+// True if the command buffer is submitted to the dedicated compute queue. Barriers in such command buffers
+// can't use graphics stages, the graphics work is synchronized with the frame semaphores instead.
+bool vk_is_async_compute_command_buffer(VkCommandBuffer command_buffer);
+
 void vk_execute(VkCommandPool command_pool, VkQueue queue, std::function<void(VkCommandBuffer)> recorder);
 
+// Copies mip level 0 from the buffer and generates the rest of the mip chain with blits.
+// The image is left in SHADER_READ_ONLY_OPTIMAL layout.
+void vk_cmd_upload_texture(VkCommandBuffer command_buffer, VkImage image, int width, int height, uint32_t mip_levels, VkBuffer src_buffer, VkDeviceSize src_offset);
+
 // Barrier for all subresources of non-depth image.
 void vk_cmd_image_barrier(
     VkCommandBuffer command_buffer, VkImage image,
@@ -174,10 +194,15 @@ struct Vk_Instance {
     VkInstance                      instance;
     VkPhysicalDevice                physical_device;
     uint32_t                        queue_family_index;
+    uint32_t                        compute_queue_family_index; // compute-only family or queue_family_index if there is none
+    uint32_t                        buffer_queue_family_indices[2]; // both families, used by buffers with concurrent sharing
     VkDevice                        device;
     VkQueue                         queue;
+    VkQueue                         compute_queue;
     double                          timestamp_period_ms;
     bool                            raytracing_supported;
+    bool                            host_accel_builds_supported; // acceleration structures can be built on the CPU
+    bool                            async_compute; // compute work is submitted to the dedicated compute queue
 
     VmaAllocator                    allocator;
 
@@ -190,13 +215,23 @@ struct Vk_Instance {
 
     VkCommandPool                   command_pools[2];
     VkCommandBuffer                 command_buffers[2];
-    VkCommandBuffer                 command_buffer; // command_buffers[frame_index]
+    VkCommandBuffer                 command_buffer; // command_buffers[frame_index] or present_command_buffers[frame_index] after vk_end_scene_commands
     int                             frame_index;
 
+    // Async compute. When it is disabled compute_command_buffer is the same as command_buffer.
+    VkCommandBuffer                 present_command_buffers[2]; // allocated from command_pools
+    VkCommandPool                   compute_command_pools[2];
+    VkCommandBuffer                 compute_command_buffers[2];
+    VkCommandBuffer                 compute_command_buffer;
+    bool                            scene_commands_submitted;
+
     VkDescriptorPool                descriptor_pool;
 
     VkSemaphore                     image_acquired_semaphore[2];
     VkSemaphore                     rendering_finished_semaphore[2];
+    VkSemaphore                     compute_finished_semaphore[2];
+    VkSemaphore                     scene_finished_semaphore[2]; // the compute queue can overwrite the scene data
+    bool                            scene_finished_semaphore_signaled;
     VkFence                         frame_fence[2];
 
     VkQueryPool                     timestamp_query_pools[2];
@@ -1,11 +1,103 @@
 #include "vk_utils.h"
 
 #include <cassert>
+#include <cstring>
+
+//
+// GPU_Mesh
+//
+GPU_Mesh create_gpu_mesh(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count, Vertex_Layout vertex_layout) {
+    GPU_Mesh gpu_mesh;
+    gpu_mesh.vertex_count = vertex_count;
+    gpu_mesh.index_count = index_count;
+    gpu_mesh.vertex_layout = vertex_layout;
+    gpu_mesh.lods.push_back(Mesh_LOD{ 0, index_count, 0.f });
+
+    const VkBufferUsageFlags vertex_usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    if (vertex_layout == vertex_layout_interleaved) {
+        gpu_mesh.vertex_stride = sizeof(Vertex);
+        gpu_mesh.vertex_buffer = vk_create_buffer(vertex_count * sizeof(Vertex), vertex_usage, vertices, "vertex_buffer");
+    }
+    else if (vertex_layout == vertex_layout_split) {
+        std::vector<Vector3> positions;
+        std::vector<Vertex_Attributes> attributes;
+        create_split_vertex_streams(vertices, vertex_count, positions, attributes);
+
+        gpu_mesh.vertex_stride = sizeof(Vector3);
+        gpu_mesh.attribute_stride = sizeof(Vertex_Attributes);
+        gpu_mesh.vertex_buffer = vk_create_buffer(vertex_count * sizeof(Vector3), vertex_usage, positions.data(), "position_buffer");
+        gpu_mesh.attribute_buffer = vk_create_buffer(vertex_count * sizeof(Vertex_Attributes), vertex_usage, attributes.data(), "attribute_buffer");
+    }
+    else {
+        assert(vertex_layout == vertex_layout_split_compact);
+        std::vector<Vector3> positions;
+        std::vector<Compact_Vertex_Attributes> attributes;
+        create_compact_vertex_streams(vertices, vertex_count, positions, attributes);
+
+        gpu_mesh.vertex_stride = sizeof(Vector3);
+        gpu_mesh.attribute_stride = sizeof(Compact_Vertex_Attributes);
+        gpu_mesh.vertex_buffer = vk_create_buffer(vertex_count * sizeof(Vector3), vertex_usage, positions.data(), "position_buffer");
+        gpu_mesh.attribute_buffer = vk_create_buffer(vertex_count * sizeof(Compact_Vertex_Attributes), vertex_usage, attributes.data(), "attribute_buffer");
+    }
+
+    const VkBufferUsageFlags index_usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    gpu_mesh.index_buffer = vk_create_buffer(index_count * sizeof(uint32_t), index_usage, indices, "index_buffer");
+    return gpu_mesh;
+}
+
+void get_vertex_layout_strides(Vertex_Layout vertex_layout, uint32_t* vertex_stride, uint32_t* attribute_stride) {
+    switch (vertex_layout) {
+        case vertex_layout_interleaved:
+            *vertex_stride = sizeof(Vertex);
+            *attribute_stride = 0;
+            break;
+        case vertex_layout_split:
+            *vertex_stride = sizeof(Vector3);
+            *attribute_stride = sizeof(Vertex_Attributes);
+            break;
+        default:
+            assert(vertex_layout == vertex_layout_split_compact);
+            *vertex_stride = sizeof(Vector3);
+            *attribute_stride = sizeof(Compact_Vertex_Attributes);
+            break;
+    }
+}
+
+void write_vertex_streams(const Vertex* vertices, uint32_t vertex_count, Vertex_Layout vertex_layout, void* vertex_data, void* attribute_data) {
+    if (vertex_layout == vertex_layout_interleaved) {
+        memcpy(vertex_data, vertices, vertex_count * sizeof(Vertex));
+    }
+    else if (vertex_layout == vertex_layout_split) {
+        std::vector<Vector3> positions;
+        std::vector<Vertex_Attributes> attributes;
+        create_split_vertex_streams(vertices, vertex_count, positions, attributes);
+        memcpy(vertex_data, positions.data(), vertex_count * sizeof(Vector3));
+        memcpy(attribute_data, attributes.data(), vertex_count * sizeof(Vertex_Attributes));
+    }
+    else {
+        assert(vertex_layout == vertex_layout_split_compact);
+        std::vector<Vector3> positions;
+        std::vector<Compact_Vertex_Attributes> attributes;
+        create_compact_vertex_streams(vertices, vertex_count, positions, attributes);
+        memcpy(vertex_data, positions.data(), vertex_count * sizeof(Vector3));
+        memcpy(attribute_data, attributes.data(), vertex_count * sizeof(Compact_Vertex_Attributes));
+    }
+}
+
+const char* get_vertex_layout_name(Vertex_Layout vertex_layout) {
+    switch (vertex_layout) {
+        case vertex_layout_interleaved: return "interleaved";
+        case vertex_layout_split: return "split positions";
+        case vertex_layout_split_compact: return "split positions, compact attributes";
+        default: return "unknown";
+    }
+}
 
 //
 // Descriptor_Writes
 //
-Descriptor_Writes& Descriptor_Writes::sampled_image(uint32_t binding, VkImageView image_view, VkImageLayout layout) {
+Descriptor_Writes& Descriptor_Writes::sampled_image(uint32_t binding, VkImageView image_view, VkImageLayout layout, uint32_t array_element) {
     assert(write_count < max_writes);
     VkDescriptorImageInfo& image = resource_infos[write_count].image;
     image               = VkDescriptorImageInfo{};
@@ -16,6 +108,7 @@ Descriptor_Writes& Descriptor_Writes::sampled_image(uint32_t binding, VkImageVie
     write = VkWriteDescriptorSet { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
     write.dstSet             = descriptor_set;
     write.dstBinding         = binding;
+    write.dstArrayElement    = array_element;
     write.descriptorCount    = 1;
     write.descriptorType     = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
     write.pImageInfo         = &image;
@@ -120,18 +213,18 @@ void Descriptor_Writes::commit() {
 //
 // Descriptor_Set_Layout
 //
-static VkDescriptorSetLayoutBinding get_set_layout_binding(uint32_t binding, VkDescriptorType descriptor_type, VkShaderStageFlags stage_flags) {
+static VkDescriptorSetLayoutBinding get_set_layout_binding(uint32_t binding, VkDescriptorType descriptor_type, VkShaderStageFlags stage_flags, uint32_t descriptor_count = 1) {
     VkDescriptorSetLayoutBinding entry{};
     entry.binding           = binding;
     entry.descriptorType    = descriptor_type;
-    entry.descriptorCount   = 1;
+    entry.descriptorCount   = descriptor_count;
     entry.stageFlags        = stage_flags;
     return entry;
 }
 
-Descriptor_Set_Layout& Descriptor_Set_Layout::sampled_image(uint32_t binding, VkShaderStageFlags stage_flags) {
+Descriptor_Set_Layout& Descriptor_Set_Layout::sampled_image(uint32_t binding, VkShaderStageFlags stage_flags, uint32_t descriptor_count) {
     assert(binding_count < max_bindings);
-    bindings[binding_count++] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, stage_flags);
+    bindings[binding_count++] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, stage_flags, descriptor_count);
     return *this;
 }
 
@@ -177,18 +270,23 @@ VkDescriptorSetLayout Descriptor_Set_Layout::create(const char* name) {
 }
 
 void GPU_Time_Interval::begin() {
-    vkCmdWriteTimestamp(vk.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index]);
+    VkCommandBuffer command_buffer = compute_queue ? vk.compute_command_buffer : vk.command_buffer;
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index]);
 }
 void GPU_Time_Interval::end() {
-    vkCmdWriteTimestamp(vk.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index] + 1);
+    VkCommandBuffer command_buffer = compute_queue ? vk.compute_command_buffer : vk.command_buffer;
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index] + 1);
 }
 
-GPU_Time_Interval* GPU_Time_Keeper::allocate_time_interval() {
+GPU_Time_Interval* GPU_Time_Keeper::allocate_time_interval(bool compute_queue) {
     assert(time_interval_count < max_time_intervals);
     GPU_Time_Interval* time_interval = &time_intervals[time_interval_count++];
 
     time_interval->start_query[0] = time_interval->start_query[1] = vk_allocate_timestamp_queries(2);
     time_interval->length_ms = 0.f;
+    time_interval->compute_queue = compute_queue;
+    time_interval->begin_timestamp = 0;
+    time_interval->end_timestamp = 0;
     return time_interval;
 }
 
@@ -218,7 +316,14 @@ void GPU_Time_Keeper::next_frame() {
     for (uint32_t i = 0; i < time_interval_count; i++) {
         assert(query_results[4*i + 2] >= query_results[4*i]);
         time_intervals[i].length_ms = (1.f-influence) * time_intervals[i].length_ms + influence * float(double(query_results[4*i + 2] - query_results[4*i]) * vk.timestamp_period_ms);
+        time_intervals[i].begin_timestamp = query_results[4*i];
+        time_intervals[i].end_timestamp = query_results[4*i + 2];
     }
 
-    vkCmdResetQueryPool(vk.command_buffer, vk.timestamp_query_pool, 0, query_count);
+    // The compute queue can write the timestamps before the graphics command buffer starts,
+    // so with async compute the queries are reset on the host.
+    if (vk.async_compute)
+        vkResetQueryPool(vk.device, vk.timestamp_query_pool, 0, query_count);
+    else
+        vkCmdResetQueryPool(vk.command_buffer, vk.timestamp_query_pool, 0, query_count);
 }
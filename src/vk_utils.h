@@ -1,24 +1,64 @@
 #pragma once
 
+#include "mesh.h"
 #include "vector.h"
 #include "vk.h"
 
+#include <cassert>
 #include <vector>
 
+// Layout of the vertex data in GPU_Mesh buffers.
+// With split layouts the vertex buffer contains only positions (12 bytes stride), so acceleration
+// structure builds and position-only passes do not fetch other attributes.
+enum Vertex_Layout : uint32_t {
+    vertex_layout_interleaved,      // vertex_buffer: Vertex array
+    vertex_layout_split,            // vertex_buffer: Vector3 array, attribute_buffer: Vertex_Attributes array
+    vertex_layout_split_compact     // vertex_buffer: Vector3 array, attribute_buffer: Compact_Vertex_Attributes array
+};
+
 struct GPU_Mesh {
     Vk_Buffer vertex_buffer;
+    Vk_Buffer attribute_buffer; // only for split layouts
     Vk_Buffer index_buffer;
     uint32_t vertex_count = 0;
     uint32_t index_count = 0;
+    Vertex_Layout vertex_layout = vertex_layout_interleaved;
+    uint32_t vertex_stride = 0; // vertex_buffer stride
+    uint32_t attribute_stride = 0; // attribute_buffer stride
+    std::vector<Mesh_LOD> lods; // index buffer ranges, LOD 0 is the full resolution mesh
+
+    // Meshes allocated from Geometry_Arena reference the shared arena buffers starting from these elements.
+    // The same first vertex is used in vertex_buffer and attribute_buffer. Indices are local to the mesh.
+    uint32_t first_vertex = 0;
+    uint32_t first_index = 0;
+    bool arena_mesh = false; // the buffers belong to the arena, the mesh is released with Geometry_Arena::free_mesh
+
+    VkDeviceSize get_vertex_offset() const { return VkDeviceSize(first_vertex) * vertex_stride; }
+    VkDeviceSize get_attribute_offset() const { return VkDeviceSize(first_vertex) * attribute_stride; }
+    VkDeviceSize get_index_offset() const { return VkDeviceSize(first_index) * sizeof(uint32_t); }
 
     void destroy() {
+        assert(!arena_mesh);
         vertex_buffer.destroy();
+        attribute_buffer.destroy();
         index_buffer.destroy();
-        vertex_count = 0;
-        index_count = 0;
+        *this = GPU_Mesh{};
     }
 };
 
+// Size of the material texture array in raster and raytracing shaders (max_textures in common.glsl).
+constexpr uint32_t max_textures = 16;
+
+GPU_Mesh create_gpu_mesh(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count, Vertex_Layout vertex_layout);
+
+// attribute_stride is 0 for the interleaved layout.
+void get_vertex_layout_strides(Vertex_Layout vertex_layout, uint32_t* vertex_stride, uint32_t* attribute_stride);
+
+// Converts vertices to the streams of the given layout. vertex_data and attribute_data should have space
+// for vertex_count elements of the corresponding stride, attribute_data is not used for the interleaved layout.
+void write_vertex_streams(const Vertex* vertices, uint32_t vertex_count, Vertex_Layout vertex_layout, void* vertex_data, void* attribute_data);
+const char* get_vertex_layout_name(Vertex_Layout vertex_layout);
+
 struct Descriptor_Writes {
     static constexpr uint32_t max_writes = 32;
 
@@ -46,7 +86,7 @@ struct Descriptor_Writes {
         commit();
     }
 
-    Descriptor_Writes& sampled_image    (uint32_t binding, VkImageView image_view, VkImageLayout layout);
+    Descriptor_Writes& sampled_image    (uint32_t binding, VkImageView image_view, VkImageLayout layout, uint32_t array_element = 0);
     Descriptor_Writes& storage_image    (uint32_t binding, VkImageView image_view);
     Descriptor_Writes& sampler          (uint32_t binding, VkSampler sampler);
     Descriptor_Writes& uniform_buffer   (uint32_t binding, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
@@ -65,7 +105,7 @@ struct Descriptor_Set_Layout {
         binding_count = 0;
     }
 
-    Descriptor_Set_Layout& sampled_image    (uint32_t binding, VkShaderStageFlags stage_flags);
+    Descriptor_Set_Layout& sampled_image    (uint32_t binding, VkShaderStageFlags stage_flags, uint32_t descriptor_count = 1);
     Descriptor_Set_Layout& storage_image    (uint32_t binding, VkShaderStageFlags stage_flags);
     Descriptor_Set_Layout& sampler          (uint32_t binding, VkShaderStageFlags stage_flags);
     Descriptor_Set_Layout& uniform_buffer   (uint32_t binding, VkShaderStageFlags stage_flags);
@@ -77,6 +117,12 @@ struct Descriptor_Set_Layout {
 struct GPU_Time_Interval {
     uint32_t start_query[2]; // end query == (start_query[frame_index] + 1)
     float length_ms;
+    bool compute_queue; // timestamps are written to vk.compute_command_buffer
+
+    // Raw timestamps of the last completed frame. Timestamps of the graphics and compute queues
+    // are comparable, so they show how the work of the queues overlaps.
+    uint64_t begin_timestamp;
+    uint64_t end_timestamp;
 
     void begin();
     void end();
@@ -88,7 +134,7 @@ struct GPU_Time_Keeper {
     GPU_Time_Interval time_intervals[max_time_intervals];
     uint32_t time_interval_count;
 
-    GPU_Time_Interval* allocate_time_interval();
+    GPU_Time_Interval* allocate_time_interval(bool compute_queue = false);
     void initialize_time_intervals();
     void next_frame();
 };
@@ -20,4 +20,57 @@ void sleep(int milliseconds) {
     ::Sleep(milliseconds);
 }
 
+bool map_file(const std::string& path, Mapped_File& mapped_file) {
+    mapped_file = Mapped_File{};
+
+    HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if (!::GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        ::CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        ::CloseHandle(file);
+        return false;
+    }
+
+    void* data = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        ::CloseHandle(mapping);
+        ::CloseHandle(file);
+        return false;
+    }
+
+    mapped_file.data            = static_cast<const uint8_t*>(data);
+    mapped_file.size            = static_cast<uint64_t>(file_size.QuadPart);
+    mapped_file.file_handle     = file;
+    mapped_file.mapping_handle  = mapping;
+    return true;
+}
+
+void unmap_file(Mapped_File& mapped_file) {
+    if (mapped_file.data != nullptr)
+        ::UnmapViewOfFile(mapped_file.data);
+    if (mapped_file.mapping_handle != nullptr)
+        ::CloseHandle(mapped_file.mapping_handle);
+    if (mapped_file.file_handle != nullptr)
+        ::CloseHandle(mapped_file.file_handle);
+    mapped_file = Mapped_File{};
+}
+
+bool get_file_info(const std::string& path, uint64_t& size, uint64_t& last_write_time) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!::GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes))
+        return false;
+
+    size = (uint64_t(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+    last_write_time = (uint64_t(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
 } // namespace platform